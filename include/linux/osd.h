@@ -73,6 +73,23 @@ static inline int ofi_free_hugepage_buf(void *memptr, size_t size)
 	return munmap(memptr, size);
 }
 
+/* Private pages that can carry their own memory policy (see mbind()) */
+static inline int ofi_alloc_numa_buf(void **memptr, size_t size)
+{
+	*memptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (*memptr == MAP_FAILED)
+		return -errno;
+
+	return FI_SUCCESS;
+}
+
+static inline int ofi_free_numa_buf(void *memptr, size_t size)
+{
+	return munmap(memptr, size);
+}
+
 static inline int ofi_hugepage_enabled(void)
 {
 	size_t len;
@@ -95,4 +112,7 @@ static inline int ofi_hugepage_enabled(void)
 
 size_t ofi_ifaddr_get_speed(struct ifaddrs *ifa);
 
+int ofi_numa_node_self(void);
+int ofi_numa_bind(void *addr, size_t len, int node);
+
 #endif /* _LINUX_OSD_H_ */
@@ -65,6 +65,7 @@ enum {
 
 extern size_t *page_sizes;
 extern size_t num_page_sizes;
+extern int ofi_bufpool_numa;
 
 static inline long ofi_get_page_size()
 {
@@ -286,9 +287,15 @@ enum {
 	OFI_BUFPOOL_INDEXED		= 1 << 1,
 	OFI_BUFPOOL_NO_TRACK		= 1 << 2,
 	OFI_BUFPOOL_HUGEPAGES		= 1 << 3,
+	OFI_BUFPOOL_THREAD_SAFE		= 1 << 4,
+	OFI_BUFPOOL_NUMA		= 1 << 5,
 };
 
+/* With OFI_BUFPOOL_NUMA, place regions on the node of the growing thread */
+#define OFI_BUFPOOL_NUMA_LOCAL	(-1)
+
 struct ofi_bufpool_region;
+struct ofi_bufpool_mt;
 
 struct ofi_bufpool_attr {
 	size_t 		size;
@@ -300,6 +307,8 @@ struct ofi_bufpool_attr {
 	void		(*init_fn)(struct ofi_bufpool_region *region, void *buf);
 	void 		*context;
 	int		flags;
+	/* OFI_BUFPOOL_NUMA only: node id or OFI_BUFPOOL_NUMA_LOCAL */
+	int		numa_node;
 };
 
 struct ofi_bufpool {
@@ -315,7 +324,21 @@ struct ofi_bufpool {
 	size_t				region_cnt;
 	size_t				alloc_size;
 	size_t				region_size;
+	size_t				numa_bind_fail;
 	struct ofi_bufpool_attr		attr;
+	struct ofi_bufpool_mt		*mt;
+};
+
+struct ofi_bufpool_stats {
+	size_t		grow_cnt;
+	size_t		entry_cnt;
+	/* OFI_BUFPOOL_THREAD_SAFE pools only */
+	size_t		depot_alloc;
+	size_t		depot_free;
+	size_t		depot_retry;
+	size_t		cache_contention;
+	/* OFI_BUFPOOL_NUMA pools only */
+	size_t		numa_bind_fail;
 };
 
 struct ofi_bufpool_region {
@@ -361,6 +384,30 @@ ofi_bufpool_create(struct ofi_bufpool **buf_pool,
 void ofi_bufpool_destroy(struct ofi_bufpool *pool);
 
 int ofi_bufpool_grow(struct ofi_bufpool *pool);
+void ofi_bufpool_get_stats(struct ofi_bufpool *pool,
+			   struct ofi_bufpool_stats *stats);
+
+/*
+ * Request that new regions are placed on the given NUMA node, if enabled
+ * with FI_BUFPOOL_NUMA.  Does nothing if the node is unknown (negative),
+ * e.g. because the caller could not look it up.  Pools that always want
+ * NUMA placement set OFI_BUFPOOL_NUMA and numa_node directly.
+ */
+static inline void
+ofi_bufpool_attr_set_numa(struct ofi_bufpool_attr *attr, int node)
+{
+	if (!ofi_bufpool_numa || node < 0)
+		return;
+	attr->flags |= OFI_BUFPOOL_NUMA;
+	attr->numa_node = node;
+}
+
+/*
+ * OFI_BUFPOOL_THREAD_SAFE pools cache free buffers in per-thread
+ * magazines, which are exchanged through a lock-free depot.
+ */
+void *ofi_bufpool_mt_alloc(struct ofi_bufpool *pool);
+void ofi_bufpool_mt_free(struct ofi_bufpool *pool, void *buf);
 
 static inline struct ofi_bufpool_hdr *ofi_buf_hdr(void *buf)
 {
@@ -387,6 +434,11 @@ static inline struct ofi_bufpool *ofi_buf_pool(void *buf)
 
 static inline void ofi_buf_free(void *buf)
 {
+	if (ofi_buf_pool(buf)->attr.flags & OFI_BUFPOOL_THREAD_SAFE) {
+		ofi_bufpool_mt_free(ofi_buf_pool(buf), buf);
+		return;
+	}
+
 	assert(ofi_buf_region(buf)->use_cnt--);
 	assert(!(ofi_buf_pool(buf)->attr.flags & OFI_BUFPOOL_INDEXED));
 	slist_insert_head(&ofi_buf_hdr(buf)->entry.slist,
@@ -401,6 +453,11 @@ static inline void ofi_ibuf_free(void *buf)
 	struct ofi_bufpool_hdr *buf_hdr;
 
 	assert(ofi_buf_pool(buf)->attr.flags & OFI_BUFPOOL_INDEXED);
+	if (ofi_buf_pool(buf)->attr.flags & OFI_BUFPOOL_THREAD_SAFE) {
+		ofi_bufpool_mt_free(ofi_buf_pool(buf), buf);
+		return;
+	}
+
 	assert(ofi_buf_region(buf)->use_cnt--);
 	buf_hdr = ofi_buf_hdr(buf);
 
@@ -426,7 +483,8 @@ static inline void *ofi_bufpool_get_ibuf(struct ofi_bufpool *pool, size_t index)
 	buf = pool->region_table[(size_t)(index / pool->attr.chunk_cnt)]->
 		mem_region + (index % pool->attr.chunk_cnt) * pool->entry_size;
 
-	assert(ofi_buf_region(buf)->use_cnt);
+	assert((pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE) ||
+	       ofi_buf_region(buf)->use_cnt);
 	return buf;
 }
 
@@ -445,6 +503,9 @@ static inline void *ofi_buf_alloc(struct ofi_bufpool *pool)
 	struct ofi_bufpool_hdr *buf_hdr;
 
 	assert(!(pool->attr.flags & OFI_BUFPOOL_INDEXED));
+	if (pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE)
+		return ofi_bufpool_mt_alloc(pool);
+
 	if (OFI_UNLIKELY(ofi_bufpool_empty(pool))) {
 		if (ofi_bufpool_grow(pool))
 			return NULL;
@@ -475,6 +536,9 @@ static inline void *ofi_ibuf_alloc(struct ofi_bufpool *pool)
 	struct ofi_bufpool_region *buf_region;
 
 	assert(pool->attr.flags & OFI_BUFPOOL_INDEXED);
+	if (pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE)
+		return ofi_bufpool_mt_alloc(pool);
+
 	if (OFI_UNLIKELY(ofi_ibufpool_empty(pool))) {
 		if (ofi_bufpool_grow(pool))
 			return NULL;
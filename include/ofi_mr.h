@@ -217,12 +217,19 @@ struct ofi_mr_cache_params {
 	size_t				max_size;
 	int				merge_regions;
 	char *				monitor;
+	size_t				shard_cnt;
+	int				reclaim;
+	size_t				low_watermark;
+	size_t				notify_queue;
 };
 
 extern struct ofi_mr_cache_params	cache_params;
 
+struct ofi_mr_cache_shard;
+
 struct ofi_mr_entry {
 	struct ofi_mr_info		info;
+	struct ofi_mr_cache_shard	*shard;
 	void				*storage_context;
 	unsigned int			subscribed:1;
 	int				use_cnt;
@@ -252,15 +259,91 @@ struct ofi_mr_storage {
 	void				(*destroy)(struct ofi_mr_storage *storage);
 };
 
+/*
+ * The cache splits the address space into 2 MB blocks, which are hashed
+ * onto cache_params.shard_cnt shards.  A region within one block belongs
+ * to the shard of that block.  Regions that cross a block boundary belong
+ * to one more, span shard, the last one, which lookups of regions within
+ * a block also check on a miss.  Each shard has its own lock, storage and
+ * LRU list, and receives an even share of the limits of the cache, so
+ * that lookups of regions in different shards do not serialize.
+ * Invalidations from the memory monitor visit every shard.
+ */
+#define OFI_MR_CACHE_SHARD_SHIFT	21
+
+struct ofi_mr_cache_shard {
+	pthread_mutex_t			lock;
+	struct ofi_mr_cache		*cache;
+	struct ofi_mr_storage		storage;
+	struct dlist_entry		lru_list;
+	size_t				max_cnt;
+	size_t				max_size;
+	size_t				low_cnt;
+	size_t				low_size;
+
+	size_t				cached_cnt;
+	size_t				cached_size;
+	size_t				uncached_cnt;
+	size_t				uncached_size;
+	size_t				search_cnt;
+	size_t				delete_cnt;
+	size_t				hit_cnt;
+	size_t				evict_cnt;
+	uint8_t				pad[64];
+};
+
+/*
+ * With cache_params.notify_queue, invalidations reported by the memory
+ * monitor are queued, and applied in a batch by the next search of the
+ * cache.  Producers are serialized by the monitor lock, and consumers by
+ * drain_lock.  A producer extends the newest queued range instead of
+ * adding one if the ranges overlap or are adjacent, unless a consumer has
+ * already claimed it.
+ */
+enum {
+	OFI_MR_NOTIFY_TAKEN,
+	OFI_MR_NOTIFY_READY,
+	OFI_MR_NOTIFY_BUSY,
+};
+
+struct ofi_mr_notify_range {
+	ofi_atomic32_t			state;
+	uintptr_t			start;
+	uintptr_t			end;
+};
+
+struct ofi_mr_notify_queue {
+	struct ofi_mr_notify_range	*ranges;
+	size_t				size;
+	ofi_atomic64_t			head;
+	ofi_atomic64_t			tail;
+	pthread_mutex_t			drain_lock;
+
+	/* Updated under the monitor lock */
+	size_t				coalesce_cnt;
+	size_t				overflow_cnt;
+	/* Updated under drain_lock */
+	size_t				drain_cnt;
+	size_t				range_cnt;
+};
+
 struct ofi_mr_cache {
 	struct util_domain		*domain;
 	struct ofi_mem_monitor		*monitor;
 	struct dlist_entry		notify_entry;
 	size_t				entry_data_size;
+	/* Set before init when several caches of a domain split the
+	 * cache_params limits: the number of such caches, or 0 */
+	size_t				share_cnt;
 
+	/* Selects the storage type; holds the ops for OFI_MR_STORAGE_USER */
 	struct ofi_mr_storage		storage;
-	struct dlist_entry		lru_list;
+	struct ofi_mr_cache_shard	*shards;
+	size_t				shard_cnt;
+	size_t				notify_cnt;
+	struct ofi_mr_notify_queue	notify_queue;
 
+	/* Totals across all shards, updated by ofi_mr_cache_stats() */
 	size_t				cached_cnt;
 	size_t				cached_size;
 	size_t				uncached_cnt;
@@ -268,9 +351,33 @@ struct ofi_mr_cache {
 	size_t				search_cnt;
 	size_t				delete_cnt;
 	size_t				hit_cnt;
-	size_t				notify_cnt;
+	size_t				evict_cnt;
+	/* With cache_params.reclaim: regions deregistered by the reclaim
+	 * path, and current and maximum number queued or in flight */
+	size_t				reclaim_cnt;
+	size_t				reclaim_queue_cnt;
+	size_t				reclaim_queue_max;
 	struct ofi_bufpool		*entry_pool;
 
+	/*
+	 * With cache_params.reclaim, regions are not deregistered by the
+	 * thread that evicts or invalidates them.  They are queued on
+	 * reclaim_list, and a reclaim thread calls delete_region in batches.
+	 * The thread also trims shards above their low watermark.  reclaim
+	 * is set before the cache is added to the monitor and not changed
+	 * until cleanup.  The counters are protected by reclaim_lock.
+	 */
+	int				reclaim;
+	int				reclaim_stop;
+	int				reclaim_evict;
+	pthread_t			reclaim_thread;
+	pthread_mutex_t			reclaim_lock;
+	pthread_cond_t			reclaim_cond;
+	struct dlist_entry		reclaim_list;
+	size_t				reclaim_released;
+	size_t				reclaim_pending;
+	size_t				reclaim_pending_max;
+
 	int				(*add_region)(struct ofi_mr_cache *cache,
 						      struct ofi_mr_entry *entry);
 	void				(*delete_region)(struct ofi_mr_cache *cache,
@@ -280,6 +387,7 @@ struct ofi_mr_cache {
 int ofi_mr_cache_init(struct util_domain *domain, struct ofi_mem_monitor *monitor,
 		      struct ofi_mr_cache *cache);
 void ofi_mr_cache_cleanup(struct ofi_mr_cache *cache);
+void ofi_mr_cache_stats(struct ofi_mr_cache *cache);
 
 void ofi_mr_cache_notify(struct ofi_mr_cache *cache, const void *addr, size_t len);
 
@@ -211,6 +211,30 @@ int ofi_domain_init(struct fid_fabric *fabric_fid, const struct fi_info *info,
 int ofi_domain_bind_eq(struct util_domain *domain, struct util_eq *eq);
 int ofi_domain_close(struct util_domain *domain);
 
+/*
+ * Dynamic receive buffers
+ *
+ * Lets a utility provider layered over a MSG provider choose where the
+ * payload of an incoming message is placed once its header has arrived.
+ * The utility provider opens these ops on the MSG domain with fi_open_ops,
+ * passing a pointer to its own ops structure in *ops. The MSG provider then
+ * first receives only hdr_size bytes of a message into the posted receive
+ * buffer and calls get_rbuf with the context of that receive. get_rbuf
+ * returns the number of iovecs (up to iov_limit) filled in where the
+ * remaining msg_len - hdr_size bytes should be placed, or 0 to keep using
+ * the posted buffer. get_rbuf is only called while the receive CQ holds no
+ * completions, so that the utility provider sees messages in order. The
+ * completion is reported for the posted receive as usual.
+ */
+#define OFI_OPS_DYNAMIC_RBUF "ofi_ops_dynamic_rbuf"
+
+struct ofi_ops_dynamic_rbuf {
+	size_t	size;
+	size_t	hdr_size;
+	ssize_t	(*get_rbuf)(void *context, size_t msg_len,
+			    struct iovec *iov, size_t iov_limit);
+};
+
 static const uint64_t ofi_rx_mr_flags[] = {
 	[ofi_op_msg] = FI_RECV,
 	[ofi_op_tagged] = FI_RECV,
@@ -446,6 +470,8 @@ int ofi_wait_fd_del(struct util_wait *wait, int fd);
  */
 
 typedef void (*fi_cq_read_func)(void **dst, void *src);
+typedef void (*fi_cq_read_n_func)(void **dst, struct fi_cq_tagged_entry *src,
+				  size_t count);
 
 struct util_cq_oflow_err_entry {
 	struct fi_cq_tagged_entry	*parent_comp;
@@ -456,8 +482,109 @@ struct util_cq_oflow_err_entry {
 
 OFI_DECLARE_CIRQUE(struct fi_cq_tagged_entry, util_comp_cirq);
 
+/*
+ * Lock-free completion ring, used instead of the cirq by OFI_CQ_LOCKFREE
+ * CQs.  Producers reserve slots by advancing head with a CAS and publish
+ * each slot by setting its sequence number to its position + 1.  The
+ * consumer, serialized by cq_lock, releases a slot for the next lap by
+ * setting the sequence number to position + size.  Completions are kept
+ * in their own array so that runs of them can be copied out at once.
+ */
+struct util_comp_ring {
+	uint64_t			size;
+	ofi_atomic64_t			*seq;
+	fi_addr_t			*src;
+	struct fi_cq_tagged_entry	*comp;
+	/* keep producers and the consumer on separate cache lines */
+	uint8_t				pad1[64];
+	ofi_atomic64_t			head;
+	uint8_t				pad2[64];
+	uint64_t			tail;
+	uint8_t				pad3[64];
+};
+
+static inline size_t util_comp_ring_idx(struct util_comp_ring *ring,
+					uint64_t pos)
+{
+	return (size_t) (pos & (ring->size - 1));
+}
+
+/*
+ * Reserve up to count consecutive slots, returns the number reserved.
+ * The consumer frees slots in order, so if the last slot of a range is
+ * free for this lap, all slots before it are as well.
+ */
+static inline size_t
+util_comp_ring_reserve(struct util_comp_ring *ring, size_t count,
+		       uint64_t *pos)
+{
+	int64_t diff;
+
+	count = MIN(count, ring->size);
+	while (count) {
+		*pos = (uint64_t) ofi_atomic_get64(&ring->head);
+		diff = ofi_atomic_get64(&ring->seq[util_comp_ring_idx(ring, *pos)]) -
+		       (int64_t) *pos;
+		if (diff < 0)
+			return 0;
+		if (diff > 0)
+			continue;
+
+		if (count > 1 &&
+		    ofi_atomic_get64(&ring->seq[util_comp_ring_idx(ring,
+					*pos + count - 1)]) !=
+		    (int64_t) (*pos + count - 1)) {
+			count /= 2;
+			continue;
+		}
+
+		if (ofi_atomic_cas_bool64(&ring->head, (int64_t) *pos,
+					  (int64_t) (*pos + count)))
+			return count;
+	}
+	return 0;
+}
+
+static inline void
+util_comp_ring_commit(struct util_comp_ring *ring, uint64_t pos)
+{
+	ofi_atomic_set64(&ring->seq[util_comp_ring_idx(ring, pos)],
+			 (int64_t) pos + 1);
+}
+
+/* Number of published entries at the tail, up to count, without wrapping */
+static inline size_t
+util_comp_ring_peek(struct util_comp_ring *ring, size_t count)
+{
+	size_t idx, n;
+
+	idx = util_comp_ring_idx(ring, ring->tail);
+	count = MIN(count, ring->size - idx);
+	for (n = 0; n < count; n++) {
+		if (ofi_atomic_get64(&ring->seq[idx + n]) !=
+		    (int64_t) (ring->tail + n + 1))
+			break;
+	}
+	return n;
+}
+
+static inline void
+util_comp_ring_discard(struct util_comp_ring *ring, size_t count)
+{
+	for (; count; count--, ring->tail++) {
+		ofi_atomic_set64(&ring->seq[util_comp_ring_idx(ring, ring->tail)],
+				 (int64_t) (ring->tail + ring->size));
+	}
+}
+
 typedef void (*ofi_cq_progress_func)(struct util_cq *cq);
 
+enum {
+	/* Provider only accesses the CQ through ofi_cq_write*() and the
+	 * util read calls, so the lock-free ring may replace the cirq. */
+	OFI_CQ_LOCKFREE = 1 << 0,
+};
+
 struct util_cq {
 	struct fid_cq		cq_fid;
 	struct util_domain	*domain;
@@ -471,8 +598,13 @@ struct util_cq {
 
 	struct util_comp_cirq	*cirq;
 	fi_addr_t		*src;
+	struct util_comp_ring	*ring;
 
 	struct slist		oflow_err_list;
+	fi_cq_read_n_func	read_entries;
+	/* ring only: oflow_err_list is not empty, so new completions must
+	 * be queued behind it */
+	ofi_atomic32_t		oflow_pending;
 	fi_cq_read_func		read_entry;
 	int			internal_wait;
 	ofi_atomic32_t		signaled;
@@ -482,6 +614,10 @@ struct util_cq {
 int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 		 struct fi_cq_attr *attr, struct util_cq *cq,
 		 ofi_cq_progress_func progress, void *context);
+int ofi_cq_init_flags(const struct fi_provider *prov,
+		      struct fid_domain *domain, struct fi_cq_attr *attr,
+		      struct util_cq *cq, ofi_cq_progress_func progress,
+		      int flags, void *context);
 int ofi_check_bind_cq_flags(struct util_ep *ep, struct util_cq *cq,
 			    uint64_t flags);
 void ofi_cq_progress(struct util_cq *cq);
@@ -500,6 +636,9 @@ int ofi_cq_signal(struct fid_cq *cq_fid);
 
 int ofi_cq_write_overflow(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 			  void *buf, uint64_t data, uint64_t tag, fi_addr_t src);
+int ofi_cq_ring_write_overflow(struct util_cq *cq, void *context,
+			       uint64_t flags, size_t len, void *buf,
+			       uint64_t data, uint64_t tag, fi_addr_t src);
 
 static inline void util_cq_signal(struct util_cq *cq)
 {
@@ -521,10 +660,44 @@ ofi_cq_write_comp_entry(struct util_cq *cq, void *context, uint64_t flags,
 	ofi_cirque_commit(cq->cirq);
 }
 
+static inline int
+ofi_cq_ring_write(struct util_cq *cq, void *context, uint64_t flags,
+		  size_t len, void *buf, uint64_t data, uint64_t tag,
+		  fi_addr_t src)
+{
+	struct fi_cq_tagged_entry *comp;
+	uint64_t pos;
+	size_t idx;
+
+	if (OFI_UNLIKELY(ofi_atomic_get32(&cq->oflow_pending)))
+		goto oflow;
+
+	if (OFI_UNLIKELY(!util_comp_ring_reserve(cq->ring, 1, &pos))) {
+		FI_DBG(cq->domain->prov, FI_LOG_CQ,
+		       "util_cq ring is full!\n");
+		goto oflow;
+	}
+	idx = util_comp_ring_idx(cq->ring, pos);
+	cq->ring->src[idx] = src;
+	comp = &cq->ring->comp[idx];
+	comp->op_context = context;
+	comp->flags = flags;
+	comp->len = len;
+	comp->buf = buf;
+	comp->data = data;
+	comp->tag = tag;
+	util_comp_ring_commit(cq->ring, pos);
+	return 0;
+oflow:
+	return ofi_cq_ring_write_overflow(cq, context, flags, len,
+					  buf, data, tag, src);
+}
+
 static inline int
 ofi_cq_write_thread_unsafe(struct util_cq *cq, void *context, uint64_t flags,
 			   size_t len, void *buf, uint64_t data, uint64_t tag)
 {
+	assert(!cq->ring);
 	if (OFI_UNLIKELY(ofi_cirque_isfull(cq->cirq))) {
 		FI_DBG(cq->domain->prov, FI_LOG_CQ,
 		       "util_cq cirq is full!\n");
@@ -540,6 +713,11 @@ ofi_cq_write(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 	     void *buf, uint64_t data, uint64_t tag)
 {
 	int ret;
+
+	if (cq->ring)
+		return ofi_cq_ring_write(cq, context, flags, len,
+					 buf, data, tag, 0);
+
 	cq->cq_fastlock_acquire(&cq->cq_lock);
 	ret = ofi_cq_write_thread_unsafe(cq, context, flags, len, buf, data, tag);
 	cq->cq_fastlock_release(&cq->cq_lock);
@@ -550,6 +728,7 @@ static inline int
 ofi_cq_write_src_thread_unsafe(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 			       void *buf, uint64_t data, uint64_t tag, fi_addr_t src)
 {
+	assert(!cq->ring);
 	if (OFI_UNLIKELY(ofi_cirque_isfull(cq->cirq))) {
 		FI_DBG(cq->domain->prov, FI_LOG_CQ,
 		       "util_cq cirq is full!\n");
@@ -566,6 +745,11 @@ ofi_cq_write_src(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 		 void *buf, uint64_t data, uint64_t tag, fi_addr_t src)
 {
 	int ret;
+
+	if (cq->ring)
+		return ofi_cq_ring_write(cq, context, flags, len,
+					 buf, data, tag, src);
+
 	cq->cq_fastlock_acquire(&cq->cq_lock);
 	ret = ofi_cq_write_src_thread_unsafe(cq, context, flags, len,
 					     buf, data, tag, src);
@@ -573,8 +757,18 @@ ofi_cq_write_src(struct util_cq *cq, void *context, uint64_t flags, size_t len,
 	return ret;
 }
 
+/*
+ * Write count completions with a single lock acquisition, or a single
+ * ring reservation for OFI_CQ_LOCKFREE CQs.  src may be NULL.
+ */
+int ofi_cq_write_batch(struct util_cq *cq,
+		       const struct fi_cq_tagged_entry *comps,
+		       const fi_addr_t *src, size_t count);
+
 int ofi_cq_write_error(struct util_cq *cq,
 		       const struct fi_cq_err_entry *err_entry);
+int ofi_cq_write_error_thread_unsafe(struct util_cq *cq,
+				     const struct fi_cq_err_entry *err_entry);
 int ofi_cq_write_error_peek(struct util_cq *cq, uint64_t tag, void *context);
 int ofi_cq_write_error_trunc(struct util_cq *cq, void *context, uint64_t flags,
 			     size_t len, void *buf, uint64_t data, uint64_t tag,
@@ -53,6 +53,7 @@
 #include <ofi_proto.h>
 #include <ofi_prov.h>
 #include <ofi_enosys.h>
+#include <ofi_recvwin.h>
 
 #define MRAIL_MAJOR_VERSION 1
 #define MRAIL_MINOR_VERSION 0
@@ -70,6 +71,7 @@
 #define MRAIL_PASSTHRU_MR_MODES	(OFI_MR_BASIC_MAP)
 
 #define MRAIL_RAIL_CQ_FORMAT	FI_CQ_FORMAT_TAGGED
+#define MRAIL_CQ_READ_CNT	16
 
 extern struct fi_info mrail_info;
 extern struct fi_provider mrail_prov;
@@ -82,7 +84,8 @@ extern size_t mrail_num_info;
 enum {
 	MRAIL_POLICY_FIXED,
 	MRAIL_POLICY_ROUND_ROBIN,
-	MRAIL_POLICY_STRIPING
+	MRAIL_POLICY_STRIPING,
+	MRAIL_POLICY_ADAPTIVE
 };
 
 #define MRAIL_MAX_CONFIG		8
@@ -95,6 +98,12 @@ struct mrail_config {
 extern struct mrail_config mrail_config[MRAIL_MAX_CONFIG];
 extern int mrail_num_config;
 extern int mrail_local_rank;
+/* Set if any config entry uses the adaptive policy */
+extern int mrail_adaptive;
+extern size_t mrail_ooo_win_size;
+
+/* Per-rail throughput is averaged over roughly this much busy time */
+#define MRAIL_ADAPTIVE_WINDOW	100000	/* usec */
 
 extern struct fi_ops_rma mrail_ops_rma;
 
@@ -181,6 +190,9 @@ struct mrail_tx_buf {
 	struct mrail_rndv_hdr	rndv_hdr;
 	struct mrail_rndv_req	*rndv_req;
 	fid_t			rndv_mr_fid;
+	/* bytes posted to the rail and post time (adaptive policy) */
+	size_t			rail_len;
+	uint64_t		post_time;
 };
 
 struct mrail_pkt {
@@ -245,19 +257,24 @@ struct mrail_av {
 	size_t num_avs;
 };
 
-struct mrail_peer_info {
-	struct slist	ooo_recv_queue;
-	fi_addr_t	addr;
-	uint32_t	seq_no;
-	uint32_t	expected_seq_no;
-};
-
 struct mrail_ooo_recv {
 	struct slist_entry 		entry;
 	struct fi_cq_tagged_entry 	comp;
 	uint32_t 			seq_no;
 };
 
+OFI_DECL_RECVWIN_BUF(struct mrail_ooo_recv *, mrail_ooo_win);
+
+struct mrail_peer_info {
+	/* The window tracks the next expected sequence number. Its ring is
+	 * only allocated once a message from the peer arrives out of order.
+	 * Messages beyond the window are kept sorted in ooo_overflow. */
+	struct mrail_ooo_win	ooo_win;
+	struct slist		ooo_overflow;
+	fi_addr_t		addr;
+	uint32_t		seq_no;
+};
+
 typedef int (*mrail_cq_process_comp_func_t)(struct fi_cq_tagged_entry *comp,
 					    fi_addr_t src_addr);
 struct mrail_cq {
@@ -273,6 +290,12 @@ struct mrail_ep {
 	struct {
 		struct fid_ep 		*ep;
 		struct fi_info		*info;
+		/* Load and throughput tracking for the adaptive policy,
+		 * updated by posting and polling threads alike */
+		ofi_atomic64_t		outstanding;
+		ofi_atomic64_t		comp_bytes;
+		ofi_atomic64_t		busy_time;
+		ofi_atomic64_t		last_comp;
 	}			*rails;
 	size_t			num_eps;
 	ofi_atomic32_t		tx_rail;
@@ -380,14 +403,48 @@ static inline int mrail_get_policy(size_t size)
 	return mrail_config[i].policy;
 }
 
-static inline size_t mrail_get_tx_rail(struct mrail_ep *mrail_ep, int policy)
+size_t mrail_get_tx_rail_adaptive(struct mrail_ep *mrail_ep, size_t len);
+
+static inline size_t mrail_get_tx_rail(struct mrail_ep *mrail_ep, int policy,
+				       size_t len)
+{
+	switch (policy) {
+	case MRAIL_POLICY_FIXED:
+		return mrail_ep->default_tx_rail;
+	case MRAIL_POLICY_ADAPTIVE:
+		return mrail_get_tx_rail_adaptive(mrail_ep, len);
+	default:
+		return mrail_get_tx_rail_rr(mrail_ep);
+	}
+}
+
+/* Measured throughput of a rail in bytes/msec, 0 if not known yet */
+static inline uint64_t mrail_get_rail_rate(struct mrail_ep *mrail_ep,
+					   size_t rail)
+{
+	return ofi_atomic_get64(&mrail_ep->rails[rail].comp_bytes) * 1000 /
+	       (ofi_atomic_get64(&mrail_ep->rails[rail].busy_time) + 1);
+}
+
+static inline void mrail_rail_post(struct mrail_ep *mrail_ep, size_t rail,
+				   size_t len, uint64_t *post_time)
 {
-	return policy == MRAIL_POLICY_FIXED ?
-				mrail_ep->default_tx_rail :
-				mrail_get_tx_rail_rr(mrail_ep);
+	if (!mrail_adaptive)
+		return;
+	ofi_atomic_add64(&mrail_ep->rails[rail].outstanding, len);
+	*post_time = fi_gettime_us();
+}
 
+static inline void mrail_rail_cancel(struct mrail_ep *mrail_ep, size_t rail,
+				     size_t len)
+{
+	if (mrail_adaptive)
+		ofi_atomic_sub64(&mrail_ep->rails[rail].outstanding, len);
 }
 
+void mrail_rail_complete(struct mrail_ep *mrail_ep, size_t rail, size_t len,
+			 uint64_t post_time);
+
 struct mrail_subreq {
 	struct fi_context context;
 	struct mrail_req *parent;
@@ -396,6 +453,10 @@ struct mrail_subreq {
 	struct fi_rma_iov rma_iov[MRAIL_IOV_LIMIT];
 	size_t iov_count;
 	size_t rma_iov_count;
+	/* rail to post on, or -1 for any rail */
+	int rail;
+	size_t len;
+	uint64_t post_time;
 };
 
 struct mrail_req {
@@ -406,6 +467,11 @@ struct mrail_req {
 	struct mrail_peer_info *peer_info;
 	struct fi_cq_tagged_entry comp;
 	ofi_atomic32_t expected_subcomps;
+	/* Remote CQ data is sent with the final subreq once all the other
+	 * subreqs have completed.  Both the poster and the completion
+	 * handler drop the gate; the second one posts the final subreq. */
+	ofi_atomic32_t data_gate;
+	int data_gated;
 	int op_type;
 	int pending_subreq;
 	struct mrail_subreq subreqs[];
@@ -431,6 +497,14 @@ void mrail_free_req(struct mrail_ep *mrail_ep, struct mrail_req *req)
 	ofi_ep_lock_release(&mrail_ep->util_ep);
 }
 
+static inline void mrail_queue_deferred_req(struct mrail_ep *mrail_ep,
+		struct mrail_req *req)
+{
+	ofi_ep_lock_acquire(&mrail_ep->util_ep);
+	slist_insert_tail(&req->entry, &mrail_ep->deferred_reqs);
+	ofi_ep_lock_release(&mrail_ep->util_ep);
+}
+
 void mrail_progress_deferred_reqs(struct mrail_ep *mrail_ep);
 
 void mrail_poll_cq(struct util_cq *cq);
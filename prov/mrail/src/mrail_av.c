@@ -32,12 +32,24 @@
 
 #include "mrail.h"
 
+static int mrail_av_free_ooo_win(struct util_av *av, void *addr,
+				 fi_addr_t fi_addr, void *arg)
+{
+	struct mrail_peer_info *peer_info = addr;
+
+	if (peer_info->ooo_win.pending)
+		ofi_recvwin_free(&peer_info->ooo_win);
+	return 0;
+}
+
 static int mrail_av_close(struct fid *fid)
 {
 	struct mrail_av *mrail_av = container_of(fid, struct mrail_av,
 						 util_av.av_fid);
 	int ret, retv = 0;
 
+	ofi_av_elements_iter(&mrail_av->util_av, mrail_av_free_ooo_win, NULL);
+
 	ret = mrail_close_fids((struct fid **)mrail_av->avs, mrail_av->num_avs);
 	if (ret)
 		retv = ret;
@@ -115,7 +127,7 @@ static int mrail_av_insert(struct fid_av *av_fid, const void *addr, size_t count
 	peer_info = calloc(1, mrail_av->util_av.addrlen);
 	if (!peer_info)
 		return -FI_ENOMEM;
-	slist_init(&peer_info->ooo_recv_queue);
+	slist_init(&peer_info->ooo_overflow);
 
 	for (i = 0; i < count; i++) {
 		offset = i * mrail_domain->addrlen;
@@ -34,34 +34,49 @@
 
 #include "mrail.h"
 
+static void mrail_tx_buf_release(struct mrail_tx_buf *tx_buf)
+{
+	if (tx_buf->hdr.protocol == MRAIL_PROTO_RNDV &&
+	    tx_buf->hdr.protocol_cmd == MRAIL_RNDV_REQ) {
+		free(tx_buf->rndv_req);
+		fi_close(tx_buf->rndv_mr_fid);
+	}
+
+	ofi_ep_lock_acquire(&tx_buf->ep->util_ep);
+	ofi_buf_free(tx_buf);
+	ofi_ep_lock_release(&tx_buf->ep->util_ep);
+}
+
+static inline void mrail_send_comp_init(struct fi_cq_tagged_entry *comp,
+					struct mrail_tx_buf *tx_buf)
+{
+	comp->op_context = tx_buf->context;
+	comp->flags = (tx_buf->flags & (FI_TAGGED | FI_MSG)) | FI_SEND;
+	comp->len = 0;
+	comp->buf = NULL;
+	comp->data = 0;
+	comp->tag = 0;
+}
+
 static int mrail_cq_write_send_comp(struct util_cq *cq,
 				    struct mrail_tx_buf *tx_buf)
 {
+	struct fi_cq_tagged_entry comp;
 	int ret = 0;
 
 	ofi_ep_tx_cntr_inc(&tx_buf->ep->util_ep);
 
 	if (tx_buf->flags & FI_COMPLETION) {
-		ret = ofi_cq_write(cq, tx_buf->context,
-				   (tx_buf->flags &
-				    (FI_TAGGED | FI_MSG)) |
-				   FI_SEND, 0, NULL, 0, 0);
+		mrail_send_comp_init(&comp, tx_buf);
+		ret = ofi_cq_write(cq, comp.op_context, comp.flags, comp.len,
+				   comp.buf, comp.data, comp.tag);
 		if (ret) {
 			FI_WARN(&mrail_prov, FI_LOG_CQ,
 				"Unable to write to util cq\n");
 		}
 	}
 
-	if (tx_buf->hdr.protocol == MRAIL_PROTO_RNDV &&
-	    tx_buf->hdr.protocol_cmd == MRAIL_RNDV_REQ) {
-		free(tx_buf->rndv_req);
-		fi_close(tx_buf->rndv_mr_fid);
-	}
-
-	ofi_ep_lock_acquire(&tx_buf->ep->util_ep);
-	ofi_buf_free(tx_buf);
-	ofi_ep_lock_release(&tx_buf->ep->util_ep);
-
+	mrail_tx_buf_release(tx_buf);
 	return ret;
 }
 
@@ -314,22 +329,61 @@ static struct mrail_recv *mrail_match_recv(struct mrail_ep *mrail_ep,
 	return recv;
 }
 
+/* Map a sequence number from the wire to an id of the peer's window */
+static inline uint64_t mrail_seq_to_id(struct mrail_ooo_win *win,
+				       uint32_t seq_no)
+{
+	uint64_t exp_id = ofi_recvwin_next_exp_id(win);
+
+	return exp_id + (uint32_t) (seq_no - (uint32_t) exp_id);
+}
+
+/* Should only be called while holding the EP's lock */
+static void mrail_fill_ooo_win(struct mrail_peer_info *peer_info)
+{
+	struct mrail_ooo_win *win = &peer_info->ooo_win;
+	struct mrail_ooo_recv *ooo_recv;
+	uint64_t id;
+
+	while (!slist_empty(&peer_info->ooo_overflow)) {
+		ooo_recv = container_of(peer_info->ooo_overflow.head,
+					struct mrail_ooo_recv, entry);
+		id = mrail_seq_to_id(win, ooo_recv->seq_no);
+		if (!ofi_recvwin_is_allowed(win, id))
+			break;
+		slist_remove_head(&peer_info->ooo_overflow);
+		ofi_recvwin_queue_msg(win, &ooo_recv, id);
+	}
+}
+
+/* Should only be called while holding the EP's lock */
 static
 struct mrail_ooo_recv *mrail_get_next_recv(struct mrail_peer_info *peer_info)
 {
-	struct slist *queue = &peer_info->ooo_recv_queue;
+	struct mrail_ooo_win *win = &peer_info->ooo_win;
 	struct mrail_ooo_recv *ooo_recv;
 
-	if (!slist_empty(queue)) {
-		ooo_recv = container_of(queue->head, struct mrail_ooo_recv,
-				entry);
-		if (ooo_recv->seq_no == peer_info->expected_seq_no) {
-			slist_remove_head(queue);
-			peer_info->expected_seq_no++;
-			return ooo_recv;
-		}
+	/* Without a window, early messages wait on the overflow list,
+	 * which is sorted by sequence number */
+	if (!win->pending) {
+		if (slist_empty(&peer_info->ooo_overflow))
+			return NULL;
+		ooo_recv = container_of(peer_info->ooo_overflow.head,
+					struct mrail_ooo_recv, entry);
+		if (ooo_recv->seq_no != (uint32_t) ofi_recvwin_next_exp_id(win))
+			return NULL;
+		slist_remove_head(&peer_info->ooo_overflow);
+		ofi_recvwin_exp_inc(win);
+		return ooo_recv;
 	}
-	return NULL;
+
+	ooo_recv = *ofi_recvwin_peek(win);
+	if (!ooo_recv)
+		return NULL;
+
+	*ofi_recvwin_get_next_msg(win) = NULL;
+	mrail_fill_ooo_win(peer_info);
+	return ooo_recv;
 }
 
 static int mrail_process_ooo_recvs(struct mrail_ep *mrail_ep,
@@ -371,7 +425,7 @@ static int mrail_ooo_recv_before(struct slist_entry *item, const void *arg)
 
 	ooo_recv = container_of(item, struct mrail_ooo_recv, entry);
 	new_recv = container_of(arg, struct mrail_ooo_recv, entry);
-	return (new_recv->seq_no < ooo_recv->seq_no);
+	return ((int32_t) (new_recv->seq_no - ooo_recv->seq_no) < 0);
 }
 
 /* Should only be called while holding the EP's lock */
@@ -380,8 +434,9 @@ static void mrail_save_ooo_recv(struct mrail_ep *mrail_ep,
 				uint32_t seq_no,
 				struct fi_cq_tagged_entry *comp)
 {
-	struct slist *queue = &peer_info->ooo_recv_queue;
+	struct mrail_ooo_win *win = &peer_info->ooo_win;
 	struct mrail_ooo_recv *ooo_recv;
+	uint64_t exp_id, id;
 
 	ooo_recv = ofi_buf_alloc(mrail_ep->ooo_recv_pool);
 	if (!ooo_recv) {
@@ -392,8 +447,24 @@ static void mrail_save_ooo_recv(struct mrail_ep *mrail_ep,
 	ooo_recv->seq_no = seq_no;
 	memcpy(&ooo_recv->comp, comp, sizeof(*comp));
 
-	slist_insert_before_first_match(queue, mrail_ooo_recv_before,
-					&ooo_recv->entry);
+	if (OFI_UNLIKELY(!win->pending)) {
+		exp_id = ofi_recvwin_next_exp_id(win);
+		ofi_recvwin_buf_alloc(win, mrail_ooo_win_size);
+		win->exp_msg_id = exp_id;
+	}
+
+	id = mrail_seq_to_id(win, seq_no);
+	if (OFI_LIKELY(win->pending && ofi_recvwin_is_allowed(win, id))) {
+		ofi_recvwin_queue_msg(win, &ooo_recv, id);
+	} else {
+		/* The buffered receive isn't released to the rail until the
+		 * message is processed, which throttles the sender. */
+		FI_DBG(&mrail_prov, FI_LOG_CQ, "ooo window full, seq=%d\n",
+		       seq_no);
+		slist_insert_before_first_match(&peer_info->ooo_overflow,
+						mrail_ooo_recv_before,
+						&ooo_recv->entry);
+	}
 
 	FI_DBG(&mrail_prov, FI_LOG_CQ, "saved ooo_recv seq=%d\n", seq_no);
 }
@@ -403,6 +474,7 @@ static int mrail_handle_recv_completion(struct fi_cq_tagged_entry *comp,
 {
 	struct fi_recv_context *recv_ctx;
 	struct mrail_peer_info *peer_info;
+	struct mrail_ooo_win *win;
 	struct mrail_ep *mrail_ep;
 	struct mrail_recv *recv;
 	struct mrail_hdr *hdr;
@@ -434,14 +506,20 @@ static int mrail_handle_recv_completion(struct fi_cq_tagged_entry *comp,
 
 	seq_no = ntohl(hdr->seq);
 	peer_info = ofi_av_get_addr(mrail_ep->util_ep.av, (int) src_addr);
+	win = &peer_info->ooo_win;
 	FI_DBG(&mrail_prov, FI_LOG_CQ,
-			"ep=%p peer=%d received seq=%d, expected=%d\n",
+			"ep=%p peer=%d received seq=%d, expected=%" PRIu64 "\n",
 			mrail_ep, (int)peer_info->addr, seq_no,
-			peer_info->expected_seq_no);
+			ofi_recvwin_next_exp_id(win));
 	ofi_ep_lock_acquire(&mrail_ep->util_ep);
-	if (seq_no == peer_info->expected_seq_no) {
+	if (seq_no == (uint32_t) ofi_recvwin_next_exp_id(win)) {
 		/* This message was received in order */
-		peer_info->expected_seq_no++;
+		if (OFI_LIKELY(!win->pending)) {
+			ofi_recvwin_exp_inc(win);
+		} else {
+			ofi_recvwin_slide(win);
+			mrail_fill_ooo_win(peer_info);
+		}
 		/* Requesting FI_AV_TABLE from the underlying provider allows
 		 * us to use src_addr as an int here. */
 		recv = mrail_match_recv(mrail_ep, comp, (int) src_addr);
@@ -507,31 +585,86 @@ static struct fi_ops_cq mrail_cq_ops = {
 	.strerror = fi_no_cq_strerror,
 };
 
-static void mrail_handle_rma_completion(struct util_cq *cq,
+/*
+ * Account a completion on a rail for the adaptive policy.  The rail is
+ * considered busy from the later of the post time and the previous
+ * completion on that rail, so throughput isn't underestimated when several
+ * operations are queued.
+ */
+void mrail_rail_complete(struct mrail_ep *mrail_ep, size_t rail, size_t len,
+			 uint64_t post_time)
+{
+	int64_t now, last, busy;
+
+	if (!mrail_adaptive)
+		return;
+
+	ofi_atomic_sub64(&mrail_ep->rails[rail].outstanding, len);
+
+	now = fi_gettime_us();
+	do {
+		last = ofi_atomic_get64(&mrail_ep->rails[rail].last_comp);
+	} while (last < now &&
+		 !ofi_atomic_cas_bool64(&mrail_ep->rails[rail].last_comp,
+					last, now));
+
+	ofi_atomic_add64(&mrail_ep->rails[rail].comp_bytes, len);
+	last = MAX((int64_t) post_time, last);
+	if (now > last)
+		busy = ofi_atomic_add64(&mrail_ep->rails[rail].busy_time,
+					now - last);
+	else
+		busy = ofi_atomic_get64(&mrail_ep->rails[rail].busy_time);
+
+	/* Only the thread that halves the busy time halves the bytes */
+	if (busy > MRAIL_ADAPTIVE_WINDOW &&
+	    ofi_atomic_cas_bool64(&mrail_ep->rails[rail].busy_time, busy,
+				  busy / 2)) {
+		ofi_atomic_sub64(&mrail_ep->rails[rail].comp_bytes,
+			ofi_atomic_get64(&mrail_ep->rails[rail].comp_bytes) / 2);
+	}
+}
+
+static void mrail_handle_rma_completion(struct util_cq *cq, size_t rail,
 		struct fi_cq_tagged_entry *comp)
 {
-	int ret;
+	int ret, remaining;
 	struct mrail_req *req;
 	struct mrail_subreq *subreq;
 
 	subreq = comp->op_context;
 	req = subreq->parent;
 
-	if (ofi_atomic_dec32(&req->expected_subcomps) == 0) {
+	mrail_rail_complete(req->mrail_ep, rail, subreq->len,
+			    subreq->post_time);
+
+	remaining = ofi_atomic_dec32(&req->expected_subcomps);
+	if (remaining == 1 && ofi_atomic_get32(&req->data_gate) &&
+	    !ofi_atomic_dec32(&req->data_gate)) {
+		/* All data has been placed, post the subreq carrying the
+		 * remote CQ data */
+		mrail_queue_deferred_req(req->mrail_ep, req);
+		return;
+	}
+
+	if (remaining == 0) {
 		if (req->comp.flags & MRAIL_RNDV_FLAG) {
 			mrail_finish_rndv_recv(cq, req, comp);
 			return;
 		}
 
-		ret = ofi_cq_write(cq, req->comp.op_context, req->comp.flags,
-				req->comp.len, req->comp.buf, req->comp.data,
-				req->comp.tag);
-		if (ret) {
-			FI_WARN(&mrail_prov, FI_LOG_CQ,
-				"Cannot write to util cq\n");
-			/* This should not happen unless totally out of memory,
-			 * in which case there is nothing we can do.  */
-			assert(0);
+		if (req->comp.flags & FI_COMPLETION) {
+			ret = ofi_cq_write(cq, req->comp.op_context,
+					   FI_RMA | req->op_type, 0, NULL, 0,
+					   0);
+			if (ret) {
+				FI_WARN(&mrail_prov, FI_LOG_CQ,
+					"Cannot write to util cq\n");
+				/* This should not happen unless totally out of
+				 * memory, in which case there is nothing we
+				 * can do.  */
+				assert(0);
+			}
 		}
 
 		if (comp->flags & FI_WRITE)
@@ -543,62 +676,112 @@ static void mrail_handle_rma_completion(struct util_cq *cq,
 	}
 }
 
+/* Send completions of a poll pass, written to the util CQ together */
+struct mrail_send_comps {
+	struct fi_cq_tagged_entry	comp[MRAIL_CQ_READ_CNT];
+	size_t				cnt;
+};
+
+static int mrail_send_comps_flush(struct util_cq *cq,
+				  struct mrail_send_comps *send_comps)
+{
+	int ret;
+
+	if (!send_comps->cnt)
+		return 0;
+
+	ret = ofi_cq_write_batch(cq, send_comps->comp, NULL, send_comps->cnt);
+	if (ret)
+		FI_WARN(&mrail_prov, FI_LOG_CQ, "Unable to write to util cq\n");
+	send_comps->cnt = 0;
+	return ret;
+}
+
+static int mrail_poll_send_comp(struct util_cq *cq,
+				struct mrail_send_comps *send_comps,
+				struct mrail_tx_buf *tx_buf)
+{
+	ofi_ep_tx_cntr_inc(&tx_buf->ep->util_ep);
+
+	if (tx_buf->flags & FI_COMPLETION)
+		mrail_send_comp_init(&send_comps->comp[send_comps->cnt++],
+				     tx_buf);
+
+	mrail_tx_buf_release(tx_buf);
+
+	if (send_comps->cnt == MRAIL_CQ_READ_CNT)
+		return mrail_send_comps_flush(cq, send_comps);
+	return 0;
+}
+
 void mrail_poll_cq(struct util_cq *cq)
 {
 	struct mrail_cq *mrail_cq;
 	struct mrail_tx_buf *tx_buf;
-	struct fi_cq_tagged_entry comp;
-	fi_addr_t src_addr;
+	struct fi_cq_tagged_entry comp[MRAIL_CQ_READ_CNT];
+	fi_addr_t src_addr[MRAIL_CQ_READ_CNT];
+	struct mrail_send_comps send_comps;
 	size_t i, idx;
+	ssize_t j, cnt;
 	int ret;
 	static int last_succ_rail = 0;
 
 	mrail_cq = container_of(cq, struct mrail_cq, util_cq);
+	send_comps.cnt = 0;
 
 	for (i = 0; i < mrail_cq->num_cqs;) {
 		idx = (last_succ_rail + i) % mrail_cq->num_cqs;
-		ret = fi_cq_readfrom(mrail_cq->cqs[idx], &comp, 1, &src_addr);
-		if (ret == -FI_EAGAIN || !ret) {
+		cnt = fi_cq_readfrom(mrail_cq->cqs[idx], comp,
+				     MRAIL_CQ_READ_CNT, src_addr);
+		if (cnt == -FI_EAGAIN || !cnt) {
 			i++;
 			continue;
 		}
-		if (ret < 0) {
+		if (cnt < 0) {
 			FI_WARN(&mrail_prov, FI_LOG_CQ,
 				"Unable to read rail completion: %s\n",
-				fi_strerror(-ret));
+				fi_strerror(-cnt));
 			goto err;
 		}
-		// TODO handle variable length message
-		if (comp.flags & FI_RECV) {
-			ret = mrail_cq->process_comp(&comp, src_addr);
-			if (ret)
-				goto err;
-		} else if (comp.flags & (FI_READ | FI_WRITE)) {
-			mrail_handle_rma_completion(cq, &comp);
-		} else if (comp.flags & FI_SEND) {
-			tx_buf = comp.op_context;
-			if (tx_buf->hdr.protocol == MRAIL_PROTO_RNDV) {
-				if (tx_buf->hdr.protocol_cmd == MRAIL_RNDV_REQ) {
-					/* buf will be freed when ACK comes */
-				} else if (tx_buf->hdr.protocol_cmd == MRAIL_RNDV_ACK) {
-					ofi_ep_lock_acquire(&tx_buf->ep->util_ep);
-					ofi_buf_free(tx_buf);
-					ofi_ep_lock_release(&tx_buf->ep->util_ep);
-				}
-			} else {
-				ret = mrail_cq_write_send_comp(cq, tx_buf);
+
+		for (j = 0; j < cnt; j++) {
+			// TODO handle variable length message
+			if (comp[j].flags & FI_RECV) {
+				ret = mrail_cq->process_comp(&comp[j],
+							     src_addr[j]);
 				if (ret)
 					goto err;
+			} else if (comp[j].flags & (FI_READ | FI_WRITE)) {
+				mrail_handle_rma_completion(cq, idx, &comp[j]);
+			} else if (comp[j].flags & FI_SEND) {
+				tx_buf = comp[j].op_context;
+				mrail_rail_complete(tx_buf->ep, idx,
+						    tx_buf->rail_len,
+						    tx_buf->post_time);
+				if (tx_buf->hdr.protocol == MRAIL_PROTO_RNDV) {
+					if (tx_buf->hdr.protocol_cmd == MRAIL_RNDV_REQ) {
+						/* buf will be freed when ACK comes */
+					} else if (tx_buf->hdr.protocol_cmd == MRAIL_RNDV_ACK) {
+						ofi_ep_lock_acquire(&tx_buf->ep->util_ep);
+						ofi_buf_free(tx_buf);
+						ofi_ep_lock_release(&tx_buf->ep->util_ep);
+					}
+				} else {
+					ret = mrail_poll_send_comp(cq, &send_comps,
+								   tx_buf);
+					if (ret)
+						goto err;
+				}
+			} else {
+				/* We currently cannot support FI_REMOTE_READ and
+				 * FI_REMOTE_WRITE because RMA operations are split
+				 * across all rails. We would need to introduce some
+				 * sort of protocol to keep track of remotely-initiated
+				 * RMA operations. */
+				assert(comp[j].flags & (FI_REMOTE_READ | FI_REMOTE_WRITE));
+				FI_WARN(&mrail_prov, FI_LOG_CQ,
+					"Unsupported completion flag\n");
 			}
-		} else {
-			/* We currently cannot support FI_REMOTE_READ and
-			 * FI_REMOTE_WRITE because RMA operations are split
-			 * across all rails. We would need to introduce some
-			 * sort of protocol to keep track of remotely-initiated
-			 * RMA operations. */
-			assert(comp.flags & (FI_REMOTE_READ | FI_REMOTE_WRITE));
-			FI_WARN(&mrail_prov, FI_LOG_CQ,
-				"Unsupported completion flag\n");
 		}
 
 		last_succ_rail = idx;
@@ -606,6 +789,8 @@ void mrail_poll_cq(struct util_cq *cq)
 			break;
 	}
 
+	if (mrail_send_comps_flush(cq, &send_comps))
+		goto err;
 	return;
 
 err:
@@ -638,8 +823,8 @@ int mrail_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	if (!mrail_cq)
 		return -FI_ENOMEM;
 
-	ret = ofi_cq_init(&mrail_prov, domain, attr, &mrail_cq->util_cq,
-			  &mrail_cq_progress, context);
+	ret = ofi_cq_init_flags(&mrail_prov, domain, attr, &mrail_cq->util_cq,
+				&mrail_cq_progress, OFI_CQ_LOCKFREE, context);
 	if (ret) {
 		free(mrail_cq);
 		return ret;
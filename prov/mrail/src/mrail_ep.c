@@ -337,6 +337,37 @@ static struct mrail_tx_buf *mrail_get_tx_buf(struct mrail_ep *mrail_ep,
 	return tx_buf;
 }
 
+/*
+ * Select the rail that is expected to drain its outstanding bytes plus
+ * this message first.  Until every rail has a throughput estimate, rails
+ * are compared by outstanding bytes only.  Ties are broken round-robin.
+ */
+size_t mrail_get_tx_rail_adaptive(struct mrail_ep *mrail_ep, size_t len)
+{
+	uint64_t est, best_est = UINT64_MAX;
+	size_t i, rail, start, best_rail = 0;
+	int have_rates = 1;
+
+	for (i = 0; i < mrail_ep->num_eps; i++) {
+		if (!ofi_atomic_get64(&mrail_ep->rails[i].comp_bytes))
+			have_rates = 0;
+	}
+
+	start = mrail_get_tx_rail_rr(mrail_ep);
+	for (i = 0; i < mrail_ep->num_eps; i++) {
+		rail = (start + i) % mrail_ep->num_eps;
+		est = ofi_atomic_get64(&mrail_ep->rails[rail].outstanding) + len;
+		if (have_rates)
+			est = est * 1000 / MAX(mrail_get_rail_rate(mrail_ep,
+								   rail), 1);
+		if (est < best_est) {
+			best_est = est;
+			best_rail = rail;
+		}
+	}
+	return best_rail;
+}
+
 /*
  * This is an internal send that doesn't use seq_no and doesn't update
  * the counters. The call doesn't return -FI_EAGAIN.
@@ -349,7 +380,7 @@ int mrail_send_rndv_ack_blocking(struct mrail_ep *mrail_ep,
 	struct mrail_tx_buf *tx_buf;
 	size_t rndv_pkt_size = sizeof(tx_buf->hdr) + sizeof(tx_buf->rndv_hdr);
 	int policy = mrail_get_policy(rndv_pkt_size);
-	uint32_t i = mrail_get_tx_rail(mrail_ep, policy);
+	uint32_t i = mrail_get_tx_rail(mrail_ep, policy, rndv_pkt_size);
 	struct fi_msg msg;
 	ssize_t ret;
 	uint64_t flags = FI_COMPLETION;
@@ -379,6 +410,9 @@ int mrail_send_rndv_ack_blocking(struct mrail_ep *mrail_ep,
 	FI_DBG(&mrail_prov, FI_LOG_EP_DATA, "Posting rdnv ack "
 	       " dest_addr: 0x%" PRIx64 " on rail: %d\n", dest_addr, i);
 
+	tx_buf->rail_len = rndv_pkt_size;
+	mrail_rail_post(mrail_ep, i, rndv_pkt_size, &tx_buf->post_time);
+
 	do {
 		ret = fi_sendmsg(mrail_ep->rails[i].ep, &msg, flags);
 		if (ret == -FI_EAGAIN) {
@@ -392,6 +426,7 @@ int mrail_send_rndv_ack_blocking(struct mrail_ep *mrail_ep,
 	if (ret) {
 		FI_WARN(&mrail_prov, FI_LOG_EP_DATA,
 			"Unable to fi_sendmsg on rail: %" PRIu32 "\n", i);
+		mrail_rail_cancel(mrail_ep, i, rndv_pkt_size);
 		ofi_buf_free(tx_buf);
 	}
 
@@ -487,7 +522,7 @@ mrail_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 	struct iovec *iov_dest = alloca(sizeof(*iov_dest) * (count + 1));
 	struct mrail_tx_buf *tx_buf;
 	int policy = mrail_get_policy(len);
-	uint32_t rail = mrail_get_tx_rail(mrail_ep, policy);
+	uint32_t rail = mrail_get_tx_rail(mrail_ep, policy, len);
 	struct fi_msg msg;
 	ssize_t ret;
 	size_t total_len;
@@ -497,7 +532,8 @@ mrail_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 	ofi_ep_lock_acquire(&mrail_ep->util_ep);
 
 	tx_buf = mrail_get_tx_buf(mrail_ep, context, peer_info->seq_no++,
-				  ofi_op_tagged, flags | op);
+				  op == FI_TAGGED ? ofi_op_tagged : ofi_op_msg,
+				  flags | op);
 	if (OFI_UNLIKELY(!tx_buf)) {
 		ret = -FI_ENOMEM;
 		goto err1;
@@ -537,10 +573,14 @@ mrail_send_common(struct fid_ep *ep_fid, const struct iovec *iov, void **desc,
 	       " dest_addr: 0x%" PRIx64 " tag: 0x%" PRIx64 " seq: %d"
 	       " on rail: %d\n", len, dest_addr, tag, peer_info->seq_no - 1, rail);
 
+	tx_buf->rail_len = total_len;
+	mrail_rail_post(mrail_ep, rail, total_len, &tx_buf->post_time);
+
 	ret = fi_sendmsg(mrail_ep->rails[rail].ep, &msg, flags | FI_COMPLETION);
 	if (ret) {
 		FI_WARN(&mrail_prov, FI_LOG_EP_DATA,
 			"Unable to fi_sendmsg on rail: %" PRIu32 "\n", rail);
+		mrail_rail_cancel(mrail_ep, rail, total_len);
 		goto err2;
 	} else if (!(flags & FI_COMPLETION)) {
 		ofi_ep_tx_cntr_inc(&mrail_ep->util_ep);
@@ -781,6 +821,12 @@ static int mrail_ep_close(fid_t fid)
 	mrail_ep_free_bufs(mrail_ep);
 
 	for (i = 0; i < mrail_ep->num_eps; i++) {
+		if (mrail_adaptive &&
+		    ofi_atomic_get64(&mrail_ep->rails[i].comp_bytes)) {
+			FI_INFO(&mrail_prov, FI_LOG_EP_CTRL, "rail %zu: measured "
+				"throughput %" PRIu64 " bytes/ms\n", i,
+				mrail_get_rail_rate(mrail_ep, i));
+		}
 		ret = fi_close(&mrail_ep->rails[i].ep->fid);
 		if (ret)
 			retv = ret;
@@ -1048,6 +1094,12 @@ int mrail_ep_open(struct fid_domain *domain_fid, struct fi_info *info,
 
 	ofi_atomic_initialize32(&mrail_ep->tx_rail, 0);
 	ofi_atomic_initialize32(&mrail_ep->rx_rail, 0);
+	for (i = 0; i < mrail_ep->num_eps; i++) {
+		ofi_atomic_initialize64(&mrail_ep->rails[i].outstanding, 0);
+		ofi_atomic_initialize64(&mrail_ep->rails[i].comp_bytes, 0);
+		ofi_atomic_initialize64(&mrail_ep->rails[i].busy_time, 0);
+		ofi_atomic_initialize64(&mrail_ep->rails[i].last_comp, 0);
+	}
 	mrail_ep->default_tx_rail = mrail_local_rank % mrail_ep->num_eps;
 
 	*ep_fid = &mrail_ep->util_ep.ep_fid;
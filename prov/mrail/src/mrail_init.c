@@ -45,6 +45,8 @@ struct mrail_config mrail_config[MRAIL_MAX_CONFIG] = {
 };
 int mrail_num_config = 2;
 int mrail_local_rank = 0;
+int mrail_adaptive = 0;
+size_t mrail_ooo_win_size = 256;
 
 static inline char **mrail_split_addr_strc(const char *addr_strc)
 {
@@ -68,7 +70,7 @@ static int mrail_parse_env_vars(void)
 	fi_param_define(&mrail_prov, "config", FI_PARAM_STRING,
 			"Comma separated list of '<max_size>:<policy>' pairs, "
 			"with <max_size> in ascending order and <policy> being "
-			"fixed, round-robin, or striping");
+			"fixed, round-robin, striping, or adaptive");
 	ret = fi_param_get_str(&mrail_prov, "config", &str);
 	if (!ret) {
 		for (i = 0; i < MRAIL_MAX_CONFIG; i++) {
@@ -92,6 +94,9 @@ static int mrail_parse_env_vars(void)
 				mrail_config[i].policy = MRAIL_POLICY_ROUND_ROBIN;
 			} else if (!strcasecmp(alg, "striping")) {
 				mrail_config[i].policy = MRAIL_POLICY_STRIPING;
+			} else if (!strcasecmp(alg, "adaptive")) {
+				mrail_config[i].policy = MRAIL_POLICY_ADAPTIVE;
+				mrail_adaptive = 1;
 			} else {
 				FI_WARN(&mrail_prov, FI_LOG_CORE, "Invalid policy "
 					"specification %s\n", alg);
@@ -101,6 +106,13 @@ static int mrail_parse_env_vars(void)
 		mrail_num_config = i;
 	}
 
+	fi_param_define(&mrail_prov, "ooo_window", FI_PARAM_SIZE_T,
+			"Number of out-of-order messages per peer that can be "
+			"reordered in constant time, rounded up to a power of "
+			"two (default: 256)");
+	fi_param_get_size_t(&mrail_prov, "ooo_window", &mrail_ooo_win_size);
+	mrail_ooo_win_size = roundup_power_of_two(MAX(mrail_ooo_win_size, 1));
+
 	fi_param_define(&mrail_prov, "addr_strc", FI_PARAM_STRING, "Deprecated. "
 			"Replaced by FI_OFI_MRAIL_ADDR.");
 
@@ -72,7 +72,8 @@ static ssize_t mrail_post_subreq(uint32_t rail,
 	struct mrail_req *req = subreq->parent;
 	struct mrail_ep *mrail_ep = req->mrail_ep;
 
-	uint64_t flags = req->flags;
+	/* Every subreq needs a completion to complete the parent req */
+	uint64_t flags = (req->flags & ~MRAIL_RNDV_FLAG) | FI_COMPLETION;
 
 	mrail_subreq_to_rail(subreq, rail, rail_iov, rail_descs, rail_rma_iov);
 
@@ -84,13 +85,20 @@ static ssize_t mrail_post_subreq(uint32_t rail,
 	msg.rma_iov_count	= subreq->rma_iov_count;
 	msg.context		= &subreq->context;
 
+	mrail_rail_post(mrail_ep, rail, subreq->len, &subreq->post_time);
+
 	if (req->op_type == FI_READ) {
 		ret = fi_readmsg(mrail_ep->rails[rail].ep, &msg, flags);
 	} else {
-		/* Immediate data is sent with the last subreq only */
+		/* Immediate data is sent with the last subreq only. The
+		 * other subreqs must have reached the target memory before
+		 * the target sees the data. */
 		if (flags & FI_REMOTE_CQ_DATA) {
 			if (req->pending_subreq > 0) {
-				flags &= ~FI_REMOTE_CQ_DATA;
+				flags &= ~(FI_REMOTE_CQ_DATA |
+					   FI_INJECT_COMPLETE |
+					   FI_TRANSMIT_COMPLETE);
+				flags |= FI_DELIVERY_COMPLETE;
 			} else {
 				msg.data = req->data;
 			}
@@ -98,22 +106,41 @@ static ssize_t mrail_post_subreq(uint32_t rail,
 		ret = fi_writemsg(mrail_ep->rails[rail].ep, &msg, flags);
 	}
 
+	if (ret)
+		mrail_rail_cancel(mrail_ep, rail, subreq->len);
 	return ret;
 }
 
 static ssize_t mrail_post_req(struct mrail_req *req)
 {
+	struct mrail_subreq *subreq;
 	size_t i;
 	uint32_t rail;
 	ssize_t ret = 0;
 
 	while (req->pending_subreq >= 0) {
+		subreq = &req->subreqs[req->pending_subreq];
+
+		if (!req->pending_subreq && req->data_gated) {
+			req->data_gated = 0;
+			/* Other subreqs still in flight, the completion
+			 * handler will queue the req again */
+			if (ofi_atomic_dec32(&req->data_gate))
+				return 0;
+		}
+
+		if (subreq->rail >= 0) {
+			/* The subreq was sized for this rail */
+			ret = mrail_post_subreq(subreq->rail, subreq);
+			if (ret == -FI_EAGAIN)
+				mrail_poll_cq(req->mrail_ep->util_ep.tx_cq);
+		}
+
 		/* Try all rails before giving up */
-		for (i = 0; i < req->mrail_ep->num_eps; ++i) {
+		for (i = 0; subreq->rail < 0 && i < req->mrail_ep->num_eps; ++i) {
 			rail = mrail_get_tx_rail_rr(req->mrail_ep);
 
-			ret = mrail_post_subreq(rail,
-					&req->subreqs[req->pending_subreq]);
+			ret = mrail_post_subreq(rail, subreq);
 			if (ret != -FI_EAGAIN) {
 				break;
 			} else {
@@ -156,14 +183,6 @@ static inline void mrail_requeue_deferred_req(struct mrail_ep *mrail_ep,
 	ofi_ep_lock_release(&mrail_ep->util_ep);
 }
 
-static inline void mrail_queue_deferred_req(struct mrail_ep *mrail_ep,
-		struct mrail_req *req)
-{
-	ofi_ep_lock_acquire(&mrail_ep->util_ep);
-	slist_insert_tail(&req->entry, &mrail_ep->deferred_reqs);
-	ofi_ep_lock_release(&mrail_ep->util_ep);
-}
-
 void mrail_progress_deferred_reqs(struct mrail_ep *mrail_ep)
 {
 	struct mrail_req *req;
@@ -180,31 +199,85 @@ void mrail_progress_deferred_reqs(struct mrail_ep *mrail_ep)
 	}
 }
 
+/*
+ * Decide how many subreqs an RMA operation is split into, their lengths,
+ * and the rail each one is posted on (-1 for any rail).  Returns the
+ * number of subreqs.
+ */
+static size_t mrail_plan_rma_subreqs(struct mrail_ep *mrail_ep,
+		size_t total_len, size_t *lens, int *rails)
+{
+	uint64_t rate, total_rate = 0;
+	size_t i, count, len_sum;
+	int policy;
+
+	policy = mrail_get_policy(total_len);
+	if (policy != MRAIL_POLICY_STRIPING) {
+		lens[0] = total_len;
+		rails[0] = (policy == MRAIL_POLICY_ROUND_ROBIN) ? -1 :
+			   (int) mrail_get_tx_rail(mrail_ep, policy, total_len);
+		return 1;
+	}
+
+	if (mrail_adaptive) {
+		for (i = 0; i < mrail_ep->num_eps; i++) {
+			rate = mrail_get_rail_rate(mrail_ep, i);
+			if (!rate) {
+				total_rate = 0;
+				break;
+			}
+			total_rate += rate;
+		}
+	}
+
+	if (!total_rate) {
+		/* Stripe equally across all rails; the first chunk is the
+		 * longest */
+		for (i = 0; i < mrail_ep->num_eps; i++) {
+			lens[i] = total_len / mrail_ep->num_eps;
+			rails[i] = -1;
+		}
+		lens[0] += total_len % mrail_ep->num_eps;
+		return mrail_ep->num_eps;
+	}
+
+	/* Weight the stripes by the measured throughput of each rail */
+	for (i = 0, count = 0, len_sum = 0; i < mrail_ep->num_eps; i++) {
+		lens[count] = total_len * mrail_get_rail_rate(mrail_ep, i) /
+			      total_rate;
+		if (!lens[count])
+			continue;
+		rails[count] = (int) i;
+		len_sum += lens[count++];
+	}
+	if (!count) {
+		lens[0] = total_len;
+		rails[0] = (int) mrail_get_tx_rail_adaptive(mrail_ep, total_len);
+		return 1;
+	}
+
+	lens[0] += total_len - len_sum;
+	return count;
+}
+
 static ssize_t mrail_prepare_rma_subreqs(struct mrail_ep *mrail_ep,
 		const struct fi_msg_rma *msg, struct mrail_req *req)
 {
-	ssize_t ret;
+	ssize_t ret = 0;
 	struct mrail_subreq *subreq;
+	size_t *lens = alloca(sizeof(*lens) * mrail_ep->num_eps);
+	int *rails = alloca(sizeof(*rails) * mrail_ep->num_eps);
 	size_t subreq_count;
 	size_t total_len;
-	size_t chunk_len;
-	size_t subreq_len;
 	size_t iov_index;
 	size_t iov_offset;
 	size_t rma_iov_index;
 	size_t rma_iov_offset;
-	int i;
+	int i, j;
 
-	/* For now, stripe across all rails.
-	 * This could be determined by a dynamic scheduler instead.
-	 */
-	subreq_count = mrail_ep->num_eps;
-
-	total_len = ofi_total_iov_len(msg->msg_iov, msg->iov_count); 
-	chunk_len = total_len / subreq_count;
+	total_len = ofi_total_iov_len(msg->msg_iov, msg->iov_count);
+	subreq_count = mrail_plan_rma_subreqs(mrail_ep, total_len, lens, rails);
 
-	/* The first chunk is the longest */
-	subreq_len =  chunk_len + (total_len % subreq_count);
 	iov_index = 0;
 	iov_offset = 0;
 	rma_iov_index = 0;
@@ -218,16 +291,18 @@ static ssize_t mrail_prepare_rma_subreqs(struct mrail_ep *mrail_ep,
 	 * track of which subreq to post next, starting at the end of the
 	 * array.
 	 */
-	for (i = (subreq_count - 1); i >= 0; --i) {
+	for (i = (subreq_count - 1), j = 0; i >= 0; --i, ++j) {
 		subreq = &req->subreqs[i];
 
 		subreq->parent = req;
+		subreq->rail = rails[j];
+		subreq->len = lens[j];
 
 		ret = ofi_copy_iov_desc(subreq->iov, subreq->descs,
 				&subreq->iov_count,
 				(struct iovec *)msg->msg_iov, msg->desc,
 				msg->iov_count, &iov_index, &iov_offset,
-				subreq_len);
+				lens[j]);
 		if (ret) {
 			goto out;
 		}
@@ -235,17 +310,18 @@ static ssize_t mrail_prepare_rma_subreqs(struct mrail_ep *mrail_ep,
 		ret = ofi_copy_rma_iov(subreq->rma_iov, &subreq->rma_iov_count,
 				(struct fi_rma_iov *)msg->rma_iov,
 				msg->rma_iov_count, &rma_iov_index,
-				&rma_iov_offset, subreq_len);
+				&rma_iov_offset, lens[j]);
 		if (ret) {
 			goto out;
 		}
-
-		/* All the other chunks have the same length */
-		subreq_len = chunk_len;
 	}
 
 	ofi_atomic_initialize32(&req->expected_subcomps, subreq_count);
 
+	req->data_gated = (req->op_type == FI_WRITE) && (subreq_count > 1) &&
+			  (req->flags & FI_REMOTE_CQ_DATA);
+	ofi_atomic_initialize32(&req->data_gate, req->data_gated ? 2 : 0);
+
 	/* pending_subreq is the index of the next subreq to post.
 	 * The array was filled in reverse order in mrail_prepare_rma_subreqs()
 	 */
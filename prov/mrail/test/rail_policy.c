@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Test of the mrail rail selection policies (FI_OFI_MRAIL_CONFIG) over two
+ * tcp;ofi_rxm rails on the loopback interface.  A server and a client
+ * process exchange messages of several sizes and check their payload and
+ * order.  Messages spread over both rails can arrive out of order, so the
+ * receiver has to reorder them through its recv window, or through the
+ * overflow list once a small window (FI_OFI_MRAIL_OOO_WINDOW) fills up.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <rdma/fabric.h>
+#include <rdma/fi_cm.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_errno.h>
+
+
+enum {
+	TEST_MSG_CNT = 64,
+	TEST_WINDOW = 4,
+	TEST_TIMEOUT = 60,
+	TEST_NAME_LEN = 128,
+};
+
+static const size_t test_sizes[] = {
+	1000,		/* eager */
+	120000,		/* SAR */
+	1 << 20,	/* rendezvous */
+};
+
+#define TEST_MAX_SIZE	(1 << 20)
+#define TEST_SIZE_CNT	(sizeof(test_sizes) / sizeof(test_sizes[0]))
+
+/* Rail selection policy for all sizes and size of the recv window */
+static const struct {
+	const char *config;
+	const char *ooo_window;
+} test_cases[] = {
+	{ ":round-robin", "256" },
+	{ ":adaptive", "256" },
+	{ ":adaptive", "1" },
+};
+
+#define TEST_CASE_CNT	(sizeof(test_cases) / sizeof(test_cases[0]))
+
+struct test_ep {
+	struct fi_info *info;
+	struct fid_fabric *fabric;
+	struct fid_domain *domain;
+	struct fid_av *av;
+	struct fid_cq *cq;
+	struct fid_ep *ep;
+	fi_addr_t peer;
+	struct fi_context ctx[TEST_WINDOW];
+	char *buf[TEST_WINDOW];
+};
+
+
+static void test_fill(char *buf, size_t len, size_t seq)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (char) (seq * 31 + i * 7);
+}
+
+static int test_check(const char *buf, size_t len, size_t seq)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != (char) (seq * 31 + i * 7)) {
+			fprintf(stderr, "message %zu of %zu bytes: bad byte "
+				"at offset %zu\n", seq, len, i);
+			return -FI_EIO;
+		}
+	}
+	return 0;
+}
+
+static int test_open(struct test_ep *t)
+{
+	struct fi_info *hints;
+	struct fi_av_attr av_attr = {
+		.type = FI_AV_TABLE,
+	};
+	struct fi_cq_attr cq_attr = {
+		.format = FI_CQ_FORMAT_MSG,
+		.wait_obj = FI_WAIT_NONE,
+	};
+	int i, ret;
+
+	hints = fi_allocinfo();
+	if (!hints)
+		return -FI_ENOMEM;
+	hints->ep_attr->type = FI_EP_RDM;
+	hints->caps = FI_MSG;
+	hints->mode = FI_CONTEXT;
+	hints->fabric_attr->prov_name = strdup("ofi_mrail");
+
+	ret = fi_getinfo(FI_VERSION(FI_MAJOR_VERSION, FI_MINOR_VERSION),
+			 NULL, NULL, 0, hints, &t->info);
+	fi_freeinfo(hints);
+	if (ret) {
+		fprintf(stderr, "fi_getinfo: %s\n", fi_strerror(-ret));
+		return ret;
+	}
+
+	ret = fi_fabric(t->info->fabric_attr, &t->fabric, NULL);
+	if (ret)
+		return ret;
+	ret = fi_domain(t->fabric, t->info, &t->domain, NULL);
+	if (ret)
+		return ret;
+	ret = fi_av_open(t->domain, &av_attr, &t->av, NULL);
+	if (ret)
+		return ret;
+	ret = fi_cq_open(t->domain, &cq_attr, &t->cq, NULL);
+	if (ret)
+		return ret;
+	ret = fi_endpoint(t->domain, t->info, &t->ep, NULL);
+	if (ret)
+		return ret;
+	ret = fi_ep_bind(t->ep, &t->av->fid, 0);
+	if (ret)
+		return ret;
+	ret = fi_ep_bind(t->ep, &t->cq->fid, FI_TRANSMIT | FI_RECV);
+	if (ret)
+		return ret;
+	ret = fi_enable(t->ep);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < TEST_WINDOW; i++) {
+		t->buf[i] = malloc(TEST_MAX_SIZE);
+		if (!t->buf[i])
+			return -FI_ENOMEM;
+		/* Populate the pages before the MR cache registers them.
+		 * A zero fill could be folded into calloc() and skipped. */
+		memset(t->buf[i], 0xff, TEST_MAX_SIZE);
+	}
+	return 0;
+}
+
+static void test_close(struct test_ep *t)
+{
+	int i;
+
+	for (i = 0; i < TEST_WINDOW; i++)
+		free(t->buf[i]);
+	if (t->ep)
+		fi_close(&t->ep->fid);
+	if (t->cq)
+		fi_close(&t->cq->fid);
+	if (t->av)
+		fi_close(&t->av->fid);
+	if (t->domain)
+		fi_close(&t->domain->fid);
+	if (t->fabric)
+		fi_close(&t->fabric->fid);
+	fi_freeinfo(t->info);
+}
+
+/* Pass the endpoint names through the pipes and insert the peer */
+static int test_exchange_names(struct test_ep *t, int rfd, int wfd)
+{
+	char name[TEST_NAME_LEN], peer_name[TEST_NAME_LEN];
+	size_t len = sizeof(name);
+	int ret;
+
+	ret = fi_getname(&t->ep->fid, name, &len);
+	if (ret)
+		return ret;
+	if (write(wfd, name, len) != (ssize_t) len ||
+	    read(rfd, peer_name, sizeof(peer_name)) <= 0)
+		return -FI_EIO;
+
+	ret = fi_av_insert(t->av, peer_name, 1, &t->peer, 0, NULL);
+	return ret == 1 ? 0 : -FI_EINVAL;
+}
+
+static int test_wait(struct test_ep *t, struct fi_cq_msg_entry *comp)
+{
+	struct fi_cq_err_entry err_entry = {0};
+	ssize_t ret;
+
+	do {
+		ret = fi_cq_read(t->cq, comp, 1);
+	} while (ret == -FI_EAGAIN);
+
+	if (ret == -FI_EAVAIL) {
+		fi_cq_readerr(t->cq, &err_entry, 0);
+		fprintf(stderr, "completion error: %s\n",
+			fi_strerror(err_entry.err));
+		return -err_entry.err;
+	}
+	return ret == 1 ? 0 : (int) ret;
+}
+
+static int test_post(struct test_ep *t, int send, int slot, size_t len)
+{
+	struct fi_cq_msg_entry comp;
+	ssize_t ret;
+
+	for (;;) {
+		if (send)
+			ret = fi_send(t->ep, t->buf[slot], len, NULL, t->peer,
+				      &t->ctx[slot]);
+		else
+			ret = fi_recv(t->ep, t->buf[slot], len, NULL,
+				      FI_ADDR_UNSPEC, &t->ctx[slot]);
+		if (ret != -FI_EAGAIN)
+			return (int) ret;
+		/* Progress the endpoint */
+		ret = fi_cq_read(t->cq, &comp, 0);
+		if (ret < 0 && ret != -FI_EAGAIN)
+			return (int) ret;
+	}
+}
+
+/* Keep up to TEST_WINDOW messages of each size in flight.  Receives are
+ * matched in the order they are posted, so the payload check catches any
+ * message that is delivered out of order.  Completions may still be
+ * reported out of order, so each buffer slot remembers the sequence number
+ * it was posted with. */
+static int test_transfer(struct test_ep *t, int send)
+{
+	struct fi_cq_msg_entry comp;
+	size_t posted, done, size, seq[TEST_WINDOW];
+	int busy[TEST_WINDOW] = {0};
+	int i, slot, ret;
+
+	for (i = 0; i < TEST_SIZE_CNT; i++) {
+		size = test_sizes[i];
+		for (posted = done = 0; done < TEST_MSG_CNT; done++) {
+			for (slot = 0; slot < TEST_WINDOW &&
+			     posted < TEST_MSG_CNT; slot++) {
+				if (busy[slot])
+					continue;
+				seq[slot] = i * TEST_MSG_CNT + posted;
+				if (send)
+					test_fill(t->buf[slot], size,
+						  seq[slot]);
+				ret = test_post(t, send, slot, size);
+				if (ret)
+					return ret;
+				busy[slot] = 1;
+				posted++;
+			}
+
+			ret = test_wait(t, &comp);
+			if (ret)
+				return ret;
+			slot = (struct fi_context *) comp.op_context - t->ctx;
+			busy[slot] = 0;
+			if (send)
+				continue;
+			if (comp.len != size) {
+				fprintf(stderr, "message %zu: received %zu "
+					"of %zu bytes\n", seq[slot], comp.len,
+					size);
+				return -FI_EIO;
+			}
+			ret = test_check(t->buf[slot], size, seq[slot]);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/* The client sends all messages and the server acknowledges them with an
+ * empty message, so that the client doesn't close the connections while
+ * transfers are still in flight */
+static int test_run(int server, int rfd, int wfd)
+{
+	struct test_ep t = {0};
+	struct fi_cq_msg_entry comp;
+	int ret;
+
+	ret = test_open(&t);
+	if (ret)
+		goto out;
+	ret = test_exchange_names(&t, rfd, wfd);
+	if (ret)
+		goto out;
+
+	ret = test_transfer(&t, !server);
+	if (ret)
+		goto out;
+
+	ret = test_post(&t, server, 0, 0);
+	if (!ret)
+		ret = test_wait(&t, &comp);
+out:
+	if (ret)
+		fprintf(stderr, "%s: %s\n", server ? "server" : "client",
+			fi_strerror(-ret));
+	test_close(&t);
+	return ret;
+}
+
+static pid_t test_spawn(int server, const char *config,
+			const char *ooo_window, int rfd, int wfd)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	setenv("FI_OFI_MRAIL_ADDR", "127.0.0.1,127.0.0.1", 1);
+	setenv("FI_OFI_MRAIL_CONFIG", config, 1);
+	setenv("FI_OFI_MRAIL_OOO_WINDOW", ooo_window, 1);
+	alarm(TEST_TIMEOUT);
+	_exit(test_run(server, rfd, wfd) ? 1 : 0);
+}
+
+static int test_case(const char *config, const char *ooo_window)
+{
+	int s2c[2], c2s[2], status, i, ret = 0;
+	pid_t pid[2];
+
+	if (pipe(s2c) || pipe(c2s))
+		return -1;
+
+	pid[0] = test_spawn(1, config, ooo_window, c2s[0], s2c[1]);
+	pid[1] = test_spawn(0, config, ooo_window, s2c[0], c2s[1]);
+
+	for (i = 0; i < 2; i++) {
+		if (pid[i] < 0 || waitpid(pid[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+
+	close(s2c[0]);
+	close(s2c[1]);
+	close(c2s[0]);
+	close(c2s[1]);
+
+	printf("policy %s, recv window %s: %s\n", config + 1, ooo_window,
+	       ret ? "failed" : "ok");
+	return ret;
+}
+
+int main(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < TEST_CASE_CNT; i++)
+		ret |= test_case(test_cases[i].config,
+				 test_cases[i].ooo_window);
+
+	if (ret) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
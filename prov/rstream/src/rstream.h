@@ -54,6 +54,8 @@
 #include <ofi_proto.h>
 #include <ofi_prov.h>
 #include <ofi_enosys.h>
+#include <ofi_list.h>
+#include <ofi_rbuf.h>
 
 
 #define RSTREAM_CAPS (FI_MSG | FI_SEND | FI_RECV | FI_LOCAL_COMM | FI_REMOTE_COMM)
@@ -64,14 +66,31 @@
 
 #define RSTREAM_MAX_POLL_TIME 10
 
+/* credit update: [type = 0, credits, freed len in units of 1 << len_shift] */
 #define RSTREAM_MAX_MR_BITS 20
 #define RSTREAM_MR_MAX (1ULL << RSTREAM_MAX_MR_BITS)
 #define RSTREAM_MR_LEN_MASK (RSTREAM_MR_MAX - 1)
 #define RSTREAM_CREDIT_OFFSET RSTREAM_MAX_MR_BITS
-#define RSTREAM_CREDIT_BITS 9
+#define RSTREAM_CREDIT_BITS 10
 #define RSTREAM_CREDITS_MAX (1ULL << RSTREAM_CREDIT_BITS)
 #define RSTREAM_CREDIT_MASK ((RSTREAM_CREDITS_MAX - 1) << RSTREAM_CREDIT_OFFSET)
-#define RSTREAM_RSOCKETV2 2
+
+/* read protocol: [type, len] - READ_REQ announces data left in the sender's
+ * tx ring for the peer to read, READ_DONE returns it */
+#define RSTREAM_CTRL_TYPE_OFFSET (RSTREAM_CREDIT_OFFSET + RSTREAM_CREDIT_BITS)
+#define RSTREAM_CTRL_TYPE_MASK (3ULL << RSTREAM_CTRL_TYPE_OFFSET)
+#define RSTREAM_CTRL_READ_REQ (1ULL << RSTREAM_CTRL_TYPE_OFFSET)
+#define RSTREAM_CTRL_READ_DONE (2ULL << RSTREAM_CTRL_TYPE_OFFSET)
+#define RSTREAM_READ_LEN_MAX (1ULL << RSTREAM_CTRL_TYPE_OFFSET)
+#define RSTREAM_READ_LEN_MASK (RSTREAM_READ_LEN_MAX - 1)
+
+/* each ring fits the read length, and both rings plus iWARP metadata fit
+ * in one registration */
+#define RSTREAM_MAX_MR_SEG_SIZE \
+	MIN(RSTREAM_READ_LEN_MAX, SIZE_MAX / (2 + RSTREAM_IWARP_DATA_SIZE))
+#define RSTREAM_DEFAULT_READ_THRESHOLD (1 << 16)
+#define RSTREAM_RSOCKETV3 3
+#define RSTREAM_CM_READ (1 << 0)
 
 /*iWARP, have to also track msg len [msglen, target_credits, target_mr_len]*/
 #define RSTREAM_USING_IWARP (rstream_info.ep_attr->protocol == FI_PROTO_IWARP)
@@ -85,6 +104,9 @@ extern struct fi_info rstream_info;
 extern struct fi_provider rstream_prov;
 extern struct util_prov rstream_util_prov;
 extern struct fi_fabric_attr rstream_fabric_attr;
+extern size_t rstream_tx_buf_size;
+extern size_t rstream_rx_buf_size;
+extern size_t rstream_read_threshold;
 
 /* util structs ~ user layer fds */
 
@@ -96,12 +118,16 @@ struct rstream_fabric {
 struct rstream_domain {
 	struct util_domain util_domain;
 	struct fid_domain *msg_domain;
+	uint64_t msg_mr_mode;
+	/* keys must be unique in the domain without FI_MR_PROV_KEY */
+	ofi_atomic64_t mr_key;
 };
 
 enum rstream_msg_type {
 	RSTREAM_CTRL_MSG,
 	RSTREAM_RX_MSG_COMP,
 	RSTREAM_TX_MSG_COMP,
+	RSTREAM_READ_COMP,
 	RSTREAM_MSG_UNKNOWN
 };
 
@@ -126,6 +152,12 @@ struct rstream_lmr_data {
 struct rstream_rmr_data {
 	struct rstream_mr_seg mr;
 	uint64_t rkey;
+	uint32_t len_shift;
+	/* peer's tx ring, mirrored to locate data announced by READ_REQ */
+	uint64_t tx_base_addr;
+	uint32_t tx_size;
+	uint64_t tx_offset;
+	int read;
 };
 
 struct rstream_cm_data {
@@ -135,15 +167,42 @@ struct rstream_cm_data {
 	uint16_t max_rx_credits;
 	uint8_t version;
 	uint8_t reserved;
+	uint64_t tx_base_addr;
+	uint32_t tx_size;
+	uint8_t len_shift;
+	uint8_t flags;
+	uint16_t reserved2;
 };
 
 struct rstream_ctx_data {
 	struct fi_context ctx;
 	size_t len;
+	enum rstream_msg_type type;
+	size_t chunk;
+	int done;
 };
 
 DECLARE_FREESTACK(struct rstream_ctx_data, rstream_tx_ctx_fs);
 
+/* tx ring space is handed out in order, but written chunks are released on
+ * tx completion and announced ones when the peer has read them */
+struct rstream_tx_chunk {
+	uint32_t len;
+	uint32_t done;
+	int read;
+};
+
+OFI_DECLARE_CIRQUE(struct rstream_tx_chunk, rstream_tx_chunkq);
+
+/* stream order of data once announced data is pending: local segments are
+ * in the rx ring, remote ones in the peer's tx ring */
+struct rstream_rx_seg {
+	struct dlist_entry entry;
+	uint64_t offset;
+	uint32_t len;
+	int remote;
+};
+
 struct rstream_tx_ctx {
 	struct rstream_ctx_data *tx_ctxs;
 	uint32_t num_in_use;
@@ -163,24 +222,50 @@ struct rstream_window {
 struct rstream_cq_data {
 	uint32_t total_len;
 	uint16_t num_completions;
+	uint32_t read_len;
+};
+
+/* updates from the peer found by rx progress, applied under send_lock */
+struct rstream_peer_update {
+	ofi_atomic32_t credits;
+	ofi_atomic32_t mr_len;
+	ofi_atomic32_t read_len;
 };
 
 struct rstream_ep {
 	struct util_ep util_ep;
 	struct fid_ep *ep_fd;
 	struct fid_domain *msg_domain;
+	struct rstream_domain *domain;
 	struct rstream_lmr_data local_mr;
 	struct rstream_rmr_data remote_data;
-	struct fid_cq *cq;
+	/* tx_cq: writes, reads and ctrl sends; rx_cq: peer writes and ctrl */
+	struct fid_cq *tx_cq;
+	struct fid_cq *rx_cq;
 	struct rstream_window qp_win;
 	struct fi_context *rx_ctxs;
 	uint32_t rx_ctx_index;
 	struct rstream_tx_ctx_fs *tx_ctxs;
+	struct rstream_tx_chunkq *tx_chunks;
+	size_t tx_read_ack;
 	struct rstream_cq_data rx_cq_data;
+	struct dlist_entry rx_segs;
+	size_t read_threshold;
+	uint32_t rx_len_shift;
+	struct rstream_peer_update peer_update;
+	/* send_lock: tx ring, credits and tx_cq; recv_lock: rx ring and rx_cq.
+	 * recv_lock is taken before send_lock, the send path only tries it.
+	 * A blocked sender hands send_lock over to a waiting receiver and
+	 * sleeps on handoff_cond until the receiver has taken it */
 	fastlock_t send_lock;
 	fastlock_t recv_lock;
-	/* must take send/recv lock before cq_lock */
-	fastlock_t cq_lock;
+	ofi_atomic32_t send_lock_waiters;
+	pthread_mutex_t handoff_lock;
+	pthread_cond_t handoff_cond;
+#ifdef HAVE_EPOLL
+	/* returned by FI_GETWAIT, signaled by either CQ */
+	fi_epoll_t epoll_fd;
+#endif
 };
 
 struct rstream_pep {
@@ -218,6 +303,14 @@ extern int rstream_passive_ep(struct fid_fabric *fabric, struct fi_info *info,
 	struct fid_pep **pep, void *context);
 extern void rstream_process_cm_event(struct rstream_ep *ep, void *cm_data);
 
+static inline uint64_t rstream_get_mr_key(struct rstream_domain *domain)
+{
+	if (domain->msg_mr_mode & FI_MR_PROV_KEY)
+		return 0;
+
+	return ofi_atomic_inc64(&domain->mr_key);
+}
+
 int rstream_fabric_open(struct fi_fabric_attr *attr, struct fid_fabric **fabric,
 	void *context);
 int rstream_domain_open(struct fid_fabric *fabric, struct fi_info *info,
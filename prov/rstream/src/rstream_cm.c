@@ -33,16 +33,34 @@
 #include "rstream.h"
 
 
+/* without FI_MR_VIRT_ADDR the peer addresses the rings by MR offset */
+static uint64_t rstream_format_addr(const struct rstream_ep *ep,
+	const void *addr)
+{
+	if (ep->domain->msg_mr_mode & FI_MR_VIRT_ADDR)
+		return (uintptr_t)addr;
+
+	return (char *)addr - (char *)ep->local_mr.base_addr;
+}
+
 static void rstream_format_data(struct rstream_cm_data *cm,
 	const struct rstream_ep *ep)
 {
 	assert(cm && ep->local_mr.rx.data_start);
 
-	cm->version = RSTREAM_RSOCKETV2;
+	memset(cm, 0, sizeof(*cm));
+	cm->version = RSTREAM_RSOCKETV3;
 	cm->max_rx_credits = htons(ep->qp_win.max_rx_credits);
-	cm->base_addr = htonll((uintptr_t)ep->local_mr.rx.data_start);
+	cm->base_addr = htonll(rstream_format_addr(ep,
+		ep->local_mr.rx.data_start));
 	cm->rkey = htonll(ep->local_mr.rkey);
 	cm->rmr_size = htonl(ep->local_mr.rx.size);
+	cm->len_shift = ep->rx_len_shift;
+	cm->tx_base_addr = htonll(rstream_format_addr(ep,
+		ep->local_mr.tx.data_start));
+	cm->tx_size = htonl(ep->local_mr.tx.size);
+	if (ep->read_threshold)
+		cm->flags = RSTREAM_CM_READ;
 }
 
 static int rstream_setname(fid_t fid, void *addr, size_t addrlen)
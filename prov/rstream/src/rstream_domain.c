@@ -106,6 +106,11 @@ int rstream_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 	if (ret)
 		goto err1;
 
+	rstream_domain->msg_mr_mode = cinfo->domain_attr->mr_mode;
+	ofi_atomic_initialize64(&rstream_domain->mr_key, 0);
+	fi_freeinfo(cinfo);
+	cinfo = NULL;
+
 	ret = ofi_domain_init(fabric, info, &rstream_domain->util_domain,
 		context);
 	if (ret)
@@ -35,6 +35,7 @@
 
 static int rstream_ep_close(fid_t fid)
 {
+	struct rstream_rx_seg *seg;
 	int ret;
 	struct rstream_ep *rstream_ep =
 		container_of(fid, struct rstream_ep, util_ep.ep_fid.fid);
@@ -48,17 +49,33 @@ static int rstream_ep_close(fid_t fid)
 	if (ret)
 		return ret;
 
-	ret = fi_close(&rstream_ep->cq->fid);
+	ret = fi_close(&rstream_ep->tx_cq->fid);
 	if (ret)
 		return ret;
 
+	ret = fi_close(&rstream_ep->rx_cq->fid);
+	if (ret)
+		return ret;
+
+#ifdef HAVE_EPOLL
+	if (rstream_ep->epoll_fd >= 0)
+		fi_epoll_close(rstream_ep->epoll_fd);
+#endif
 	ofi_endpoint_close(&rstream_ep->util_ep);
 
 	rstream_tx_ctx_fs_free(rstream_ep->tx_ctxs);
+	rstream_tx_chunkq_free(rstream_ep->tx_chunks);
+
+	while (!dlist_empty(&rstream_ep->rx_segs)) {
+		dlist_pop_front(&rstream_ep->rx_segs, struct rstream_rx_seg,
+			seg, entry);
+		free(seg);
+	}
 
 	fastlock_destroy(&rstream_ep->send_lock);
 	fastlock_destroy(&rstream_ep->recv_lock);
-	fastlock_destroy(&rstream_ep->cq_lock);
+	pthread_cond_destroy(&rstream_ep->handoff_cond);
+	pthread_mutex_destroy(&rstream_ep->handoff_lock);
 	free(rstream_ep->rx_ctxs);
 	free(rstream_ep);
 	return 0;
@@ -88,22 +105,32 @@ static int rstream_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 	return ret;
 }
 
-static int rstream_reg_mrs(struct fid_domain *domain,
+static int rstream_reg_mrs(struct rstream_domain *domain,
 	struct rstream_lmr_data *lmr)
 {
 	int ret;
 	uint64_t rx_meta_data_offset = 0;
-	uint32_t full_mr_size = lmr->tx.size + lmr->rx.size;
+	uint64_t full_mr_size;
 
 	if (RSTREAM_USING_IWARP)
-		rx_meta_data_offset = RSTREAM_IWARP_DATA_SIZE * lmr->rx.size;
+		rx_meta_data_offset = RSTREAM_IWARP_DATA_SIZE *
+			(uint64_t) lmr->rx.size;
+
+	full_mr_size = (uint64_t) lmr->tx.size + lmr->rx.size +
+		rx_meta_data_offset;
+	if (full_mr_size > SIZE_MAX) {
+		FI_WARN(&rstream_prov, FI_LOG_EP_CTRL,
+			"send and receive buffers too large\n");
+		return -FI_EINVAL;
+	}
 
-	full_mr_size = full_mr_size + rx_meta_data_offset;
 	lmr->base_addr = malloc(full_mr_size);
+	if (!lmr->base_addr)
+		return -FI_ENOMEM;
 
-	ret = fi_mr_reg(domain, lmr->base_addr, full_mr_size,
+	ret = fi_mr_reg(domain->msg_domain, lmr->base_addr, full_mr_size,
 		FI_READ | FI_WRITE | FI_REMOTE_READ | FI_REMOTE_WRITE,
-		0, 0, 0, &lmr->mr, NULL);
+		0, rstream_get_mr_key(domain), 0, &lmr->mr, NULL);
 	if (ret)
 		return ret;
 
@@ -117,6 +144,21 @@ static int rstream_reg_mrs(struct fid_domain *domain,
 	return ret;
 }
 
+#ifdef HAVE_EPOLL
+static int rstream_epoll_add_cq(struct rstream_ep *rep, struct fid_cq *cq)
+{
+	int fd, ret;
+
+	ret = fi_control(&cq->fid, FI_GETWAIT, &fd);
+	if (ret)
+		return ret;
+
+	return fi_epoll_add(rep->epoll_fd, fd, FI_EPOLL_IN, cq);
+}
+#endif
+
+/* separate CQs let the send and recv paths progress independently, both
+ * have a wait object: tx completions free credits as peer updates do */
 static int rstream_cq_init(struct fid_domain *domain, struct rstream_ep *rep)
 {
 	int ret;
@@ -125,13 +167,37 @@ static int rstream_cq_init(struct fid_domain *domain, struct rstream_ep *rep)
 	memset(&attr, 0, sizeof(attr));
 	attr.format = FI_CQ_FORMAT_DATA;
 	attr.wait_obj = FI_WAIT_FD;
-	attr.size = rep->qp_win.max_rx_credits + rep->qp_win.max_tx_credits;
+	attr.size = rep->qp_win.max_tx_credits;
+
+	ret = fi_cq_open(domain, &attr, &rep->tx_cq, NULL);
+	if (ret)
+		return ret;
+
+	attr.size = rep->qp_win.max_rx_credits;
+
+	ret = fi_cq_open(domain, &attr, &rep->rx_cq, NULL);
+	if (ret)
+		return ret;
+
+#ifdef HAVE_EPOLL
+	ret = fi_epoll_create(&rep->epoll_fd);
+	if (ret)
+		return ret;
 
-	ret = fi_cq_open(domain, &attr, &rep->cq, NULL);
+	ret = rstream_epoll_add_cq(rep, rep->tx_cq);
 	if (ret)
 		return ret;
 
-	ret = fi_ep_bind(rep->ep_fd, &rep->cq->fid, FI_TRANSMIT | FI_RECV);
+	ret = rstream_epoll_add_cq(rep, rep->rx_cq);
+	if (ret)
+		return ret;
+#endif
+
+	ret = fi_ep_bind(rep->ep_fd, &rep->tx_cq->fid, FI_TRANSMIT);
+	if (ret)
+		return ret;
+
+	ret = fi_ep_bind(rep->ep_fd, &rep->rx_cq->fid, FI_RECV);
 	if (ret)
 		return ret;
 
@@ -149,19 +215,24 @@ static int rstream_ep_ctrl(struct fid *fid, int command, void *arg)
 
 	switch (command) {
 	case FI_ENABLE:
-		ret = rstream_reg_mrs(rstream_ep->msg_domain,
+		ret = rstream_reg_mrs(rstream_ep->domain,
 			&rstream_ep->local_mr);
 		if (ret)
 			goto err1;
+		while ((rstream_ep->local_mr.rx.size >>
+			rstream_ep->rx_len_shift) >= RSTREAM_MR_MAX)
+			rstream_ep->rx_len_shift++;
 		ret = rstream_cq_init(rstream_ep->msg_domain, rstream_ep);
 		if (ret)
 			goto err1;
 		ret = fi_enable(rstream_ep->ep_fd);
 		break;
 	case FI_GETWAIT:
-		ret = fi_control(&rstream_ep->cq->fid, FI_GETWAIT, arg);
-		if (ret)
-			return ret;
+#ifdef HAVE_EPOLL
+		*(int *) arg = rstream_ep->epoll_fd;
+#else
+		ret = -FI_ENOSYS;
+#endif
 		break;
 	default:
 		return -FI_ENOSYS;
@@ -196,11 +267,15 @@ static int rstream_ep_setopt(fid_t fid, int level, int optname,
 		return -FI_ENOPROTOOPT;
 
 	if (optname == FI_OPT_SEND_BUF_SIZE) {
-		if(sizeof(rstream_ep->local_mr.tx.size) != optlen)
+		if(sizeof(rstream_ep->local_mr.tx.size) != optlen ||
+			!*((uint32_t *)optval) ||
+			*((uint32_t *)optval) > RSTREAM_MAX_MR_SEG_SIZE)
 			return -FI_EINVAL;
 		rstream_ep->local_mr.tx.size = *((uint32_t *)optval);
 	} else if (optname == FI_OPT_RECV_BUF_SIZE) {
-		if(sizeof(rstream_ep->local_mr.rx.size) != optlen)
+		if(sizeof(rstream_ep->local_mr.rx.size) != optlen ||
+			!*((uint32_t *)optval) ||
+			*((uint32_t *)optval) > RSTREAM_MAX_MR_SEG_SIZE)
 			return -FI_EINVAL;
 		rstream_ep->local_mr.rx.size = *((uint32_t *)optval);
 	} else if (optname == FI_OPT_TX_SIZE) {
@@ -267,8 +342,11 @@ int rstream_ep_open(struct fid_domain *domain, struct fi_info *info,
 		free(rstream_pep);
 
 	rstream_ep->msg_domain = rstream_domain->msg_domain;
-	rstream_ep->local_mr.tx.size = RSTREAM_DEFAULT_MR_SEG_SIZE;
-	rstream_ep->local_mr.rx.size = RSTREAM_DEFAULT_MR_SEG_SIZE;
+	rstream_ep->domain = rstream_domain;
+	rstream_ep->local_mr.tx.size = rstream_tx_buf_size;
+	rstream_ep->local_mr.rx.size = rstream_rx_buf_size;
+	rstream_ep->read_threshold = RSTREAM_USING_IWARP ? 0 :
+		rstream_read_threshold;
 
 	rstream_ep->qp_win.max_tx_credits = rstream_info.tx_attr->size;
 	rstream_ep->qp_win.ctrl_credits = RSTREAM_MAX_CTRL;
@@ -284,6 +362,16 @@ int rstream_ep_open(struct fid_domain *domain, struct fi_info *info,
 		sizeof(*rstream_ep->rx_ctxs));
 	assert(rstream_ep->rx_ctxs);
 
+	/* every write holds a tx ctx, announced data is bounded the same */
+	rstream_ep->tx_chunks =
+		rstream_tx_chunkq_create(2 * rstream_ep->qp_win.max_tx_credits);
+	assert(rstream_ep->tx_chunks);
+	dlist_init(&rstream_ep->rx_segs);
+	ofi_atomic_initialize32(&rstream_ep->peer_update.credits, 0);
+	ofi_atomic_initialize32(&rstream_ep->peer_update.mr_len, 0);
+	ofi_atomic_initialize32(&rstream_ep->peer_update.read_len, 0);
+	ofi_atomic_initialize32(&rstream_ep->send_lock_waiters, 0);
+
 	*ep_fid = &rstream_ep->util_ep.ep_fid;
 	(*ep_fid)->fid.ops = &rstream_ep_fi_ops;
 	(*ep_fid)->ops = &rstream_ops_ep;
@@ -291,7 +379,11 @@ int rstream_ep_open(struct fid_domain *domain, struct fi_info *info,
 	(*ep_fid)->msg = &rstream_ops_msg;
 	fastlock_init(&rstream_ep->send_lock);
 	fastlock_init(&rstream_ep->recv_lock);
-	fastlock_init(&rstream_ep->cq_lock);
+	pthread_mutex_init(&rstream_ep->handoff_lock, NULL);
+	pthread_cond_init(&rstream_ep->handoff_cond, NULL);
+#ifdef HAVE_EPOLL
+	rstream_ep->epoll_fd = -1;
+#endif
 	return 0;
 
 err1:
@@ -405,7 +497,7 @@ void rstream_process_cm_event(struct rstream_ep *ep, void *cm_data)
 	int i;
 	struct rstream_cm_data *rcv_data = (struct rstream_cm_data *)cm_data;
 
-	assert(rcv_data->version == RSTREAM_RSOCKETV2);
+	assert(rcv_data->version == RSTREAM_RSOCKETV3);
 
 	ep->qp_win.target_rx_credits = ntohs(rcv_data->max_rx_credits);
 	ep->qp_win.max_target_rx_credits = ep->qp_win.target_rx_credits;
@@ -413,6 +505,11 @@ void rstream_process_cm_event(struct rstream_ep *ep, void *cm_data)
 	ep->remote_data.mr.data_start = (void *)ntohll(rcv_data->base_addr);
 	ep->remote_data.mr.size = ntohl(rcv_data->rmr_size);
 	ep->remote_data.mr.avail_size = ep->remote_data.mr.size;
+	ep->remote_data.len_shift = rcv_data->len_shift;
+	ep->remote_data.tx_base_addr = ntohll(rcv_data->tx_base_addr);
+	ep->remote_data.tx_size = ntohl(rcv_data->tx_size);
+	ep->remote_data.read = (rcv_data->flags & RSTREAM_CM_READ) &&
+		ep->read_threshold;
 
 	for(i = 0; i < ep->qp_win.max_rx_credits; i++) {
 		rstream_post_cq_data_recv(ep, NULL);
@@ -62,10 +62,10 @@ int rstream_trywait(struct fid_fabric *fabric, struct fid **fids, int count)
 	int ret;
 	struct rstream_ep *rstream_ep;
 	struct rstream_fabric *rstream_fabric;
-	int num_fids = 1;
+	int num_fids = 2;
 	struct fid *rstream_fids[num_fids];
 
-	if (count != num_fids)
+	if (count != 1)
 		return -FI_ENOSYS;
 
 	if (fids[0]->fclass == FI_CLASS_EP) {
@@ -73,7 +73,8 @@ int rstream_trywait(struct fid_fabric *fabric, struct fid **fids, int count)
 			util_ep.ep_fid.fid);
 		rstream_fabric = container_of(fabric, struct rstream_fabric,
 			util_fabric.fabric_fid);
-		rstream_fids[0] = &rstream_ep->cq->fid;
+		rstream_fids[0] = &rstream_ep->tx_cq->fid;
+		rstream_fids[1] = &rstream_ep->rx_cq->fid;
 		ret = fi_trywait(rstream_fabric->msg_fabric, rstream_fids,
 			num_fids);
 		return ret;
@@ -175,7 +175,39 @@ struct util_prov rstream_util_prov = {
 	.flags = 0,
 };
 
+size_t rstream_tx_buf_size = RSTREAM_DEFAULT_MR_SEG_SIZE;
+size_t rstream_rx_buf_size = RSTREAM_DEFAULT_MR_SEG_SIZE;
+size_t rstream_read_threshold = RSTREAM_DEFAULT_READ_THRESHOLD;
+
+static void rstream_get_buf_size(const char *name, size_t *size)
+{
+	fi_param_get_size_t(&rstream_prov, name, size);
+	if (!*size || *size > RSTREAM_MAX_MR_SEG_SIZE) {
+		FI_WARN(&rstream_prov, FI_LOG_CORE,
+			"invalid %s (max %zu), using default (%d)\n", name,
+			(size_t) RSTREAM_MAX_MR_SEG_SIZE,
+			RSTREAM_DEFAULT_MR_SEG_SIZE);
+		*size = RSTREAM_DEFAULT_MR_SEG_SIZE;
+	}
+}
+
 RSTREAM_INI
 {
+	fi_param_define(&rstream_prov, "tx_buf_size", FI_PARAM_SIZE_T,
+			"Size of the registered send ring of an endpoint "
+			"(default: 32 KB, max: 1 GB)");
+	fi_param_define(&rstream_prov, "rx_buf_size", FI_PARAM_SIZE_T,
+			"Size of the registered receive ring of an endpoint "
+			"(default: 32 KB, max: 1 GB)");
+	fi_param_define(&rstream_prov, "read_threshold", FI_PARAM_SIZE_T,
+			"Sends of at least this size are left in the send "
+			"ring for the peer to RMA read directly into its "
+			"receive buffer. 0 disables reads (default: 64 KB)");
+
+	rstream_get_buf_size("tx_buf_size", &rstream_tx_buf_size);
+	rstream_get_buf_size("rx_buf_size", &rstream_rx_buf_size);
+	fi_param_get_size_t(&rstream_prov, "read_threshold",
+			    &rstream_read_threshold);
+
 	return &rstream_prov;
 }
@@ -35,22 +35,21 @@
 #include <sys/time.h>
 
 
-ssize_t rstream_process_cq(struct rstream_ep *ep, enum rstream_msg_type type);
-
-static uint32_t rstream_cq_data_get_len(uint32_t cq_data)
+static uint32_t rstream_cq_data_get_len(uint32_t cq_data, uint32_t len_shift)
 {
-	return (cq_data & RSTREAM_MR_LEN_MASK);
+	return (cq_data & RSTREAM_MR_LEN_MASK) << len_shift;
 }
 
-static uint32_t rstream_cq_data_set(struct rstream_cq_data cq_data)
+static uint32_t rstream_cq_data_set(struct rstream_cq_data cq_data,
+	uint32_t len_shift)
 {
 	uint32_t credits = cq_data.num_completions;
 
 	assert(cq_data.num_completions < RSTREAM_CREDITS_MAX);
-	assert(cq_data.total_len < RSTREAM_MR_MAX);
+	assert((cq_data.total_len >> len_shift) < RSTREAM_MR_MAX);
 
 	credits = credits << RSTREAM_CREDIT_OFFSET;
-	return credits | cq_data.total_len;
+	return credits | (cq_data.total_len >> len_shift);
 }
 
 static uint16_t rstream_cq_data_get_credits(uint32_t cq_data)
@@ -63,6 +62,18 @@ static uint16_t rstream_cq_data_get_credits(uint32_t cq_data)
 	return credits;
 }
 
+static uint32_t rstream_cq_data_set_read(uint32_t type, uint32_t len)
+{
+	assert(len && len < RSTREAM_READ_LEN_MAX);
+
+	return type | len;
+}
+
+static uint32_t rstream_cq_data_get_read_len(uint32_t cq_data)
+{
+	return cq_data & RSTREAM_READ_LEN_MASK;
+}
+
 static uint32_t rstream_iwarp_cq_data_is_msg(uint32_t cq_data) {
 	return cq_data & RSTREAM_IWARP_MSG_BIT;
 }
@@ -115,7 +126,8 @@ static struct fi_context *rstream_get_rx_ctx(struct rstream_ep *ep)
 	return ctx;
 }
 
-static struct fi_context *rstream_get_tx_ctx(struct rstream_ep *ep, int len)
+static struct rstream_ctx_data *rstream_get_tx_ctx(struct rstream_ep *ep,
+	int len, enum rstream_msg_type type)
 {
 	struct rstream_tx_ctx_fs *fs = ep->tx_ctxs;
 	struct rstream_ctx_data *rtn_ctx = freestack_pop(fs);
@@ -124,20 +136,17 @@ static struct fi_context *rstream_get_tx_ctx(struct rstream_ep *ep, int len)
 		return NULL;
 
 	rtn_ctx->len = len;
-	return &rtn_ctx->ctx;
+	rtn_ctx->type = type;
+	rtn_ctx->done = 0;
+	return rtn_ctx;
 }
 
-static int rstream_return_tx_ctx(struct fi_context *ctx_ptr,
+static void rstream_return_tx_ctx(struct rstream_ctx_data *ctx_data,
 	struct rstream_ep *ep)
 {
-	int len;
 	struct rstream_tx_ctx_fs *fs = ep->tx_ctxs;
 
-	struct rstream_ctx_data *ctx_data = (struct rstream_ctx_data *)ctx_ptr;
-	len = ctx_data->len;
 	freestack_push(fs, ctx_data);
-
-	return len;
 }
 
 static ssize_t rstream_inject(struct fid_ep *ep_fid, const void *buf, size_t len,
@@ -146,23 +155,20 @@ static ssize_t rstream_inject(struct fid_ep *ep_fid, const void *buf, size_t len
 	return -FI_ENOSYS;
 }
 
-static ssize_t rstream_print_cq_error(struct fid_cq *cq)
+static ssize_t rstream_read_cq_error(struct fid_cq *cq,
+	struct fi_cq_err_entry *cq_entry)
 {
 	ssize_t ret;
-	struct fi_cq_err_entry cq_entry = {0};
-	const char *errmsg;
 
-	ret = fi_cq_readerr(cq, &cq_entry, 0);
-	if (cq_entry.err == FI_ENOMSG) {
-		ret = FI_ENOMSG;
+	ret = fi_cq_readerr(cq, cq_entry, 0);
+	if (ret < 0)
 		return ret;
-	}
 
-	errmsg = fi_cq_strerror(cq, cq_entry.prov_errno,
-		cq_entry.err_data, NULL, 0);
-	fprintf(stderr, "CQ error msg: %s\n", errmsg);
+	FI_WARN(&rstream_prov, FI_LOG_CQ, "CQ error msg: %s\n",
+		fi_cq_strerror(cq, cq_entry->prov_errno,
+		cq_entry->err_data, NULL, 0));
 
-	return ret;
+	return cq_entry->err ? -cq_entry->err : -FI_EIO;
 }
 
 static void rstream_update_tx_credits(struct rstream_ep *ep,
@@ -210,6 +216,11 @@ static int rstream_target_rx_full(struct rstream_ep *ep)
 	return ((ep->qp_win.target_rx_credits - RSTREAM_MAX_CTRL) == 0);
 }
 
+static int rstream_rx_data_avail(struct rstream_ep *ep)
+{
+	return ep->local_mr.rx.avail_size || !dlist_empty(&ep->rx_segs);
+}
+
 static uint32_t rstream_calc_contig_len(struct rstream_mr_seg *mr)
 {
 	if (!mr->avail_size) {
@@ -243,6 +254,14 @@ static uint32_t rstream_alloc_contig_len_available(struct rstream_mr_seg *mr,
 	return len;
 }
 
+/* undo the last allocation if it couldn't be posted */
+static void rstream_unalloc_contig_len(struct rstream_mr_seg *mr,
+	char *data_addr, uint32_t len)
+{
+	mr->start_offset = data_addr - (char *)mr->data_start;
+	mr->avail_size = mr->avail_size + len;
+}
+
 static void rstream_free_contig_len(struct rstream_mr_seg *mr, uint32_t len)
 {
 	assert((mr->avail_size + len) <= mr->size);
@@ -250,10 +269,97 @@ static void rstream_free_contig_len(struct rstream_mr_seg *mr, uint32_t len)
 	mr->end_offset = (mr->end_offset + len) % mr->size;
 }
 
+static size_t rstream_alloc_tx_chunk(struct rstream_ep *ep, uint32_t len,
+	int read)
+{
+	struct rstream_tx_chunk *chunk;
+
+	assert(!ofi_cirque_isfull(ep->tx_chunks));
+	chunk = ofi_cirque_tail(ep->tx_chunks);
+	chunk->len = len;
+	chunk->done = 0;
+	chunk->read = read;
+	ofi_cirque_commit(ep->tx_chunks);
+
+	return ep->tx_chunks->wcnt - 1;
+}
+
+static struct rstream_tx_chunk *rstream_get_tx_chunk(struct rstream_ep *ep,
+	size_t index)
+{
+	return &ep->tx_chunks->buf[index & ep->tx_chunks->size_mask];
+}
+
+/* tx ring space can only be returned in the order it was handed out */
+static void rstream_release_tx_chunks(struct rstream_ep *ep)
+{
+	struct rstream_tx_chunk *chunk;
+
+	while (!ofi_cirque_isempty(ep->tx_chunks)) {
+		chunk = ofi_cirque_head(ep->tx_chunks);
+		if (chunk->done != chunk->len)
+			break;
+		rstream_free_contig_len(&ep->local_mr.tx, chunk->len);
+		ofi_cirque_discard(ep->tx_chunks);
+	}
+}
+
+/* the peer reads announced chunks in stream order */
+static void rstream_ack_read_chunks(struct rstream_ep *ep, uint32_t len)
+{
+	struct rstream_tx_chunk *chunk;
+	uint32_t acked;
+
+	ep->tx_read_ack = MAX(ep->tx_read_ack, ep->tx_chunks->rcnt);
+	while (len) {
+		assert(ep->tx_read_ack != ep->tx_chunks->wcnt);
+		chunk = rstream_get_tx_chunk(ep, ep->tx_read_ack);
+		if (!chunk->read) {
+			ep->tx_read_ack++;
+			continue;
+		}
+
+		acked = MIN(len, chunk->len - chunk->done);
+		chunk->done += acked;
+		len -= acked;
+		if (chunk->done == chunk->len)
+			ep->tx_read_ack++;
+	}
+
+	rstream_release_tx_chunks(ep);
+}
+
+/* fold in the ctrl msgs that rx progress has seen, needs send_lock */
+static void rstream_apply_peer_update(struct rstream_ep *ep)
+{
+	int32_t val;
+
+	val = ofi_atomic_get32(&ep->peer_update.credits);
+	if (val) {
+		ofi_atomic_sub32(&ep->peer_update.credits, val);
+		ep->qp_win.target_rx_credits += val;
+		assert(ep->qp_win.target_rx_credits <=
+			ep->qp_win.max_target_rx_credits);
+	}
+
+	val = ofi_atomic_get32(&ep->peer_update.mr_len);
+	if (val) {
+		ofi_atomic_sub32(&ep->peer_update.mr_len, val);
+		rstream_free_contig_len(&ep->remote_data.mr, val);
+	}
+
+	val = ofi_atomic_get32(&ep->peer_update.read_len);
+	if (val) {
+		ofi_atomic_sub32(&ep->peer_update.read_len, val);
+		rstream_ack_read_chunks(ep, val);
+	}
+}
+
 static ssize_t rstream_send_ctrl_msg(struct rstream_ep *ep, uint32_t cq_data)
 {
 	ssize_t ret = 0;
 	struct fi_msg msg;
+	struct rstream_ctx_data *ctx;
 
 	if (!ep->qp_win.ctrl_credits || (ep->qp_win.target_rx_credits == 0)) {
 		ret = -FI_EAGAIN;
@@ -265,15 +371,18 @@ static ssize_t rstream_send_ctrl_msg(struct rstream_ep *ep, uint32_t cq_data)
 		if (ret != 0)
 			goto out;
 	} else {
+		ctx = rstream_get_tx_ctx(ep, 0, RSTREAM_CTRL_MSG);
 		msg.msg_iov = NULL;
 		msg.desc = NULL;
 		msg.iov_count = 0;
-		msg.context = rstream_get_tx_ctx(ep, 0);
+		msg.context = ctx;
 		msg.data = cq_data;
 
 		ret = fi_sendmsg(ep->ep_fd, &msg, FI_REMOTE_CQ_DATA);
-		if (ret != 0)
+		if (ret != 0) {
+			rstream_return_tx_ctx(ctx, ep);
 			goto out;
+		}
 
 		if (ep->qp_win.tx_credits > 0)
 			ep->qp_win.tx_credits--;
@@ -288,57 +397,152 @@ out:
 	return ret;
 }
 
-/* accumulate data in tx_cq exhaustion case */
+/* accumulate data in tx_cq exhaustion case, called with both locks held */
 static ssize_t rstream_update_target(struct rstream_ep *ep,
 	uint16_t num_completions, uint32_t len)
 {
-	uint32_t cq_data;
+	struct rstream_cq_data cq_data = {0};
+	uint32_t read_len;
 	ssize_t ret = 0;
 
 	ep->rx_cq_data.num_completions =
 		ep->rx_cq_data.num_completions + num_completions;
 	ep->rx_cq_data.total_len = ep->rx_cq_data.total_len + len;
 
+	/* announced data is held in the peer's tx ring until acked */
+	if (ep->rx_cq_data.read_len) {
+		read_len = MIN(ep->rx_cq_data.read_len, RSTREAM_READ_LEN_MASK);
+		ret = rstream_send_ctrl_msg(ep,
+			rstream_cq_data_set_read(RSTREAM_CTRL_READ_DONE,
+			read_len));
+		if (ret)
+			return ret;
+		ep->rx_cq_data.read_len -= read_len;
+	}
+
 	if ((ep->rx_cq_data.num_completions >= ep->qp_win.max_rx_credits / 2) ||
 		(ep->rx_cq_data.total_len >= ep->local_mr.rx.size / 2)) {
 
-		cq_data = rstream_cq_data_set(ep->rx_cq_data);
+		cq_data.num_completions = MIN(ep->rx_cq_data.num_completions,
+			RSTREAM_CREDITS_MAX - 1);
+		cq_data.total_len = (ep->rx_cq_data.total_len >>
+			ep->rx_len_shift) << ep->rx_len_shift;
+		if (!cq_data.num_completions && !cq_data.total_len)
+			return ret;
 
-		ret = rstream_send_ctrl_msg(ep, cq_data);
+		ret = rstream_send_ctrl_msg(ep,
+			rstream_cq_data_set(cq_data, ep->rx_len_shift));
 		if (ret == 0) {
 			FI_DBG(&rstream_prov, FI_LOG_EP_CTRL,
 				"ctrl msg update %u = completions %u = len \n",
-				ep->rx_cq_data.num_completions,
-				ep->rx_cq_data.total_len);
-			ep->rx_cq_data.num_completions = 0;
-			ep->rx_cq_data.total_len = 0;
+				cq_data.num_completions,
+				cq_data.total_len);
+			ep->rx_cq_data.num_completions -=
+				cq_data.num_completions;
+			ep->rx_cq_data.total_len -= cq_data.total_len;
 		}
 	}
 
 	return ret;
 }
 
-ssize_t rstream_process_rx_cq_data(struct rstream_ep *ep,
+static int rstream_queue_rx_seg(struct rstream_ep *ep, int remote,
+	uint64_t offset, uint32_t len)
+{
+	struct rstream_rx_seg *seg;
+
+	if (!dlist_empty(&ep->rx_segs)) {
+		seg = container_of(ep->rx_segs.prev, struct rstream_rx_seg,
+			entry);
+		if (seg->remote == remote &&
+			(!remote || seg->offset + seg->len == offset)) {
+			seg->len += len;
+			return 0;
+		}
+	}
+
+	seg = calloc(1, sizeof(*seg));
+	if (!seg)
+		return -FI_ENOMEM;
+
+	seg->remote = remote;
+	seg->offset = offset;
+	seg->len = len;
+	dlist_insert_tail(&seg->entry, &ep->rx_segs);
+	return 0;
+}
+
+static void rstream_advance_peer_tx(struct rstream_ep *ep, uint32_t len)
+{
+	if (ep->remote_data.tx_size)
+		ep->remote_data.tx_offset = (ep->remote_data.tx_offset + len) %
+			ep->remote_data.tx_size;
+}
+
+/* data placed by the peer in the rx ring */
+static int rstream_process_rx_data(struct rstream_ep *ep, uint32_t len)
+{
+	int ret = 0;
+
+	if (!dlist_empty(&ep->rx_segs))
+		ret = rstream_queue_rx_seg(ep, 0, 0, len);
+
+	rstream_free_contig_len(&ep->local_mr.rx, len);
+	rstream_advance_peer_tx(ep, len);
+	return ret;
+}
+
+/* data left by the peer in its tx ring, to be read in stream order */
+static int rstream_process_read_req(struct rstream_ep *ep, uint32_t len)
+{
+	int ret;
+
+	if (dlist_empty(&ep->rx_segs) && ep->local_mr.rx.avail_size) {
+		ret = rstream_queue_rx_seg(ep, 0, 0,
+			ep->local_mr.rx.avail_size);
+		if (ret)
+			return ret;
+	}
+
+	ret = rstream_queue_rx_seg(ep, 1, ep->remote_data.tx_offset, len);
+	if (ret)
+		return ret;
+
+	rstream_advance_peer_tx(ep, len);
+	return 0;
+}
+
+static ssize_t rstream_process_rx_cq_data(struct rstream_ep *ep,
 	const struct fi_cq_data_entry *cq_entry)
 {
+	uint32_t cq_data = cq_entry->data;
 	uint16_t recvd_credits;
 	uint32_t recvd_len;
+	int ret = 0;
+
+	if (!cq_data) {
+		ret = rstream_process_rx_data(ep, cq_entry->len);
+	} else if ((cq_data & RSTREAM_CTRL_TYPE_MASK) ==
+		RSTREAM_CTRL_READ_REQ) {
+		ret = rstream_process_read_req(ep,
+			rstream_cq_data_get_read_len(cq_data));
+	} else if ((cq_data & RSTREAM_CTRL_TYPE_MASK) ==
+		RSTREAM_CTRL_READ_DONE) {
+		ofi_atomic_add32(&ep->peer_update.read_len,
+			rstream_cq_data_get_read_len(cq_data));
+	} else {
+		recvd_credits = rstream_cq_data_get_credits(cq_data);
+		recvd_len = rstream_cq_data_get_len(cq_data,
+			ep->remote_data.len_shift);
 
-	if (cq_entry->data != 0) {
-		recvd_credits = rstream_cq_data_get_credits(cq_entry->data);
-		recvd_len = rstream_cq_data_get_len(cq_entry->data);
-
-		ep->qp_win.target_rx_credits += recvd_credits;
-		assert(ep->qp_win.target_rx_credits <=
-			ep->qp_win.max_target_rx_credits);
-
-		rstream_free_contig_len(&ep->remote_data.mr, recvd_len);
+		ofi_atomic_add32(&ep->peer_update.credits, recvd_credits);
+		ofi_atomic_add32(&ep->peer_update.mr_len, recvd_len);
 		FI_DBG(&rstream_prov, FI_LOG_EP_CTRL,
 			"recvd: ctrl msg %u = completions %u = len \n",
 			recvd_credits, recvd_len);
-	} else {
-		rstream_free_contig_len(&ep->local_mr.rx, cq_entry->len);
 	}
+	if (ret)
+		return ret;
 
 	return rstream_post_cq_data_recv(ep, cq_entry);
 }
@@ -360,102 +564,175 @@ static void format_iwarp_cq_data(struct rstream_ep *ep,
 	}
 }
 
-static enum rstream_msg_type rstream_cqe_msg_type(struct rstream_ep *ep,
-	struct fi_cq_data_entry *cq_entry)
+/* peer writes and ctrl msgs, called with recv_lock held */
+static ssize_t rstream_progress_rx(struct rstream_ep *ep)
 {
-	enum rstream_msg_type type = RSTREAM_MSG_UNKNOWN;
+	struct fi_cq_data_entry cq_entry;
+	struct fi_cq_err_entry err_entry = {0};
+	ssize_t ret, count = 0;
+
+	while (count < ep->qp_win.max_rx_credits) {
+		ret = fi_cq_read(ep->rx_cq, &cq_entry, 1);
+		if (ret == -FI_EAGAIN)
+			break;
+		if (ret == -FI_EAVAIL)
+			return rstream_read_cq_error(ep->rx_cq, &err_entry);
+		if (ret < 0)
+			return ret;
 
-	if (cq_entry->flags & FI_REMOTE_WRITE || cq_entry->flags & FI_RECV ||
-		cq_entry->flags & FI_REMOTE_CQ_DATA) {
 		if (RSTREAM_USING_IWARP)
-			format_iwarp_cq_data(ep, cq_entry);
+			format_iwarp_cq_data(ep, &cq_entry);
 
-		if (cq_entry->data) {
-			type = RSTREAM_CTRL_MSG;
-		} else {
-			type = RSTREAM_RX_MSG_COMP;
+		ret = rstream_process_rx_cq_data(ep, &cq_entry);
+		if (ret) {
+			FI_WARN(&rstream_prov, FI_LOG_EP_DATA,
+				"unable to process rx completion: %zd\n", ret);
+			return ret;
 		}
-	} else if (cq_entry->flags & FI_WRITE || cq_entry->flags & FI_SEND) {
-		type = RSTREAM_TX_MSG_COMP;
+		ep->rx_cq_data.num_completions++;
+		count++;
 	}
 
-	return type;
+	return count;
 }
 
-static ssize_t rstream_check_cq(struct rstream_ep *ep,
-	struct fi_cq_data_entry *completion_entry)
+static void rstream_process_tx_comp(struct rstream_ep *ep,
+	struct rstream_ctx_data *ctx_data, int err)
 {
-	const int max_num = 1;
-	ssize_t ret;
+	switch (ctx_data->type) {
+	case RSTREAM_READ_COMP:
+		/* returned by the reader */
+		ctx_data->done = err ? -err : 1;
+		break;
+	case RSTREAM_TX_MSG_COMP:
+		rstream_get_tx_chunk(ep, ctx_data->chunk)->done =
+			ctx_data->len;
+		rstream_release_tx_chunks(ep);
+		/* fall through */
+	default:
+		rstream_return_tx_ctx(ctx_data, ep);
+		break;
+	}
+	rstream_update_tx_credits(ep, 1);
+}
+
+/* local writes, reads and ctrl sends, called with send_lock held */
+static ssize_t rstream_progress_tx(struct rstream_ep *ep)
+{
+	struct fi_cq_data_entry cq_entry;
+	struct fi_cq_err_entry err_entry = {0};
+	ssize_t ret, count = 0;
 
-	ret = fi_cq_read(ep->cq, completion_entry, max_num);
-	if (ret < 0 && ret != -FI_EAGAIN) {
+	while (count < ep->qp_win.max_tx_credits) {
+		ret = fi_cq_read(ep->tx_cq, &cq_entry, 1);
+		if (ret == -FI_EAGAIN)
+			break;
 		if (ret == -FI_EAVAIL) {
-			ret = rstream_print_cq_error(ep->cq);
-			fprintf(stderr, "error from %s:%d\n", __FILE__, __LINE__);
-			return ret;
+			ret = rstream_read_cq_error(ep->tx_cq, &err_entry);
+			if (!err_entry.op_context ||
+				((struct rstream_ctx_data *)
+				err_entry.op_context)->type != RSTREAM_READ_COMP)
+				return ret;
+			rstream_process_tx_comp(ep, err_entry.op_context,
+				err_entry.err ? err_entry.err : FI_EIO);
+			continue;
 		}
+		if (ret < 0)
+			return ret;
+
+		rstream_process_tx_comp(ep, cq_entry.op_context, 0);
+		count++;
 	}
-	assert(ret == -FI_EAGAIN || ret == max_num);
 
-	return ret;
+	return count;
 }
 
-ssize_t rstream_process_cq(struct rstream_ep *ep, enum rstream_msg_type type)
+/* called with both locks held */
+static ssize_t rstream_progress_ep(struct rstream_ep *ep)
 {
-	struct fi_cq_data_entry cq_entry;
-	ssize_t ret, data_ret;
-	ssize_t found_msg_type = 0;
-	uint16_t rx_completions = 0;
-	struct rstream_timer timer = {.poll_time = 0};
-	enum rstream_msg_type comp_type;
-	int len;
+	ssize_t ret;
 
-	fastlock_acquire(&ep->cq_lock);
-	do {
-		ret = rstream_check_cq(ep, &cq_entry);
-		if (ret == 1) {
-			comp_type = rstream_cqe_msg_type(ep, &cq_entry);
-
-			if (comp_type == type)
-				found_msg_type++;
-
-			if (comp_type == RSTREAM_CTRL_MSG ||
-				comp_type == RSTREAM_RX_MSG_COMP) {
-				data_ret = rstream_process_rx_cq_data(ep, &cq_entry);
-				if (data_ret) {
-					fprintf(stderr, "error from %s:%d\n",
-						__FILE__, __LINE__);
-					ret = data_ret;
-					goto out;
-				}
-				rx_completions++;
-			} else if (comp_type == RSTREAM_TX_MSG_COMP) {
-				len = rstream_return_tx_ctx(cq_entry.op_context, ep);
-				rstream_update_tx_credits(ep, ret);
-				rstream_free_contig_len(&ep->local_mr.tx, len);
-			} else {
-				ret = -FI_ENOMSG;
-				goto out;
-			}
-		} else if (ret != -FI_EAGAIN) {
-			goto out;
-		}
-	} while ((ret == -FI_EAGAIN && !rstream_timer_completed(&timer) &&
-		!found_msg_type) || (found_msg_type && ret > 0));
+	ret = rstream_progress_rx(ep);
+	if (ret < 0)
+		return ret;
 
-	ret = rstream_update_target(ep, rx_completions, 0);
-	fastlock_release(&ep->cq_lock);
-	if (ret)
+	ret = rstream_update_target(ep, 0, 0);
+	return (ret == -FI_EAGAIN) ? 0 : ret;
+}
+
+/* the receive side needs send_lock to return credits, keep a sender that
+ * is waiting on them from starving it */
+static void rstream_rx_acquire_send_lock(struct rstream_ep *ep)
+{
+	ofi_atomic_inc32(&ep->send_lock_waiters);
+	fastlock_acquire(&ep->send_lock);
+	if (!ofi_atomic_dec32(&ep->send_lock_waiters)) {
+		pthread_mutex_lock(&ep->handoff_lock);
+		pthread_cond_broadcast(&ep->handoff_cond);
+		pthread_mutex_unlock(&ep->handoff_lock);
+	}
+}
+
+static void rstream_yield_send_lock(struct rstream_ep *ep)
+{
+	if (!ofi_atomic_get32(&ep->send_lock_waiters))
+		return;
+
+	fastlock_release(&ep->send_lock);
+	pthread_mutex_lock(&ep->handoff_lock);
+	while (ofi_atomic_get32(&ep->send_lock_waiters))
+		pthread_cond_wait(&ep->handoff_cond, &ep->handoff_lock);
+	pthread_mutex_unlock(&ep->handoff_lock);
+	fastlock_acquire(&ep->send_lock);
+}
+
+/* called with send_lock held, rx progress is left to a receiver if one is
+ * already making it */
+static ssize_t rstream_progress_send(struct rstream_ep *ep)
+{
+	ssize_t ret;
+
+	ret = rstream_progress_tx(ep);
+	if (ret < 0)
 		return ret;
 
-	if (found_msg_type)
-		return found_msg_type;
-	else
-		return -FI_EAGAIN;
-out:
-	fastlock_release(&ep->cq_lock);
-	return ret;
+	if (!fastlock_tryacquire(&ep->recv_lock)) {
+		ret = rstream_progress_ep(ep);
+		fastlock_release(&ep->recv_lock);
+		if (ret < 0)
+			return ret;
+	}
+
+	rstream_apply_peer_update(ep);
+	return 0;
+}
+
+static int rstream_tx_blocked(struct rstream_ep *ep, int read)
+{
+	return rstream_tx_mr_full(ep) || rstream_tx_full(ep) ||
+		rstream_target_rx_full(ep) ||
+		ofi_cirque_isfull(ep->tx_chunks) ||
+		(!read && rstream_target_mr_full(ep));
+}
+
+static ssize_t rstream_can_send(struct rstream_ep *ep, int read)
+{
+	struct rstream_timer timer = {.poll_time = 0};
+	ssize_t ret;
+
+	rstream_apply_peer_update(ep);
+	while (rstream_tx_blocked(ep, read)) {
+		if (rstream_timer_completed(&timer))
+			return -FI_EAGAIN;
+
+		ret = rstream_progress_send(ep);
+		if (ret < 0)
+			return ret;
+
+		rstream_yield_send_lock(ep);
+	}
+
+	return 0;
 }
 
 static uint32_t get_send_addrs_and_len(struct rstream_ep *ep, char **tx_addr,
@@ -477,24 +754,86 @@ static uint32_t get_send_addrs_and_len(struct rstream_ep *ep, char **tx_addr,
 	return available_len;
 }
 
-static ssize_t rstream_can_send(struct rstream_ep *ep)
+/* copy into the tx ring and write it to the peer's rx ring */
+static ssize_t rstream_write_data(struct rstream_ep *ep, const char *buf,
+	size_t len)
 {
+	struct rstream_ctx_data *ctx;
+	char *tx_addr = NULL;
+	char *remote_addr = NULL;
+	uint32_t curr_len;
 	ssize_t ret;
 
-	if (rstream_tx_mr_full(ep) || rstream_target_mr_full(ep) ||
-		rstream_target_rx_full(ep)) {
-		ret = rstream_process_cq(ep, RSTREAM_CTRL_MSG);
-		if (ret < 0)
-			return ret;
+	if (RSTREAM_USING_IWARP)
+		len = MIN(len, RSTREAM_IWARP_IMM_MSG_LEN - 1);
+
+	curr_len = get_send_addrs_and_len(ep, &tx_addr, &remote_addr,
+		MIN(len, UINT32_MAX));
+	if (curr_len == 0)
+		return 0;
+
+	memcpy(tx_addr, buf, curr_len);
+	ctx = rstream_get_tx_ctx(ep, curr_len, RSTREAM_TX_MSG_COMP);
+	ctx->chunk = rstream_alloc_tx_chunk(ep, curr_len, 0);
+
+	if (RSTREAM_USING_IWARP) {
+		ret = fi_write(ep->ep_fd, tx_addr, curr_len,
+			ep->local_mr.ldesc, 0, (uint64_t)remote_addr,
+			ep->remote_data.rkey, ctx);
+		if (!ret)
+			ret = rstream_send_ctrl_msg(ep,
+				rstream_iwarp_cq_data_set_msg_len(curr_len));
+	} else {
+		ret = fi_writedata(ep->ep_fd, tx_addr, curr_len,
+			ep->local_mr.ldesc, 0, 0, (uint64_t)remote_addr,
+			ep->remote_data.rkey, ctx);
+	}
+	if (ret != 0) {
+		FI_DBG(&rstream_prov, FI_LOG_EP_DATA,
+			"error: fi_write failed: %zd", ret);
+		if (!RSTREAM_USING_IWARP) {
+			ep->tx_chunks->wcnt--;
+			rstream_return_tx_ctx(ctx, ep);
+			rstream_unalloc_contig_len(&ep->local_mr.tx, tx_addr,
+				curr_len);
+			rstream_unalloc_contig_len(&ep->remote_data.mr,
+				remote_addr, curr_len);
+		}
+		return ret;
 	}
 
-	if (rstream_tx_full(ep)) {
-		ret = rstream_process_cq(ep, RSTREAM_TX_MSG_COMP);
-		if (ret < 0)
-			return ret;
+	if (!RSTREAM_USING_IWARP)
+		ep->qp_win.target_rx_credits--;
+
+	ep->qp_win.tx_credits--;
+	return curr_len;
+}
+
+/* copy into the tx ring and announce it, the peer reads it from there */
+static ssize_t rstream_send_read_req(struct rstream_ep *ep, const char *buf,
+	size_t len)
+{
+	char *tx_addr = NULL;
+	uint32_t curr_len;
+	ssize_t ret;
+
+	curr_len = rstream_alloc_contig_len_available(&ep->local_mr.tx,
+		&tx_addr, MIN(len, RSTREAM_READ_LEN_MASK));
+	if (curr_len == 0)
+		return 0;
+
+	memcpy(tx_addr, buf, curr_len);
+	rstream_alloc_tx_chunk(ep, curr_len, 1);
+
+	ret = rstream_send_ctrl_msg(ep,
+		rstream_cq_data_set_read(RSTREAM_CTRL_READ_REQ, curr_len));
+	if (ret) {
+		ep->tx_chunks->wcnt--;
+		rstream_unalloc_contig_len(&ep->local_mr.tx, tx_addr, curr_len);
+		return ret;
 	}
 
-	return 0;
+	return curr_len;
 }
 
 static ssize_t rstream_send(struct fid_ep *ep_fid, const void *buf, size_t len,
@@ -502,17 +841,14 @@ static ssize_t rstream_send(struct fid_ep *ep_fid, const void *buf, size_t len,
 {
 	struct rstream_ep *ep = container_of(ep_fid, struct rstream_ep,
 		util_ep.ep_fid);
-	uint32_t cq_data = 0;
 	ssize_t ret;
-	char *tx_addr = NULL;
-	char *remote_addr = NULL;
 	size_t sent_len = 0;
-	uint32_t curr_avail_len = len;
-	void *ctx;
+	int read;
 
 	fastlock_acquire(&ep->send_lock);
+	read = ep->remote_data.read && len >= ep->read_threshold;
 	do {
-		ret = rstream_can_send(ep);
+		ret = rstream_can_send(ep, read);
 		if (ret < 0) {
 			if (ret < 0 && ret != -FI_EAGAIN) {
 				goto err;
@@ -522,45 +858,25 @@ static ssize_t rstream_send(struct fid_ep *ep_fid, const void *buf, size_t len,
 			}
 		}
 
-		curr_avail_len = get_send_addrs_and_len(ep, &tx_addr,
-			&remote_addr, curr_avail_len);
-		if (curr_avail_len == 0)
-			break;
-
-		memcpy(tx_addr, ((char *)buf + sent_len), curr_avail_len);
-		sent_len = sent_len + curr_avail_len;
-		ctx = rstream_get_tx_ctx(ep, curr_avail_len);
-
-		if (RSTREAM_USING_IWARP) {
-			ret = fi_write(ep->ep_fd, tx_addr, curr_avail_len,
-				ep->local_mr.ldesc, 0, (uint64_t)remote_addr,
-				ep->remote_data.rkey, ctx);
-			ret = rstream_send_ctrl_msg(ep,
-				rstream_iwarp_cq_data_set_msg_len(curr_avail_len));
-		} else {
-			ret = fi_writedata(ep->ep_fd, tx_addr, curr_avail_len,
-				ep->local_mr.ldesc, cq_data, 0, (uint64_t)remote_addr,
-				ep->remote_data.rkey, ctx);
-		}
-		if (ret != 0) {
-			FI_DBG(&rstream_prov, FI_LOG_EP_DATA,
-				"error: fi_write failed: %zd", ret);
+		ret = read ? rstream_send_read_req(ep,
+			(const char *)buf + sent_len, len - sent_len) :
+			rstream_write_data(ep, (const char *)buf + sent_len,
+			len - sent_len);
+		if (ret < 0)
 			goto err;
-		}
-		curr_avail_len = len - sent_len;
-
-		if (!RSTREAM_USING_IWARP)
-			ep->qp_win.target_rx_credits--;
-
-		ep->qp_win.tx_credits--;
+		if (ret == 0)
+			break;
 
-	} while(curr_avail_len); /* circle buffer rollover requires two loops */
+		sent_len = sent_len + ret;
+	} while (sent_len < len); /* circle buffer rollover requires two loops */
 
 	fastlock_release(&ep->send_lock);
 	return sent_len;
 
 err:
 	fastlock_release(&ep->send_lock);
+	if (ret == -FI_EAGAIN && sent_len)
+		return sent_len;
 	return ret;
 }
 
@@ -579,7 +895,7 @@ static ssize_t rstream_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 
 	if (flags == FI_PEEK) {
 		fastlock_acquire(&ep->send_lock);
-		ret = rstream_can_send(ep);
+		ret = rstream_can_send(ep, 0);
 		fastlock_release(&ep->send_lock);
 		return ret;
 	} else {
@@ -641,31 +957,152 @@ static uint32_t rstream_copy_out_chunk(struct rstream_ep *ep, void *buf,
 	return current_chunk;
 }
 
+/* RMA read announced data from the peer's tx ring straight into the user
+ * buffer, called with recv_lock held */
+static ssize_t rstream_read_remote(struct rstream_ep *ep,
+	struct rstream_rx_seg *seg, void *buf, size_t len)
+{
+	struct rstream_ctx_data *ctx;
+	struct fid_mr *mr;
+	ssize_t ret, err;
+	int done;
+
+	len = MIN(len, seg->len);
+	ret = fi_mr_reg(ep->msg_domain, buf, len, FI_READ, 0,
+		rstream_get_mr_key(ep->domain), 0, &mr, NULL);
+	if (ret) {
+		FI_WARN(&rstream_prov, FI_LOG_EP_DATA,
+			"unable to register recv buffer: %zd\n", ret);
+		return ret;
+	}
+
+	rstream_rx_acquire_send_lock(ep);
+	while (rstream_tx_full(ep)) {
+		ret = rstream_progress_tx(ep);
+		if (ret < 0)
+			goto unlock;
+	}
+
+	ctx = rstream_get_tx_ctx(ep, len, RSTREAM_READ_COMP);
+	ret = fi_read(ep->ep_fd, buf, len, fi_mr_desc(mr), 0,
+		ep->remote_data.tx_base_addr + seg->offset,
+		ep->remote_data.rkey, ctx);
+	if (ret) {
+		rstream_return_tx_ctx(ctx, ep);
+		goto unlock;
+	}
+	ep->qp_win.tx_credits--;
+
+	/* let senders in while the read is in flight. The buffer can't be
+	 * deregistered before the read completes, so keep draining the CQ
+	 * even if progress fails: the read is then flushed with an error */
+	do {
+		err = rstream_progress_tx(ep);
+		if (err < 0 && !ret)
+			ret = err;
+		done = ctx->done;
+		fastlock_release(&ep->send_lock);
+		rstream_rx_acquire_send_lock(ep);
+	} while (!done);
+
+	rstream_return_tx_ctx(ctx, ep);
+	if (!ret && done < 0)
+		ret = done;
+unlock:
+	fastlock_release(&ep->send_lock);
+	fi_close(&mr->fid);
+	if (ret)
+		return ret;
+
+	seg->offset += len;
+	seg->len -= len;
+	ep->rx_cq_data.read_len += len;
+	return len;
+}
+
+/* copy out of the rx ring or read from the peer in stream order */
+static ssize_t rstream_recv_data(struct rstream_ep *ep, char *buf,
+	size_t len, uint32_t *ring_len)
+{
+	struct rstream_rx_seg *seg;
+	size_t copied = 0;
+	ssize_t ret;
+
+	while (copied < len) {
+		if (dlist_empty(&ep->rx_segs)) {
+			ret = rstream_copy_out_chunk(ep, buf + copied,
+				MIN(len - copied, UINT32_MAX));
+			if (!ret)
+				break;
+			*ring_len += ret;
+		} else {
+			seg = container_of(ep->rx_segs.next,
+				struct rstream_rx_seg, entry);
+			if (seg->remote) {
+				ret = rstream_read_remote(ep, seg,
+					buf + copied, len - copied);
+				if (ret < 0)
+					return copied ? copied : ret;
+			} else {
+				ret = rstream_copy_out_chunk(ep, buf + copied,
+					MIN(len - copied, seg->len));
+				*ring_len += ret;
+				seg->len -= ret;
+			}
+
+			if (!seg->len) {
+				dlist_remove(&seg->entry);
+				free(seg);
+			}
+		}
+		copied += ret;
+	}
+
+	return copied;
+}
+
+static ssize_t rstream_poll_rx(struct rstream_ep *ep)
+{
+	struct rstream_timer timer = {.poll_time = 0};
+	ssize_t ret;
+
+	do {
+		ret = rstream_progress_rx(ep);
+	} while (!ret && !rstream_timer_completed(&timer));
+
+	return ret ? ret : -FI_EAGAIN;
+}
+
 static ssize_t rstream_recv(struct fid_ep *ep_fid, void *buf, size_t len,
 	void *desc, fi_addr_t src_addr, void *context)
 {
 	struct rstream_ep *ep = container_of(ep_fid, struct rstream_ep,
 		util_ep.ep_fid);
-	uint32_t copy_out_len = 0;
+	uint32_t ring_len = 0;
+	ssize_t copy_out_len;
 	ssize_t ret;
 
 	fastlock_acquire(&ep->recv_lock);
 
-	copy_out_len = rstream_copy_out_chunk(ep, buf, len);
+	copy_out_len = rstream_recv_data(ep, buf, len, &ring_len);
 
-	if ((len - copy_out_len)) {
-		ret = rstream_process_cq(ep, RSTREAM_RX_MSG_COMP);
+	if (copy_out_len >= 0 && (len - copy_out_len)) {
+		ret = rstream_poll_rx(ep);
 		if(ret < 0 && ret != -FI_EAGAIN) {
 			fastlock_release(&ep->recv_lock);
-			return ret;
+			return copy_out_len ? copy_out_len : ret;
 		}
 
-		copy_out_len = copy_out_len + rstream_copy_out_chunk(ep,
-			((char *)buf + copy_out_len), (len - copy_out_len));
+		ret = rstream_recv_data(ep, (char *)buf + copy_out_len,
+			len - copy_out_len, &ring_len);
+		if (ret >= 0)
+			copy_out_len = copy_out_len + ret;
+		else if (!copy_out_len)
+			copy_out_len = ret;
 	}
 
-	fastlock_acquire(&ep->send_lock);
-	ret = rstream_update_target(ep, 0, copy_out_len);
+	rstream_rx_acquire_send_lock(ep);
+	ret = rstream_update_target(ep, 0, ring_len);
 	fastlock_release(&ep->send_lock);
 	fastlock_release(&ep->recv_lock);
 	if(ret < 0 && ret != -FI_EAGAIN) {
@@ -691,38 +1128,30 @@ static ssize_t rstream_recvv(struct fid_ep *ep_fid, const struct iovec *iov,
 static ssize_t rstream_recvmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	uint64_t flags)
 {
-	int ret;
+	ssize_t ret = 0;
 	struct rstream_ep *ep = container_of(ep_fid, struct rstream_ep,
 		util_ep.ep_fid);
 
 	if (flags == FI_PEEK) {
 		fastlock_acquire(&ep->recv_lock);
-		if (!ep->local_mr.rx.avail_size) {
-			ret = rstream_process_cq(ep, RSTREAM_RX_MSG_COMP);
+		if (!rstream_rx_data_avail(ep)) {
+			ret = rstream_poll_rx(ep);
 			if (ret < 0) {
 				fastlock_release(&ep->recv_lock);
 				return ret;
 			}
 		}
-		fastlock_release(&ep->recv_lock);
-
-		fastlock_acquire(&ep->send_lock);
-		if (rstream_target_rx_full(ep)) {
-			ret = rstream_process_cq(ep, RSTREAM_RX_MSG_COMP);
-			if (ret < 0) {
-				fastlock_release(&ep->send_lock);
-				return ret;
-			}
-		}
-
-		if (!ep->qp_win.ctrl_credits) {
-			ret = rstream_process_cq(ep, RSTREAM_TX_MSG_COMP);
-			fastlock_release(&ep->send_lock);
-			return ret;
-		}
 
+		rstream_rx_acquire_send_lock(ep);
+		rstream_apply_peer_update(ep);
+		if (!ep->qp_win.ctrl_credits)
+			ret = rstream_progress_tx(ep);
+		if (ret >= 0)
+			ret = rstream_update_target(ep, 0, 0);
 		fastlock_release(&ep->send_lock);
-		return 0;
+		fastlock_release(&ep->recv_lock);
+
+		return (ret == -FI_EAGAIN) ? 0 : ret;
 	} else {
 		return -FI_ENOSYS;
 	}
@@ -61,9 +61,15 @@
 
 #define RXD_MAJOR_VERSION 	(1)
 #define RXD_MINOR_VERSION 	(0)
-#define RXD_PROTOCOL_VERSION 	(2)
+#define RXD_PROTOCOL_VERSION 	(5)
 
-#define RXD_MAX_MTU_SIZE	4096
+/*
+ * Op packets are built before the peer's MTU is known and never exceed
+ * the base MTU.  Data segments use the MTU negotiated with the peer in
+ * the RTS/CTS handshake, up to the max MTU.
+ */
+#define RXD_BASE_MTU_SIZE	4096
+#define RXD_MAX_MTU_SIZE	65536
 
 #define RXD_MAX_TX_BITS 	10
 #define RXD_MAX_RX_BITS 	10
@@ -71,11 +77,31 @@
 #define RXD_BUF_POOL_ALIGNMENT	16
 #define RXD_TX_POOL_CHUNK_CNT	1024
 #define RXD_RX_POOL_CHUNK_CNT	1024
+#define RXD_MIN_BUF_CNT		64
+#define RXD_CQ_READ_CNT		16
 #define RXD_MAX_PENDING		128
 #define RXD_MAX_PKT_RETRY	50
+#define RXD_DUP_ACK_THRESH	3
+
+/* Retransmission timeout bounds, in usec */
+#define RXD_INIT_RTO		1000
+#define RXD_MIN_RTO		1000
+#define RXD_MAX_RTO		4000000
+
+/* Congestion window bounds, in packets */
+#define RXD_INIT_CWND		16
+#define RXD_MIN_CWND		2
+
+/* Retransmit timer wheel: 1ms ticks, 256 ticks per level 0 turn */
+#define RXD_TIMER_TICK		1000
+#define RXD_TIMER_L0_BITS	8
+#define RXD_TIMER_L0_SLOTS	(1 << RXD_TIMER_L0_BITS)
+#define RXD_TIMER_L1_SLOTS	64
 
 #define RXD_PKT_IN_USE		(1 << 0)
 #define RXD_PKT_ACKED		(1 << 1)
+#define RXD_PKT_RETRANS		(1 << 2)
+#define RXD_PKT_SACKED		(1 << 3)
 
 #define RXD_REMOTE_CQ_DATA	(1 << 0)
 #define RXD_NO_TX_COMP		(1 << 1)
@@ -84,12 +110,18 @@
 #define RXD_TAG_HDR		(1 << 4)
 #define RXD_INLINE		(1 << 5)
 #define RXD_MULTI_RECV		(1 << 6)
+#define RXD_ACK_REQ		(1 << 7)
+#define RXD_PIGGY_ACK		(1 << 8)
 
 struct rxd_env {
 	int spin_count;
 	int retry;
 	int max_peers;
 	int max_unacked;
+	int congestion_ctrl;
+	int ack_count;
+	size_t max_mtu;
+	int stats_interval;
 };
 
 extern struct rxd_env rxd_env;
@@ -112,6 +144,7 @@ struct rxd_domain {
 	struct fid_domain *dg_domain;
 
 	ssize_t max_mtu_sz;
+	ssize_t base_mtu_sz;
 	ssize_t max_inline_msg;
 	ssize_t max_inline_rma;
 	ssize_t max_inline_atom;
@@ -131,8 +164,36 @@ struct rxd_peer {
 	int retry_cnt;
 
 	uint16_t unacked_cnt;
+	uint16_t dup_ack_cnt;
 	uint8_t active;
 
+	/* negotiated in the RTS/CTS handshake */
+	ssize_t mtu_sz;
+	ssize_t max_seg_sz;
+
+	/* RTT estimation (usec) and AIMD congestion window (packets) */
+	uint64_t srtt;
+	uint64_t rttvar;
+	uint64_t rto;
+	uint16_t cwnd;
+	uint16_t cwnd_cnt;
+	uint16_t ssthresh;
+
+	uint64_t rtx_cnt;
+	uint64_t fast_rtx_cnt;
+	uint64_t timeout_cnt;
+
+	/* in-order packets received since the last (piggybacked) ACK */
+	uint16_t rx_ack_cnt;
+	struct dlist_entry ack_entry;
+	uint64_t ack_req_seq;
+	uint64_t rx_pkt_cnt;
+	uint64_t ack_cnt;
+	uint64_t piggy_ack_cnt;
+
+	struct dlist_entry timer_entry;
+	uint64_t timer_tick;
+
 	uint16_t curr_rx_id;
 	uint16_t curr_tx_id;
 
@@ -182,6 +243,21 @@ struct rxd_buf_pool {
 	struct rxd_ep *rxd_ep;
 };
 
+/*
+ * Hierarchical timer wheel of the peers that have unacked packets (or
+ * stalled sends), so that progress only visits peers that are due.
+ * Level 0 has a slot per tick, level 1 a slot per level 0 turn; level 1
+ * slots are cascaded into level 0 as the wheel turns.
+ */
+struct rxd_timer_wheel {
+	uint64_t cur_tick;
+	/* lower bound of the earliest deadline, in usec */
+	uint64_t next_expire;
+	size_t cnt;
+	struct dlist_entry l0[RXD_TIMER_L0_SLOTS];
+	struct dlist_entry l1[RXD_TIMER_L1_SLOTS];
+};
+
 struct rxd_ep {
 	struct util_ep util_ep;
 	struct fid_ep *dg_ep;
@@ -194,6 +270,8 @@ struct rxd_ep {
 	size_t min_multi_recv_size;
 	int do_local_mr;
 	int next_retry;
+	uint64_t next_stats;
+	int numa_node;
 	int dg_cq_fd;
 	uint32_t tx_flags;
 	uint32_t rx_flags;
@@ -217,6 +295,8 @@ struct rxd_ep {
 	struct dlist_entry active_peers;
 	struct dlist_entry rts_sent_list;
 	struct dlist_entry ctrl_pkts;
+	struct dlist_entry ack_peers;
+	struct rxd_timer_wheel timer_wheel;
 
 	struct rxd_peer peers[];
 };
@@ -342,8 +422,15 @@ static inline struct rxd_ext_hdr *rxd_get_ext_hdr(struct rxd_pkt_entry *pkt_entr
 
 static inline struct rxd_sar_hdr *rxd_get_sar_hdr(struct rxd_pkt_entry *pkt_entry)
 {
-	return (struct rxd_sar_hdr *) ((char *) pkt_entry->pkt +
-		sizeof(struct rxd_base_hdr));
+	struct rxd_base_hdr *base_hdr = rxd_get_base_hdr(pkt_entry);
+	char *ptr = (char *) base_hdr + sizeof(*base_hdr);
+
+	if (base_hdr->flags & RXD_TAG_HDR)
+		ptr += sizeof(struct rxd_tag_hdr);
+	if (base_hdr->flags & RXD_REMOTE_CQ_DATA)
+		ptr += sizeof(struct rxd_data_hdr);
+
+	return (struct rxd_sar_hdr *) ptr;
 }
 
 static inline void rxd_set_tx_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
@@ -426,6 +513,7 @@ int rxd_av_insert_dg_addr(struct rxd_av *av, const void *addr,
 /* Pkt resource functions */
 int rxd_ep_post_buf(struct rxd_ep *ep);
 void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer);
+void rxd_ep_delay_ack(struct rxd_ep *rxd_ep, fi_addr_t peer);
 struct rxd_pkt_entry *rxd_get_tx_pkt(struct rxd_ep *ep);
 struct rxd_x_entry *rxd_get_tx_entry(struct rxd_ep *ep, uint32_t op);
 struct rxd_x_entry *rxd_get_rx_entry(struct rxd_ep *ep, uint32_t op);
@@ -469,8 +557,47 @@ struct rxd_x_entry *rxd_rx_entry_init(struct rxd_ep *ep,
 			uint32_t op, uint32_t flags);
 void rxd_tx_entry_free(struct rxd_ep *ep, struct rxd_x_entry *tx_entry);
 void rxd_rx_entry_free(struct rxd_ep *ep, struct rxd_x_entry *rx_entry);
-int rxd_get_timeout(uint8_t retry_cnt);
-uint64_t rxd_get_retry_time(uint64_t start, uint8_t retry_cnt);
+int rxd_get_timeout(struct rxd_peer *peer);
+uint64_t rxd_get_retry_time(struct rxd_peer *peer, uint64_t start);
+void rxd_peer_update_rtt(struct rxd_peer *peer, uint64_t rtt);
+void rxd_peer_cwnd_inc(struct rxd_peer *peer, uint16_t acked);
+void rxd_peer_cwnd_loss(struct rxd_peer *peer, int timeout);
+void rxd_peer_timer_set(struct rxd_ep *ep, struct rxd_peer *peer,
+			uint64_t expire);
+
+/*
+ * Scale a number of packet buffers down with the MTU, so that large
+ * packets don't multiply the memory they take up.
+ */
+static inline size_t rxd_buf_cnt(struct rxd_ep *ep, size_t cnt)
+{
+	return MAX(MIN(cnt, cnt * RXD_BASE_MTU_SIZE /
+			    rxd_ep_domain(ep)->max_mtu_sz),
+		   MIN(cnt, RXD_MIN_BUF_CNT));
+}
+
+/* Keep the bytes in flight about the same with a large MTU */
+static inline uint16_t rxd_peer_max_window(struct rxd_peer *peer)
+{
+	return MAX(MIN(rxd_env.max_unacked, rxd_env.max_unacked *
+		       RXD_BASE_MTU_SIZE / peer->mtu_sz), RXD_MIN_CWND);
+}
+
+static inline uint16_t rxd_peer_tx_window(struct rxd_peer *peer)
+{
+	return MIN(peer->tx_window, peer->cwnd);
+}
+
+/* Ask for an immediate ACK when a packet fills the window, one at a time */
+static inline int rxd_peer_ack_req(struct rxd_peer *peer, uint64_t seq_no)
+{
+	if (peer->unacked_cnt + 1 < rxd_peer_tx_window(peer) ||
+	    ofi_after_eq(peer->ack_req_seq, peer->last_rx_ack))
+		return 0;
+
+	peer->ack_req_seq = seq_no;
+	return 1;
+}
 
 /* Generic message functions */
 ssize_t rxd_ep_generic_recvmsg(struct rxd_ep *rxd_ep, const struct iovec *iov,
@@ -503,6 +630,7 @@ void rxd_progress_op(struct rxd_ep *ep, struct rxd_x_entry *rx_entry,
 void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
 		      struct rxd_data_pkt *pkt, size_t size);
 void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer);
+void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer);
 struct rxd_x_entry *rxd_progress_multi_recv(struct rxd_ep *ep,
 					    struct rxd_x_entry *rx_entry,
 					    size_t total_size);
@@ -46,7 +46,7 @@ struct fi_tx_attr rxd_tx_attr = {
 	.op_flags = RXD_TX_OP_FLAGS,
 	.comp_order = FI_ORDER_NONE,
 	.msg_order = FI_ORDER_SAS,
-	.inject_size = RXD_MAX_MTU_SIZE - sizeof(struct rxd_base_hdr),
+	.inject_size = RXD_BASE_MTU_SIZE - sizeof(struct rxd_base_hdr),
 	.size = (1ULL << RXD_MAX_TX_BITS),
 	.iov_limit = RXD_IOV_LIMIT,
 	.rma_iov_limit = RXD_IOV_LIMIT,
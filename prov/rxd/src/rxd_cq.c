@@ -162,13 +162,12 @@ static int rxd_comp_pkt_seq_no(struct dlist_entry *item, const void *arg)
 	new_hdr = rxd_get_base_hdr(container_of((struct dlist_entry *) arg,
 				  struct rxd_pkt_entry, d_entry));
 
-	return new_hdr->seq_no > list_hdr->seq_no;
+	return ofi_before(new_hdr->seq_no, list_hdr->seq_no);
 }
 
 void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
 		      struct rxd_data_pkt *pkt, size_t size)
 {
-	struct rxd_domain *rxd_domain = rxd_ep_domain(ep);
 	uint64_t done;
 	struct iovec *iov;
 	size_t iov_count;
@@ -182,20 +181,21 @@ void rxd_ep_recv_data(struct rxd_ep *ep, struct rxd_x_entry *x_entry,
 	}
 
 	done = ofi_copy_to_iov(iov, iov_count, x_entry->offset +
-			       (pkt->ext_hdr.seg_no * rxd_domain->max_seg_sz),
+			       (pkt->ext_hdr.seg_no *
+				ep->peers[x_entry->peer].max_seg_sz),
 			       pkt->msg, size - sizeof(struct rxd_data_pkt) -
 			       ep->rx_prefix_size);
 
 	x_entry->bytes_done += done;
 	x_entry->next_seg_no++;
 
-	if (x_entry->next_seg_no < x_entry->num_segs) {
-		if (!(ep->peers[pkt->base_hdr.peer].rx_seq_no %
-		    ep->peers[pkt->base_hdr.peer].rx_window))
-			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+	if (pkt->base_hdr.flags & RXD_ACK_REQ)
+		rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+	else
+		rxd_ep_delay_ack(ep, pkt->base_hdr.peer);
+
+	if (x_entry->next_seg_no < x_entry->num_segs)
 		return;
-	}
-	rxd_ep_send_ack(ep, pkt->base_hdr.peer);
 
 	if (x_entry->cq_entry.flags & FI_READ)
 		rxd_complete_tx(ep, x_entry);
@@ -236,14 +236,37 @@ static void rxd_verify_active(struct rxd_ep *ep, fi_addr_t addr, fi_addr_t peer_
 	}
 }
 
+/*
+ * The op packet was built before the peer's MTU was known, split the rest
+ * of the transfer into segments of the negotiated size.
+ */
+static void rxd_set_num_segs(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
+{
+	struct rxd_peer *peer = &ep->peers[tx_entry->peer];
+
+	if (tx_entry->op == RXD_READ_REQ)
+		tx_entry->num_segs = ofi_div_ceil(tx_entry->cq_entry.len,
+						  peer->max_seg_sz);
+	else if (tx_entry->num_segs > 1)
+		tx_entry->num_segs = ofi_div_ceil(tx_entry->cq_entry.len -
+						  tx_entry->bytes_done,
+						  peer->max_seg_sz) + 1;
+	else
+		return;
+
+	rxd_get_sar_hdr(tx_entry->pkt)->num_segs = tx_entry->num_segs;
+}
+
 int rxd_start_xfer(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 {
 	struct rxd_base_hdr *hdr = rxd_get_base_hdr(tx_entry->pkt);
 
 	if (ep->peers[tx_entry->peer].unacked_cnt >=
-	    ep->peers[tx_entry->peer].tx_window)
+	    rxd_peer_tx_window(&ep->peers[tx_entry->peer]))
 		return 0;
 
+	rxd_set_num_segs(ep, tx_entry);
+
 	tx_entry->start_seq = rxd_set_pkt_seq(&ep->peers[tx_entry->peer],
 					      tx_entry->pkt);
 	if (tx_entry->op != RXD_READ_REQ && tx_entry->num_segs > 1) {
@@ -251,6 +274,8 @@ int rxd_start_xfer(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 						      tx_entry->num_segs;
 	}
 	hdr->peer = ep->peers[tx_entry->peer].peer_addr;
+	if (rxd_peer_ack_req(&ep->peers[tx_entry->peer], hdr->seq_no))
+		hdr->flags |= RXD_ACK_REQ;
 	rxd_ep_send_pkt(ep, tx_entry->pkt);
 	rxd_insert_unacked(ep, tx_entry->peer, tx_entry->pkt);
 	tx_entry->pkt = NULL;
@@ -263,7 +288,7 @@ int rxd_start_xfer(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 	}
 
 	return ep->peers[tx_entry->peer].unacked_cnt <
-	       ep->peers[tx_entry->peer].tx_window;
+	       rxd_peer_tx_window(&ep->peers[tx_entry->peer]);
 }
 
 void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer)
@@ -305,7 +330,7 @@ void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer)
 				
 		if (tx_entry->op == RXD_DATA_READ && !tx_entry->bytes_done) {
 			if (ep->peers[tx_entry->peer].unacked_cnt >=
-		    	    ep->peers[tx_entry->peer].tx_window) {
+		    	    rxd_peer_tx_window(&ep->peers[tx_entry->peer])) {
 				break;
 			} 
 			tx_entry->start_seq = ep->peers[tx_entry->peer].tx_seq_no;
@@ -325,10 +350,26 @@ void rxd_progress_tx_list(struct rxd_ep *ep, struct rxd_peer *peer)
 
 	if (dlist_empty(&peer->tx_list))
 		peer->retry_cnt = 0;
+	else if (dlist_empty(&peer->unacked))
+		rxd_peer_timer_set(ep, peer, fi_gettime_us() + RXD_TIMER_TICK);
 }
 
-static void rxd_update_peer(struct rxd_ep *ep, fi_addr_t peer, fi_addr_t peer_addr)
+/*
+ * Data segments use the smaller of both MTUs, so that both sides agree
+ * on the segment size.
+ */
+static void rxd_update_peer(struct rxd_ep *ep, fi_addr_t peer,
+			    fi_addr_t peer_addr, uint32_t mtu)
 {
+	struct rxd_domain *rxd_domain = rxd_ep_domain(ep);
+
+	ep->peers[peer].mtu_sz = MIN(rxd_domain->max_mtu_sz, mtu);
+	ep->peers[peer].max_seg_sz = rxd_domain->max_seg_sz +
+				     ep->peers[peer].mtu_sz -
+				     rxd_domain->base_mtu_sz;
+	ep->peers[peer].rx_window = rxd_peer_max_window(&ep->peers[peer]);
+	ep->peers[peer].tx_window = ep->peers[peer].rx_window;
+
 	rxd_verify_active(ep, peer, peer_addr);
 	rxd_progress_tx_list(ep, &ep->peers[peer]);
 }
@@ -340,7 +381,7 @@ static int rxd_send_cts(struct rxd_ep *rxd_ep, struct rxd_rts_pkt *rts_pkt,
 	struct rxd_cts_pkt *cts;
 	int ret = 0;
 
-	rxd_update_peer(rxd_ep, peer, rts_pkt->rts_addr);
+	rxd_update_peer(rxd_ep, peer, rts_pkt->rts_addr, rts_pkt->mtu);
 
 	pkt_entry = rxd_get_tx_pkt(rxd_ep);
 	if (!pkt_entry)
@@ -354,6 +395,8 @@ static int rxd_send_cts(struct rxd_ep *rxd_ep, struct rxd_rts_pkt *rts_pkt,
 	cts->base_hdr.type = RXD_CTS;
 	cts->cts_addr = peer;
 	cts->rts_addr = rts_pkt->rts_addr;
+	cts->mtu = rxd_ep_domain(rxd_ep)->max_mtu_sz;
+	cts->resv = 0;
 
 	dlist_insert_tail(&pkt_entry->d_entry, &rxd_ep->ctrl_pkts);
 	ret = rxd_ep_send_pkt(rxd_ep, pkt_entry);
@@ -567,7 +610,6 @@ static struct rxd_x_entry *rxd_rma_read_entry_init(struct rxd_ep *ep,
 			struct rxd_rma_hdr *rma_hdr)
 {
 	struct rxd_x_entry *rx_entry;
-	struct rxd_domain *rxd_domain = rxd_ep_domain(ep);
 	int ret;
 
 	rx_entry = rxd_get_rx_entry(ep, base_hdr->type);
@@ -582,7 +624,8 @@ static struct rxd_x_entry *rxd_rma_read_entry_init(struct rxd_ep *ep,
 	rx_entry->flags = RXD_NO_TX_COMP;
 	rx_entry->bytes_done = 0;
 	rx_entry->next_seg_no = 0;
-	rx_entry->num_segs = ofi_div_ceil(sar_hdr->size, rxd_domain->max_seg_sz);
+	rx_entry->num_segs = ofi_div_ceil(sar_hdr->size,
+					  ep->peers[base_hdr->peer].max_seg_sz);
 	rx_entry->pkt = NULL;
 
  	ret = rxd_verify_iov(ep, rma_hdr->rma, sar_hdr->iov_count,
@@ -671,7 +714,7 @@ static struct rxd_x_entry *rxd_rx_atomic_fetch(struct rxd_ep *ep,
 
 	dlist_insert_tail(&rx_entry->entry, &ep->peers[rx_entry->peer].tx_list);
 
-	rxd_ep_send_ack(ep, base_hdr->peer);
+	rxd_ep_delay_ack(ep, base_hdr->peer);
 
 	rxd_progress_tx_list(ep, &ep->peers[rx_entry->peer]);
 
@@ -779,7 +822,7 @@ static int rxd_unpack_init_rx(struct rxd_ep *ep, struct rxd_x_entry **rx_entry,
 void rxd_do_atomic(void *src, void *dst, void *cmp, enum fi_datatype datatype,
 		   enum fi_op atomic_op, size_t cnt)
 {
-	char tmp_result[RXD_MAX_MTU_SIZE];
+	char tmp_result[RXD_BASE_MTU_SIZE];
 
 	if (atomic_op >= OFI_SWAP_OP_START) {
 		ofi_atomic_swap_handlers[atomic_op - OFI_SWAP_OP_START][datatype](dst,
@@ -882,112 +925,52 @@ static struct rxd_x_entry *rxd_get_data_x_entry(struct rxd_ep *ep,
 	return ofi_bufpool_get_ibuf(ep->tx_entry_pool.pool, data_pkt->ext_hdr.tx_id);
 }
 
-static void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
-{
-	struct fi_cq_err_entry err_entry;
-	struct rxd_pkt_entry *pkt_entry;
-	struct rxd_base_hdr *base_hdr;
-	struct rxd_sar_hdr *sar_hdr;
-	struct rxd_tag_hdr *tag_hdr;
-	struct rxd_data_hdr *data_hdr;
-	struct rxd_rma_hdr *rma_hdr;
-	struct rxd_atom_hdr *atom_hdr;
-	void *msg;
-	int ret;
-	size_t msg_size;
-	struct rxd_x_entry *rx_entry = NULL;
-	struct rxd_data_pkt *data_pkt;
-
-	while (!dlist_empty(&ep->peers[peer].buf_pkts)) {
-		pkt_entry = container_of((&ep->peers[peer].buf_pkts)->next,
-					struct rxd_pkt_entry, d_entry);
-		base_hdr = rxd_get_base_hdr(pkt_entry);
-		if (base_hdr->seq_no != ep->peers[peer].rx_seq_no)
-			return;
-
-		if (base_hdr->type == RXD_DATA || base_hdr->type == RXD_DATA_READ) {
-			data_pkt = (struct rxd_data_pkt *) pkt_entry->pkt;
-			rx_entry = rxd_get_data_x_entry(ep, data_pkt);
-			rxd_ep_recv_data(ep, rx_entry, data_pkt, pkt_entry->pkt_size);
-		} else {
-			ret = rxd_unpack_init_rx(ep, &rx_entry, pkt_entry, base_hdr, &sar_hdr,
-					      &tag_hdr, &data_hdr, &rma_hdr, &atom_hdr,
-					      &msg, &msg_size);
-			if (ret) {
-				memset(&err_entry, 0, sizeof(err_entry));
-				err_entry.err = FI_ETRUNC;
-				err_entry.prov_errno = 0;
-				ret = ofi_cq_write_error(&rxd_ep_rx_cq(ep)->util_cq,
-							 &err_entry);
-				if (ret)
-					FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
-						"could not write error entry\n");
-				ep->peers[base_hdr->peer].rx_seq_no++;
-				rxd_remove_free_pkt_entry(pkt_entry);
-				continue;
-			}
-			if (!rx_entry) {
-				if (base_hdr->type == RXD_MSG ||
-				    base_hdr->type == RXD_TAGGED) {
-					ep->peers[base_hdr->peer].rx_seq_no++;
-					continue;
-				}
-				break;
-			}
-
-			rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr,
-					sar_hdr, tag_hdr, data_hdr, rma_hdr,
-					atom_hdr, &msg, msg_size);
-		}
-
-		ep->peers[base_hdr->peer].rx_seq_no++;
-		rxd_remove_free_pkt_entry(pkt_entry);
-	}
-}
-
-static void rxd_handle_data(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+/*
+ * Process a data packet carrying the next sequence number expected from
+ * its peer. The packet is either released or kept by an unexpected message.
+ */
+static void rxd_process_data_pkt(struct rxd_ep *ep,
+				 struct rxd_pkt_entry *pkt_entry)
 {
 	struct rxd_data_pkt *pkt = (struct rxd_data_pkt *) (pkt_entry->pkt);
-	struct rxd_x_entry *x_entry;
+	struct rxd_peer *peer = &ep->peers[pkt->base_hdr.peer];
 	struct rxd_unexp_msg *unexp_msg;
+	struct rxd_x_entry *x_entry;
 
-	if (pkt_entry->pkt_size < sizeof(*pkt) + ep->rx_prefix_size) {
-		FI_WARN(&rxd_prov, FI_LOG_CQ,
-			"Cannot process packet smaller than minimum header size\n");
-		goto free;
-	}
+	peer->rx_seq_no++;
+	if (pkt->base_hdr.type == RXD_DATA && peer->curr_unexp) {
+		unexp_msg = peer->curr_unexp;
+		dlist_insert_tail(&pkt_entry->d_entry, &unexp_msg->pkt_list);
+		if (pkt->ext_hdr.seg_no + 1 == unexp_msg->sar_hdr->num_segs - 1)
+			peer->curr_unexp = NULL;
 
-	if (pkt->base_hdr.seq_no == ep->peers[pkt->base_hdr.peer].rx_seq_no) {
-		ep->peers[pkt->base_hdr.peer].rx_seq_no++;
-		if (pkt->base_hdr.type == RXD_DATA &&
-		    ep->peers[pkt->base_hdr.peer].curr_unexp) {
-			unexp_msg = ep->peers[pkt->base_hdr.peer].curr_unexp;
-			dlist_insert_tail(&pkt_entry->d_entry, &unexp_msg->pkt_list);
-			if (pkt->ext_hdr.seg_no + 1 == unexp_msg->sar_hdr->num_segs - 1) {
-				ep->peers[pkt->base_hdr.peer].curr_unexp = NULL;
-				rxd_ep_send_ack(ep, pkt->base_hdr.peer);
-			}
-			return;
-		}
-		x_entry = rxd_get_data_x_entry(ep, pkt);
-		rxd_ep_recv_data(ep, x_entry, pkt, pkt_entry->pkt_size);
-		if (!dlist_empty(&ep->peers[pkt->base_hdr.peer].buf_pkts))
-			rxd_progress_buf_pkts(ep, pkt->base_hdr.peer);
-	} else if (!rxd_env.retry) {
-		dlist_insert_order(&ep->peers[pkt->base_hdr.peer].buf_pkts,
-				   &rxd_comp_pkt_seq_no, &pkt_entry->d_entry);
+		if (pkt->base_hdr.flags & RXD_ACK_REQ)
+			rxd_ep_send_ack(ep, pkt->base_hdr.peer);
+		else
+			rxd_ep_delay_ack(ep, pkt->base_hdr.peer);
 		return;
-	} else if (ep->peers[pkt->base_hdr.peer].peer_addr != FI_ADDR_UNSPEC) {
-		rxd_ep_send_ack(ep, pkt->base_hdr.peer);
 	}
-free:
+
+	x_entry = rxd_get_data_x_entry(ep, pkt);
+	rxd_ep_recv_data(ep, x_entry, pkt, pkt_entry->pkt_size);
 	ofi_buf_free(pkt_entry);
 }
 
-static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+/*
+ * Process an op packet carrying the next sequence number expected from its
+ * peer. Returns 1 if the packet was consumed, in which case it has been
+ * released or kept by an unexpected message. Returns 0 if it couldn't be
+ * processed yet (e.g. no rx entries left); the packet is left to the
+ * caller and the peer will resend it. Without retries, a malformed packet
+ * is never resent, so it is dropped and counted as consumed rather than
+ * holding up every later packet from the peer.
+ */
+static int rxd_process_op_pkt(struct rxd_ep *ep,
+			      struct rxd_pkt_entry *pkt_entry)
 {
 	struct rxd_x_entry *rx_entry;
 	struct rxd_base_hdr *base_hdr = rxd_get_base_hdr(pkt_entry);
+	struct rxd_peer *peer = &ep->peers[base_hdr->peer];
 	struct rxd_sar_hdr *sar_hdr;
 	struct rxd_tag_hdr *tag_hdr;
 	struct rxd_data_hdr *data_hdr;
@@ -995,60 +978,173 @@ static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 	struct rxd_atom_hdr *atom_hdr;
 	void *msg;
 	size_t msg_size;
-	int ret;
-
-	if (base_hdr->seq_no != ep->peers[base_hdr->peer].rx_seq_no) {
-		if (!rxd_env.retry) {
-			dlist_insert_order(&ep->peers[base_hdr->peer].buf_pkts,
-					   &rxd_comp_pkt_seq_no, &pkt_entry->d_entry);
-			return;
-		}
-
-		if (ep->peers[base_hdr->peer].peer_addr != FI_ADDR_UNSPEC)
-			goto ack;
-		goto release;
-	}
-
-	if (ep->peers[base_hdr->peer].peer_addr == FI_ADDR_UNSPEC)
-		goto release;
+	int ret, ack_now;
 
 	ret = rxd_unpack_init_rx(ep, &rx_entry, pkt_entry, base_hdr, &sar_hdr,
 				 &tag_hdr, &data_hdr, &rma_hdr, &atom_hdr,
 				 &msg, &msg_size);
-	if (ret)
-		goto ack;
+	if (ret) {
+		if (rxd_env.retry)
+			goto ack;
+		peer->rx_seq_no++;
+		ofi_buf_free(pkt_entry);
+		return 1;
+	}
 
 	if (!rx_entry) {
 		if (base_hdr->type == RXD_MSG || base_hdr->type == RXD_TAGGED) {
-			if (!ep->peers[base_hdr->peer].curr_unexp)
+			if (!peer->curr_unexp)
 				goto ack;
 
-			ep->peers[base_hdr->peer].rx_seq_no++;
+			peer->rx_seq_no++;
 
 			if (!sar_hdr)
-				ep->peers[base_hdr->peer].curr_unexp = NULL;
+				peer->curr_unexp = NULL;
 
-			rxd_ep_send_ack(ep, base_hdr->peer);
-			return;
+			rxd_ep_delay_ack(ep, base_hdr->peer);
+			return 1;
 		}
-		ep->peers[base_hdr->peer].rx_window = 0;
+		peer->rx_window = 0;
 		goto ack;
 	}
 
-	ep->peers[base_hdr->peer].rx_seq_no++;
-	ep->peers[base_hdr->peer].rx_window = rxd_env.max_unacked;
+	/* Reopening a closed window can't wait */
+	ack_now = !peer->rx_window || (base_hdr->flags & RXD_ACK_REQ);
+	peer->rx_seq_no++;
+	peer->rx_window = rxd_peer_max_window(peer);
 	rxd_progress_op(ep, rx_entry, pkt_entry, base_hdr, sar_hdr, tag_hdr,
 			data_hdr, rma_hdr, atom_hdr, &msg, msg_size);
 
-	if (!dlist_empty(&ep->peers[base_hdr->peer].buf_pkts))
-		rxd_progress_buf_pkts(ep, base_hdr->peer);
+	if (ack_now)
+		rxd_ep_send_ack(ep, base_hdr->peer);
+	else
+		rxd_ep_delay_ack(ep, base_hdr->peer);
+	ofi_buf_free(pkt_entry);
+	return 1;
 
 ack:
 	rxd_ep_send_ack(ep, base_hdr->peer);
+	return 0;
+}
+
+/*
+ * Process packets buffered for the peer for as long as they are in
+ * sequence. Copies of packets that were resent and already processed
+ * are dropped. If the next packet can't be processed yet, the peer's
+ * timer is armed to retry it, as no new packet may arrive to do so.
+ */
+void rxd_progress_buf_pkts(struct rxd_ep *ep, fi_addr_t peer)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	struct rxd_base_hdr *base_hdr;
+
+	while (!dlist_empty(&ep->peers[peer].buf_pkts)) {
+		pkt_entry = container_of((&ep->peers[peer].buf_pkts)->next,
+					struct rxd_pkt_entry, d_entry);
+		base_hdr = rxd_get_base_hdr(pkt_entry);
+		if (ofi_before(base_hdr->seq_no, ep->peers[peer].rx_seq_no)) {
+			rxd_remove_free_pkt_entry(pkt_entry);
+			continue;
+		}
+
+		if (base_hdr->seq_no != ep->peers[peer].rx_seq_no)
+			return;
+
+		dlist_remove(&pkt_entry->d_entry);
+		if (base_hdr->type == RXD_DATA || base_hdr->type == RXD_DATA_READ) {
+			rxd_process_data_pkt(ep, pkt_entry);
+		} else if (!rxd_process_op_pkt(ep, pkt_entry)) {
+			dlist_insert_head(&pkt_entry->d_entry,
+					  &ep->peers[peer].buf_pkts);
+			rxd_peer_timer_set(ep, &ep->peers[peer],
+					   fi_gettime_us() + RXD_TIMER_TICK);
+			return;
+		}
+	}
+}
+
+static int rxd_match_pkt_seq_no(struct dlist_entry *item, const void *arg)
+{
+	return rxd_get_base_hdr(container_of(item, struct rxd_pkt_entry,
+				d_entry))->seq_no == *((uint64_t *) arg);
+}
+
+/*
+ * Handle a packet that is not the next one expected from its peer. Packets
+ * ahead of it within the receive window are buffered until the missing
+ * ones arrive, so that the sender only needs to resend those. The ACK
+ * sent back reports the buffered packets as SACK blocks.
+ */
+static void rxd_buffer_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_base_hdr *base_hdr = rxd_get_base_hdr(pkt_entry);
+	struct rxd_peer *peer = &ep->peers[base_hdr->peer];
+
+	if (!rxd_env.retry) {
+		dlist_insert_order(&peer->buf_pkts, &rxd_comp_pkt_seq_no,
+				   &pkt_entry->d_entry);
+		return;
+	}
+
+	if (peer->peer_addr == FI_ADDR_UNSPEC)
+		goto release;
+
+	if (ofi_before(peer->rx_seq_no, base_hdr->seq_no) &&
+	    ofi_before(base_hdr->seq_no, peer->rx_seq_no + rxd_env.max_unacked) &&
+	    !dlist_find_first_match(&peer->buf_pkts, &rxd_match_pkt_seq_no,
+				    &base_hdr->seq_no)) {
+		dlist_insert_order(&peer->buf_pkts, &rxd_comp_pkt_seq_no,
+				   &pkt_entry->d_entry);
+		rxd_ep_send_ack(ep, base_hdr->peer);
+		return;
+	}
+
+	rxd_ep_send_ack(ep, base_hdr->peer);
 release:
 	ofi_buf_free(pkt_entry);
 }
 
+static void rxd_handle_data(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_data_pkt *pkt = (struct rxd_data_pkt *) (pkt_entry->pkt);
+
+	if (pkt_entry->pkt_size < sizeof(*pkt) + ep->rx_prefix_size) {
+		FI_WARN(&rxd_prov, FI_LOG_CQ,
+			"Cannot process packet smaller than minimum header size\n");
+		ofi_buf_free(pkt_entry);
+		return;
+	}
+
+	if (pkt->base_hdr.seq_no != ep->peers[pkt->base_hdr.peer].rx_seq_no) {
+		rxd_buffer_pkt(ep, pkt_entry);
+		return;
+	}
+
+	rxd_process_data_pkt(ep, pkt_entry);
+	if (!dlist_empty(&ep->peers[pkt->base_hdr.peer].buf_pkts))
+		rxd_progress_buf_pkts(ep, pkt->base_hdr.peer);
+}
+
+static void rxd_handle_op(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_base_hdr *base_hdr = rxd_get_base_hdr(pkt_entry);
+	fi_addr_t peer = base_hdr->peer;
+
+	if (base_hdr->seq_no != ep->peers[peer].rx_seq_no) {
+		rxd_buffer_pkt(ep, pkt_entry);
+		return;
+	}
+
+	if (ep->peers[peer].peer_addr == FI_ADDR_UNSPEC ||
+	    !rxd_process_op_pkt(ep, pkt_entry)) {
+		ofi_buf_free(pkt_entry);
+		return;
+	}
+
+	if (!dlist_empty(&ep->peers[peer].buf_pkts))
+		rxd_progress_buf_pkts(ep, peer);
+}
+
 static void rxd_handle_cts(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 {
 	struct rxd_cts_pkt *cts = (struct rxd_cts_pkt *) (pkt_entry->pkt);
@@ -1059,49 +1155,182 @@ static void rxd_handle_cts(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
 		return;
 	}
 
-	rxd_update_peer(ep, cts->rts_addr, cts->cts_addr);
+	rxd_update_peer(ep, cts->rts_addr, cts->cts_addr, cts->mtu);
 }
 
-static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
+/*
+ * Returns 1 if the packet was newly acknowledged, i.e. not selectively
+ * acknowledged before.  rtt_ts is set to the latest send time of such a
+ * packet that was never retransmitted.
+ */
+static int rxd_ack_pkt_entry(struct rxd_ep *ep, struct rxd_peer *peer,
+			     struct rxd_pkt_entry *pkt_entry, uint64_t *rtt_ts)
+{
+	int acked = !(pkt_entry->flags & RXD_PKT_SACKED);
+
+	if (pkt_entry->flags & RXD_PKT_ACKED)
+		return 0;
+
+	if (acked && !(pkt_entry->flags & RXD_PKT_RETRANS))
+		*rtt_ts = MAX(*rtt_ts, pkt_entry->timestamp);
+
+	if (pkt_entry->flags & RXD_PKT_IN_USE) {
+		pkt_entry->flags |= RXD_PKT_ACKED;
+		return acked;
+	}
+	rxd_remove_free_pkt_entry(pkt_entry);
+	peer->unacked_cnt--;
+	peer->retry_cnt = 0;
+	return acked;
+}
+
+static int rxd_sack_match(struct rxd_sack_blk *sack, uint32_t sack_cnt,
+			  uint64_t seq_no)
+{
+	uint32_t i;
+
+	for (i = 0; i < sack_cnt; i++) {
+		if (ofi_after_eq(seq_no, sack[i].start) &&
+		    ofi_before(seq_no, sack[i].end))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Mark the unacked packets that the receiver reported in SACK blocks, so
+ * that they aren't resent. They are only released once the cumulative
+ * ACK covers them: the receiver may still be unable to process them.
+ * With fast_rtx set (enough duplicate ACKs were received), resend the
+ * holes: unacked packets sent before the last selectively acked one.
+ */
+static uint16_t rxd_handle_sack(struct rxd_ep *ep, struct rxd_peer *peer,
+				struct rxd_sack_blk *sack, uint32_t sack_cnt,
+				int fast_rtx, uint64_t *rtt_ts)
 {
-	struct rxd_ack_pkt *ack = (struct rxd_ack_pkt *) (ack_entry->pkt);
 	struct rxd_pkt_entry *pkt_entry;
-	fi_addr_t peer = ack->base_hdr.peer;
-	struct rxd_base_hdr *hdr;
+	struct dlist_entry *tmp;
+	uint64_t seq_no, high_seq = sack[sack_cnt - 1].end;
+	uint16_t acked = 0;
 
-	ep->peers[peer].tx_window = ack->ext_hdr.rx_id;
+	dlist_foreach_container_safe(&peer->unacked, struct rxd_pkt_entry,
+				     pkt_entry, d_entry, tmp) {
+		if (pkt_entry->flags & (RXD_PKT_ACKED | RXD_PKT_SACKED))
+			continue;
 
-	if (ep->peers[peer].last_rx_ack == ack->base_hdr.seq_no)
-		return;
+		seq_no = rxd_get_base_hdr(pkt_entry)->seq_no;
+		if (rxd_sack_match(sack, sack_cnt, seq_no)) {
+			if (!(pkt_entry->flags & RXD_PKT_RETRANS))
+				*rtt_ts = MAX(*rtt_ts, pkt_entry->timestamp);
+			pkt_entry->flags |= RXD_PKT_SACKED;
+			acked++;
+			continue;
+		}
+
+		if (!fast_rtx || !ofi_before(seq_no, high_seq) ||
+		    (pkt_entry->flags & RXD_PKT_IN_USE))
+			continue;
+
+		FI_DBG(&rxd_prov, FI_LOG_EP_DATA,
+		       "fast retransmit of seq_no %" PRIu64 "\n", seq_no);
+		if (rxd_ep_send_pkt(ep, pkt_entry)) {
+			fast_rtx = 0;
+			continue;
+		}
+		pkt_entry->flags |= RXD_PKT_RETRANS;
+		peer->rtx_cnt++;
+	}
+	return acked;
+}
+
+static void rxd_process_ack(struct rxd_ep *ep, fi_addr_t peer,
+			    uint64_t seq_no, uint32_t rx_window,
+			    struct rxd_sack_blk *sack, uint32_t sack_cnt)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	struct dlist_entry *tmp;
+	uint64_t rtt_ts = 0;
+	uint16_t acked = 0;
+	int fast_rtx = 0;
 
-	ep->peers[peer].last_rx_ack = ack->base_hdr.seq_no;
+	ep->peers[peer].tx_window = rx_window;
+
+	if (ep->peers[peer].last_rx_ack == seq_no) {
+		/* Duplicate ACKs carrying SACK blocks report losses */
+		if (!sack_cnt || dlist_empty(&ep->peers[peer].unacked))
+			return;
+		fast_rtx = (++ep->peers[peer].dup_ack_cnt == RXD_DUP_ACK_THRESH);
+		goto sack;
+	}
+
+	ep->peers[peer].last_rx_ack = seq_no;
+	ep->peers[peer].dup_ack_cnt = 0;
 
 	if (dlist_empty(&ep->peers[peer].unacked))
 		return;
 
-	pkt_entry = container_of((&ep->peers[peer].unacked)->next,
-				struct rxd_pkt_entry, d_entry);
-
-	while (&pkt_entry->d_entry != &ep->peers[peer].unacked) {
-		hdr = rxd_get_base_hdr(pkt_entry);
-		if (ofi_after_eq(hdr->seq_no, ack->base_hdr.seq_no))
+	dlist_foreach_container_safe(&ep->peers[peer].unacked,
+				     struct rxd_pkt_entry, pkt_entry,
+				     d_entry, tmp) {
+		if (ofi_after_eq(rxd_get_base_hdr(pkt_entry)->seq_no, seq_no))
 			break;
+		acked += rxd_ack_pkt_entry(ep, &ep->peers[peer], pkt_entry,
+					   &rtt_ts);
+	}
 
-		if (pkt_entry->flags & RXD_PKT_IN_USE) {
-			pkt_entry->flags |= RXD_PKT_ACKED;
-			pkt_entry = container_of((&pkt_entry->d_entry)->next,
-						 struct rxd_pkt_entry, d_entry);
-			continue;
-		}
-		rxd_remove_free_pkt_entry(pkt_entry);
-		ep->peers[peer].unacked_cnt--;
-		ep->peers[peer].retry_cnt = 0;
+sack:
+	if (sack_cnt)
+		acked += rxd_handle_sack(ep, &ep->peers[peer], sack,
+					 sack_cnt, fast_rtx, &rtt_ts);
 
-		pkt_entry = container_of((&ep->peers[peer].unacked)->next,
-					struct rxd_pkt_entry, d_entry);
+	if (rtt_ts)
+		rxd_peer_update_rtt(&ep->peers[peer], fi_gettime_us() - rtt_ts);
+	if (acked)
+		rxd_peer_cwnd_inc(&ep->peers[peer], acked);
+	if (fast_rtx)
+		rxd_peer_cwnd_loss(&ep->peers[peer], 0);
+
+	rxd_progress_tx_list(ep, &ep->peers[peer]);
+}
+
+static void rxd_handle_ack(struct rxd_ep *ep, struct rxd_pkt_entry *ack_entry)
+{
+	struct rxd_ack_pkt *ack = (struct rxd_ack_pkt *) (ack_entry->pkt);
+	uint32_t sack_cnt = 0;
+
+	if (ack_entry->pkt_size - ep->rx_prefix_size >=
+	    sizeof(*ack) - sizeof(ack->sack)) {
+		sack_cnt = MIN(ack->sack_cnt, RXD_MAX_SACK_BLKS);
+		sack_cnt = MIN(sack_cnt, (ack_entry->pkt_size -
+			       ep->rx_prefix_size - (sizeof(*ack) -
+			       sizeof(ack->sack))) / sizeof(*ack->sack));
 	}
 
-	rxd_progress_tx_list(ep, &ep->peers[ack->base_hdr.peer]);
+	rxd_process_ack(ep, ack->base_hdr.peer, ack->base_hdr.seq_no,
+			ack->ext_hdr.rx_id, ack->sack, sack_cnt);
+}
+
+/* Strip a piggybacked ACK from a data or op packet and process it */
+static void rxd_handle_piggy_ack(struct rxd_ep *ep,
+				 struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_base_hdr *base_hdr = rxd_get_base_hdr(pkt_entry);
+	struct rxd_piggy_ack piggy;
+
+	base_hdr->flags &= ~RXD_PIGGY_ACK;
+	if (pkt_entry->pkt_size < ep->rx_prefix_size + sizeof(*base_hdr) +
+				  sizeof(piggy))
+		return;
+
+	pkt_entry->pkt_size -= sizeof(piggy);
+	memcpy(&piggy, (char *) rxd_pkt_start(pkt_entry) +
+	       pkt_entry->pkt_size, sizeof(piggy));
+
+	if (ep->peers[base_hdr->peer].peer_addr == FI_ADDR_UNSPEC)
+		return;
+
+	rxd_process_ack(ep, base_hdr->peer, piggy.seq_no, piggy.rx_window,
+			NULL, 0);
 } 
 
 void rxd_handle_send_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
@@ -1144,6 +1373,12 @@ void rxd_handle_recv_comp(struct rxd_ep *ep, struct fi_cq_msg_entry *comp)
 	rxd_remove_rx_pkt(ep, pkt_entry);
 
 	pkt_entry->pkt_size = comp->len;
+	if (rxd_pkt_type(pkt_entry) != RXD_RTS &&
+	    rxd_pkt_type(pkt_entry) != RXD_CTS &&
+	    rxd_pkt_type(pkt_entry) != RXD_ACK &&
+	    (rxd_get_base_hdr(pkt_entry)->flags & RXD_PIGGY_ACK))
+		rxd_handle_piggy_ack(ep, pkt_entry);
+
 	switch (rxd_pkt_type(pkt_entry)) {
 	case RXD_RTS:
 		rxd_handle_rts(ep, pkt_entry);
@@ -1247,7 +1482,7 @@ ssize_t rxd_cq_sreadfrom(struct fid_cq *cq_fid, void *buf, size_t count,
 		cq->cq_fastlock_release(&cq->ep_list_lock);
 
 		ret = fi_wait(&cq->wait->wait_fid, ep_retry == -1 ?
-			      timeout : rxd_get_timeout(ep_retry));
+			      timeout : ep_retry);
 
 		if (ep_retry != -1 && ret == -FI_ETIMEDOUT)
 			ret = 0;
@@ -124,16 +124,20 @@ int rxd_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 	if (ret)
 		goto err2;
 
-	rxd_domain->max_mtu_sz = MIN(dg_info->ep_attr->max_msg_size, RXD_MAX_MTU_SIZE);
-	rxd_domain->max_inline_msg = rxd_domain->max_mtu_sz -
+	rxd_domain->max_mtu_sz = MIN(dg_info->ep_attr->max_msg_size, rxd_env.max_mtu);
+	rxd_domain->base_mtu_sz = MIN(rxd_domain->max_mtu_sz, RXD_BASE_MTU_SIZE);
+	/* Leave room in every packet for a piggybacked ACK */
+	rxd_domain->max_inline_msg = rxd_domain->base_mtu_sz -
 					sizeof(struct rxd_base_hdr) -
+					sizeof(struct rxd_piggy_ack) -
 					dg_info->ep_attr->msg_prefix_size;
 	rxd_domain->max_inline_rma = rxd_domain->max_inline_msg -
 					(sizeof(struct rxd_rma_hdr) +
 					(RXD_IOV_LIMIT * sizeof(struct ofi_rma_iov)));
 	rxd_domain->max_inline_atom = rxd_domain->max_inline_rma -
 					sizeof(struct rxd_atom_hdr);
-	rxd_domain->max_seg_sz = rxd_domain->max_mtu_sz - sizeof(struct rxd_data_pkt) -
+	rxd_domain->max_seg_sz = rxd_domain->base_mtu_sz - sizeof(struct rxd_data_pkt) -
+				 sizeof(struct rxd_piggy_ack) -
 				 dg_info->ep_attr->msg_prefix_size;
 
 	ret = ofi_domain_init(fabric, info, &rxd_domain->util_domain, context);
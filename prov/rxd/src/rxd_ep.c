@@ -264,7 +264,7 @@ static int rxd_ep_enable(struct rxd_ep *ep)
 	ep->rx_flags = rxd_rx_flags(ep->util_ep.rx_op_flags);
 
 	fastlock_acquire(&ep->util_ep.lock);
-	for (i = 0; i < ep->rx_size; i++) {
+	for (i = 0; i < rxd_buf_cnt(ep, ep->rx_size); i++) {
 		ret = rxd_ep_post_buf(ep);
 		if (ret)
 			break;
@@ -275,16 +275,77 @@ static int rxd_ep_enable(struct rxd_ep *ep)
 }
 
 /*
- * Exponential back-off starting at 1ms, max 4s.
+ * Retransmit timeout of the peer in ms, for waiting on the CQ/counter.
+ * The RTO is doubled on every timeout (max 4s) until a new RTT sample
+ * is taken.
  */
-int rxd_get_timeout(uint8_t retry_cnt)
+int rxd_get_timeout(struct rxd_peer *peer)
 {
-	return MIN(1 << retry_cnt, 4000);
+	return (int) MAX(peer->rto / 1000, 1);
 }
 
-uint64_t rxd_get_retry_time(uint64_t start, uint8_t retry_cnt)
+uint64_t rxd_get_retry_time(struct rxd_peer *peer, uint64_t start)
 {
-	return start + rxd_get_timeout(retry_cnt);
+	return start + peer->rto;
+}
+
+/*
+ * Smoothed RTT and RTO computation as in RFC 6298.  Only packets that
+ * were not retransmitted are sampled (Karn's algorithm).
+ */
+void rxd_peer_update_rtt(struct rxd_peer *peer, uint64_t rtt)
+{
+	uint64_t delta;
+
+	if (!peer->srtt) {
+		peer->srtt = MAX(rtt, 1);
+		peer->rttvar = rtt / 2;
+	} else {
+		delta = peer->srtt > rtt ? peer->srtt - rtt : rtt - peer->srtt;
+		peer->rttvar = (3 * peer->rttvar + delta) / 4;
+		peer->srtt = MAX((7 * peer->srtt + rtt) / 8, 1);
+	}
+
+	peer->rto = peer->srtt + 4 * peer->rttvar;
+	peer->rto = MIN(MAX(peer->rto, RXD_MIN_RTO), RXD_MAX_RTO);
+}
+
+/* Slow start below ssthresh, additive increase above it */
+void rxd_peer_cwnd_inc(struct rxd_peer *peer, uint16_t acked)
+{
+	if (!rxd_env.congestion_ctrl || peer->cwnd >= rxd_env.max_unacked)
+		return;
+
+	if (peer->cwnd < peer->ssthresh) {
+		peer->cwnd = MIN(peer->cwnd + acked, peer->ssthresh);
+		return;
+	}
+
+	peer->cwnd_cnt += acked;
+	if (peer->cwnd_cnt >= peer->cwnd) {
+		peer->cwnd_cnt -= peer->cwnd;
+		peer->cwnd++;
+	}
+}
+
+/*
+ * Multiplicative decrease.  A retransmit timeout restarts slow start, a
+ * fast retransmit continues from the halved window.
+ */
+void rxd_peer_cwnd_loss(struct rxd_peer *peer, int timeout)
+{
+	if (timeout)
+		peer->timeout_cnt++;
+	else
+		peer->fast_rtx_cnt++;
+
+	/* Timeouts before the first RTT sample are likely spurious */
+	if (!rxd_env.congestion_ctrl || !peer->srtt)
+		return;
+
+	peer->ssthresh = MAX(peer->unacked_cnt / 2, RXD_MIN_CWND);
+	peer->cwnd = timeout ? RXD_MIN_CWND : peer->ssthresh;
+	peer->cwnd_cnt = 0;
 }
 
 void rxd_init_data_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry,
@@ -294,7 +355,7 @@ void rxd_init_data_pkt(struct rxd_ep *ep, struct rxd_x_entry *tx_entry,
 	uint32_t seg_size;
 
 	seg_size = tx_entry->cq_entry.len - tx_entry->bytes_done;
-	seg_size = MIN(rxd_ep_domain(ep)->max_seg_sz, seg_size);
+	seg_size = MIN(ep->peers[tx_entry->peer].max_seg_sz, seg_size);
 
 	data_pkt->base_hdr.version = RXD_PROTOCOL_VERSION;
 	data_pkt->base_hdr.type = (tx_entry->cq_entry.flags &
@@ -379,16 +440,97 @@ void rxd_insert_unacked(struct rxd_ep *ep, fi_addr_t peer,
 	dlist_insert_tail(&pkt_entry->d_entry,
 			  &ep->peers[peer].unacked);
 	ep->peers[peer].unacked_cnt++;
+	rxd_peer_timer_set(ep, &ep->peers[peer],
+			   rxd_get_retry_time(&ep->peers[peer],
+					      pkt_entry->timestamp));
+}
+
+/*
+ * Acknowledge the packets received from the peer with a trailer on this
+ * packet if an ACK is pending.  A retransmitted packet that already has
+ * the trailer gets it refreshed.
+ */
+static void rxd_piggyback_ack(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	struct rxd_base_hdr *hdr = rxd_get_base_hdr(pkt_entry);
+	struct rxd_peer *peer = &ep->peers[pkt_entry->peer];
+	struct rxd_piggy_ack piggy;
+
+	if (hdr->type == RXD_RTS || hdr->type == RXD_CTS ||
+	    hdr->type == RXD_ACK)
+		return;
+
+	if (!(hdr->flags & RXD_PIGGY_ACK)) {
+		if (!peer->rx_ack_cnt)
+			return;
+		hdr->flags |= RXD_PIGGY_ACK;
+		pkt_entry->pkt_size += sizeof(piggy);
+	}
+
+	piggy.seq_no = peer->rx_seq_no;
+	piggy.rx_window = peer->rx_window;
+	piggy.resv = 0;
+	memcpy((char *) rxd_pkt_start(pkt_entry) + pkt_entry->pkt_size -
+	       sizeof(piggy), &piggy, sizeof(piggy));
+	peer->last_tx_ack = piggy.seq_no;
+
+	if (peer->rx_ack_cnt) {
+		peer->rx_ack_cnt = 0;
+		dlist_remove_init(&peer->ack_entry);
+		peer->piggy_ack_cnt++;
+	}
+}
+
+static int rxd_ep_sendmsg_pkt(struct rxd_ep *ep,
+			      struct rxd_pkt_entry *pkt_entry, uint64_t flags)
+{
+	struct fi_msg msg;
+	struct iovec iov;
+	int ret;
+
+	pkt_entry->timestamp = fi_gettime_us();
+	rxd_piggyback_ack(ep, pkt_entry);
+
+	if (flags) {
+		iov.iov_base = rxd_pkt_start(pkt_entry);
+		iov.iov_len = pkt_entry->pkt_size;
+		msg.msg_iov = &iov;
+		msg.desc = &pkt_entry->desc;
+		msg.iov_count = 1;
+		msg.addr = rxd_ep_av(ep)->rxd_addr_table[pkt_entry->peer].dg_addr;
+		msg.context = &pkt_entry->context;
+		msg.data = 0;
+		ret = fi_sendmsg(ep->dg_ep, &msg, flags | FI_COMPLETION);
+	} else {
+		ret = fi_send(ep->dg_ep, (const void *) rxd_pkt_start(pkt_entry),
+			      pkt_entry->pkt_size, pkt_entry->desc,
+			      rxd_ep_av(ep)->rxd_addr_table[pkt_entry->peer].dg_addr,
+			      &pkt_entry->context);
+	}
+	if (ret) {
+		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "error sending packet: %d (%s)\n",
+			ret, fi_strerror(-ret));
+		return ret;
+	}
+	pkt_entry->flags |= RXD_PKT_IN_USE;
+
+	return 0;
+}
+
+int rxd_ep_send_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
+{
+	return rxd_ep_sendmsg_pkt(ep, pkt_entry, 0);
 }
 
 ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 {
 	struct rxd_pkt_entry *pkt_entry;
 	struct rxd_data_pkt *data;
+	int more;
 
 	while (tx_entry->bytes_done != tx_entry->cq_entry.len) {
 		if (ep->peers[tx_entry->peer].unacked_cnt >=
-		    ep->peers[tx_entry->peer].tx_window)
+		    rxd_peer_tx_window(&ep->peers[tx_entry->peer]))
 			return 0;
 
 		pkt_entry = rxd_get_tx_pkt(ep);
@@ -402,33 +544,19 @@ ssize_t rxd_ep_post_data_pkts(struct rxd_ep *ep, struct rxd_x_entry *tx_entry)
 				        data->ext_hdr.seg_no;
 		if (data->base_hdr.type != RXD_DATA_READ)
 			data->base_hdr.seq_no++;
-
-		rxd_ep_send_pkt(ep, pkt_entry);
+		if (rxd_peer_ack_req(&ep->peers[tx_entry->peer],
+				     data->base_hdr.seq_no))
+			data->base_hdr.flags |= RXD_ACK_REQ;
+
+		more = tx_entry->bytes_done != tx_entry->cq_entry.len &&
+		       ep->peers[tx_entry->peer].unacked_cnt + 1 <
+		       rxd_peer_tx_window(&ep->peers[tx_entry->peer]);
+		rxd_ep_sendmsg_pkt(ep, pkt_entry, more ? FI_MORE : 0);
 		rxd_insert_unacked(ep, tx_entry->peer, pkt_entry);
 	}
 
 	return ep->peers[tx_entry->peer].unacked_cnt >=
-	       ep->peers[tx_entry->peer].tx_window;
-}
-
-int rxd_ep_send_pkt(struct rxd_ep *ep, struct rxd_pkt_entry *pkt_entry)
-{
-	int ret;
-
-	pkt_entry->timestamp = fi_gettime_ms();
-
-	ret = fi_send(ep->dg_ep, (const void *) rxd_pkt_start(pkt_entry),
-		      pkt_entry->pkt_size, pkt_entry->desc,
-		      rxd_ep_av(ep)->rxd_addr_table[pkt_entry->peer].dg_addr,
-		      &pkt_entry->context);
-	if (ret) {
-		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL, "error sending packet: %d (%s)\n",
-			ret, fi_strerror(-ret));
-		return ret;
-	}
-	pkt_entry->flags |= RXD_PKT_IN_USE;
-
-	return 0;
+	       rxd_peer_tx_window(&ep->peers[tx_entry->peer]);
 }
 
 static ssize_t rxd_ep_send_rts(struct rxd_ep *rxd_ep, fi_addr_t rxd_addr)
@@ -449,6 +577,8 @@ static ssize_t rxd_ep_send_rts(struct rxd_ep *rxd_ep, fi_addr_t rxd_addr)
 	rts_pkt->base_hdr.version = RXD_PROTOCOL_VERSION;
 	rts_pkt->base_hdr.type = RXD_RTS;
 	rts_pkt->rts_addr = rxd_addr;
+	rts_pkt->mtu = rxd_ep_domain(rxd_ep)->max_mtu_sz;
+	rts_pkt->resv = 0;
 
 	addrlen = RXD_NAME_LENGTH;
 	memset(rts_pkt->source, 0, RXD_NAME_LENGTH);
@@ -552,6 +682,38 @@ size_t rxd_init_msg(void **ptr, const struct iovec *iov, size_t iov_count,
 	return done;
 }
 
+/*
+ * Describe the runs of out of order packets buffered for the peer (sorted
+ * by sequence number) as SACK blocks, nearest ones first.
+ */
+static uint32_t rxd_init_sack(struct rxd_peer *peer, struct rxd_sack_blk *sack)
+{
+	struct rxd_pkt_entry *pkt_entry;
+	uint64_t seq_no;
+	uint32_t cnt = 0;
+
+	dlist_foreach_container(&peer->buf_pkts, struct rxd_pkt_entry,
+				pkt_entry, d_entry) {
+		seq_no = rxd_get_base_hdr(pkt_entry)->seq_no;
+		if (ofi_before(seq_no, peer->rx_seq_no))
+			continue;
+
+		if (cnt && seq_no == sack[cnt - 1].end) {
+			sack[cnt - 1].end++;
+			continue;
+		}
+
+		if (cnt == RXD_MAX_SACK_BLKS)
+			break;
+
+		sack[cnt].start = seq_no;
+		sack[cnt].end = seq_no + 1;
+		cnt++;
+	}
+
+	return cnt;
+}
+
 void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
@@ -564,7 +726,10 @@ void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 	}
 
 	ack = (struct rxd_ack_pkt *) (pkt_entry->pkt);
-	pkt_entry->pkt_size = sizeof(*ack) + rxd_ep->tx_prefix_size;
+	ack->sack_cnt = rxd_init_sack(&rxd_ep->peers[peer], ack->sack);
+	pkt_entry->pkt_size = sizeof(*ack) - sizeof(ack->sack) +
+			      sizeof(*ack->sack) * ack->sack_cnt +
+			      rxd_ep->tx_prefix_size;
 	pkt_entry->peer = peer;
 
 	ack->base_hdr.version = RXD_PROTOCOL_VERSION;
@@ -573,12 +738,50 @@ void rxd_ep_send_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
 	ack->base_hdr.seq_no = rxd_ep->peers[peer].rx_seq_no;
 	ack->ext_hdr.rx_id = rxd_ep->peers[peer].rx_window;
 	rxd_ep->peers[peer].last_tx_ack = ack->base_hdr.seq_no;
+	rxd_ep->peers[peer].rx_ack_cnt = 0;
+	dlist_remove_init(&rxd_ep->peers[peer].ack_entry);
+	rxd_ep->peers[peer].ack_cnt++;
 
 	dlist_insert_tail(&pkt_entry->d_entry, &rxd_ep->ctrl_pkts);
 	if (rxd_ep_send_pkt(rxd_ep, pkt_entry))
 		rxd_remove_free_pkt_entry(pkt_entry);
 }
 
+/*
+ * Acknowledge an in-order packet.  The ACK is sent once ack_count packets
+ * are pending, or at the end of the progress call, unless it gets
+ * piggybacked on a packet sent to the peer before.  ACKs aren't delayed
+ * past the progress call: the application may not progress the endpoint
+ * again until the peer completes its sends.
+ */
+void rxd_ep_delay_ack(struct rxd_ep *rxd_ep, fi_addr_t peer)
+{
+	struct rxd_peer *rxd_peer = &rxd_ep->peers[peer];
+
+	rxd_peer->rx_pkt_cnt++;
+	if (++rxd_peer->rx_ack_cnt >= rxd_env.ack_count) {
+		rxd_ep_send_ack(rxd_ep, peer);
+		return;
+	}
+
+	if (rxd_peer->rx_ack_cnt == 1)
+		dlist_insert_tail(&rxd_peer->ack_entry, &rxd_ep->ack_peers);
+}
+
+static void rxd_ep_flush_acks(struct rxd_ep *ep)
+{
+	struct rxd_peer *peer;
+
+	while (!dlist_empty(&ep->ack_peers)) {
+		peer = container_of(ep->ack_peers.next, struct rxd_peer,
+				    ack_entry);
+		rxd_ep_send_ack(ep, peer - ep->peers);
+		/* Out of tx packets, try again on the next progress call */
+		if (peer->rx_ack_cnt)
+			break;
+	}
+}
+
 static void rxd_ep_free_res(struct rxd_ep *ep)
 {
 	if (ep->tx_pkt_pool.pool)
@@ -594,11 +797,57 @@ static void rxd_ep_free_res(struct rxd_ep *ep)
 		ofi_bufpool_destroy(ep->rx_entry_pool.pool);
 }
 
+static void rxd_peer_log_stats(struct rxd_peer *peer)
+{
+	FI_INFO(&rxd_prov, FI_LOG_EP_CTRL, "peer %" PRIu64 ": srtt %" PRIu64
+		" us, rto %" PRIu64 " us, cwnd %" PRIu16 ", ssthresh %" PRIu16
+		", retransmits %" PRIu64 " (fast %" PRIu64 ", timeouts %"
+		PRIu64 ")\n", peer->peer_addr, peer->srtt, peer->rto,
+		peer->cwnd, peer->ssthresh, peer->rtx_cnt,
+		peer->fast_rtx_cnt, peer->timeout_cnt);
+	FI_INFO(&rxd_prov, FI_LOG_EP_CTRL, "peer %" PRIu64 ": received %"
+		PRIu64 " packets, sent %" PRIu64 " ACKs (%.2f per packet), "
+		"%" PRIu64 " piggybacked\n", peer->peer_addr, peer->rx_pkt_cnt,
+		peer->ack_cnt, peer->rx_pkt_cnt ?
+		(double) peer->ack_cnt / peer->rx_pkt_cnt : 0.0,
+		peer->piggy_ack_cnt);
+}
+
+/* Log the counters of the active peers every FI_OFI_RXD_STATS_INTERVAL ms,
+ * so that they can be followed while the endpoint is in use */
+static void rxd_ep_log_stats(struct rxd_ep *ep)
+{
+	struct rxd_peer *peer;
+	uint64_t now;
+
+	if (!fi_log_enabled(&rxd_prov, FI_LOG_INFO, FI_LOG_EP_CTRL))
+		return;
+
+	now = fi_gettime_us();
+	if (now < ep->next_stats)
+		return;
+
+	ep->next_stats = now + (uint64_t) rxd_env.stats_interval * 1000;
+	dlist_foreach_container(&ep->active_peers, struct rxd_peer, peer, entry)
+		rxd_peer_log_stats(peer);
+}
+
 static void rxd_close_peer(struct rxd_ep *ep, struct rxd_peer *peer)
 {
 	struct rxd_pkt_entry *pkt_entry;
 	struct rxd_x_entry *x_entry;
 
+	/* Don't leave the peer waiting for a delayed ACK */
+	if (peer->rx_ack_cnt)
+		rxd_ep_send_ack(ep, peer - ep->peers);
+
+	if (!dlist_empty(&peer->timer_entry)) {
+		dlist_remove_init(&peer->timer_entry);
+		ep->timer_wheel.cnt--;
+	}
+
+	rxd_peer_log_stats(peer);
+
 	while (!dlist_empty(&peer->unacked)) {
 		dlist_pop_front(&peer->unacked, struct rxd_pkt_entry,
 				pkt_entry, d_entry);
@@ -915,7 +1164,7 @@ static void rxd_progress_pkt_list(struct rxd_ep *ep, struct rxd_peer *peer)
 	uint64_t current;
 	int ret, retry = 0;
 
-	current = fi_gettime_ms();
+	current = fi_gettime_us();
 	if (peer->retry_cnt > RXD_MAX_PKT_RETRY) {
 		rxd_peer_timeout(ep, peer);
 		return;
@@ -923,29 +1172,194 @@ static void rxd_progress_pkt_list(struct rxd_ep *ep, struct rxd_peer *peer)
 
 	dlist_foreach_container(&peer->unacked, struct rxd_pkt_entry,
 				pkt_entry, d_entry) {
+		/* Selectively acked packets are only resent if the timer
+		 * keeps expiring, in case the receiver dropped them */
+		if ((pkt_entry->flags & RXD_PKT_SACKED) && !peer->retry_cnt)
+			continue;
 		if (pkt_entry->flags & (RXD_PKT_IN_USE | RXD_PKT_ACKED) ||
-		    current < rxd_get_retry_time(pkt_entry->timestamp, peer->retry_cnt))
+		    current < rxd_get_retry_time(peer, pkt_entry->timestamp))
 			break;
+		if (!retry) {
+			rxd_peer_cwnd_loss(peer, 1);
+			peer->rto = MIN(peer->rto * 2, RXD_MAX_RTO);
+		}
 		retry = 1;
 		ret = rxd_ep_send_pkt(ep, pkt_entry);
 		if (ret)
 			break;
+		pkt_entry->flags &= ~RXD_PKT_SACKED;
+		pkt_entry->flags |= RXD_PKT_RETRANS;
+		peer->rtx_cnt++;
 	}
 	if (retry)
 		peer->retry_cnt++;
+}
+
+static void rxd_timer_insert(struct rxd_timer_wheel *tw, struct rxd_peer *peer)
+{
+	uint64_t max_tick = tw->cur_tick +
+			    RXD_TIMER_L0_SLOTS * (RXD_TIMER_L1_SLOTS - 1) - 1;
 
-	if (!dlist_empty(&peer->unacked))
-		ep->next_retry = ep->next_retry == -1 ? peer->retry_cnt :
-				 MIN(ep->next_retry, peer->retry_cnt);
+	peer->timer_tick = MIN(MAX(peer->timer_tick, tw->cur_tick), max_tick);
+
+	if (peer->timer_tick - tw->cur_tick < RXD_TIMER_L0_SLOTS)
+		dlist_insert_tail(&peer->timer_entry,
+			&tw->l0[peer->timer_tick & (RXD_TIMER_L0_SLOTS - 1)]);
+	else
+		dlist_insert_tail(&peer->timer_entry,
+			&tw->l1[(peer->timer_tick >> RXD_TIMER_L0_BITS) &
+				(RXD_TIMER_L1_SLOTS - 1)]);
 }
 
-void rxd_ep_progress(struct util_ep *util_ep)
+/*
+ * Arm the peer's retransmit timer to fire at expire (usec), unless it
+ * is already armed to fire earlier.  A timer firing early is harmless:
+ * the peer's packets are checked and the timer is re-armed.
+ */
+void rxd_peer_timer_set(struct rxd_ep *ep, struct rxd_peer *peer,
+			uint64_t expire)
+{
+	struct rxd_timer_wheel *tw = &ep->timer_wheel;
+	uint64_t tick = (expire + RXD_TIMER_TICK - 1) / RXD_TIMER_TICK;
+
+	if (!rxd_env.retry)
+		return;
+
+	if (!dlist_empty(&peer->timer_entry)) {
+		if (peer->timer_tick <= tick)
+			return;
+		dlist_remove(&peer->timer_entry);
+	} else if (!tw->cnt++) {
+		tw->cur_tick = fi_gettime_us() / RXD_TIMER_TICK;
+	}
+
+	peer->timer_tick = tick;
+	rxd_timer_insert(tw, peer);
+	tw->next_expire = MIN(tw->next_expire,
+			      peer->timer_tick * RXD_TIMER_TICK);
+}
+
+static void rxd_timer_cascade(struct rxd_timer_wheel *tw)
+{
+	struct dlist_entry *slot, list;
+	struct rxd_peer *peer;
+
+	slot = &tw->l1[(tw->cur_tick >> RXD_TIMER_L0_BITS) &
+		       (RXD_TIMER_L1_SLOTS - 1)];
+	dlist_init(&list);
+	dlist_splice_tail(&list, slot);
+	while (!dlist_empty(&list)) {
+		dlist_pop_front(&list, struct rxd_peer, peer, timer_entry);
+		rxd_timer_insert(tw, peer);
+	}
+}
+
+static uint64_t rxd_timer_next_expire(struct rxd_timer_wheel *tw)
+{
+	uint64_t tick, block;
+	int i;
+
+	if (!tw->cnt)
+		return UINT64_MAX;
+
+	/* The next level 1 slot is cascaded at the start of its block */
+	block = (tw->cur_tick >> RXD_TIMER_L0_BITS) + 1;
+	for (i = 0; i < RXD_TIMER_L0_SLOTS; i++) {
+		tick = tw->cur_tick + i;
+		if ((tick >> RXD_TIMER_L0_BITS) == block &&
+		    !dlist_empty(&tw->l1[block & (RXD_TIMER_L1_SLOTS - 1)]))
+			return tick * RXD_TIMER_TICK;
+		if (!dlist_empty(&tw->l0[tick & (RXD_TIMER_L0_SLOTS - 1)]))
+			return tick * RXD_TIMER_TICK;
+	}
+
+	for (i = 1; i < RXD_TIMER_L1_SLOTS; i++, block++) {
+		if (!dlist_empty(&tw->l1[block & (RXD_TIMER_L1_SLOTS - 1)]))
+			return (block << RXD_TIMER_L0_BITS) * RXD_TIMER_TICK;
+	}
+	return tw->cur_tick * RXD_TIMER_TICK;
+}
+
+static void rxd_peer_timer_expired(struct rxd_ep *ep, struct rxd_peer *peer,
+				   uint64_t now)
 {
+	struct rxd_pkt_entry *pkt_entry;
+
+	if (!dlist_empty(&peer->buf_pkts))
+		rxd_progress_buf_pkts(ep, peer - ep->peers);
+
+	rxd_progress_pkt_list(ep, peer);
+
+	if (dlist_empty(&peer->unacked)) {
+		if (!dlist_empty(&peer->tx_list))
+			rxd_progress_tx_list(ep, peer);
+		return;
+	}
+
+	pkt_entry = container_of(peer->unacked.next, struct rxd_pkt_entry,
+				 d_entry);
+	rxd_peer_timer_set(ep, peer,
+			   MAX(rxd_get_retry_time(peer, pkt_entry->timestamp),
+			       now + RXD_TIMER_TICK));
+}
+
+static void rxd_progress_timers(struct rxd_ep *ep)
+{
+	struct rxd_timer_wheel *tw = &ep->timer_wheel;
+	struct dlist_entry expired, *tmp;
 	struct rxd_peer *peer;
-	struct fi_cq_msg_entry cq_entry;
-	struct dlist_entry *tmp;
+	uint64_t now, now_tick;
+
+	if (!tw->cnt) {
+		ep->next_retry = -1;
+		return;
+	}
+
+	now = fi_gettime_us();
+	if (now < tw->next_expire)
+		goto out;
+
+	now_tick = now / RXD_TIMER_TICK;
+	dlist_init(&expired);
+	for (; tw->cur_tick <= now_tick; tw->cur_tick++) {
+		if (!(tw->cur_tick & (RXD_TIMER_L0_SLOTS - 1)))
+			rxd_timer_cascade(tw);
+		dlist_splice_tail(&expired, &tw->l0[tw->cur_tick &
+						    (RXD_TIMER_L0_SLOTS - 1)]);
+	}
+
+	dlist_foreach_container_safe(&expired, struct rxd_peer, peer,
+				     timer_entry, tmp) {
+		dlist_remove_init(&peer->timer_entry);
+		tw->cnt--;
+		rxd_peer_timer_expired(ep, peer, now);
+	}
+	tw->next_expire = rxd_timer_next_expire(tw);
+
+out:
+	ep->next_retry = !tw->cnt ? -1 : tw->next_expire <= now ? 0 :
+			 (int) ((tw->next_expire - now + 999) / 1000);
+}
+
+static void rxd_timer_wheel_init(struct rxd_timer_wheel *tw)
+{
+	int i;
+
+	tw->cur_tick = 0;
+	tw->next_expire = UINT64_MAX;
+	tw->cnt = 0;
+	for (i = 0; i < RXD_TIMER_L0_SLOTS; i++)
+		dlist_init(&tw->l0[i]);
+	for (i = 0; i < RXD_TIMER_L1_SLOTS; i++)
+		dlist_init(&tw->l1[i]);
+}
+
+void rxd_ep_progress(struct util_ep *util_ep)
+{
+	struct fi_cq_msg_entry cq_entry[RXD_CQ_READ_CNT];
 	struct rxd_ep *ep;
-	ssize_t ret;
+	ssize_t ret, j;
+	size_t cnt;
 	int i;
 
 	ep = container_of(util_ep, struct rxd_ep, util_ep);
@@ -953,38 +1367,34 @@ void rxd_ep_progress(struct util_ep *util_ep)
 	fastlock_acquire(&ep->util_ep.lock);
 	for(ret = 1, i = 0;
 	    ret > 0 && (!rxd_env.spin_count || i < rxd_env.spin_count);
-	    i++) {
-		ret = fi_cq_read(ep->dg_cq, &cq_entry, 1);
+	    i += ret) {
+		cnt = rxd_env.spin_count ?
+		      MIN(RXD_CQ_READ_CNT, rxd_env.spin_count - i) :
+		      RXD_CQ_READ_CNT;
+		ret = fi_cq_read(ep->dg_cq, cq_entry, cnt);
 		if (ret == -FI_EAGAIN)
 			break;
 
 		if (ret == -FI_EAVAIL) {
 			rxd_handle_error(ep);
-			continue;
+			break;
 		}
 
-		if (cq_entry.flags & FI_RECV)
-			rxd_handle_recv_comp(ep, &cq_entry);
-		else
-			rxd_handle_send_comp(ep, &cq_entry);
+		for (j = 0; j < ret; j++) {
+			if (cq_entry[j].flags & FI_RECV)
+				rxd_handle_recv_comp(ep, &cq_entry[j]);
+			else
+				rxd_handle_send_comp(ep, &cq_entry[j]);
+		}
 	}
 
-	if (!rxd_env.retry)
-		goto out;
-
-	ep->next_retry = -1;
-	dlist_foreach_container_safe(&ep->rts_sent_list, struct rxd_peer,
-				     peer, entry, tmp)
-		rxd_progress_pkt_list(ep, peer);
+	if (rxd_env.retry)
+		rxd_progress_timers(ep);
 
-	dlist_foreach_container_safe(&ep->active_peers, struct rxd_peer,
-				     peer, entry, tmp) {
-		rxd_progress_pkt_list(ep, peer);
-		if (dlist_empty(&peer->unacked))
-			rxd_progress_tx_list(ep, peer);
-	}
+	rxd_ep_flush_acks(ep);
 
-out:
+	if (rxd_env.stats_interval > 0)
+		rxd_ep_log_stats(ep);
 	fastlock_release(&ep->util_ep.lock);
 }
 
@@ -1051,6 +1461,7 @@ static int rxd_pool_create_attrs(struct rxd_ep *ep, struct rxd_buf_pool *pool,
 	pool->rxd_ep = ep;
 	pool->type = type;
 
+	ofi_bufpool_attr_set_numa(&attr, ep->numa_node);
 	ret = ofi_bufpool_create_attr(&attr, &pool->pool);
 	if (ret)
 		FI_WARN(&rxd_prov, FI_LOG_EP_CTRL,
@@ -1067,7 +1478,7 @@ static int rxd_pkt_pool_create(struct rxd_ep *ep,
 				  sizeof(struct rxd_pkt_entry),
 		.alignment	= RXD_BUF_POOL_ALIGNMENT,
 		.max_cnt	= 0,
-		.chunk_cnt	= chunk_cnt,
+		.chunk_cnt	= rxd_buf_cnt(ep, chunk_cnt),
 		.alloc_fn	= rxd_buf_region_alloc_fn,
 		.free_fn	= rxd_buf_region_free_fn,
 		.init_fn	= rxd_pkt_init_fn,
@@ -1130,7 +1541,9 @@ int rxd_ep_init_res(struct rxd_ep *ep, struct fi_info *fi_info)
 	dlist_init(&ep->unexp_list);
 	dlist_init(&ep->unexp_tag_list);
 	dlist_init(&ep->ctrl_pkts);
+	dlist_init(&ep->ack_peers);
 	slist_init(&ep->rx_pkt_list);
+	rxd_timer_wheel_init(&ep->timer_wheel);
 
 	return 0;
 err:
@@ -1145,17 +1558,38 @@ static void rxd_init_peer(struct rxd_ep *ep, uint64_t rxd_addr)
 	ep->peers[rxd_addr].tx_seq_no = 0;
 	ep->peers[rxd_addr].rx_seq_no = 0;
 	ep->peers[rxd_addr].last_rx_ack = 0;
+	ep->peers[rxd_addr].ack_req_seq = ~0ULL;
+	ep->peers[rxd_addr].mtu_sz = rxd_ep_domain(ep)->base_mtu_sz;
+	ep->peers[rxd_addr].max_seg_sz = rxd_ep_domain(ep)->max_seg_sz;
 	ep->peers[rxd_addr].last_tx_ack = 0;
 	ep->peers[rxd_addr].rx_window = rxd_env.max_unacked;
 	ep->peers[rxd_addr].tx_window = rxd_env.max_unacked;
 	ep->peers[rxd_addr].unacked_cnt = 0;
+	ep->peers[rxd_addr].dup_ack_cnt = 0;
 	ep->peers[rxd_addr].retry_cnt = 0;
 	ep->peers[rxd_addr].active = 0;
+	ep->peers[rxd_addr].srtt = 0;
+	ep->peers[rxd_addr].rttvar = 0;
+	ep->peers[rxd_addr].rto = RXD_INIT_RTO;
+	ep->peers[rxd_addr].cwnd = rxd_env.congestion_ctrl ?
+			MIN(RXD_INIT_CWND, rxd_env.max_unacked) :
+			rxd_env.max_unacked;
+	ep->peers[rxd_addr].cwnd_cnt = 0;
+	ep->peers[rxd_addr].ssthresh = rxd_env.max_unacked;
+	ep->peers[rxd_addr].rtx_cnt = 0;
+	ep->peers[rxd_addr].fast_rtx_cnt = 0;
+	ep->peers[rxd_addr].timeout_cnt = 0;
+	ep->peers[rxd_addr].rx_ack_cnt = 0;
+	ep->peers[rxd_addr].rx_pkt_cnt = 0;
+	ep->peers[rxd_addr].ack_cnt = 0;
+	ep->peers[rxd_addr].piggy_ack_cnt = 0;
 	dlist_init(&ep->peers[rxd_addr].unacked);
 	dlist_init(&ep->peers[rxd_addr].tx_list);
 	dlist_init(&ep->peers[rxd_addr].rx_list);
 	dlist_init(&ep->peers[rxd_addr].rma_rx_list);
 	dlist_init(&ep->peers[rxd_addr].buf_pkts);
+	dlist_init(&ep->peers[rxd_addr].timer_entry);
+	dlist_init(&ep->peers[rxd_addr].ack_entry);
 }
 
 int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
@@ -1205,6 +1639,7 @@ int rxd_endpoint(struct fid_domain *domain, struct fi_info *info,
 	fi_freeinfo(dg_info);
 
 	rxd_ep->next_retry = -1;
+	rxd_ep->numa_node = ofi_numa_node_self();
 	ret = rxd_ep_init_res(rxd_ep, info);
 	if (ret)
 		goto err3;
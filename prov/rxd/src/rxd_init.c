@@ -43,6 +43,10 @@ struct rxd_env rxd_env = {
 	.retry		= 1,
 	.max_peers	= 1024,
 	.max_unacked	= 128,
+	.congestion_ctrl = 1,
+	.ack_count	= 8,
+	.max_mtu	= RXD_MAX_MTU_SIZE,
+	.stats_interval	= 0,
 };
 
 char *rxd_pkt_type_str[] = {
@@ -55,6 +59,12 @@ static void rxd_init_env(void)
 	fi_param_get_bool(&rxd_prov, "retry", &rxd_env.retry);
 	fi_param_get_int(&rxd_prov, "max_peers", &rxd_env.max_peers);
 	fi_param_get_int(&rxd_prov, "max_unacked", &rxd_env.max_unacked);
+	fi_param_get_bool(&rxd_prov, "congestion_control",
+			  &rxd_env.congestion_ctrl);
+	fi_param_get_int(&rxd_prov, "ack_count", &rxd_env.ack_count);
+	fi_param_get_size_t(&rxd_prov, "max_mtu", &rxd_env.max_mtu);
+	rxd_env.max_mtu = MIN(rxd_env.max_mtu, RXD_MAX_MTU_SIZE);
+	fi_param_get_int(&rxd_prov, "stats_interval", &rxd_env.stats_interval);
 }
 
 void rxd_info_to_core_mr_modes(uint32_t version, const struct fi_info *hints,
@@ -95,7 +105,7 @@ int rxd_info_to_rxd(uint32_t version, const struct fi_info *core_info,
 
 	*info->tx_attr = *rxd_info.tx_attr;
 	info->tx_attr->inject_size = MIN(core_info->ep_attr->max_msg_size,
-			RXD_MAX_MTU_SIZE) - (sizeof(struct rxd_base_hdr) +
+			RXD_BASE_MTU_SIZE) - (sizeof(struct rxd_base_hdr) +
 			core_info->ep_attr->msg_prefix_size +
 			sizeof(struct rxd_rma_hdr) + (RXD_IOV_LIMIT *
 			sizeof(struct ofi_rma_iov)) + sizeof(struct rxd_atom_hdr));
@@ -143,6 +153,19 @@ RXD_INI
 			"Maximum number of peers to track (default: 1024)");
 	fi_param_define(&rxd_prov, "max_unacked", FI_PARAM_INT,
 			"Maximum number of packets to send at once (default: 128)");
+	fi_param_define(&rxd_prov, "congestion_control", FI_PARAM_BOOL,
+			"Limit the packets in flight to each peer with a "
+			"congestion window (default: yes)");
+	fi_param_define(&rxd_prov, "ack_count", FI_PARAM_INT,
+			"Number of packets to receive before sending a delayed "
+			"acknowledgement (default: 8)");
+	fi_param_define(&rxd_prov, "max_mtu", FI_PARAM_SIZE_T,
+			"Maximum packet size to negotiate with peers, limited "
+			"by the base provider's max_msg_size (default: 65536)");
+	fi_param_define(&rxd_prov, "stats_interval", FI_PARAM_INT,
+			"Interval in milliseconds at which to log the RTT, "
+			"congestion window and retransmit counters of each "
+			"peer (default: 0, only when the endpoint is closed)");
 
 	rxd_init_env();
 
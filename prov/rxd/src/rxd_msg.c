@@ -145,7 +145,7 @@ static int rxd_ep_discard_recv(struct rxd_ep *rxd_ep, void *context,
 
 	rxd_ep->peers[unexp_msg->base_hdr->peer].rx_seq_no =
 			MAX(seq, rxd_ep->peers[unexp_msg->base_hdr->peer].rx_seq_no);
-	rxd_ep_send_ack(rxd_ep, unexp_msg->base_hdr->peer);
+	rxd_ep_delay_ack(rxd_ep, unexp_msg->base_hdr->peer);
 
 	ret = ofi_cq_write(rxd_ep->util_ep.rx_cq, context, FI_TAGGED | FI_RECV,
 			   0, NULL, unexp_msg->data_hdr ?
@@ -42,6 +42,7 @@
 
 #define RXD_IOV_LIMIT		4
 #define RXD_NAME_LENGTH		64
+#define RXD_MAX_SACK_BLKS	4
 
 /* Values below are part of the wire protocol
    Reserved values are unused but defined for compatibility */
@@ -99,11 +100,14 @@ struct rxd_ext_hdr {
 /*
  * Ready to send: initialize peer communication and exchange addressing info
  * 	- rts_addr: local address for peer sending RTS
+ * 	- mtu: largest packet the transmitting endpoint can receive
  * 	- source: name of transmitting endpoint for peer to add to AV
  */
 struct rxd_rts_pkt {
 	struct rxd_base_hdr	base_hdr;
 	uint64_t		rts_addr;
+	uint32_t		mtu;
+	uint32_t		resv;
 	uint8_t			source[RXD_NAME_LENGTH];
 };
 
@@ -111,20 +115,48 @@ struct rxd_rts_pkt {
  * Clear to send: response to RTS request
  * 	- rts_addr: peer address packet is responding to
  * 	- cts_addr: local address for peer
+ * 	- mtu: largest packet the transmitting endpoint can receive
  */
 struct rxd_cts_pkt {
 	struct	rxd_base_hdr	base_hdr;
 	uint64_t		rts_addr;
 	uint64_t		cts_addr;
+	uint32_t		mtu;
+	uint32_t		resv;
+};
+
+/*
+ * Selective ACK block: packets [start, end) were received out of order
+ * and are buffered by the receiver
+ */
+struct rxd_sack_blk {
+	uint64_t	start;
+	uint64_t	end;
 };
 
 /*
  * ACK: to signal received packets and send tx/rx id info
+ * 	- base_hdr.seq_no: next sequence number expected (cumulative ACK)
+ * 	- ext_hdr.rx_id: receive window of the peer
+ * 	- sack_cnt: number of valid blocks in sack; only those are sent
  */
 struct rxd_ack_pkt {
 	struct rxd_base_hdr	base_hdr;
 	struct rxd_ext_hdr	ext_hdr;
-	//TODO fill in more fields? Selective ack?
+	uint32_t		sack_cnt;
+	uint32_t		resv;
+	struct rxd_sack_blk	sack[RXD_MAX_SACK_BLKS];
+};
+
+/*
+ * Trailer appended to data and op packets flagged with RXD_PIGGY_ACK.
+ * It acknowledges the packets received from the peer, like an ACK packet
+ * without SACK blocks.
+ */
+struct rxd_piggy_ack {
+	uint64_t	seq_no;
+	uint32_t	rx_window;
+	uint32_t	resv;
 };
 
 /*
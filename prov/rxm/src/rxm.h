@@ -53,6 +53,7 @@
 #include <ofi_list.h>
 #include <ofi_proto.h>
 #include <ofi_iov.h>
+#include <ofi_mr.h>
 
 #ifndef _RXM_H_
 #define _RXM_H_
@@ -64,15 +65,24 @@
 
 #define RXM_CM_DATA_VERSION	1
 #define RXM_OP_VERSION		3
-#define RXM_CTRL_VERSION	4
+#define RXM_CTRL_VERSION	5
 
 #define RXM_BUF_SIZE	16384
 extern size_t rxm_eager_limit;
 
+#define RXM_TX_SMALL_BUF_SIZE	512
+extern size_t rxm_tx_small_limit;
+
 #define RXM_SAR_LIMIT	131072
 #define RXM_SAR_TX_ERROR	UINT64_MAX
 #define RXM_SAR_RX_INIT		UINT64_MAX
 
+/* SAR msg_id carries the index of the first segment's TX buffer in the
+ * lower 32 bits and a per-connection sequence number in the upper bits */
+#define RXM_SAR_MSG_ID_INDEX(msg_id)	((msg_id) & UINT32_MAX)
+
+#define RXM_MAX_CONN_PER_PEER	8
+
 #define RXM_IOV_LIMIT 4
 
 #define RXM_MR_MODES	(OFI_MR_BASIC_MAP | FI_MR_LOCAL)
@@ -132,6 +142,10 @@ extern size_t rxm_msg_tx_size;
 extern size_t rxm_msg_rx_size;
 extern size_t rxm_def_univ_size;
 extern size_t rxm_cm_progress_interval;
+extern size_t rxm_aggr_size;
+extern size_t rxm_aggr_timeout;
+extern size_t rxm_conn_per_peer;
+extern int rxm_direct_recv;
 extern int force_auto_progress;
 
 /*
@@ -228,7 +242,10 @@ union rxm_cm_data {
 		uint8_t ctrl_version;
 		uint8_t op_version;
 		uint16_t port;
-		uint8_t padding[2];
+		/* 0 for the primary connection, otherwise the index of an
+		 * additional connection to the same peer */
+		uint8_t conn_idx;
+		uint8_t padding;
 		uint32_t eager_size;
 		uint32_t rx_size;
 		uint64_t client_conn_id;
@@ -237,6 +254,10 @@ union rxm_cm_data {
 	struct _accept {
 		uint64_t server_conn_id;
 		uint32_t rx_size;
+		/* Connections the server accepts from the peer, 0 from peers
+		 * that don't support additional connections */
+		uint8_t conn_per_peer;
+		uint8_t padding[3];
 	} accept;
 
 	struct _reject {
@@ -273,11 +294,30 @@ struct rxm_fabric {
 	struct fid_fabric *msg_fabric;
 };
 
+/* The MR cache looks up regions by address only, and cached MSG MRs are
+ * registered with the access flags of their cache. RxM keeps one cache
+ * for each access set that it registers internally.
+ */
+enum rxm_mr_cache_type {
+	RXM_MR_CACHE_READ,		/* rendezvous and RMA read targets */
+	RXM_MR_CACHE_WRITE,		/* RMA write sources */
+	RXM_MR_CACHE_REMOTE_READ,	/* rendezvous sources */
+	RXM_MR_CACHE_MAX,
+};
+
+struct rxm_mr_cache {
+	struct ofi_mr_cache cache;
+	uint64_t access;
+	uint8_t enabled;
+};
+
 struct rxm_domain {
 	struct util_domain util_domain;
 	struct fid_domain *msg_domain;
 	size_t max_atomic_size;
 	uint8_t mr_local;
+	/* Caches the MSG MRs registered internally for rendezvous and RMA */
+	struct rxm_mr_cache mr_cache[RXM_MR_CACHE_MAX];
 };
 
 int rxm_av_open(struct fid_domain *domain_fid, struct fi_av_attr *attr,
@@ -289,6 +329,17 @@ struct rxm_mr {
 	struct rxm_domain *domain;
 };
 
+/* Stored in ofi_mr_entry::data. Closing mr_fid releases the cache entry */
+struct rxm_cached_mr {
+	struct fid_mr mr_fid;
+	struct fid_mr *msg_mr;
+	struct ofi_mr_entry *entry;
+	struct ofi_mr_cache *cache;
+};
+
+int rxm_msg_mr_reg_internal(struct rxm_domain *rxm_domain, const void *buf,
+			    size_t len, uint64_t acs, struct fid_mr **mr);
+
 struct rxm_rndv_hdr {
 	struct ofi_rma_iov iov[RXM_IOV_LIMIT];
 	uint8_t count;
@@ -340,7 +391,10 @@ struct rxm_atomic_resp_hdr {
 	FUNC(RXM_RNDV_ACK_RECVD),	\
 	FUNC(RXM_RNDV_FINISH),		\
 	FUNC(RXM_ATOMIC_RESP_WAIT),	\
-	FUNC(RXM_ATOMIC_RESP_SENT)
+	FUNC(RXM_ATOMIC_RESP_SENT),	\
+	FUNC(RXM_AGGR_TX),		\
+	FUNC(RXM_RX_DIRECT),		\
+	FUNC(RXM_RNDV_LANE_READ)
 
 enum rxm_proto_state {
 	RXM_PROTO_STATES(OFI_ENUM_VAL)
@@ -355,6 +409,7 @@ enum {
 	rxm_ctrl_rndv_ack,
 	rxm_ctrl_atomic,
 	rxm_ctrl_atomic_resp,
+	rxm_ctrl_aggr,
 };
 
 struct rxm_pkt {
@@ -363,6 +418,32 @@ struct rxm_pkt {
 	char data[];
 };
 
+/*
+ * Aggregated packet (rxm_ctrl_aggr) layout. pkt.hdr.size holds the total
+ * length of the packed entries. Each entry is a rxm_aggr_hdr followed by
+ * the message payload, padded to 8 bytes:
+ *
+ * | rxm_pkt | rxm_aggr_hdr | data | pad | rxm_aggr_hdr | data | pad | ...
+ */
+struct rxm_aggr_hdr {
+	uint64_t tag;
+	uint64_t data;
+	uint32_t size;
+	uint32_t flags;
+};
+
+/* Per-message completion info of an aggregated send. This is kept at the
+ * tail of the transmit buffer and is never sent on the wire */
+struct rxm_aggr_comp {
+	void *app_context;
+	uint64_t flags;
+};
+
+static inline size_t rxm_aggr_entry_size(size_t len)
+{
+	return ofi_get_aligned_size(sizeof(struct rxm_aggr_hdr) + len, 8);
+}
+
 union rxm_sar_ctrl_data {
 	struct {
 		enum rxm_sar_seg_type {
@@ -410,6 +491,7 @@ enum rxm_buf_pool_type {
 	RXM_BUF_POOL_START	= RXM_BUF_POOL_RX,
 	RXM_BUF_POOL_TX,
 	RXM_BUF_POOL_TX_START	= RXM_BUF_POOL_TX,
+	RXM_BUF_POOL_TX_SMALL,
 	RXM_BUF_POOL_TX_INJECT,
 	RXM_BUF_POOL_TX_ACK,
 	RXM_BUF_POOL_TX_RNDV,
@@ -449,12 +531,26 @@ struct rxm_rx_buf {
 	/* Used for large messages */
 	struct rxm_rndv_hdr *rndv_hdr;
 	size_t rndv_rma_index;
+	size_t rndv_rma_cnt;
+	/* First error of the reads, reported once all of them are done */
+	int rndv_rma_err;
 	struct fid_mr *mr[RXM_IOV_LIMIT];
 
 	/* Must stay at bottom */
 	struct rxm_pkt pkt;
 };
 
+/* Context of a rendezvous read over an additional connection. It is
+ * linked to the connection until the read completes, so the reads lost
+ * when the connection goes away can be accounted for. */
+struct rxm_rndv_lane_read {
+	/* Must stay at top */
+	struct rxm_buf hdr;
+
+	struct rxm_rx_buf *rx_buf;
+	struct dlist_entry entry;
+};
+
 struct rxm_tx_base_buf {
 	/* Must stay at top */
 	struct rxm_buf hdr;
@@ -672,10 +768,16 @@ struct rxm_ep {
 	size_t			sar_limit;
 
 	struct rxm_buf_pool	*buf_pools;
+	/* node buffers are placed on, negative if unknown */
+	int			numa_node;
 
 	struct dlist_entry	repost_ready_list;
 	struct dlist_entry	deferred_tx_conn_queue;
 
+	/* Tagged message aggregation, disabled if aggr_limit is 0 */
+	size_t			aggr_limit;
+	struct dlist_entry	aggr_conn_queue;
+
 	struct rxm_recv_queue	recv_queue;
 	struct rxm_recv_queue	trecv_queue;
 
@@ -698,8 +800,29 @@ struct rxm_conn {
 	struct dlist_entry deferred_tx_queue;
 	struct dlist_entry sar_rx_msg_list;
 	struct dlist_entry sar_deferred_rx_msg_list;
+	/* SAR messages that lost segments along with an additional
+	 * connection, whose remaining segments are dropped */
+	struct dlist_entry sar_drop_list;
+	/* Rendezvous reads in flight over this additional connection */
+	struct dlist_entry rndv_read_list;
+
+	/* Open aggregated send (if any) and its entry in aggr_conn_queue */
+	struct rxm_tx_eager_buf *aggr_buf;
+	struct dlist_entry aggr_entry;
+	size_t aggr_cnt;
+	uint64_t aggr_start;
 
 	uint32_t rndv_tx_credits;
+	uint32_t sar_msg_seq;
+
+	/* Additional MSG connections to the peer (FI_OFI_RXM_CONN_PER_PEER).
+	 * Only SAR segments and rendezvous reads are striped over them, so
+	 * that message ordering is kept by the primary connection. */
+	struct rxm_conn *aux_conn[RXM_MAX_CONN_PER_PEER - 1];
+	uint8_t aux_cnt;
+	uint8_t next_lane;
+	/* Set for the additional connections only */
+	struct rxm_conn *primary;
 };
 
 extern struct fi_provider rxm_prov;
@@ -738,6 +861,15 @@ ssize_t rxm_cq_handle_eager(struct rxm_rx_buf *rx_buf);
 ssize_t rxm_cq_handle_coll_eager(struct rxm_rx_buf *rx_buf);
 ssize_t rxm_cq_handle_rndv(struct rxm_rx_buf *rx_buf);
 ssize_t rxm_cq_handle_seg_data(struct rxm_rx_buf *rx_buf);
+ssize_t rxm_cq_post_rndv_read(struct rxm_rx_buf *rx_buf, struct rxm_conn *lane,
+			      const struct iovec *iov, void **desc,
+			      size_t count, uint64_t addr, uint64_t key);
+ssize_t rxm_cq_finish_rndv_read(struct rxm_rx_buf *rx_buf, int err);
+void rxm_cq_abort_lane_reads(struct rxm_conn *lane);
+void rxm_cq_abort_sar_rx(struct rxm_conn *rxm_conn);
+void rxm_cq_free_sar_drop_list(struct rxm_conn *rxm_conn);
+ssize_t rxm_get_dynamic_rbuf(void *context, size_t msg_len,
+			     struct iovec *iov, size_t iov_limit);
 int rxm_finish_eager_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_eager_buf);
 int rxm_finish_coll_eager_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_eager_buf);
 
@@ -786,6 +918,40 @@ static inline struct rxm_conn *rxm_key2conn(struct rxm_ep *rxm_ep, uint64_t key)
 	return (struct rxm_conn *)rxm_cmap_key2handle(rxm_ep->cmap, key);
 }
 
+static inline size_t rxm_conn_lane_cnt(struct rxm_conn *rxm_conn)
+{
+	size_t i, cnt = 1;
+
+	for (i = 0; i < rxm_conn->aux_cnt; i++) {
+		if (rxm_conn->aux_conn[i]->handle.state == RXM_CMAP_CONNECTED)
+			cnt++;
+	}
+	return cnt;
+}
+
+/* Round-robin over the primary connection and the connected additional
+ * connections to the peer */
+static inline struct rxm_conn *rxm_conn_next_lane(struct rxm_conn *rxm_conn)
+{
+	struct rxm_conn *lane;
+	size_t i;
+
+	for (i = 0; i < rxm_conn->aux_cnt; i++) {
+		if (++rxm_conn->next_lane > rxm_conn->aux_cnt)
+			rxm_conn->next_lane = 0;
+		if (!rxm_conn->next_lane)
+			return rxm_conn;
+		lane = rxm_conn->aux_conn[rxm_conn->next_lane - 1];
+		if (lane->handle.state == RXM_CMAP_CONNECTED)
+			return lane;
+	}
+	return rxm_conn;
+}
+
+ssize_t rxm_ep_aggr_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn);
+void rxm_ep_flush_aggr_queue(struct rxm_ep *rxm_ep, uint64_t timeout);
+int rxm_finish_aggr_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_buf,
+			 int err);
 void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 				    struct rxm_conn *rxm_conn);
 
@@ -838,8 +1004,8 @@ rxm_ep_msg_mr_regv(struct rxm_ep *rxm_ep, const struct iovec *iov, size_t count,
 		container_of(rxm_ep->util_ep.domain, struct rxm_domain, util_domain);
 
 	for (i = 0; i < count; i++) {
-		ret = fi_mr_reg(rxm_domain->msg_domain, iov[i].iov_base,
-				iov[i].iov_len, access, 0, 0, 0, &mr[i], NULL);
+		ret = rxm_msg_mr_reg_internal(rxm_domain, iov[i].iov_base,
+					      iov[i].iov_len, access, &mr[i]);
 		if (ret)
 			goto err;
 	}
@@ -860,8 +1026,8 @@ rxm_ep_msg_mr_regv_lim(struct rxm_ep *rxm_ep, const struct iovec *iov, size_t co
 
 	for (i = 0; i < count && total_reg_len; i++) {
 		size_t len = MIN(iov[i].iov_len, total_reg_len);
-		ret = fi_mr_reg(rxm_domain->msg_domain, iov[i].iov_base,
-				len, access, 0, 0, 0, &mr[i], NULL);
+		ret = rxm_msg_mr_reg_internal(rxm_domain, iov[i].iov_base,
+					      len, access, &mr[i]);
 		if (ret)
 			goto err;
 		total_reg_len -= len;
@@ -984,9 +1150,11 @@ rxm_process_recv_entry(struct rxm_recv_queue *recv_queue,
 	return FI_SUCCESS;
 }
 
+/* Tagged sends may be appended to the open aggregated send of the
+ * connection, so they don't flush it here */
 static inline ssize_t
-rxm_ep_prepare_tx(struct rxm_ep *rxm_ep, fi_addr_t dest_addr,
-		 struct rxm_conn **rxm_conn)
+rxm_ep_prepare_tagged_tx(struct rxm_ep *rxm_ep, fi_addr_t dest_addr,
+			 struct rxm_conn **rxm_conn)
 {
 	ssize_t ret;
 
@@ -1010,6 +1178,22 @@ rxm_ep_prepare_tx(struct rxm_ep *rxm_ep, fi_addr_t dest_addr,
 	return 0;
 }
 
+static inline ssize_t
+rxm_ep_prepare_tx(struct rxm_ep *rxm_ep, fi_addr_t dest_addr,
+		 struct rxm_conn **rxm_conn)
+{
+	ssize_t ret;
+
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, rxm_conn);
+	if (OFI_UNLIKELY(ret))
+		return ret;
+
+	/* Preserve ordering with previously aggregated messages */
+	if (OFI_UNLIKELY((*rxm_conn)->aggr_buf != NULL))
+		return rxm_ep_aggr_flush(rxm_ep, *rxm_conn);
+	return 0;
+}
+
 static inline void
 rxm_ep_format_tx_buf_pkt(struct rxm_conn *rxm_conn, size_t len, uint8_t op,
 			 uint64_t data, uint64_t tag, uint64_t flags,
@@ -1028,6 +1212,7 @@ static inline struct rxm_buf *
 rxm_tx_buf_alloc(struct rxm_ep *rxm_ep, enum rxm_buf_pool_type type)
 {
 	assert((type == RXM_BUF_POOL_TX) ||
+	       (type == RXM_BUF_POOL_TX_SMALL) ||
 	       (type == RXM_BUF_POOL_TX_INJECT) ||
 	       (type == RXM_BUF_POOL_TX_ACK) ||
 	       (type == RXM_BUF_POOL_TX_RNDV) ||
@@ -1036,6 +1221,26 @@ rxm_tx_buf_alloc(struct rxm_ep *rxm_ep, enum rxm_buf_pool_type type)
 	return ofi_buf_alloc(rxm_ep->buf_pools[type].pool);
 }
 
+/* Returns the end of the completion table of an aggregated send. Entries
+ * are stored in reverse order, growing towards the packed messages */
+static inline struct rxm_aggr_comp *
+rxm_aggr_comp_tbl(struct rxm_tx_eager_buf *tx_buf)
+{
+	return (struct rxm_aggr_comp *)
+		(tx_buf->pkt.data + (rxm_eager_limit & ~(size_t) 7));
+}
+
+/* Small eager messages are staged in a separate size class so that they
+ * don't pin a full RXM_BUF_SIZE buffer (and its registration) while the
+ * send is outstanding */
+static inline struct rxm_tx_eager_buf *
+rxm_tx_eager_buf_alloc(struct rxm_ep *rxm_ep, size_t data_len)
+{
+	return (struct rxm_tx_eager_buf *)
+		rxm_tx_buf_alloc(rxm_ep, (data_len <= rxm_tx_small_limit) ?
+				 RXM_BUF_POOL_TX_SMALL : RXM_BUF_POOL_TX);
+}
+
 
 static inline struct rxm_rx_buf *
 rxm_rx_buf_alloc(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep, uint8_t repost)
@@ -1048,9 +1253,12 @@ rxm_rx_buf_alloc(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep, uint8_t repost)
 		rx_buf->msg_ep = msg_ep;
 		rx_buf->repost = repost;
 
-		if (!rxm_ep->srx_ctx)
+		if (!rxm_ep->srx_ctx) {
 			rx_buf->conn = container_of(msg_ep->fid.context,
 						    struct rxm_conn, handle);
+			if (rx_buf->conn->primary)
+				rx_buf->conn = rx_buf->conn->primary;
+		}
 	}
 	return rx_buf;
 }
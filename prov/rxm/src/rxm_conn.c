@@ -243,6 +243,9 @@ static int rxm_conn_res_alloc(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
 	dlist_init(&rxm_conn->deferred_tx_queue);
 	dlist_init(&rxm_conn->sar_rx_msg_list);
 	dlist_init(&rxm_conn->sar_deferred_rx_msg_list);
+	dlist_init(&rxm_conn->sar_drop_list);
+	dlist_init(&rxm_conn->rndv_read_list);
+	dlist_init(&rxm_conn->aggr_entry);
 
 	if (rxm_ep->util_ep.domain->threading != FI_THREAD_SAFE) {
 		rxm_conn->inject_pkt =
@@ -269,10 +272,65 @@ static int rxm_conn_res_alloc(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
 	return 0;
 }
 
+/* Drop the transfers that are still waiting for room on the connection
+ * and take it off the endpoint's deferred queue */
+static void rxm_conn_free_deferred_tx_queue(struct rxm_conn *rxm_conn)
+{
+	struct rxm_deferred_tx_entry *def_tx_entry;
+
+	while (!dlist_empty(&rxm_conn->deferred_tx_queue)) {
+		def_tx_entry = container_of(rxm_conn->deferred_tx_queue.next,
+					    struct rxm_deferred_tx_entry, entry);
+		rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
+		if (def_tx_entry->type == RXM_DEFERRED_TX_RNDV_READ)
+			(void) rxm_cq_finish_rndv_read(
+				def_tx_entry->rndv_read.rx_buf, -FI_ECANCELED);
+		free(def_tx_entry);
+	}
+}
+
+/* Receive buffers of a closed MSG endpoint must not be posted again */
+static void rxm_conn_drop_reposts(struct rxm_ep *rxm_ep, struct fid_ep *msg_ep)
+{
+	struct rxm_rx_buf *rx_buf;
+	struct dlist_entry *tmp;
+
+	dlist_foreach_container_safe(&rxm_ep->repost_ready_list,
+				     struct rxm_rx_buf, rx_buf,
+				     repost_entry, tmp) {
+		if (rx_buf->msg_ep != msg_ep)
+			continue;
+		dlist_remove(&rx_buf->repost_entry);
+		ofi_buf_free(rx_buf);
+	}
+}
+
+/* Closing the MSG endpoint releases the transfers still queued on it, so
+ * the reads issued over it are accounted as failed and its receive
+ * buffers are dropped before the connection is freed */
+static void rxm_conn_aux_free(struct rxm_conn *aux)
+{
+	struct rxm_ep *rxm_ep = container_of(aux->handle.cmap->ep,
+					     struct rxm_ep, util_ep);
+	struct fid_ep *msg_ep = aux->msg_ep;
+
+	rxm_conn_close(&aux->handle);
+	rxm_conn_free_deferred_tx_queue(aux);
+	rxm_cq_abort_lane_reads(aux);
+	if (msg_ep && !rxm_ep->srx_ctx)
+		rxm_conn_drop_reposts(rxm_ep, msg_ep);
+	free(aux);
+}
+
 static void rxm_conn_free(struct rxm_cmap_handle *handle)
 {
 	struct rxm_conn *rxm_conn =
 		container_of(handle, struct rxm_conn, handle);
+	uint8_t i;
+
+	for (i = 0; i < rxm_conn->aux_cnt; i++)
+		rxm_conn_aux_free(rxm_conn->aux_conn[i]);
+	rxm_conn->aux_cnt = 0;
 
 	if (rxm_conn->msg_ep) {
 		if (fi_close(&rxm_conn->msg_ep->fid)) {
@@ -284,6 +342,18 @@ static void rxm_conn_free(struct rxm_cmap_handle *handle)
 		}
 		rxm_conn->msg_ep = NULL;
 	}
+
+	/* Messages of an open aggregated send were never sent, report them
+	 * as canceled */
+	if (rxm_conn->aggr_buf) {
+		dlist_remove_init(&rxm_conn->aggr_entry);
+		rxm_finish_aggr_send(container_of(rxm_conn->handle.cmap->ep,
+						  struct rxm_ep, util_ep),
+				     rxm_conn->aggr_buf, -FI_ECANCELED);
+		rxm_conn->aggr_buf = NULL;
+		rxm_conn->aggr_cnt = 0;
+	}
+	rxm_cq_free_sar_drop_list(rxm_conn);
 	rxm_conn_res_free(rxm_conn);
 	free(rxm_conn);
 }
@@ -857,6 +927,122 @@ static void rxm_conn_close(struct rxm_cmap_handle *handle)
 	rxm_conn->msg_ep = NULL;
 }
 
+/*
+ * Additional connections to a peer
+ *
+ * These aren't tracked by the cmap. They share the key of the primary
+ * connection, so whatever arrives over them is accounted to the primary
+ * connection by the peer, and are freed along with it.
+ */
+
+static struct rxm_conn *
+rxm_conn_aux_alloc(struct rxm_conn *primary, enum rxm_cmap_state state)
+{
+	struct rxm_cmap_handle *handle;
+	struct rxm_conn *aux;
+
+	if (primary->aux_cnt == RXM_MAX_CONN_PER_PEER - 1)
+		return NULL;
+
+	aux = calloc(1, sizeof(*aux));
+	if (!aux)
+		return NULL;
+
+	dlist_init(&aux->deferred_conn_entry);
+	dlist_init(&aux->deferred_tx_queue);
+	dlist_init(&aux->sar_rx_msg_list);
+	dlist_init(&aux->sar_deferred_rx_msg_list);
+	dlist_init(&aux->sar_drop_list);
+	dlist_init(&aux->rndv_read_list);
+	dlist_init(&aux->aggr_entry);
+
+	handle = &aux->handle;
+	handle->cmap = primary->handle.cmap;
+	handle->key = primary->handle.key;
+	handle->remote_key = primary->handle.remote_key;
+	handle->fi_addr = primary->handle.fi_addr;
+	RXM_CM_UPDATE_STATE(handle, state);
+
+	aux->primary = primary;
+	primary->aux_conn[primary->aux_cnt++] = aux;
+	return aux;
+}
+
+/* Unlink a rejected or shut down additional connection from its primary
+ * connection and free it */
+static void rxm_conn_aux_shutdown(struct rxm_conn *aux)
+{
+	struct rxm_cmap_handle *handle = &aux->handle;
+	struct rxm_conn *primary = aux->primary;
+	int connected = (handle->state == RXM_CMAP_CONNECTED);
+	uint8_t i;
+
+	RXM_CM_UPDATE_STATE(handle, RXM_CMAP_SHUTDOWN);
+
+	for (i = 0; i < primary->aux_cnt; i++) {
+		if (primary->aux_conn[i] == aux)
+			break;
+	}
+	assert(i < primary->aux_cnt);
+	primary->aux_conn[i] = primary->aux_conn[--primary->aux_cnt];
+	primary->aux_conn[primary->aux_cnt] = NULL;
+	if (primary->next_lane > primary->aux_cnt)
+		primary->next_lane = 0;
+
+	rxm_conn_aux_free(aux);
+	/* Segments may have been lost with the connection */
+	if (connected)
+		rxm_cq_abort_sar_rx(primary);
+}
+
+static void rxm_conn_aux_connect(struct rxm_ep *rxm_ep, struct rxm_conn *primary,
+				 size_t conn_cnt)
+{
+	struct rxm_cmap_handle *handle = &primary->handle;
+	struct rxm_conn *aux;
+	const void *addr;
+	int ret;
+
+	addr = handle->peer ? handle->peer->addr :
+	       ofi_av_get_addr(handle->cmap->av, handle->fi_addr);
+
+	while (primary->aux_cnt < conn_cnt - 1) {
+		aux = rxm_conn_aux_alloc(primary, RXM_CMAP_IDLE);
+		if (!aux) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "unable to allocate "
+				"additional connection to peer\n");
+			return;
+		}
+
+		ret = rxm_conn_connect(&rxm_ep->util_ep, &aux->handle, addr);
+		if (ret) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "unable to initiate "
+				"additional connection to peer: %d\n", ret);
+			rxm_conn_aux_shutdown(aux);
+			return;
+		}
+		handle = &aux->handle;
+		RXM_CM_UPDATE_STATE(handle, RXM_CMAP_CONNREQ_SENT);
+	}
+}
+
+static void rxm_conn_aux_process_connect(struct rxm_conn *aux)
+{
+	struct rxm_cmap_handle *handle = &aux->handle;
+
+	FI_DBG(&rxm_prov, FI_LOG_EP_CTRL, "additional connection %p to peer "
+	       "of %p established\n", aux, aux->primary);
+	RXM_CM_UPDATE_STATE(handle, RXM_CMAP_CONNECTED);
+}
+
+static void rxm_conn_aux_process_reject(struct rxm_conn *aux)
+{
+	FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "additional connection to peer "
+		"rejected, using %zu connection(s)\n",
+		rxm_conn_lane_cnt(aux->primary));
+	rxm_conn_aux_shutdown(aux);
+}
+
 static int rxm_conn_reprocess_directed_recvs(struct rxm_recv_queue *recv_queue)
 {
 	struct rxm_rx_buf *rx_buf;
@@ -1001,6 +1187,67 @@ static size_t rxm_conn_get_rx_size(struct rxm_ep *rxm_ep,
 		return msg_info->rx_attr->size;
 }
 
+static int
+rxm_msg_process_aux_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
+			    union rxm_cm_data *remote_cm_data, void *addr,
+			    union rxm_cm_data *cm_data)
+{
+	struct rxm_cmap *cmap = rxm_ep->cmap;
+	struct rxm_cmap_handle *handle;
+	struct rxm_conn *aux, *primary;
+	fi_addr_t fi_addr = ofi_ip_av_get_fi_addr(cmap->av, addr);
+	int ret;
+
+	if (fi_addr == FI_ADDR_NOTAVAIL)
+		handle = rxm_cmap_get_handle_peer(cmap, addr);
+	else
+		handle = rxm_cmap_acquire_handle(cmap, fi_addr);
+
+	if (!handle ||
+	    handle->remote_key != remote_cm_data->connect.client_conn_id ||
+	    (handle->state != RXM_CMAP_CONNREQ_RECV &&
+	     handle->state != RXM_CMAP_CONNECTED)) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "no primary connection "
+			"found for additional connection request\n");
+		return -FI_ENOTCONN;
+	}
+
+	/* Only as many connections as were advertised on accept */
+	primary = container_of(handle, struct rxm_conn, handle);
+	if (primary->aux_cnt >= rxm_conn_per_peer - 1) {
+		FI_DBG(&rxm_prov, FI_LOG_EP_CTRL, "rejecting additional "
+		       "connection request over the limit of %zu\n",
+		       rxm_conn_per_peer);
+		return -FI_ECONNREFUSED;
+	}
+
+	aux = rxm_conn_aux_alloc(primary, RXM_CMAP_CONNREQ_RECV);
+	if (!aux) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL, "unable to allocate "
+			"additional connection to peer\n");
+		return -FI_ENOMEM;
+	}
+
+	ret = rxm_msg_ep_open(rxm_ep, msg_info, aux, &aux->handle);
+	if (ret)
+		goto err;
+
+	cm_data->accept.server_conn_id = handle->key;
+	cm_data->accept.rx_size = rxm_conn_get_rx_size(rxm_ep, msg_info);
+
+	ret = fi_accept(aux->msg_ep, &cm_data->accept.server_conn_id,
+			sizeof(cm_data->accept));
+	if (ret) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_CTRL,
+			"Unable to accept additional connection\n");
+		goto err;
+	}
+	return 0;
+err:
+	rxm_conn_aux_shutdown(aux);
+	return ret;
+}
+
 static int
 rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 			union rxm_cm_data *remote_cm_data)
@@ -1039,6 +1286,15 @@ rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 	ofi_addr_set_port((struct sockaddr *)&remote_pep_addr,
 			  remote_cm_data->connect.port);
 
+	if (remote_cm_data->connect.conn_idx) {
+		ret = rxm_msg_process_aux_connreq(rxm_ep, msg_info,
+						  remote_cm_data,
+						  &remote_pep_addr, &cm_data);
+		if (ret)
+			goto err1;
+		return 0;
+	}
+
 	ret = rxm_cmap_process_connreq(rxm_ep->cmap, &remote_pep_addr,
 				       &handle, &reject_cm_data.reject.reason);
 	if (ret)
@@ -1056,6 +1312,7 @@ rxm_msg_process_connreq(struct rxm_ep *rxm_ep, struct fi_info *msg_info,
 
 	cm_data.accept.server_conn_id = rxm_conn->handle.key;
 	cm_data.accept.rx_size = rxm_conn_get_rx_size(rxm_ep, msg_info);
+	cm_data.accept.conn_per_peer = (uint8_t) rxm_conn_per_peer;
 
 	ret = fi_accept(rxm_conn->msg_ep, &cm_data.accept.server_conn_id,
 			sizeof(cm_data.accept));
@@ -1118,6 +1375,7 @@ rxm_conn_handle_event(struct rxm_ep *rxm_ep, struct rxm_msg_eq_entry *entry)
 {
 	union rxm_cm_data *cm_data = entry->err_entry.err_data;
 	enum rxm_cmap_reject_reason reject_reason;
+	struct rxm_conn *rxm_conn;
 
 	if (entry->rd == -FI_ECONNREFUSED) {
 		if (OFI_UNLIKELY(entry->err_entry.err_data_size !=
@@ -1156,8 +1414,12 @@ rxm_conn_handle_event(struct rxm_ep *rxm_ep, struct rxm_msg_eq_entry *entry)
 			        "received unknown reject reason: %d\n",
 				reject_reason);
 		}
-		rxm_cmap_process_reject(rxm_ep->cmap, entry->context,
-					reject_reason);
+		rxm_conn = container_of(entry->context, struct rxm_conn, handle);
+		if (rxm_conn->primary)
+			rxm_conn_aux_process_reject(rxm_conn);
+		else
+			rxm_cmap_process_reject(rxm_ep->cmap, entry->context,
+						reject_reason);
 		return 0;
 	}
 
@@ -1186,15 +1448,35 @@ rxm_conn_handle_event(struct rxm_ep *rxm_ep, struct rxm_msg_eq_entry *entry)
 		FI_DBG(&rxm_prov, FI_LOG_EP_CTRL,
 		       "connection successful\n");
 		cm_data = (void *)entry->cm_entry.data;
+		rxm_conn = container_of(entry->cm_entry.fid->context,
+					struct rxm_conn, handle);
+		if (rxm_conn->primary) {
+			rxm_conn_aux_process_connect(rxm_conn);
+			break;
+		}
 		rxm_cmap_process_connect(rxm_ep->cmap,
 					 entry->cm_entry.fid->context,
 					 ((entry->rd - sizeof(entry->cm_entry)) ?
 					  cm_data : NULL));
+		/* Additional connections are set up by the side that
+		 * initiated the primary one, if the peer advertised them */
+		if (rxm_conn_per_peer > 1 &&
+		    (entry->rd - sizeof(entry->cm_entry)) &&
+		    cm_data->accept.conn_per_peer > 1)
+			rxm_conn_aux_connect(rxm_ep, rxm_conn,
+					     MIN(rxm_conn_per_peer,
+						 cm_data->accept.conn_per_peer));
 		rxm_conn_wake_up_wait_obj(rxm_ep);
 		break;
 	case FI_SHUTDOWN:
 		FI_DBG(&rxm_prov, FI_LOG_EP_CTRL,
 		       "Received connection shutdown\n");
+		rxm_conn = container_of(entry->cm_entry.fid->context,
+					struct rxm_conn, handle);
+		if (rxm_conn->primary) {
+			rxm_conn_aux_shutdown(rxm_conn);
+			break;
+		}
 		rxm_cmap_process_shutdown(rxm_ep->cmap,
 					  entry->cm_entry.fid->context);
 		break;
@@ -1474,6 +1756,9 @@ rxm_conn_connect(struct util_ep *util_ep, struct rxm_cmap_handle *handle,
 		goto err;
 
 	cm_data.connect.rx_size = rxm_conn_get_rx_size(rxm_ep, rxm_ep->msg_info);
+	/* An additional connection is the last one added to its primary */
+	if (rxm_conn->primary)
+		cm_data.connect.conn_idx = rxm_conn->primary->aux_cnt;
 
 	ret = fi_connect(rxm_conn->msg_ep, rxm_ep->msg_info->dest_addr,
 			 &cm_data, sizeof(cm_data));
@@ -246,6 +246,19 @@ static int rxm_finish_recv(struct rxm_rx_buf *rx_buf, size_t done_len)
 	return FI_SUCCESS;
 }
 
+/* Report a receive that can't be completed and give its entry back */
+static ssize_t rxm_cq_fail_recv(struct rxm_ep *rxm_ep,
+				struct rxm_recv_entry *recv_entry, int err)
+{
+	rxm_cq_write_error(rxm_ep->util_ep.rx_cq, rxm_ep->util_ep.rx_cntr,
+			   recv_entry->context, err);
+	if (recv_entry->flags & FI_MULTI_RECV)
+		return rxm_process_recv_entry(recv_entry->recv_queue,
+					      recv_entry);
+	rxm_recv_entry_release(recv_entry->recv_queue, recv_entry);
+	return 0;
+}
+
 static inline int
 rxm_cq_tx_comp_write(struct rxm_ep *rxm_ep, uint64_t comp_flags,
 		     void *app_context,  uint64_t flags)
@@ -296,6 +309,40 @@ int rxm_finish_eager_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_buf
 	return ret;
 }
 
+int rxm_finish_aggr_send(struct rxm_ep *rxm_ep, struct rxm_tx_eager_buf *tx_buf,
+			 int err)
+{
+	struct rxm_aggr_comp *comp = rxm_aggr_comp_tbl(tx_buf);
+	struct rxm_aggr_hdr *aggr_hdr;
+	size_t offset;
+	int ret = 0;
+
+	for (offset = 0; offset < tx_buf->pkt.hdr.size;
+	     offset += rxm_aggr_entry_size(aggr_hdr->size)) {
+		aggr_hdr = (struct rxm_aggr_hdr *) (tx_buf->pkt.data + offset);
+		comp--;
+
+		if (OFI_UNLIKELY(err)) {
+			rxm_cq_write_error(rxm_ep->util_ep.tx_cq,
+					   rxm_ep->util_ep.tx_cntr,
+					   comp->app_context, err);
+			continue;
+		}
+		if (!ret)
+			ret = rxm_cq_tx_comp_write(rxm_ep,
+						   ofi_tx_cq_flags(ofi_op_tagged),
+						   comp->app_context,
+						   comp->flags);
+		ofi_ep_tx_cntr_inc(&rxm_ep->util_ep);
+	}
+
+	/* Restore the eager buffer before returning it to the pool */
+	tx_buf->hdr.state = RXM_TX;
+	tx_buf->pkt.ctrl_hdr.type = rxm_ctrl_eager;
+	ofi_buf_free(tx_buf);
+	return ret;
+}
+
 static inline int rxm_finish_sar_segment_send(struct rxm_ep *rxm_ep, struct rxm_tx_sar_buf *tx_buf)
 {
 	int ret = FI_SUCCESS;
@@ -315,7 +362,7 @@ static inline int rxm_finish_sar_segment_send(struct rxm_ep *rxm_ep, struct rxm_
 		ofi_ep_tx_cntr_inc(&rxm_ep->util_ep);
 		first_tx_buf = ofi_bufpool_get_ibuf(rxm_ep->
 					buf_pools[RXM_BUF_POOL_TX_SAR].pool,
-					tx_buf->pkt.ctrl_hdr.msg_id);
+					RXM_SAR_MSG_ID_INDEX(tx_buf->pkt.ctrl_hdr.msg_id));
 		ofi_buf_free(first_tx_buf);
 		ofi_buf_free(tx_buf);
 		break;
@@ -393,21 +440,26 @@ static int rxm_rx_buf_match_msg_id(struct dlist_entry *item, const void *arg)
 static inline
 ssize_t rxm_cq_copy_seg_data(struct rxm_rx_buf *rx_buf, int *done)
 {
-	uint64_t done_len = ofi_copy_to_iov(rx_buf->recv_entry->rxm_iov.iov,
-					    rx_buf->recv_entry->rxm_iov.count,
-					    rx_buf->recv_entry->sar.total_recv_len,
-					    rx_buf->pkt.data,
-					    rx_buf->pkt.ctrl_hdr.seg_size);
-	rx_buf->recv_entry->sar.total_recv_len += done_len;
+	uint64_t done_len;
+
+	/* Segments striped over several connections may arrive out of
+	 * order, so place them by segment number and count the received
+	 * bytes (truncated data included) to know when the message is done */
+	ofi_copy_to_iov(rx_buf->recv_entry->rxm_iov.iov,
+			rx_buf->recv_entry->rxm_iov.count,
+			(uint64_t)rx_buf->pkt.ctrl_hdr.seg_no * rxm_eager_limit,
+			rx_buf->pkt.data, rx_buf->pkt.ctrl_hdr.seg_size);
+	rx_buf->recv_entry->sar.total_recv_len += rx_buf->pkt.ctrl_hdr.seg_size;
 
-	if ((rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) == RXM_SAR_SEG_LAST) ||
-	    (done_len != rx_buf->pkt.ctrl_hdr.seg_size)) {
-		dlist_remove(&rx_buf->recv_entry->sar.entry);
+	if (rx_buf->recv_entry->sar.total_recv_len >= rx_buf->pkt.hdr.size) {
+		if (rx_buf->recv_entry->sar.msg_id != RXM_SAR_RX_INIT)
+			dlist_remove(&rx_buf->recv_entry->sar.entry);
 
 		/* Mark rxm_recv_entry::msg_id as unknown for futher re-use */
 		rx_buf->recv_entry->sar.msg_id = RXM_SAR_RX_INIT;
 
-		done_len = rx_buf->recv_entry->sar.total_recv_len;
+		done_len = MIN(rx_buf->pkt.hdr.size,
+			       rx_buf->recv_entry->total_len);
 		rx_buf->recv_entry->sar.total_recv_len = 0;
 
 		*done = 1;
@@ -435,11 +487,103 @@ ssize_t rxm_cq_copy_seg_data(struct rxm_rx_buf *rx_buf, int *done)
 	}
 }
 
+/* A SAR message that lost segments along with an additional connection */
+struct rxm_sar_drop {
+	struct dlist_entry entry;
+	uint64_t msg_id;
+};
+
+static int rxm_sar_match_drop(struct dlist_entry *item, const void *arg)
+{
+	struct rxm_sar_drop *drop = container_of(item, struct rxm_sar_drop,
+						 entry);
+	return drop->msg_id == *((uint64_t *)arg);
+}
+
+static int rxm_sar_msg_dropped(struct rxm_conn *rxm_conn, uint64_t msg_id)
+{
+	return !dlist_empty(&rxm_conn->sar_drop_list) &&
+	       dlist_find_first_match(&rxm_conn->sar_drop_list,
+				      rxm_sar_match_drop, &msg_id);
+}
+
+static void rxm_sar_drop_msg(struct rxm_conn *rxm_conn, uint64_t msg_id)
+{
+	struct rxm_sar_drop *drop;
+
+	if (rxm_sar_msg_dropped(rxm_conn, msg_id))
+		return;
+
+	drop = calloc(1, sizeof(*drop));
+	if (OFI_UNLIKELY(!drop)) {
+		FI_WARN(&rxm_prov, FI_LOG_CQ, "unable to allocate memory, "
+			"late segments of aborted message 0x%" PRIx64
+			" may be delivered\n", msg_id);
+		return;
+	}
+	drop->msg_id = msg_id;
+	dlist_insert_tail(&drop->entry, &rxm_conn->sar_drop_list);
+}
+
+void rxm_cq_free_sar_drop_list(struct rxm_conn *rxm_conn)
+{
+	struct rxm_sar_drop *drop;
+
+	while (!dlist_empty(&rxm_conn->sar_drop_list)) {
+		dlist_pop_front(&rxm_conn->sar_drop_list, struct rxm_sar_drop,
+				drop, entry);
+		free(drop);
+	}
+}
+
+/* An additional connection went away, possibly with SAR segments still in
+ * flight over it.  Fail the messages being reassembled and the ones with
+ * segments held for their first segment.  Their remaining segments are
+ * dropped as they arrive. */
+void rxm_cq_abort_sar_rx(struct rxm_conn *rxm_conn)
+{
+	struct rxm_ep *rxm_ep = container_of(rxm_conn->handle.cmap->ep,
+					     struct rxm_ep, util_ep);
+	struct rxm_recv_entry *recv_entry;
+	struct rxm_rx_buf *rx_buf;
+	struct dlist_entry *tmp;
+
+	while (!dlist_empty(&rxm_conn->sar_rx_msg_list)) {
+		dlist_pop_front(&rxm_conn->sar_rx_msg_list,
+				struct rxm_recv_entry, recv_entry, sar.entry);
+		rxm_sar_drop_msg(rxm_conn, recv_entry->sar.msg_id);
+		recv_entry->sar.msg_id = RXM_SAR_RX_INIT;
+		recv_entry->sar.total_recv_len = 0;
+		(void) rxm_cq_fail_recv(rxm_ep, recv_entry, -FI_ECONNABORTED);
+	}
+
+	dlist_foreach_container_safe(&rxm_conn->sar_deferred_rx_msg_list,
+				     struct rxm_rx_buf, rx_buf,
+				     unexp_msg.entry, tmp) {
+		dlist_remove(&rx_buf->unexp_msg.entry);
+		rxm_sar_drop_msg(rxm_conn, rx_buf->pkt.ctrl_hdr.msg_id);
+		ofi_buf_free(rx_buf);
+	}
+}
+
 ssize_t rxm_cq_handle_seg_data(struct rxm_rx_buf *rx_buf)
 {
+	struct rxm_recv_entry *recv_entry;
+	struct rxm_ep *rxm_ep;
 	int done;
 
-	if (rx_buf->ep->rxm_info->mode & FI_BUFFERED_RECV) {
+	/* The first segment of an aborted message fails its receive */
+	if (OFI_UNLIKELY(rxm_sar_msg_dropped(rx_buf->conn,
+					     rx_buf->pkt.ctrl_hdr.msg_id))) {
+		recv_entry = rx_buf->recv_entry;
+		rxm_ep = rx_buf->ep;
+		rxm_rx_buf_finish(rx_buf);
+		return rxm_cq_fail_recv(rxm_ep, recv_entry, -FI_ECONNABORTED);
+	}
+
+	/* Pick up the segments that arrived ahead of the one that matched */
+	if ((rx_buf->ep->rxm_info->mode & FI_BUFFERED_RECV) ||
+	    rx_buf->conn->aux_cnt) {
 		struct rxm_recv_entry *recv_entry = rx_buf->recv_entry;
 		struct rxm_conn *conn = rx_buf->conn;
 		uint64_t msg_id = rx_buf->pkt.ctrl_hdr.msg_id;
@@ -468,22 +612,21 @@ ssize_t rxm_cq_handle_seg_data(struct rxm_rx_buf *rx_buf)
 }
 
 static inline ssize_t
-rxm_cq_rndv_read_prepare_deferred(struct rxm_deferred_tx_entry **def_tx_entry, size_t index,
-				 struct iovec *iov, void *desc[RXM_IOV_LIMIT],
-				 size_t count, struct rxm_rx_buf *rx_buf)
+rxm_cq_rndv_read_prepare_deferred(struct rxm_deferred_tx_entry **def_tx_entry,
+				  struct rxm_conn *lane, uint64_t addr, uint64_t key,
+				  struct iovec *iov, void *desc[RXM_IOV_LIMIT],
+				  size_t count, struct rxm_rx_buf *rx_buf)
 {
 	uint8_t i;
 
-	*def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rx_buf->ep, rx_buf->conn,
+	*def_tx_entry = rxm_ep_alloc_deferred_tx_entry(rx_buf->ep, lane,
 						       RXM_DEFERRED_TX_RNDV_READ);
 	if (OFI_UNLIKELY(!*def_tx_entry))
 		return -FI_ENOMEM;
 
 	(*def_tx_entry)->rndv_read.rx_buf = rx_buf;
-	(*def_tx_entry)->rndv_read.rma_iov.addr =
-			rx_buf->rndv_hdr->iov[index].addr;
-	(*def_tx_entry)->rndv_read.rma_iov.key =
-			rx_buf->rndv_hdr->iov[index].key;
+	(*def_tx_entry)->rndv_read.rma_iov.addr = addr;
+	(*def_tx_entry)->rndv_read.rma_iov.key = key;
 	for (i = 0; i < count; i++) {
 		(*def_tx_entry)->rndv_read.rxm_iov.iov[i] = iov[i];
 		(*def_tx_entry)->rndv_read.rxm_iov.desc[i] = desc[i];
@@ -493,9 +636,59 @@ rxm_cq_rndv_read_prepare_deferred(struct rxm_deferred_tx_entry **def_tx_entry, s
 	return 0;
 }
 
+/* Reads over an additional connection carry their own context, which is
+ * linked to the connection until the read completes */
+ssize_t rxm_cq_post_rndv_read(struct rxm_rx_buf *rx_buf, struct rxm_conn *lane,
+			      const struct iovec *iov, void **desc,
+			      size_t count, uint64_t addr, uint64_t key)
+{
+	struct rxm_rndv_lane_read *lane_read;
+	ssize_t ret;
+
+	if (!lane->primary)
+		return fi_readv(lane->msg_ep, iov, desc, count, 0, addr, key,
+				rx_buf);
+
+	lane_read = calloc(1, sizeof(*lane_read));
+	if (OFI_UNLIKELY(!lane_read))
+		return -FI_ENOMEM;
+	lane_read->hdr.state = RXM_RNDV_LANE_READ;
+	lane_read->rx_buf = rx_buf;
+
+	ret = fi_readv(lane->msg_ep, iov, desc, count, 0, addr, key, lane_read);
+	if (OFI_UNLIKELY(ret)) {
+		free(lane_read);
+		return ret;
+	}
+	dlist_insert_tail(&lane_read->entry, &lane->rndv_read_list);
+	return 0;
+}
+
+static inline ssize_t
+rxm_cq_rndv_read(struct rxm_rx_buf *rx_buf, struct rxm_conn *lane,
+		 uint64_t addr, uint64_t key, struct iovec *iov,
+		 void *desc[RXM_IOV_LIMIT], size_t count)
+{
+	struct rxm_deferred_tx_entry *def_tx_entry;
+	ssize_t ret;
+
+	rx_buf->rndv_rma_cnt++;
+	ret = rxm_cq_post_rndv_read(rx_buf, lane, iov, desc, count, addr, key);
+	if (OFI_LIKELY(ret != -FI_EAGAIN))
+		return ret;
+
+	ret = rxm_cq_rndv_read_prepare_deferred(&def_tx_entry, lane, addr, key,
+						iov, desc, count, rx_buf);
+	if (ret)
+		return ret;
+	rxm_ep_enqueue_deferred_tx_queue(def_tx_entry);
+	return 0;
+}
+
 ssize_t rxm_cq_handle_rndv(struct rxm_rx_buf *rx_buf)
 {
 	size_t i, index = 0, offset = 0, count, total_recv_len;
+	size_t lane_cnt, chunk_len, rma_offset, len;
 	struct iovec iov[RXM_IOV_LIMIT];
 	void *desc[RXM_IOV_LIMIT];
 	struct rxm_rx_buf *new_rx_buf;
@@ -526,6 +719,8 @@ ssize_t rxm_cq_handle_rndv(struct rxm_rx_buf *rx_buf)
 
 	rx_buf->rndv_hdr = (struct rxm_rndv_hdr *)rx_buf->pkt.data;
 	rx_buf->rndv_rma_index = 0;
+	rx_buf->rndv_rma_cnt = 0;
+	rx_buf->rndv_rma_err = 0;
 
 	if (!rx_buf->ep->rxm_mr_local) {
 		total_recv_len = MIN(rx_buf->recv_entry->total_len,
@@ -555,42 +750,40 @@ ssize_t rxm_cq_handle_rndv(struct rxm_rx_buf *rx_buf)
 
 	RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RNDV_READ);
 
+	/* Split the reads over the connections to the peer, if any */
+	lane_cnt = rxm_conn_lane_cnt(rx_buf->conn);
+
 	for (i = 0; i < rx_buf->rndv_hdr->count; i++) {
 		size_t copy_len = MIN(rx_buf->rndv_hdr->iov[i].len,
 				      total_recv_len);
 
-		ret = ofi_copy_iov_desc(&iov[0], &desc[0], &count,
-					&rx_buf->recv_entry->rxm_iov.iov[0],
-					&rx_buf->recv_entry->rxm_iov.desc[0],
-					rx_buf->recv_entry->rxm_iov.count,
-					&index, &offset, copy_len);
-		if (ret) {
-			assert(ret == -FI_ETOOSMALL);
-			return rxm_cq_write_error_trunc(
-				rx_buf, rx_buf->recv_entry->total_len);
-		}
-		total_recv_len -= copy_len;
-		ret = fi_readv(rx_buf->conn->msg_ep, iov, desc, count, 0,
-			       rx_buf->rndv_hdr->iov[i].addr,
-			       rx_buf->rndv_hdr->iov[i].key, rx_buf);
-		if (OFI_UNLIKELY(ret)) {
-			if (OFI_LIKELY(ret == -FI_EAGAIN)) {
-				struct rxm_deferred_tx_entry *def_tx_entry;
-
-				ret = rxm_cq_rndv_read_prepare_deferred(
-						&def_tx_entry, i, iov, desc,
-						count, rx_buf);
-				if (ret)
-					goto readv_err;
-				rxm_ep_enqueue_deferred_tx_queue(def_tx_entry);
-				continue;
+		chunk_len = ofi_div_ceil(copy_len, lane_cnt);
+		rma_offset = 0;
+		do {
+			len = MIN(chunk_len, copy_len - rma_offset);
+			ret = ofi_copy_iov_desc(&iov[0], &desc[0], &count,
+						&rx_buf->recv_entry->rxm_iov.iov[0],
+						&rx_buf->recv_entry->rxm_iov.desc[0],
+						rx_buf->recv_entry->rxm_iov.count,
+						&index, &offset, len);
+			if (ret) {
+				assert(ret == -FI_ETOOSMALL);
+				return rxm_cq_write_error_trunc(
+					rx_buf, rx_buf->recv_entry->total_len);
 			}
-readv_err:
-			rxm_cq_write_error(rx_buf->ep->util_ep.rx_cq,
-					   rx_buf->ep->util_ep.rx_cntr,
-					   rx_buf->recv_entry->context, ret);
-			break;
-		}
+			ret = rxm_cq_rndv_read(rx_buf,
+					       rxm_conn_next_lane(rx_buf->conn),
+					       rx_buf->rndv_hdr->iov[i].addr +
+					       rma_offset,
+					       rx_buf->rndv_hdr->iov[i].key,
+					       iov, desc, count);
+			/* The message fails once the reads already issued
+			 * are done */
+			if (OFI_UNLIKELY(ret))
+				return rxm_cq_finish_rndv_read(rx_buf, (int) ret);
+			rma_offset += len;
+		} while (rma_offset < copy_len);
+		total_recv_len -= copy_len;
 	}
 	assert(!total_recv_len);
 	return ret;
@@ -656,11 +849,16 @@ rxm_cq_match_rx_buf(struct rxm_rx_buf *rx_buf,
 		       "queue\n");
 		rx_buf->unexp_msg.addr = match_attr->addr;
 		rx_buf->unexp_msg.tag = match_attr->tag;
-		rx_buf->repost = 0;
 
 		dlist_insert_tail(&rx_buf->unexp_msg.entry,
 				  &recv_queue->unexp_msg_list);
 
+		/* Buffers unpacked from an aggregated message aren't posted
+		 * to the MSG EP, so there's nothing to replace */
+		if (!rx_buf->repost)
+			return 0;
+		rx_buf->repost = 0;
+
 		msg_ep = rx_buf->msg_ep;
 		rxm_ep = rx_buf->ep;
 
@@ -680,6 +878,75 @@ rxm_cq_match_rx_buf(struct rxm_rx_buf *rx_buf,
 	return rxm_cq_handle_rx_buf(rx_buf);
 }
 
+/* Called by the MSG provider once the RxM header of a message has been
+ * received into rx_buf. An eager message that matches a posted receive is
+ * claimed here and its payload is placed straight into the user buffer,
+ * which saves the copy out of rx_buf. Anything else is left to the regular
+ * receive path. */
+ssize_t rxm_get_dynamic_rbuf(void *context, size_t msg_len,
+			     struct iovec *iov, size_t iov_limit)
+{
+	struct rxm_rx_buf *rx_buf = context;
+	struct rxm_ep *rxm_ep = rx_buf->ep;
+	struct rxm_recv_queue *recv_queue;
+	struct rxm_recv_entry *recv_entry;
+	struct dlist_entry *entry;
+	struct rxm_recv_match_attr match_attr = {
+		.addr = FI_ADDR_UNSPEC,
+	};
+
+	if ((rx_buf->pkt.hdr.version != OFI_OP_VERSION) ||
+	    (rx_buf->pkt.ctrl_hdr.version != RXM_CTRL_VERSION) ||
+	    (rx_buf->pkt.ctrl_hdr.type != rxm_ctrl_eager) ||
+	    (msg_len != sizeof(rx_buf->pkt) + rx_buf->pkt.hdr.size) ||
+	    (rxm_ep->rxm_info->mode & FI_BUFFERED_RECV))
+		return 0;
+
+	switch (rx_buf->pkt.hdr.op) {
+	case ofi_op_msg:
+		recv_queue = &rxm_ep->recv_queue;
+		break;
+	case ofi_op_tagged:
+		/* Collective messages don't complete to the user */
+		if (rx_buf->pkt.hdr.tag & OFI_COLL_TAG_FLAG)
+			return 0;
+		recv_queue = &rxm_ep->trecv_queue;
+		match_attr.tag = rx_buf->pkt.hdr.tag;
+		break;
+	default:
+		return 0;
+	}
+
+	if (rxm_ep->rxm_info->caps & (FI_SOURCE | FI_DIRECTED_RECV)) {
+		if (rxm_ep->srx_ctx)
+			rx_buf->conn =
+				rxm_key2conn(rxm_ep, rx_buf->pkt.ctrl_hdr.conn_id);
+		if (OFI_UNLIKELY(!rx_buf->conn))
+			return 0;
+		match_attr.addr = rx_buf->conn->handle.fi_addr;
+	}
+
+	entry = dlist_find_first_match(&recv_queue->recv_list,
+				       recv_queue->match_recv, &match_attr);
+	if (!entry)
+		return 0;
+
+	/* Multi-recv buffers and truncated receives take the copy path */
+	recv_entry = container_of(entry, struct rxm_recv_entry, entry);
+	if ((recv_entry->flags & FI_MULTI_RECV) ||
+	    (recv_entry->rxm_iov.count > iov_limit) ||
+	    (recv_entry->total_len < rx_buf->pkt.hdr.size))
+		return 0;
+
+	dlist_remove(entry);
+	rx_buf->recv_entry = recv_entry;
+	RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RX_DIRECT);
+
+	memcpy(iov, recv_entry->rxm_iov.iov,
+	       sizeof(*iov) * recv_entry->rxm_iov.count);
+	return recv_entry->rxm_iov.count;
+}
+
 static inline ssize_t rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 {
 	struct rxm_recv_match_attr match_attr = {
@@ -715,6 +982,53 @@ static inline ssize_t rxm_handle_recv_comp(struct rxm_rx_buf *rx_buf)
 	}
 }
 
+/* Unpack the messages of an aggregated packet into separate rx buffers so
+ * that each of them goes through matching (and possibly the unexpected
+ * queue) on its own */
+static ssize_t rxm_handle_aggr_recv(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_aggr_hdr *aggr_hdr;
+	struct rxm_rx_buf *msg_buf;
+	size_t offset, entry_size;
+	ssize_t ret = 0;
+
+	for (offset = 0; offset < rx_buf->pkt.hdr.size; offset += entry_size) {
+		aggr_hdr = (struct rxm_aggr_hdr *) (rx_buf->pkt.data + offset);
+		entry_size = rxm_aggr_entry_size(aggr_hdr->size);
+		if (OFI_UNLIKELY(offset + entry_size > rx_buf->pkt.hdr.size)) {
+			FI_WARN(&rxm_prov, FI_LOG_CQ,
+				"Malformed aggregated message\n");
+			ret = -FI_EIO;
+			break;
+		}
+
+		msg_buf = rxm_rx_buf_alloc(rx_buf->ep, rx_buf->msg_ep, 0);
+		if (OFI_UNLIKELY(!msg_buf)) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+				"ran out of buffers from RX buffer pool\n");
+			ret = -FI_ENOMEM;
+			break;
+		}
+
+		msg_buf->conn = rx_buf->conn;
+		msg_buf->pkt.ctrl_hdr = rx_buf->pkt.ctrl_hdr;
+		msg_buf->pkt.ctrl_hdr.type = rxm_ctrl_eager;
+		msg_buf->pkt.hdr = rx_buf->pkt.hdr;
+		msg_buf->pkt.hdr.size = aggr_hdr->size;
+		msg_buf->pkt.hdr.tag = aggr_hdr->tag;
+		msg_buf->pkt.hdr.data = aggr_hdr->data;
+		msg_buf->pkt.hdr.flags = aggr_hdr->flags;
+		memcpy(msg_buf->pkt.data, aggr_hdr + 1, aggr_hdr->size);
+
+		ret = rxm_handle_recv_comp(msg_buf);
+		if (OFI_UNLIKELY(ret))
+			break;
+	}
+
+	rxm_rx_buf_finish(rx_buf);
+	return ret;
+}
+
 static int rxm_sar_match_msg_id(struct dlist_entry *item, const void *arg)
 {
 	uint64_t msg_id = *((uint64_t *)arg);
@@ -723,6 +1037,28 @@ static int rxm_sar_match_msg_id(struct dlist_entry *item, const void *arg)
 	return (msg_id == recv_entry->sar.msg_id);
 }
 
+/* Hold a segment that overtook the first one of its message over another
+ * connection to the peer. Message matching is done on the first segment
+ * only, which is always sent over the primary connection. */
+static ssize_t rxm_sar_defer_segment(struct rxm_rx_buf *rx_buf)
+{
+	struct rxm_rx_buf *new_rx_buf;
+
+	new_rx_buf = rxm_rx_buf_alloc(rx_buf->ep, rx_buf->msg_ep, 1);
+	if (OFI_UNLIKELY(!new_rx_buf)) {
+		FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+			"ran out of buffers from RX buffer pool\n");
+		return -FI_ENOMEM;
+	}
+	dlist_insert_tail(&new_rx_buf->repost_entry,
+			  &new_rx_buf->ep->repost_ready_list);
+
+	rx_buf->repost = 0;
+	dlist_insert_tail(&rx_buf->unexp_msg.entry,
+			  &rx_buf->conn->sar_deferred_rx_msg_list);
+	return 0;
+}
+
 static inline
 ssize_t rxm_sar_handle_segment(struct rxm_rx_buf *rx_buf)
 {
@@ -735,11 +1071,22 @@ ssize_t rxm_sar_handle_segment(struct rxm_rx_buf *rx_buf)
 	FI_DBG(&rxm_prov, FI_LOG_CQ,
 	       "Got incoming recv with msg_id: 0x%" PRIx64 "for conn - %p\n",
 	       rx_buf->pkt.ctrl_hdr.msg_id, rx_buf->conn);
+	if (OFI_UNLIKELY(rxm_sar_msg_dropped(rx_buf->conn,
+					     rx_buf->pkt.ctrl_hdr.msg_id)) &&
+	    rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) != RXM_SAR_SEG_FIRST) {
+		rxm_rx_buf_finish(rx_buf);
+		return 0;
+	}
 	sar_entry = dlist_find_first_match(&rx_buf->conn->sar_rx_msg_list,
 					   rxm_sar_match_msg_id,
 					   &rx_buf->pkt.ctrl_hdr.msg_id);
-	if (!sar_entry)
+	if (!sar_entry) {
+		if (rx_buf->conn->aux_cnt &&
+		    rxm_sar_get_seg_type(&rx_buf->pkt.ctrl_hdr) !=
+		    RXM_SAR_SEG_FIRST)
+			return rxm_sar_defer_segment(rx_buf);
 		return rxm_handle_recv_comp(rx_buf);
+	}
 	rx_buf->recv_entry =
 		container_of(sar_entry, struct rxm_recv_entry, sar.entry);
 	return rx_buf->ep->txrx_ops->handle_seg_data_rx(rx_buf);
@@ -837,6 +1184,51 @@ err:
 	return ret;
 }
 
+/* Account for a finished rendezvous read.  Once all reads of the message
+ * are done, acknowledge it, or fail the receive with the first error. */
+ssize_t rxm_cq_finish_rndv_read(struct rxm_rx_buf *rx_buf, int err)
+{
+	struct rxm_recv_entry *recv_entry = rx_buf->recv_entry;
+	struct rxm_ep *rxm_ep = rx_buf->ep;
+
+	if (err && !rx_buf->rndv_rma_err)
+		rx_buf->rndv_rma_err = err;
+	if (++rx_buf->rndv_rma_index < rx_buf->rndv_rma_cnt)
+		return 0;
+	if (!rx_buf->rndv_rma_err)
+		return rxm_rndv_send_ack(rx_buf);
+
+	RXM_UPDATE_STATE(FI_LOG_CQ, rx_buf, RXM_RNDV_FINISH);
+	if (!rxm_ep->rxm_mr_local)
+		rxm_ep_msg_mr_closev(rx_buf->mr, recv_entry->rxm_iov.count);
+	err = rx_buf->rndv_rma_err;
+	rxm_rx_buf_finish(rx_buf);
+	return rxm_cq_fail_recv(rxm_ep, recv_entry, err);
+}
+
+static ssize_t
+rxm_cq_finish_lane_read(struct rxm_rndv_lane_read *lane_read, int err)
+{
+	struct rxm_rx_buf *rx_buf = lane_read->rx_buf;
+
+	dlist_remove(&lane_read->entry);
+	free(lane_read);
+	return rxm_cq_finish_rndv_read(rx_buf, err);
+}
+
+/* The reads still linked to an additional connection were released along
+ * with its MSG endpoint and won't complete */
+void rxm_cq_abort_lane_reads(struct rxm_conn *lane)
+{
+	struct rxm_rndv_lane_read *lane_read;
+
+	while (!dlist_empty(&lane->rndv_read_list)) {
+		lane_read = container_of(lane->rndv_read_list.next,
+					 struct rxm_rndv_lane_read, entry);
+		(void) rxm_cq_finish_lane_read(lane_read, -FI_ECONNABORTED);
+	}
+}
+
 
 
 static int rxm_handle_remote_write(struct rxm_ep *rxm_ep,
@@ -1144,6 +1536,9 @@ static ssize_t rxm_cq_handle_comp(struct rxm_ep *rxm_ep,
 		ret = rxm_ep->txrx_ops->comp_eager_tx(rxm_ep, tx_eager_buf);
 		ofi_buf_free(tx_eager_buf);
 		return ret;
+	case RXM_AGGR_TX:
+		assert(comp->flags & FI_SEND);
+		return rxm_finish_aggr_send(rxm_ep, comp->op_context, 0);
 	case RXM_SAR_TX:
 		tx_sar_buf = comp->op_context;
 		assert(comp->flags & FI_SEND);
@@ -1171,11 +1566,17 @@ static ssize_t rxm_cq_handle_comp(struct rxm_ep *rxm_ep,
 			return rxm_handle_atomic_req(rxm_ep, rx_buf);
 		case rxm_ctrl_atomic_resp:
 			return rxm_handle_atomic_resp(rxm_ep, rx_buf);
+		case rxm_ctrl_aggr:
+			return rxm_handle_aggr_recv(rx_buf);
 		default:
 			FI_WARN(&rxm_prov, FI_LOG_CQ, "Unknown message type\n");
 			assert(0);
 			return -FI_EINVAL;
 		}
+	case RXM_RX_DIRECT:
+		/* Payload was received straight into the user buffer */
+		rx_buf = comp->op_context;
+		return rxm_finish_recv(rx_buf, rx_buf->pkt.hdr.size);
 	case RXM_RNDV_TX:
 		tx_rndv_buf = comp->op_context;
 		assert(comp->flags & FI_SEND);
@@ -1186,12 +1587,11 @@ static ssize_t rxm_cq_handle_comp(struct rxm_ep *rxm_ep,
 		assert(comp->flags & FI_SEND);
 		return rxm_rndv_tx_finish(rxm_ep, tx_rndv_buf);
 	case RXM_RNDV_READ:
-		rx_buf = comp->op_context;
 		assert(comp->flags & FI_READ);
-		if (++rx_buf->rndv_rma_index < rx_buf->rndv_hdr->count)
-			return 0;
-		else
-			return rxm_rndv_send_ack(rx_buf);
+		return rxm_cq_finish_rndv_read(comp->op_context, 0);
+	case RXM_RNDV_LANE_READ:
+		assert(comp->flags & FI_READ);
+		return rxm_cq_finish_lane_read(comp->op_context, 0);
 	case RXM_RNDV_ACK_SENT:
 		assert(comp->flags & FI_SEND);
 		return rxm_finish_send_rndv_ack(comp->op_context);
@@ -1297,6 +1697,28 @@ static void rxm_cq_read_write_error(struct rxm_ep *rxm_ep)
 				rxm_ep->msg_cq, &err_entry);
 
 	state = RXM_GET_PROTO_STATE(err_entry.op_context);
+	switch (state) {
+	case RXM_AGGR_TX:
+		rxm_finish_aggr_send(rxm_ep, err_entry.op_context,
+				     -err_entry.err);
+		return;
+	/* A failed read fails its message once the other reads are done */
+	case RXM_RNDV_READ:
+		ret = rxm_cq_finish_rndv_read(err_entry.op_context,
+					      -err_entry.err);
+		if (ret)
+			rxm_cq_write_error_all(rxm_ep, (int) ret);
+		return;
+	case RXM_RNDV_LANE_READ:
+		ret = rxm_cq_finish_lane_read(err_entry.op_context,
+					      -err_entry.err);
+		if (ret)
+			rxm_cq_write_error_all(rxm_ep, (int) ret);
+		return;
+	default:
+		break;
+	}
+
 	if (RXM_IS_PROTO_STATE_TX(state)) {
 		util_cq = rxm_ep->util_ep.tx_cq;
 		util_cntr = rxm_ep->util_ep.tx_cntr;
@@ -1329,9 +1751,9 @@ static void rxm_cq_read_write_error(struct rxm_ep *rxm_ep)
 			return;
 		}
 		/* fall through */
-	case RXM_RNDV_ACK_SENT:
+	case RXM_RX_DIRECT:
 		/* fall through */
-	case RXM_RNDV_READ:
+	case RXM_RNDV_ACK_SENT:
 		rx_buf = (struct rxm_rx_buf *)err_entry.op_context;
 		util_cq = rx_buf->ep->util_ep.rx_cq;
 		util_cntr = rx_buf->ep->util_ep.rx_cntr;
@@ -1462,6 +1884,9 @@ void rxm_ep_do_progress(struct util_ep *util_ep)
 					     deferred_conn_entry, conn_entry_tmp)
 			rxm_ep_progress_deferred_queue(rxm_ep, rxm_conn);
 	}
+
+	if (OFI_UNLIKELY(!dlist_empty(&rxm_ep->aggr_conn_queue)))
+		rxm_ep_flush_aggr_queue(rxm_ep, rxm_aggr_timeout);
 }
 
 void rxm_ep_progress(struct util_ep *util_ep)
@@ -1525,8 +1950,8 @@ int rxm_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	if (!util_cq)
 		return -FI_ENOMEM;
 
-	ret = ofi_cq_init(&rxm_prov, domain, attr, util_cq, &ofi_cq_progress,
-			context);
+	ret = ofi_cq_init_flags(&rxm_prov, domain, attr, util_cq,
+				&ofi_cq_progress, OFI_CQ_LOCKFREE, context);
 	if (ret)
 		goto err1;
 
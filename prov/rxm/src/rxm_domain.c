@@ -104,6 +104,16 @@ static int rxm_mr_add_map_entry(struct util_domain *domain,
 	return ret;
 }
 
+static void rxm_mr_cache_cleanup(struct rxm_domain *rxm_domain)
+{
+	int i;
+
+	for (i = 0; i < RXM_MR_CACHE_MAX; i++) {
+		if (rxm_domain->mr_cache[i].enabled)
+			ofi_mr_cache_cleanup(&rxm_domain->mr_cache[i].cache);
+	}
+}
+
 static int rxm_domain_close(fid_t fid)
 {
 	struct rxm_domain *rxm_domain;
@@ -111,6 +121,8 @@ static int rxm_domain_close(fid_t fid)
 
 	rxm_domain = container_of(fid, struct rxm_domain, util_domain.domain_fid.fid);
 
+	rxm_mr_cache_cleanup(rxm_domain);
+
 	ret = fi_close(&rxm_domain->msg_domain->fid);
 	if (ret)
 		return ret;
@@ -290,6 +302,105 @@ static int rxm_mr_reg(struct fid *fid, const void *buf, size_t len,
 			   flags, mr, context);
 }
 
+static int rxm_cached_mr_close(fid_t fid)
+{
+	struct rxm_cached_mr *cached_mr =
+		container_of(fid, struct rxm_cached_mr, mr_fid.fid);
+
+	ofi_mr_cache_delete(cached_mr->cache, cached_mr->entry);
+	return 0;
+}
+
+static struct fi_ops rxm_cached_mr_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = rxm_cached_mr_close,
+	.bind = fi_no_bind,
+	.control = fi_no_control,
+	.ops_open = fi_no_ops_open,
+};
+
+static int rxm_mr_cache_add_region(struct ofi_mr_cache *cache,
+				   struct ofi_mr_entry *entry)
+{
+	struct rxm_cached_mr *cached_mr = (struct rxm_cached_mr *) entry->data;
+	struct rxm_mr_cache *mr_cache =
+		container_of(cache, struct rxm_mr_cache, cache);
+	struct rxm_domain *rxm_domain =
+		container_of(cache->domain, struct rxm_domain, util_domain);
+	int ret;
+
+	ret = fi_mr_reg(rxm_domain->msg_domain, entry->info.iov.iov_base,
+			entry->info.iov.iov_len, mr_cache->access, 0, 0,
+			OFI_MR_NOCACHE, &cached_mr->msg_mr, NULL);
+	if (ret) {
+		FI_WARN(&rxm_prov, FI_LOG_DOMAIN,
+			"Unable to register MSG MR for cache entry\n");
+		return ret;
+	}
+
+	cached_mr->mr_fid.fid.fclass = FI_CLASS_MR;
+	cached_mr->mr_fid.fid.context = NULL;
+	cached_mr->mr_fid.fid.ops = &rxm_cached_mr_ops;
+	cached_mr->mr_fid.mem_desc = fi_mr_desc(cached_mr->msg_mr);
+	cached_mr->mr_fid.key = fi_mr_key(cached_mr->msg_mr);
+	cached_mr->entry = entry;
+	cached_mr->cache = cache;
+	return 0;
+}
+
+static void rxm_mr_cache_delete_region(struct ofi_mr_cache *cache,
+				       struct ofi_mr_entry *entry)
+{
+	struct rxm_cached_mr *cached_mr = (struct rxm_cached_mr *) entry->data;
+
+	if (cached_mr->msg_mr && fi_close(&cached_mr->msg_mr->fid))
+		FI_WARN(&rxm_prov, FI_LOG_DOMAIN,
+			"Unable to close cached MSG MR\n");
+}
+
+/* Registers a buffer with the MSG provider for RxM's own use (rendezvous
+ * and RMA). The returned MR must be released with fi_close */
+int rxm_msg_mr_reg_internal(struct rxm_domain *rxm_domain, const void *buf,
+			    size_t len, uint64_t acs, struct fid_mr **mr)
+{
+	struct rxm_mr_cache *mr_cache = NULL;
+	struct rxm_cached_mr *cached_mr;
+	struct ofi_mr_entry *entry;
+	struct fi_mr_attr attr;
+	struct iovec iov;
+	int ret, i;
+
+	for (i = 0; i < RXM_MR_CACHE_MAX; i++) {
+		if (rxm_domain->mr_cache[i].enabled &&
+		    rxm_domain->mr_cache[i].access == acs) {
+			mr_cache = &rxm_domain->mr_cache[i];
+			break;
+		}
+	}
+
+	if (!mr_cache || !len)
+		return fi_mr_reg(rxm_domain->msg_domain, buf, len, acs, 0, 0,
+				 0, mr, NULL);
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	attr.mr_iov = &iov;
+	attr.iov_count = 1;
+	attr.access = acs;
+	attr.offset = 0;
+	attr.requested_key = 0;
+	attr.context = NULL;
+	attr.auth_key_size = 0;
+
+	ret = ofi_mr_cache_search(&mr_cache->cache, &attr, &entry);
+	if (OFI_UNLIKELY(ret))
+		return ret;
+
+	cached_mr = (struct rxm_cached_mr *) entry->data;
+	*mr = &cached_mr->mr_fid;
+	return 0;
+}
+
 static struct fi_ops_mr rxm_domain_mr_ops = {
 	.size = sizeof(struct fi_ops_mr),
 	.reg = rxm_mr_reg,
@@ -297,9 +408,46 @@ static struct fi_ops_mr rxm_domain_mr_ops = {
 	.regattr = rxm_mr_regattr,
 };
 
+static struct ofi_ops_dynamic_rbuf rxm_dynamic_rbuf_ops = {
+	.size = sizeof(struct ofi_ops_dynamic_rbuf),
+	.hdr_size = sizeof(struct rxm_pkt),
+	.get_rbuf = rxm_get_dynamic_rbuf,
+};
+
+static void rxm_mr_cache_init(struct rxm_domain *rxm_domain)
+{
+	static const uint64_t access[RXM_MR_CACHE_MAX] = {
+		[RXM_MR_CACHE_READ] = FI_READ,
+		[RXM_MR_CACHE_WRITE] = FI_WRITE,
+		[RXM_MR_CACHE_REMOTE_READ] = FI_REMOTE_READ,
+	};
+	struct rxm_mr_cache *mr_cache;
+	int i;
+
+	for (i = 0; i < RXM_MR_CACHE_MAX; i++) {
+		mr_cache = &rxm_domain->mr_cache[i];
+		mr_cache->access = access[i];
+		mr_cache->cache.entry_data_size = sizeof(struct rxm_cached_mr);
+		/* The caches split FI_MR_CACHE_MAX_SIZE and _COUNT */
+		mr_cache->cache.share_cnt = RXM_MR_CACHE_MAX;
+		mr_cache->cache.add_region = rxm_mr_cache_add_region;
+		mr_cache->cache.delete_region = rxm_mr_cache_delete_region;
+		mr_cache->enabled =
+			!ofi_mr_cache_init(&rxm_domain->util_domain,
+					   default_monitor, &mr_cache->cache);
+		if (!mr_cache->enabled) {
+			FI_INFO(&rxm_prov, FI_LOG_DOMAIN,
+				"MR cache disabled, MSG MRs would be "
+				"registered for every transfer\n");
+			break;
+		}
+	}
+}
+
 int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 		struct fid_domain **domain, void *context)
 {
+	struct ofi_ops_dynamic_rbuf *rbuf_ops = &rxm_dynamic_rbuf_ops;
 	int ret;
 	struct rxm_domain *rxm_domain;
 	struct rxm_fabric *rxm_fabric;
@@ -347,6 +495,14 @@ int rxm_domain_open(struct fid_fabric *fabric, struct fi_info *info,
 
 	rxm_domain->mr_local = ofi_mr_local(msg_info) && !ofi_mr_local(info);
 
+	rxm_mr_cache_init(rxm_domain);
+
+	if (rxm_direct_recv &&
+	    !fi_open_ops(&rxm_domain->msg_domain->fid, OFI_OPS_DYNAMIC_RBUF, 0,
+			 (void **) &rbuf_ops, NULL))
+		FI_INFO(&rxm_prov, FI_LOG_DOMAIN, "expected eager messages "
+			"would be received directly into user buffers\n");
+
 	fi_freeinfo(msg_info);
 	return 0;
 err3:
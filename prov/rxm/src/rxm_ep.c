@@ -174,6 +174,7 @@ static void rxm_buf_init(struct ofi_bufpool_region *region, void *buf)
 		type = rxm_ctrl_eager; /* This can be any value */
 		break;
 	case RXM_BUF_POOL_TX:
+	case RXM_BUF_POOL_TX_SMALL:
 		tx_eager_buf = buf;
 		tx_eager_buf->hdr.state = RXM_TX;
 
@@ -278,6 +279,8 @@ static int rxm_buf_pool_create(struct rxm_ep *rxm_ep, size_t size,
 		.flags		= OFI_BUFPOOL_NO_TRACK | OFI_BUFPOOL_HUGEPAGES,
 	};
 
+	ofi_bufpool_attr_set_numa(&attr, rxm_ep->numa_node);
+
 	pool->rxm_ep = rxm_ep;
 	pool->type = type;
 	ret = ofi_bufpool_create_attr(&attr, &pool->pool);
@@ -354,6 +357,7 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 	size_t queue_sizes[] = {
 		[RXM_BUF_POOL_RX] = rxm_ep->msg_info->rx_attr->size,
 		[RXM_BUF_POOL_TX] = rxm_ep->msg_info->tx_attr->size,
+		[RXM_BUF_POOL_TX_SMALL] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_INJECT] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_ACK] = rxm_ep->msg_info->tx_attr->size,
 		[RXM_BUF_POOL_TX_RNDV] = rxm_ep->msg_info->tx_attr->size,
@@ -366,6 +370,8 @@ static int rxm_ep_txrx_pool_create(struct rxm_ep *rxm_ep)
 				    sizeof(struct rxm_rx_buf),
 		[RXM_BUF_POOL_TX] = rxm_eager_limit +
 				    sizeof(struct rxm_tx_eager_buf),
+		[RXM_BUF_POOL_TX_SMALL] = rxm_tx_small_limit +
+					  sizeof(struct rxm_tx_eager_buf),
 		[RXM_BUF_POOL_TX_INJECT] = rxm_ep->inject_limit +
 					   sizeof(struct rxm_tx_base_buf),
 		[RXM_BUF_POOL_TX_ACK] = sizeof(struct rxm_tx_base_buf),
@@ -1063,7 +1069,9 @@ rxm_ep_sar_tx_prepare_segment(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	rxm_ep_format_tx_buf_pkt(rxm_conn, total_len, op, data, tag, flags, &tx_buf->pkt);
 	if (seg_type == RXM_SAR_SEG_FIRST) {
-		*msg_id = tx_buf->pkt.ctrl_hdr.msg_id = ofi_buf_index(tx_buf);
+		*msg_id = tx_buf->pkt.ctrl_hdr.msg_id =
+			((uint64_t)rxm_conn->sar_msg_seq++ << 32) |
+			ofi_buf_index(tx_buf);
 	} else {
 		tx_buf->pkt.ctrl_hdr.msg_id = *msg_id;
 	}
@@ -1084,11 +1092,36 @@ rxm_ep_sar_tx_cleanup(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	first_tx_buf = ofi_bufpool_get_ibuf(rxm_ep->
 				buf_pools[RXM_BUF_POOL_TX_SAR].pool,
-				tx_buf->pkt.ctrl_hdr.msg_id);
+				RXM_SAR_MSG_ID_INDEX(tx_buf->pkt.ctrl_hdr.msg_id));
 	ofi_buf_free(first_tx_buf);
 	ofi_buf_free(tx_buf);
 }
 
+/* The first and last segments go over the primary connection, so that the
+ * message is matched in order and the send completes after the segments
+ * ahead of it. Middle segments are striped over all connections to the
+ * peer, moving on to the next one if a connection can't take more data. */
+static inline ssize_t
+rxm_ep_sar_send_segment(struct rxm_conn *rxm_conn, struct rxm_tx_sar_buf *tx_buf)
+{
+	size_t len = sizeof(struct rxm_pkt) + tx_buf->pkt.ctrl_hdr.seg_size;
+	ssize_t ret = -FI_EAGAIN;
+	uint8_t i;
+
+	if (!rxm_conn->aux_cnt ||
+	    rxm_sar_get_seg_type(&tx_buf->pkt.ctrl_hdr) != RXM_SAR_SEG_MIDDLE)
+		return fi_send(rxm_conn->msg_ep, &tx_buf->pkt, len,
+			       tx_buf->hdr.desc, 0, tx_buf);
+
+	for (i = 0; i <= rxm_conn->aux_cnt; i++) {
+		ret = fi_send(rxm_conn_next_lane(rxm_conn)->msg_ep, &tx_buf->pkt,
+			      len, tx_buf->hdr.desc, 0, tx_buf);
+		if (ret != -FI_EAGAIN)
+			break;
+	}
+	return ret;
+}
+
 static inline ssize_t
 rxm_ep_sar_tx_prepare_and_send_segment(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 				       void *app_context, size_t data_len, size_t remain_len,
@@ -1118,8 +1151,7 @@ rxm_ep_sar_tx_prepare_and_send_segment(struct rxm_ep *rxm_ep, struct rxm_conn *r
 
 	*out_tx_buf = tx_buf;
 
-	return fi_send(rxm_conn->msg_ep, &tx_buf->pkt, sizeof(struct rxm_pkt) +
-		       tx_buf->pkt.ctrl_hdr.seg_size, tx_buf->hdr.desc, 0, tx_buf);
+	return rxm_ep_sar_send_segment(rxm_conn, tx_buf);
 }
 
 static inline ssize_t
@@ -1207,8 +1239,7 @@ rxm_ep_emulate_inject(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	struct rxm_tx_eager_buf *tx_buf;
 	ssize_t ret;
 
-	tx_buf = (struct rxm_tx_eager_buf *)
-		  rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+	tx_buf = rxm_tx_eager_buf_alloc(rxm_ep, len);
 	if (OFI_UNLIKELY(!tx_buf)) {
 		FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
 			"Ran out of buffers from Eager buffer pool\n");
@@ -1231,6 +1262,104 @@ rxm_ep_emulate_inject(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 	return ret;
 }
 
+static ssize_t
+rxm_ep_aggr_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
+		 const struct iovec *iov, size_t count, size_t data_len,
+		 void *context, uint64_t data, uint64_t flags, uint64_t tag)
+{
+	struct rxm_tx_eager_buf *tx_buf = rxm_conn->aggr_buf;
+	struct rxm_aggr_hdr *aggr_hdr;
+	struct rxm_aggr_comp *comp;
+	size_t entry_size = rxm_aggr_entry_size(data_len);
+	ssize_t ret;
+
+	if (tx_buf && (tx_buf->pkt.hdr.size + entry_size +
+		       (rxm_conn->aggr_cnt + 1) * sizeof(*comp) >
+		       (size_t) ((char *) rxm_aggr_comp_tbl(tx_buf) -
+				 tx_buf->pkt.data))) {
+		ret = rxm_ep_aggr_flush(rxm_ep, rxm_conn);
+		if (OFI_UNLIKELY(ret))
+			return ret;
+		tx_buf = NULL;
+	}
+
+	if (!tx_buf) {
+		tx_buf = (struct rxm_tx_eager_buf *)
+			 rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+		if (OFI_UNLIKELY(!tx_buf)) {
+			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
+				"Ran out of buffers from Eager buffer pool\n");
+			return -FI_EAGAIN;
+		}
+		tx_buf->hdr.state = RXM_AGGR_TX;
+		tx_buf->app_context = NULL;
+		tx_buf->flags = 0;
+		rxm_ep_format_tx_buf_pkt(rxm_conn, 0, ofi_op_tagged, 0, 0, 0,
+					 &tx_buf->pkt);
+		tx_buf->pkt.ctrl_hdr.type = rxm_ctrl_aggr;
+
+		rxm_conn->aggr_buf = tx_buf;
+		rxm_conn->aggr_cnt = 0;
+		rxm_conn->aggr_start = fi_gettime_us();
+		dlist_insert_tail(&rxm_conn->aggr_entry,
+				  &rxm_ep->aggr_conn_queue);
+	}
+
+	aggr_hdr = (struct rxm_aggr_hdr *)
+		   (tx_buf->pkt.data + tx_buf->pkt.hdr.size);
+	aggr_hdr->tag = tag;
+	aggr_hdr->data = data;
+	aggr_hdr->size = (uint32_t) data_len;
+	aggr_hdr->flags = (uint32_t) (flags & FI_REMOTE_CQ_DATA);
+	ofi_copy_from_iov(aggr_hdr + 1, data_len, iov, count, 0);
+	tx_buf->pkt.hdr.size += entry_size;
+
+	comp = rxm_aggr_comp_tbl(tx_buf) - (++rxm_conn->aggr_cnt);
+	comp->app_context = context;
+	comp->flags = flags;
+	return 0;
+}
+
+ssize_t rxm_ep_aggr_flush(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn)
+{
+	struct rxm_tx_eager_buf *tx_buf = rxm_conn->aggr_buf;
+	ssize_t ret;
+
+	assert(tx_buf);
+	ret = rxm_ep_msg_normal_send(rxm_conn, &tx_buf->pkt,
+				     sizeof(struct rxm_pkt) +
+				     tx_buf->pkt.hdr.size,
+				     tx_buf->hdr.desc, tx_buf);
+	if (OFI_UNLIKELY(ret))
+		return ret;
+
+	FI_DBG(&rxm_prov, FI_LOG_EP_DATA, "Sent %zu aggregated messages\n",
+	       rxm_conn->aggr_cnt);
+	dlist_remove(&rxm_conn->aggr_entry);
+	rxm_conn->aggr_buf = NULL;
+	return 0;
+}
+
+/* Flush aggregated sends that have been open for at least timeout us.
+ * Connections are queued in the order in which their aggregated sends
+ * were started */
+void rxm_ep_flush_aggr_queue(struct rxm_ep *rxm_ep, uint64_t timeout)
+{
+	struct rxm_conn *rxm_conn;
+	struct dlist_entry *tmp;
+	uint64_t now = fi_gettime_us();
+
+	dlist_foreach_container_safe(&rxm_ep->aggr_conn_queue, struct rxm_conn,
+				     rxm_conn, aggr_entry, tmp) {
+		if (now - rxm_conn->aggr_start < timeout)
+			break;
+		if (!rxm_conn->msg_ep)
+			continue;
+		if (rxm_ep_aggr_flush(rxm_ep, rxm_conn))
+			break;
+	}
+}
+
 static inline ssize_t
 rxm_ep_inject_send_fast(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 			const void *buf, size_t len, struct rxm_pkt *inject_pkt)
@@ -1240,6 +1369,24 @@ rxm_ep_inject_send_fast(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	assert(len <= rxm_ep->rxm_info->tx_attr->inject_size);
 
+	if (rxm_ep->aggr_limit && (inject_pkt->hdr.op == ofi_op_tagged)) {
+		if (len <= rxm_ep->aggr_limit) {
+			struct iovec iov = {
+				.iov_base = (void *) buf,
+				.iov_len = len,
+			};
+			return rxm_ep_aggr_send(rxm_ep, rxm_conn, &iov, 1, len,
+						NULL, inject_pkt->hdr.data,
+						inject_pkt->hdr.flags,
+						inject_pkt->hdr.tag);
+		}
+		if (rxm_conn->aggr_buf) {
+			ret = rxm_ep_aggr_flush(rxm_ep, rxm_conn);
+			if (OFI_UNLIKELY(ret))
+				return ret;
+		}
+	}
+
 	if (pkt_size <= rxm_ep->inject_limit) {
 		inject_pkt->hdr.size = len;
 		memcpy(inject_pkt->data, buf, len);
@@ -1263,6 +1410,23 @@ rxm_ep_inject_send(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 
 	assert(len <= rxm_ep->rxm_info->tx_attr->inject_size);
 
+	if (rxm_ep->aggr_limit && (op == ofi_op_tagged)) {
+		if (len <= rxm_ep->aggr_limit) {
+			struct iovec iov = {
+				.iov_base = (void *) buf,
+				.iov_len = len,
+			};
+			return rxm_ep_aggr_send(rxm_ep, rxm_conn, &iov, 1, len,
+						NULL, data, flags & ~FI_COMPLETION,
+						tag);
+		}
+		if (rxm_conn->aggr_buf) {
+			ret = rxm_ep_aggr_flush(rxm_ep, rxm_conn);
+			if (OFI_UNLIKELY(ret))
+				return ret;
+		}
+	}
+
 	if (pkt_size <= rxm_ep->inject_limit) {
 		struct rxm_tx_base_buf *tx_buf = (struct rxm_tx_base_buf *)
 			rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX_INJECT);
@@ -1303,9 +1467,21 @@ rxm_ep_send_common(struct rxm_ep *rxm_ep, struct rxm_conn *rxm_conn,
 		(data_len > rxm_ep->rxm_info->tx_attr->inject_size)) ||
 	       (data_len <= rxm_ep->rxm_info->tx_attr->inject_size));
 
+	if (rxm_ep->aggr_limit && (op == ofi_op_tagged)) {
+		if (data_len <= rxm_ep->aggr_limit)
+			return rxm_ep_aggr_send(rxm_ep, rxm_conn, iov, count,
+						data_len, context, data, flags,
+						tag);
+		if (rxm_conn->aggr_buf) {
+			ret = rxm_ep_aggr_flush(rxm_ep, rxm_conn);
+			if (OFI_UNLIKELY(ret))
+				return ret;
+		}
+	}
+
 	if (data_len <= rxm_eager_limit) {
-		struct rxm_tx_eager_buf *tx_buf = (struct rxm_tx_eager_buf *)
-			rxm_tx_buf_alloc(rxm_ep, RXM_BUF_POOL_TX);
+		struct rxm_tx_eager_buf *tx_buf =
+			rxm_tx_eager_buf_alloc(rxm_ep, data_len);
 
 		if (OFI_UNLIKELY(!tx_buf)) {
 			FI_WARN(&rxm_prov, FI_LOG_EP_DATA,
@@ -1385,8 +1561,7 @@ rxm_ep_progress_sar_deferred_segments(struct rxm_deferred_tx_entry *def_tx_entry
 	struct rxm_tx_sar_buf *tx_buf = def_tx_entry->sar_seg.cur_seg_tx_buf;
 
 	if (tx_buf) {
-		ret = fi_send(def_tx_entry->rxm_conn->msg_ep, &tx_buf->pkt, sizeof(tx_buf->pkt) +
-			      tx_buf->pkt.ctrl_hdr.seg_size, tx_buf->hdr.desc, 0, tx_buf);
+		ret = rxm_ep_sar_send_segment(def_tx_entry->rxm_conn, tx_buf);
 		if (OFI_UNLIKELY(ret)) {
 			if (OFI_LIKELY(ret != -FI_EAGAIN)) {
 				rxm_ep_sar_handle_segment_failure(def_tx_entry, ret);
@@ -1470,21 +1645,19 @@ void rxm_ep_progress_deferred_queue(struct rxm_ep *rxm_ep,
 			free(def_tx_entry);
 			break;
 		case RXM_DEFERRED_TX_RNDV_READ:
-			ret = fi_readv(def_tx_entry->rxm_conn->msg_ep,
-				       def_tx_entry->rndv_read.rxm_iov.iov,
-				       def_tx_entry->rndv_read.rxm_iov.desc,
-				       def_tx_entry->rndv_read.rxm_iov.count, 0,
-				       def_tx_entry->rndv_read.rma_iov.addr,
-				       def_tx_entry->rndv_read.rma_iov.key,
-				       def_tx_entry->rndv_read.rx_buf);
+			ret = rxm_cq_post_rndv_read(def_tx_entry->rndv_read.rx_buf,
+					def_tx_entry->rxm_conn,
+					def_tx_entry->rndv_read.rxm_iov.iov,
+					def_tx_entry->rndv_read.rxm_iov.desc,
+					def_tx_entry->rndv_read.rxm_iov.count,
+					def_tx_entry->rndv_read.rma_iov.addr,
+					def_tx_entry->rndv_read.rma_iov.key);
 			if (OFI_UNLIKELY(ret)) {
 				if (OFI_LIKELY(ret == -FI_EAGAIN))
 					break;
-				rxm_cq_write_error(def_tx_entry->rxm_ep->util_ep.rx_cq,
-						   def_tx_entry->rxm_ep->util_ep.rx_cntr,
-						   def_tx_entry->rndv_read.rx_buf->
-							recv_entry->context, ret);
-				break;
+				/* The read counts as done, failing its message */
+				ret = rxm_cq_finish_rndv_read(
+					def_tx_entry->rndv_read.rx_buf, (int) ret);
 			}
 			rxm_ep_dequeue_deferred_tx_queue(def_tx_entry);
 			free(def_tx_entry);
@@ -1754,7 +1927,7 @@ static ssize_t rxm_ep_tsendmsg(struct fid_ep *ep_fid, const struct fi_msg_tagged
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, msg->addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, msg->addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1782,7 +1955,7 @@ static ssize_t rxm_ep_tsend(struct fid_ep *ep_fid, const void *buf, size_t len,
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1804,7 +1977,7 @@ static ssize_t rxm_ep_tsendv(struct fid_ep *ep_fid, const struct iovec *iov,
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1825,7 +1998,7 @@ static ssize_t rxm_ep_tinject(struct fid_ep *ep_fid, const void *buf, size_t len
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1845,7 +2018,7 @@ static ssize_t rxm_ep_tinject_fast(struct fid_ep *ep_fid, const void *buf, size_
 	struct rxm_ep *rxm_ep = container_of(ep_fid, struct rxm_ep,
 					     util_ep.ep_fid.fid);
 
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		return ret;
 
@@ -1869,7 +2042,7 @@ static ssize_t rxm_ep_tsenddata(struct fid_ep *ep_fid, const void *buf, size_t l
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1890,7 +2063,7 @@ static ssize_t rxm_ep_tinjectdata(struct fid_ep *ep_fid, const void *buf, size_t
 					     util_ep.ep_fid.fid);
 
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		goto unlock;
 
@@ -1910,7 +2083,7 @@ static ssize_t rxm_ep_tinjectdata_fast(struct fid_ep *ep_fid, const void *buf, s
 	struct rxm_ep *rxm_ep = container_of(ep_fid, struct rxm_ep,
 					     util_ep.ep_fid.fid);
 
-	ret = rxm_ep_prepare_tx(rxm_ep, dest_addr, &rxm_conn);
+	ret = rxm_ep_prepare_tagged_tx(rxm_ep, dest_addr, &rxm_conn);
 	if (OFI_UNLIKELY(ret))
 		return ret;
 
@@ -2058,7 +2231,13 @@ static int rxm_ep_trywait_cq(void *arg)
 	rxm_fabric = container_of(rxm_ep->util_ep.domain->fabric,
 				  struct rxm_fabric, util_fabric);
 	ofi_ep_lock_acquire(&rxm_ep->util_ep);
-	ret = fi_trywait(rxm_fabric->msg_fabric, fids, 1);
+	/* Don't block while aggregated sends are held open */
+	if (!dlist_empty(&rxm_ep->aggr_conn_queue)) {
+		rxm_ep_flush_aggr_queue(rxm_ep, 0);
+		ret = -FI_EAGAIN;
+	} else {
+		ret = fi_trywait(rxm_fabric->msg_fabric, fids, 1);
+	}
 	ofi_ep_lock_release(&rxm_ep->util_ep);
 	return ret;
 }
@@ -2202,6 +2381,20 @@ static void rxm_ep_sar_init(struct rxm_ep *rxm_ep)
 	}
 }
 
+static void rxm_ep_aggr_init(struct rxm_ep *rxm_ep)
+{
+	/* Largest message for which a packed entry and its completion
+	 * info still fit in an eager buffer */
+	size_t max_size = (rxm_eager_limit & ~(size_t) 7);
+
+	if (!rxm_aggr_size || max_size <= sizeof(struct rxm_aggr_hdr) +
+					  sizeof(struct rxm_aggr_comp))
+		return;
+
+	max_size -= sizeof(struct rxm_aggr_hdr) + sizeof(struct rxm_aggr_comp);
+	rxm_ep->aggr_limit = MIN(rxm_aggr_size, max_size);
+}
+
 static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 {
 	size_t max_prog_val;
@@ -2237,6 +2430,7 @@ static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 	rxm_ep->buffered_limit = rxm_eager_limit;
 
 	rxm_ep_sar_init(rxm_ep);
+	rxm_ep_aggr_init(rxm_ep);
 
  	FI_INFO(&rxm_prov, FI_LOG_CORE,
 		"Settings:\n"
@@ -2246,13 +2440,16 @@ static void rxm_ep_settings_init(struct rxm_ep *rxm_ep)
 	        "\t\t Min multi recv size: %zu\n"
 	        "\t\t FI_EP_MSG provider inject size: %zu\n"
 	        "\t\t rxm inject size: %zu\n"
-		"\t\t Protocol limits: Eager: %zu, "
-				      "SAR: %zu\n",
+		"\t\t Protocol limits: Small TX: %zu, Eager: %zu, "
+				      "SAR: %zu\n"
+		"\t\t Aggregation limit: %zu, timeout: %zu us\n"
+		"\t\t Connections per peer: %zu\n",
 		rxm_ep->msg_mr_local, rxm_ep->rxm_mr_local,
 		rxm_ep->comp_per_progress, rxm_ep->buffered_min,
 		rxm_ep->min_multi_recv_size, rxm_ep->inject_limit,
 		rxm_ep->rxm_info->tx_attr->inject_size,
-		rxm_eager_limit, rxm_ep->sar_limit);
+		rxm_tx_small_limit, rxm_eager_limit, rxm_ep->sar_limit,
+		rxm_ep->aggr_limit, rxm_aggr_timeout, rxm_conn_per_peer);
 }
 
 static int rxm_ep_txrx_res_open(struct rxm_ep *rxm_ep)
@@ -2264,6 +2461,7 @@ static int rxm_ep_txrx_res_open(struct rxm_ep *rxm_ep)
 		return ret;
 
 	dlist_init(&rxm_ep->deferred_tx_conn_queue);
+	dlist_init(&rxm_ep->aggr_conn_queue);
 
 	ret = rxm_ep_rx_queue_init(rxm_ep);
 	if (ret)
@@ -2477,6 +2675,8 @@ int rxm_endpoint(struct fid_domain *domain, struct fi_info *info,
 			     (int *)&rxm_ep->comp_per_progress))
 		rxm_ep->comp_per_progress = 1;
 
+	rxm_ep->numa_node = ofi_numa_node_self();
+
 	if (rxm_ep->rxm_info->caps & FI_COLLECTIVE) {
 		ret = ofi_endpoint_init(domain, &rxm_util_prov, info,
 					&rxm_ep->util_ep, context,
@@ -52,6 +52,11 @@ size_t rxm_msg_tx_size		= 128;
 size_t rxm_msg_rx_size		= 128;
 size_t rxm_def_univ_size	= 256;
 size_t rxm_eager_limit		= RXM_BUF_SIZE - sizeof(struct rxm_pkt);
+size_t rxm_tx_small_limit	= RXM_TX_SMALL_BUF_SIZE - sizeof(struct rxm_pkt);
+size_t rxm_aggr_size		= 0;
+size_t rxm_aggr_timeout		= 10;
+size_t rxm_conn_per_peer	= 1;
+int rxm_direct_recv		= 1;
 int force_auto_progress		= 0;
 
 char *rxm_proto_state_str[] = {
@@ -200,6 +205,17 @@ static int rxm_init_info(void)
 			return -FI_EINVAL;
 		}
 	}
+
+	if (!fi_param_get_size_t(&rxm_prov, "tx_small_buffer_size", &param)) {
+		if (param > sizeof(struct rxm_pkt)) {
+			rxm_tx_small_limit = param - sizeof(struct rxm_pkt);
+		} else {
+			/* Disable the small transmit buffer size class */
+			rxm_tx_small_limit = 0;
+		}
+	}
+	rxm_tx_small_limit = MIN(rxm_tx_small_limit, rxm_eager_limit);
+
 	rxm_info.tx_attr->inject_size = rxm_eager_limit;
 	rxm_util_prov.info = &rxm_info;
 	return 0;
@@ -370,6 +386,17 @@ RXM_INI
 			" would be copied up to eager limit.",
 			sizeof(struct rxm_pkt));
 
+	fi_param_define(&rxm_prov, "tx_small_buffer_size", FI_PARAM_SIZE_T,
+			"Defines the size of the small transmit buffer class "
+			"(default: 512 B). Eager messages whose size is less "
+			"than (FI_OFI_RXM_TX_SMALL_BUFFER_SIZE - RxM header "
+			"size (%zu B)) are staged in these buffers instead of "
+			"full FI_OFI_RXM_BUFFER_SIZE buffers. Receive buffers "
+			"are not affected. Setting this to a value less than "
+			"the RxM header size disables the small transmit "
+			"buffer class.",
+			sizeof(struct rxm_pkt));
+
 	fi_param_define(&rxm_prov, "comp_per_progress", FI_PARAM_INT,
 			"Defines the maximum number of MSG provider CQ entries "
 			"(default: 1) that would be read per progress "
@@ -414,6 +441,29 @@ RXM_INI
 			"decrease noise during cq polling, but may result in "
 			"longer connection establishment times. (default: 10000).");
 
+	fi_param_define(&rxm_prov, "aggr_size", FI_PARAM_SIZE_T,
+			"Enables aggregation of small tagged messages sent to "
+			"the same peer. Tagged messages of size up to this "
+			"value are packed into a single MSG provider send "
+			"(default: 0, disabled).");
+
+	fi_param_define(&rxm_prov, "aggr_timeout", FI_PARAM_SIZE_T,
+			"Defines the maximum time in microseconds that an "
+			"aggregated send is held open waiting for more "
+			"messages (default: 10).");
+
+	fi_param_define(&rxm_prov, "conn_per_peer", FI_PARAM_SIZE_T,
+			"Defines the number of MSG provider connections opened "
+			"to each peer. Large messages (SAR and rendezvous) are "
+			"striped over the connections, while message ordering "
+			"is kept on the first one (default: 1, max: %d).",
+			RXM_MAX_CONN_PER_PEER);
+
+	fi_param_define(&rxm_prov, "direct_recv", FI_PARAM_BOOL,
+			"Receive eager messages that match a posted receive "
+			"directly into the application buffer if the MSG "
+			"provider supports it (default: true).");
+
 	fi_param_define(&rxm_prov, "data_auto_progress", FI_PARAM_BOOL,
 			"Force auto-progress for data transfers even if app "
 			"requested manual progress (default: false/no) \n");
@@ -426,6 +476,12 @@ RXM_INI
 	if (fi_param_get_int(&rxm_prov, "cm_progress_interval",
 				(int *) &rxm_cm_progress_interval))
 		rxm_cm_progress_interval = 10000;
+	fi_param_get_size_t(&rxm_prov, "aggr_size", &rxm_aggr_size);
+	fi_param_get_size_t(&rxm_prov, "aggr_timeout", &rxm_aggr_timeout);
+	fi_param_get_size_t(&rxm_prov, "conn_per_peer", &rxm_conn_per_peer);
+	rxm_conn_per_peer = MIN(MAX(rxm_conn_per_peer, 1),
+				RXM_MAX_CONN_PER_PEER);
+	fi_param_get_bool(&rxm_prov, "direct_recv", &rxm_direct_recv);
 	fi_param_get_bool(&rxm_prov, "data_auto_progress", &force_auto_progress);
 
 	if (force_auto_progress)
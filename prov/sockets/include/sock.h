@@ -88,6 +88,7 @@
 
 #define SOCK_PE_POLL_TIMEOUT (100000)
 #define SOCK_PE_MAX_ENTRIES (128)
+#define SOCK_PE_MAX_COUNT (64)
 #define SOCK_PE_WAITTIME (10)
 
 #define SOCK_EQ_DEF_SZ (1<<8)
@@ -250,6 +251,10 @@ struct sock_domain {
 	enum fi_progress	progress_mode;
 	struct ofi_mr_map	mr_map;
 	struct sock_pe		*pe;
+	struct sock_pe		**pe_set;
+	int			num_pe;
+	ofi_atomic32_t		pe_next;
+	fastlock_t		atomic_lock;
 	struct dlist_entry	dom_list_entry;
 	struct fi_domain_attr	attr;
 	struct sock_conn_listener conn_listener;
@@ -560,6 +565,7 @@ struct sock_ep_attr {
 	struct sock_eq *eq;
 	struct sock_av *av;
 	struct sock_domain *domain;
+	struct sock_pe *pe;
 
 	struct sock_rx_ctx *rx_ctx;
 	struct sock_tx_ctx *tx_ctx;
@@ -660,6 +666,7 @@ struct sock_rx_ctx {
 	struct sock_av *av;
 	struct sock_eq *eq;
  	struct sock_domain *domain;
+	struct sock_pe *pe;
 
 	struct dlist_entry pe_entry;
 	struct dlist_entry cq_entry;
@@ -699,6 +706,7 @@ struct sock_tx_ctx {
 	struct sock_av *av;
 	struct sock_eq *eq;
  	struct sock_domain *domain;
+	struct sock_pe *pe;
 
 	struct dlist_entry pe_entry;
 	struct dlist_entry cq_entry;
@@ -838,7 +846,8 @@ struct sock_pe_entry {
 	uint8_t mr_checked;
 	uint8_t is_pool_entry;
 	uint8_t completion_reported;
-	uint8_t reserved[3];
+	uint8_t reserved[2];
+	uint16_t id;
 
 	uint64_t done_len;
 	uint64_t total_len;
@@ -848,6 +857,8 @@ struct sock_pe_entry {
 	struct sock_ep_attr *ep_attr;
 	struct sock_conn *conn;
 	struct sock_comp *comp;
+	/* PE whose table or pool the entry comes from */
+	struct sock_pe *owner;
 
 	struct dlist_entry entry;
 	struct dlist_entry ctx_entry;
@@ -857,6 +868,7 @@ struct sock_pe_entry {
 
 struct sock_pe {
 	struct sock_domain *domain;
+	int index;
 	int num_free_entries;
 	struct sock_pe_entry pe_table[SOCK_PE_MAX_ENTRIES];
 	fastlock_t lock;
@@ -871,12 +883,17 @@ struct sock_pe {
 	struct dlist_entry free_list;
 	struct dlist_entry busy_list;
 	struct dlist_entry pool_list;
+	/* entries released by the PE that an endpoint was moved to; also
+	 * guards atomic_rx_pool, which that PE uses for the entries */
+	fastlock_t return_lock;
+	struct dlist_entry return_list;
 
 	struct dlist_entry tx_list;
 	struct dlist_entry rx_list;
 
 	pthread_t progress_thread;
 	volatile int do_progress;
+	ofi_atomic32_t idle;
 	struct sock_pe_entry *pe_atomic;
 	fi_epoll_t epoll_set;
 };
@@ -1170,7 +1187,8 @@ void sock_set_sockopts(int sock, int sock_opts);
 int fd_set_nonblock(int fd);
 int sock_conn_map_init(struct sock_ep *ep, int init_size);
 
-struct sock_pe *sock_pe_init(struct sock_domain *domain);
+int sock_pe_init(struct sock_domain *domain);
+struct sock_pe *sock_pe_select(struct sock_domain *domain);
 void sock_pe_add_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *ctx);
 void sock_pe_add_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *ctx);
 void sock_pe_signal(struct sock_pe *pe);
@@ -1183,7 +1201,7 @@ int sock_pe_progress_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx);
 int sock_pe_progress_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx);
 void sock_pe_remove_tx_ctx(struct sock_tx_ctx *tx_ctx);
 void sock_pe_remove_rx_ctx(struct sock_rx_ctx *rx_ctx);
-void sock_pe_finalize(struct sock_pe *pe);
+void sock_pe_finalize(struct sock_domain *domain);
 
 
 struct sock_rx_entry *sock_rx_new_entry(struct sock_rx_ctx *rx_ctx);
@@ -184,7 +184,7 @@ static int sock_dom_close(struct fid *fid)
 	sock_conn_stop_listener_thread(&dom->conn_listener);
 	sock_ep_cm_stop_thread(&dom->cm_head);
 
-	sock_pe_finalize(dom->pe);
+	sock_pe_finalize(dom);
 	fastlock_destroy(&dom->lock);
 	ofi_mr_map_close(&dom->mr_map);
 	sock_dom_remove_from_list(dom);
@@ -314,8 +314,7 @@ int sock_domain(struct fid_fabric *fabric, struct fi_info *info,
 	else
 		sock_domain->progress_mode = info->domain_attr->data_progress;
 
-	sock_domain->pe = sock_pe_init(sock_domain);
-	if (!sock_domain->pe) {
+	if (sock_pe_init(sock_domain)) {
 		SOCK_LOG_ERROR("Failed to init PE\n");
 		goto err1;
 	}
@@ -347,7 +346,7 @@ int sock_domain(struct fid_fabric *fabric, struct fi_info *info,
 err3:
 	sock_conn_stop_listener_thread(&sock_domain->conn_listener);
 err2:
-	sock_pe_finalize(sock_domain->pe);
+	sock_pe_finalize(sock_domain);
 err1:
 	fastlock_destroy(&sock_domain->lock);
 	free(sock_domain);
@@ -288,7 +288,7 @@ static int sock_ctx_enable(struct fid_ep *ep)
 	switch (ep->fid.fclass) {
 	case FI_CLASS_RX_CTX:
 		rx_ctx = container_of(ep, struct sock_rx_ctx, ctx.fid);
-		sock_pe_add_rx_ctx(rx_ctx->domain->pe, rx_ctx);
+		sock_pe_add_rx_ctx(rx_ctx->ep_attr->pe, rx_ctx);
 
 		if (!rx_ctx->ep_attr->conn_handle.do_listen &&
 		    sock_conn_listen(rx_ctx->ep_attr)) {
@@ -299,7 +299,7 @@ static int sock_ctx_enable(struct fid_ep *ep)
 
 	case FI_CLASS_TX_CTX:
 		tx_ctx = container_of(ep, struct sock_tx_ctx, fid.ctx.fid);
-		sock_pe_add_tx_ctx(tx_ctx->domain->pe, tx_ctx);
+		sock_pe_add_tx_ctx(tx_ctx->ep_attr->pe, tx_ctx);
 
 		if (!tx_ctx->ep_attr->conn_handle.do_listen &&
 		    sock_conn_listen(tx_ctx->ep_attr)) {
@@ -642,10 +642,28 @@ static void sock_ep_clear_eq_list(struct dlistfd_head *list,
 	}
 }
 
+/*
+ * A busy endpoint may be moved to another PE, with the locks of both PEs
+ * held. Once the lock of the PE that the endpoint is on is held, it stays.
+ */
+static struct sock_pe *sock_ep_lock_pe(struct sock_ep_attr *attr)
+{
+	struct sock_pe *pe;
+
+	for (;;) {
+		pe = *((struct sock_pe * volatile *) &attr->pe);
+		fastlock_acquire(&pe->lock);
+		if (pe == attr->pe)
+			return pe;
+		fastlock_release(&pe->lock);
+	}
+}
+
 static int sock_ep_close(struct fid *fid)
 {
 	struct sock_conn_req_handle *handle;
 	struct sock_ep *sock_ep;
+	struct sock_pe *pe;
 
 	switch (fid->fclass) {
 	case FI_CLASS_EP:
@@ -749,10 +767,10 @@ static int sock_ep_close(struct fid *fid)
 	if (sock_ep->attr->dest_addr)
 		free(sock_ep->attr->dest_addr);
 
-	fastlock_acquire(&sock_ep->attr->domain->pe->lock);
+	pe = sock_ep_lock_pe(sock_ep->attr);
 	ofi_idm_reset(&sock_ep->attr->av_idm);
 	sock_conn_map_destroy(sock_ep->attr);
-	fastlock_release(&sock_ep->attr->domain->pe->lock);
+	fastlock_release(&pe->lock);
 
 	ofi_atomic_dec32(&sock_ep->attr->domain->ref);
 	fastlock_destroy(&sock_ep->attr->lock);
@@ -908,6 +926,8 @@ static int sock_ep_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
 
 		ep->attr->tx_ctx->use_shared = 1;
 		ep->attr->tx_ctx->stx_ctx = tx_ctx;
+		/* shared contexts are progressed by the first PE */
+		ep->attr->pe = ep->attr->domain->pe;
 		break;
 
 	case FI_CLASS_SRX_CTX:
@@ -918,6 +938,7 @@ static int sock_ep_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
 
 		ep->attr->rx_ctx->use_shared = 1;
 		ep->attr->rx_ctx->srx_ctx = rx_ctx;
+		ep->attr->pe = ep->attr->domain->pe;
 		break;
 
 	default:
@@ -1016,7 +1037,7 @@ int sock_ep_enable(struct fid_ep *ep)
 					tx_ctx->stx_ctx->enabled = 1;
 				}
 			} else {
-				sock_pe_add_tx_ctx(tx_ctx->domain->pe, tx_ctx);
+				sock_pe_add_tx_ctx(tx_ctx->ep_attr->pe, tx_ctx);
 			}
 		}
 	}
@@ -1031,7 +1052,7 @@ int sock_ep_enable(struct fid_ep *ep)
 					rx_ctx->srx_ctx->enabled = 1;
 				}
 			} else {
-				sock_pe_add_rx_ctx(rx_ctx->domain->pe, rx_ctx);
+				sock_pe_add_rx_ctx(rx_ctx->ep_attr->pe, rx_ctx);
 			}
 		}
 	}
@@ -1792,6 +1813,7 @@ int sock_alloc_endpoint(struct fid_domain *domain, struct fi_info *info,
 		memcpy(&sock_ep->attr->info, info, sizeof(struct fi_info));
 
 	sock_ep->attr->domain = sock_dom;
+	sock_ep->attr->pe = sock_pe_select(sock_dom);
 	fastlock_init(&sock_ep->attr->cm.lock);
 
 	if (sock_conn_map_init(sock_ep, sock_cm_def_map_sz)) {
@@ -1816,7 +1838,7 @@ err1:
 
 void sock_ep_remove_conn(struct sock_ep_attr *attr, struct sock_conn *conn)
 {
-	sock_pe_poll_del(attr->domain->pe, conn->sock_fd);
+	sock_pe_poll_del(attr->pe, conn->sock_fd);
 	sock_conn_release_entry(&attr->cmap, conn);
 }
 
@@ -49,6 +49,7 @@
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_FABRIC, __VA_ARGS__)
 
 int sock_pe_waittime = SOCK_PE_WAITTIME;
+int sock_pe_count = 1;
 const char sock_fab_name[] = "IP";
 const char sock_dom_name[] = "sockets";
 const char sock_prov_name[] = "sockets";
@@ -341,6 +342,7 @@ static void sock_read_default_params()
 {
 	if (!read_default_params) {
 		fi_param_get_int(&sock_prov, "pe_waittime", &sock_pe_waittime);
+		fi_param_get_int(&sock_prov, "pe_count", &sock_pe_count);
 		fi_param_get_int(&sock_prov, "conn_timeout", &sock_conn_timeout);
 		fi_param_get_int(&sock_prov, "max_conn_retry", &sock_conn_retry);
 		fi_param_get_int(&sock_prov, "def_conn_map_sz", &sock_cm_def_map_sz);
@@ -707,6 +709,10 @@ SOCKETS_INI
 	fi_param_define(&sock_prov, "pe_waittime", FI_PARAM_INT,
 			"How many milliseconds to spin while waiting for progress");
 
+	fi_param_define(&sock_prov, "pe_count", FI_PARAM_INT,
+			"Number of progress engines (and progress threads) per domain. "
+			"Endpoints are spread over them (default: 1, max: 64)");
+
 	fi_param_define(&sock_prov, "conn_timeout", FI_PARAM_INT,
 			"How many milliseconds to wait for one connection establishment");
 
@@ -727,7 +733,8 @@ SOCKETS_INI
 
 	fi_param_define(&sock_prov, "pe_affinity", FI_PARAM_STRING,
 			"If specified, bind the progress thread to the indicated range(s) of Linux virtual processor ID(s). "
-			"This option is currently not supported on OS X and Windows. Usage: id_start[-id_end[:stride]][,]");
+			"This option is currently not supported on OS X and Windows. Usage: id_start[-id_end[:stride]][,]. "
+			"With more than one progress engine, a ';' separated list gives the set for each thread in turn");
 
 	fi_param_define(&sock_prov, "keepalive_enable", FI_PARAM_BOOL,
 			"Enable keepalive support");
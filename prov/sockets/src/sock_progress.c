@@ -63,7 +63,6 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
 
-#define PE_INDEX(_pe, _e) (_e - &_pe->pe_table[0])
 #define SOCK_GET_RX_ID(_addr, _bits) (((_bits) == 0) ? 0 : \
 		(((uint64_t)_addr) >> (64 - _bits)))
 
@@ -147,23 +146,22 @@ static inline void sock_pe_discard_field(struct sock_pe_entry *pe_entry)
 	}
 }
 
-static void sock_pe_release_entry(struct sock_pe *pe,
-				  struct sock_pe_entry *pe_entry)
+/*
+ * Entry ids are unique across the progress engines of a domain: an endpoint
+ * may be moved to another engine while its entries wait for a response.
+ */
+static struct sock_pe_entry *sock_pe_lookup_entry(struct sock_pe *pe,
+						  uint16_t id)
 {
-	assert((pe_entry->type != SOCK_PE_RX) ||
-		ofi_rbempty(&pe_entry->comm_buf));
-	dlist_remove(&pe_entry->ctx_entry);
-
-	if (pe_entry->conn->tx_pe_entry == pe_entry)
-		pe_entry->conn->tx_pe_entry = NULL;
-	if (pe_entry->conn->rx_pe_entry == pe_entry)
-		pe_entry->conn->rx_pe_entry = NULL;
-
-	if (pe_entry->type == SOCK_PE_RX && pe_entry->pe.rx.atomic_cmp) {
-		ofi_buf_free(pe_entry->pe.rx.atomic_cmp);
-		ofi_buf_free(pe_entry->pe.rx.atomic_src);
-	}
+	assert(id < pe->domain->num_pe * SOCK_PE_MAX_ENTRIES);
+	return &pe->domain->pe_set[id / SOCK_PE_MAX_ENTRIES]->
+		pe_table[id % SOCK_PE_MAX_ENTRIES];
+}
 
+/* Called by the owner of the entry, with its lock held */
+static void sock_pe_free_entry(struct sock_pe *pe,
+			       struct sock_pe_entry *pe_entry)
+{
 	if (pe_entry->is_pool_entry) {
 		ofi_rbfree(&pe_entry->comm_buf);
 		dlist_remove(&pe_entry->entry);
@@ -199,16 +197,105 @@ static void sock_pe_release_entry(struct sock_pe *pe,
 	SOCK_LOG_DBG("progress entry %p released\n", pe_entry);
 }
 
+/* Free the entries that other PEs handed back, called with pe->lock held */
+static void sock_pe_reclaim_entries(struct sock_pe *pe)
+{
+	struct sock_pe_entry *pe_entry;
+	struct dlist_entry list;
+
+	dlist_init(&list);
+	fastlock_acquire(&pe->return_lock);
+	dlist_splice_tail(&list, &pe->return_list);
+	fastlock_release(&pe->return_lock);
+
+	while (!dlist_empty(&list)) {
+		pe_entry = container_of(list.next, struct sock_pe_entry, entry);
+		sock_pe_free_entry(pe, pe_entry);
+	}
+}
+
+/*
+ * The atomic buffers of an entry come from the pool of its owner.  That
+ * pool is guarded by the owner's return lock, since the PE that the entry
+ * moved to also allocates and frees them.
+ */
+static int sock_pe_alloc_atomic_bufs(struct sock_pe_entry *pe_entry)
+{
+	struct sock_pe *owner = pe_entry->owner;
+	int ret = 0;
+
+	fastlock_acquire(&owner->return_lock);
+	pe_entry->pe.rx.atomic_cmp = ofi_buf_alloc(owner->atomic_rx_pool);
+	pe_entry->pe.rx.atomic_src = ofi_buf_alloc(owner->atomic_rx_pool);
+	if (!pe_entry->pe.rx.atomic_cmp || !pe_entry->pe.rx.atomic_src) {
+		if (pe_entry->pe.rx.atomic_cmp)
+			ofi_buf_free(pe_entry->pe.rx.atomic_cmp);
+		if (pe_entry->pe.rx.atomic_src)
+			ofi_buf_free(pe_entry->pe.rx.atomic_src);
+		pe_entry->pe.rx.atomic_cmp = NULL;
+		pe_entry->pe.rx.atomic_src = NULL;
+		ret = -FI_ENOMEM;
+	}
+	fastlock_release(&owner->return_lock);
+	return ret;
+}
+
+static void sock_pe_free_atomic_bufs(struct sock_pe_entry *pe_entry)
+{
+	struct sock_pe *owner = pe_entry->owner;
+
+	fastlock_acquire(&owner->return_lock);
+	ofi_buf_free(pe_entry->pe.rx.atomic_cmp);
+	ofi_buf_free(pe_entry->pe.rx.atomic_src);
+	fastlock_release(&owner->return_lock);
+	pe_entry->pe.rx.atomic_cmp = NULL;
+	pe_entry->pe.rx.atomic_src = NULL;
+}
+
+static void sock_pe_release_entry(struct sock_pe *pe,
+				  struct sock_pe_entry *pe_entry)
+{
+	assert((pe_entry->type != SOCK_PE_RX) ||
+		ofi_rbempty(&pe_entry->comm_buf));
+	dlist_remove(&pe_entry->ctx_entry);
+
+	if (pe_entry->conn->tx_pe_entry == pe_entry)
+		pe_entry->conn->tx_pe_entry = NULL;
+	if (pe_entry->conn->rx_pe_entry == pe_entry)
+		pe_entry->conn->rx_pe_entry = NULL;
+
+	if (pe_entry->type == SOCK_PE_RX && pe_entry->pe.rx.atomic_cmp)
+		sock_pe_free_atomic_bufs(pe_entry);
+
+	if (pe_entry->owner == pe) {
+		sock_pe_free_entry(pe, pe_entry);
+		return;
+	}
+
+	/* The entry moved here with its endpoint: hand it back to its owner
+	 * without taking the owner's lock, it frees it on its next acquire */
+	dlist_remove(&pe_entry->entry);
+	fastlock_acquire(&pe_entry->owner->return_lock);
+	dlist_insert_tail(&pe_entry->entry, &pe_entry->owner->return_list);
+	fastlock_release(&pe_entry->owner->return_lock);
+	SOCK_LOG_DBG("progress entry %p returned to PE %d\n", pe_entry,
+		     pe_entry->owner->index);
+}
+
 static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 {
 	struct dlist_entry *entry;
 	struct sock_pe_entry *pe_entry;
 
+	if (dlist_empty(&pe->free_list))
+		sock_pe_reclaim_entries(pe);
+
 	if (dlist_empty(&pe->free_list)) {
 		pe_entry = ofi_buf_alloc(pe->pe_rx_pool);
 		SOCK_LOG_DBG("Getting rx pool entry\n");
 		if (pe_entry) {
 			memset(pe_entry, 0, sizeof(*pe_entry));
+			pe_entry->owner = pe;
 			pe_entry->is_pool_entry = 1;
 			if (ofi_rbinit(&pe_entry->comm_buf, SOCK_PE_OVERFLOW_COMM_BUFF_SZ))
 				SOCK_LOG_ERROR("failed to init comm-cache\n");
@@ -223,8 +310,8 @@ static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 		assert(ofi_rbempty(&pe_entry->comm_buf));
 		dlist_remove(&pe_entry->entry);
 		dlist_insert_tail(&pe_entry->entry, &pe->busy_list);
-		SOCK_LOG_DBG("progress entry %p acquired : %lu\n", pe_entry,
-			     PE_INDEX(pe, pe_entry));
+		SOCK_LOG_DBG("progress entry %p acquired : %d\n", pe_entry,
+			     pe_entry->id);
 	}
 	return pe_entry;
 }
@@ -577,8 +664,7 @@ static int sock_pe_handle_ack(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_lookup_entry(pe, response->pe_entry_id);
 	SOCK_LOG_DBG("Received ack for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
@@ -599,8 +685,7 @@ static int sock_pe_handle_error(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_lookup_entry(pe, response->pe_entry_id);
 	SOCK_LOG_ERROR("Received error for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
@@ -635,12 +720,10 @@ static int sock_pe_handle_read_complete(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_lookup_entry(pe, response->pe_entry_id);
 	SOCK_LOG_DBG("Received read complete for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
 	assert(waiting_entry->type == SOCK_PE_TX);
 
 	len = sizeof(struct sock_msg_response);
@@ -669,8 +752,7 @@ static int sock_pe_handle_write_complete(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_lookup_entry(pe, response->pe_entry_id);
 	SOCK_LOG_DBG("Received ack for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
@@ -693,12 +775,10 @@ static int sock_pe_handle_atomic_complete(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_lookup_entry(pe, response->pe_entry_id);
 	SOCK_LOG_DBG("Received atomic complete for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
 	assert(waiting_entry->type == SOCK_PE_TX);
 
 	len = sizeof(struct sock_msg_response);
@@ -884,12 +964,8 @@ static int sock_pe_recv_atomic_hdrs(struct sock_pe *pe,
 	uint64_t len;
 	int i;
 
-	if (!pe_entry->pe.rx.atomic_cmp) {
-		pe_entry->pe.rx.atomic_cmp = ofi_buf_alloc(pe->atomic_rx_pool);
-		pe_entry->pe.rx.atomic_src = ofi_buf_alloc(pe->atomic_rx_pool);
-		if (!pe_entry->pe.rx.atomic_cmp || !pe_entry->pe.rx.atomic_src)
-			return -FI_ENOMEM;
-	}
+	if (!pe_entry->pe.rx.atomic_cmp && sock_pe_alloc_atomic_bufs(pe_entry))
+		return -FI_ENOMEM;
 
 	len = sizeof(struct sock_msg_hdr);
 	if (sock_pe_recv_field(pe_entry, &pe_entry->pe.rx.rx_op,
@@ -978,6 +1054,8 @@ static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 		pe->pe_atomic = pe_entry;
 	}
 
+	/* atomics may target the same memory from several progress engines */
+	fastlock_acquire(&rx_ctx->domain->atomic_lock);
 	offset = 0;
 	for (i = 0; i < pe_entry->pe.rx.rx_op.dest_iov_len; i++) {
 		sock_pe_do_atomic(pe_entry->pe.rx.atomic_cmp + offset,
@@ -989,6 +1067,7 @@ static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 			pe_entry->pe.rx.rx_op.atomic.res_iov_len);
 		offset += datatype_sz * pe_entry->pe.rx.rx_iov[i].ioc.count;
 	}
+	fastlock_release(&rx_ctx->domain->atomic_lock);
 
 	pe_entry->buf = pe_entry->pe.rx.rx_iov[0].iov.addr;
 	pe_entry->data_len = offset;
@@ -2076,8 +2155,8 @@ static void sock_pe_new_rx_entry(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 	else
 		pe_entry->comp = &rx_ctx->comp;
 
-	SOCK_LOG_DBG("New RX on PE entry %p (%ld)\n",
-		      pe_entry, PE_INDEX(pe, pe_entry));
+	SOCK_LOG_DBG("New RX on PE entry %p (%d)\n",
+		      pe_entry, pe_entry->id);
 
 	SOCK_LOG_DBG("Inserting rx_entry to PE entry %p, conn: %p\n",
 		      pe_entry, pe_entry->conn);
@@ -2110,7 +2189,7 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 	msg_hdr = &pe_entry->msg_hdr;
 	msg_hdr->msg_len = sizeof(*msg_hdr);
 
-	msg_hdr->pe_entry_id = PE_INDEX(pe, pe_entry);
+	msg_hdr->pe_entry_id = pe_entry->id;
 	SOCK_LOG_DBG("New TX on PE entry %p (%d)\n",
 		      pe_entry, msg_hdr->pe_entry_id);
 
@@ -2303,6 +2382,7 @@ void sock_pe_add_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *ctx)
 	}
 
 	dlist_insert_tail(&ctx->pe_entry, &pe->tx_list);
+	ctx->pe = pe;
 	sock_pe_signal(pe);
 out:
 	pthread_mutex_unlock(&pe->list_lock);
@@ -2321,24 +2401,43 @@ void sock_pe_add_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *ctx)
 			goto out;
 	}
 	dlist_insert_tail(&ctx->pe_entry, &pe->rx_list);
+	ctx->pe = pe;
 	sock_pe_signal(pe);
 out:
 	pthread_mutex_unlock(&pe->list_lock);
 	SOCK_LOG_DBG("RX ctx added to PE\n");
 }
 
+/*
+ * The owning PE of a context only changes under that PE's list_lock, so
+ * check again once the lock is held.
+ */
 void sock_pe_remove_tx_ctx(struct sock_tx_ctx *tx_ctx)
 {
-	pthread_mutex_lock(&tx_ctx->domain->pe->list_lock);
-	dlist_remove(&tx_ctx->pe_entry);
-	pthread_mutex_unlock(&tx_ctx->domain->pe->list_lock);
+	struct sock_pe *pe;
+
+	while ((pe = tx_ctx->pe)) {
+		pthread_mutex_lock(&pe->list_lock);
+		if (pe == tx_ctx->pe) {
+			dlist_remove_init(&tx_ctx->pe_entry);
+			tx_ctx->pe = NULL;
+		}
+		pthread_mutex_unlock(&pe->list_lock);
+	}
 }
 
 void sock_pe_remove_rx_ctx(struct sock_rx_ctx *rx_ctx)
 {
-	pthread_mutex_lock(&rx_ctx->domain->pe->list_lock);
-	dlist_remove(&rx_ctx->pe_entry);
-	pthread_mutex_unlock(&rx_ctx->domain->pe->list_lock);
+	struct sock_pe *pe;
+
+	while ((pe = rx_ctx->pe)) {
+		pthread_mutex_lock(&pe->list_lock);
+		if (pe == rx_ctx->pe) {
+			dlist_remove_init(&rx_ctx->pe_entry);
+			rx_ctx->pe = NULL;
+		}
+		pthread_mutex_unlock(&pe->list_lock);
+	}
 }
 
 static int sock_pe_progress_rx_ep(struct sock_pe *pe,
@@ -2516,6 +2615,9 @@ int sock_pe_progress_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 		}
 	}
 
+	if (dlist_empty(&pe->free_list))
+		sock_pe_reclaim_entries(pe);
+
 	fastlock_acquire(&tx_ctx->rb_lock);
 	if (!ofi_rbempty(&tx_ctx->rb) && !dlist_empty(&pe->free_list)) {
 		ret = sock_pe_new_tx_entry(pe, tx_ctx);
@@ -2592,17 +2694,211 @@ static void sock_pe_wait(struct sock_pe *pe)
 	pe->waittime = fi_gettime_ms();
 }
 
-static void sock_pe_set_affinity(void)
+/*
+ * FI_SOCKETS_PE_AFFINITY may hold a ';' separated list of CPU sets, one per
+ * progress thread.  Thread i uses entry (i % number of entries).
+ */
+static void sock_pe_set_affinity(struct sock_pe *pe)
 {
-	char *sock_pe_affinity_str;
+	char *sock_pe_affinity_str, *str, *cpus, *saveptr;
+	int i, cnt;
+
 	if (fi_param_get_str(&sock_prov, "pe_affinity", &sock_pe_affinity_str) != FI_SUCCESS)
 		return;
 
 	if (sock_pe_affinity_str == NULL)
 		return;
 
-	if (ofi_set_thread_affinity(sock_pe_affinity_str) == -FI_ENOSYS)
+	str = strdup(sock_pe_affinity_str);
+	if (!str)
+		return;
+
+	for (cnt = 0, cpus = str; cpus; cnt++) {
+		cpus = strchr(cpus, ';');
+		if (cpus)
+			cpus++;
+	}
+
+	cpus = strtok_r(str, ";", &saveptr);
+	for (i = 0; cpus && i < pe->index % cnt; i++)
+		cpus = strtok_r(NULL, ";", &saveptr);
+
+	if (cpus && ofi_set_thread_affinity(cpus) == -FI_ENOSYS)
 		SOCK_LOG_ERROR("FI_SOCKETS_PE_AFFINITY is not supported on OS X and Windows\n");
+	free(str);
+}
+
+static int sock_pe_ep_movable(struct sock_pe *pe, struct sock_ep_attr *ep_attr)
+{
+	size_t i;
+
+	if (ep_attr->pe != pe || ep_attr->tx_shared || ep_attr->rx_shared)
+		return 0;
+
+	for (i = 0; i < ep_attr->ep_attr.tx_ctx_cnt; i++) {
+		if (ep_attr->tx_array[i] && ep_attr->tx_array[i]->use_shared)
+			return 0;
+	}
+	for (i = 0; i < ep_attr->ep_attr.rx_ctx_cnt; i++) {
+		if (ep_attr->rx_array[i] && ep_attr->rx_array[i]->use_shared)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns an endpoint with work pending, provided that this PE has at
+ * least one other endpoint with work pending to keep itself busy.
+ */
+static struct sock_ep_attr *sock_pe_busy_ep(struct sock_pe *pe)
+{
+	struct dlist_entry *entry;
+	struct sock_tx_ctx *tx_ctx;
+	struct sock_rx_ctx *rx_ctx;
+	struct sock_ep_attr *ep_attr, *busy_ep = NULL;
+
+	for (entry = pe->tx_list.next; entry != &pe->tx_list;
+	     entry = entry->next) {
+		tx_ctx = container_of(entry, struct sock_tx_ctx, pe_entry);
+		if (tx_ctx->fclass == FI_CLASS_STX_CTX ||
+		    (ofi_rbempty(&tx_ctx->rb) &&
+		     dlist_empty(&tx_ctx->pe_entry_list)))
+			continue;
+
+		ep_attr = tx_ctx->ep_attr;
+		if (!busy_ep)
+			busy_ep = ep_attr;
+		else if (ep_attr != busy_ep && sock_pe_ep_movable(pe, ep_attr))
+			return ep_attr;
+	}
+
+	for (entry = pe->rx_list.next; entry != &pe->rx_list;
+	     entry = entry->next) {
+		rx_ctx = container_of(entry, struct sock_rx_ctx, pe_entry);
+		if (rx_ctx->ctx.fid.fclass == FI_CLASS_SRX_CTX ||
+		    dlist_empty(&rx_ctx->pe_entry_list))
+			continue;
+
+		ep_attr = rx_ctx->ep_attr;
+		if (!busy_ep)
+			busy_ep = ep_attr;
+		else if (ep_attr != busy_ep && sock_pe_ep_movable(pe, ep_attr))
+			return ep_attr;
+	}
+	return NULL;
+}
+
+static void sock_pe_move_entries(struct sock_pe *pe, struct sock_pe *new_pe,
+				 struct dlist_entry *pe_entry_list)
+{
+	struct dlist_entry *entry;
+	struct sock_pe_entry *pe_entry;
+
+	dlist_foreach(pe_entry_list, entry) {
+		pe_entry = container_of(entry, struct sock_pe_entry, ctx_entry);
+		dlist_remove(&pe_entry->entry);
+		dlist_insert_tail(&pe_entry->entry, pe_entry->is_pool_entry ?
+				  &new_pe->pool_list : &new_pe->busy_list);
+		if (pe->pe_atomic == pe_entry)
+			pe->pe_atomic = NULL;
+	}
+}
+
+/*
+ * Hand an endpoint over to another PE.  Called with both PEs' list_lock
+ * and lock held, so neither of them is progressing the endpoint.
+ */
+static void sock_pe_move_ep(struct sock_pe *pe, struct sock_pe *new_pe,
+			    struct sock_ep_attr *ep_attr)
+{
+	struct sock_conn_map *map = &ep_attr->cmap;
+	struct sock_tx_ctx *tx_ctx;
+	struct sock_rx_ctx *rx_ctx;
+	size_t i;
+	int j;
+
+	for (i = 0; i < ep_attr->ep_attr.tx_ctx_cnt; i++) {
+		if (ep_attr->tx_array[i])
+			fastlock_acquire(&ep_attr->tx_array[i]->rb_lock);
+	}
+	fastlock_acquire(&map->lock);
+
+	for (i = 0; i < ep_attr->ep_attr.tx_ctx_cnt; i++) {
+		tx_ctx = ep_attr->tx_array[i];
+		if (!tx_ctx || tx_ctx->pe != pe)
+			continue;
+		sock_pe_move_entries(pe, new_pe, &tx_ctx->pe_entry_list);
+		if (tx_ctx->rx_ctrl_ctx)
+			sock_pe_move_entries(pe, new_pe,
+					     &tx_ctx->rx_ctrl_ctx->pe_entry_list);
+		dlist_remove(&tx_ctx->pe_entry);
+		dlist_insert_tail(&tx_ctx->pe_entry, &new_pe->tx_list);
+		tx_ctx->pe = new_pe;
+	}
+
+	for (i = 0; i < ep_attr->ep_attr.rx_ctx_cnt; i++) {
+		rx_ctx = ep_attr->rx_array[i];
+		if (!rx_ctx || rx_ctx->pe != pe)
+			continue;
+		sock_pe_move_entries(pe, new_pe, &rx_ctx->pe_entry_list);
+		dlist_remove(&rx_ctx->pe_entry);
+		dlist_insert_tail(&rx_ctx->pe_entry, &new_pe->rx_list);
+		rx_ctx->pe = new_pe;
+	}
+
+	for (j = 0; j < map->used; j++) {
+		if (map->table[j].sock_fd == -1)
+			continue;
+		sock_pe_poll_del(pe, map->table[j].sock_fd);
+		sock_pe_poll_add(new_pe, map->table[j].sock_fd);
+	}
+	ep_attr->pe = new_pe;
+
+	fastlock_release(&map->lock);
+	for (i = 0; i < ep_attr->ep_attr.tx_ctx_cnt; i++) {
+		if (ep_attr->tx_array[i])
+			fastlock_release(&ep_attr->tx_array[i]->rb_lock);
+	}
+	SOCK_LOG_DBG("Moved EP %p from PE %d to PE %d\n", ep_attr,
+		     pe->index, new_pe->index);
+}
+
+/*
+ * Called by a progress thread with its list_lock held: if another progress
+ * thread is idle, give it one of our busy endpoints.  Only the owner thread
+ * moves endpoints away from a PE and the target's list_lock is only tried,
+ * so two threads can't deadlock moving endpoints to each other.
+ */
+static void sock_pe_share_work(struct sock_pe *pe)
+{
+	struct sock_domain *domain = pe->domain;
+	struct sock_pe *idle_pe = NULL;
+	struct sock_ep_attr *ep_attr;
+	int i;
+
+	for (i = 0; i < domain->num_pe; i++) {
+		if (domain->pe_set[i] != pe &&
+		    ofi_atomic_get32(&domain->pe_set[i]->idle)) {
+			idle_pe = domain->pe_set[i];
+			break;
+		}
+	}
+	if (!idle_pe)
+		return;
+
+	ep_attr = sock_pe_busy_ep(pe);
+	if (!ep_attr || pthread_mutex_trylock(&idle_pe->list_lock))
+		return;
+
+	fastlock_acquire(&pe->lock);
+	fastlock_acquire(&idle_pe->lock);
+	sock_pe_move_ep(pe, idle_pe, ep_attr);
+	fastlock_release(&idle_pe->lock);
+	fastlock_release(&pe->lock);
+
+	ofi_atomic_set32(&idle_pe->idle, 0);
+	pthread_mutex_unlock(&idle_pe->list_lock);
+	sock_pe_signal(idle_pe);
 }
 
 static void *sock_pe_progress_thread(void *data)
@@ -2614,13 +2910,15 @@ static void *sock_pe_progress_thread(void *data)
 	struct sock_pe *pe = (struct sock_pe *)data;
 
 	SOCK_LOG_DBG("Progress thread started\n");
-	sock_pe_set_affinity();
+	sock_pe_set_affinity(pe);
 	while (*((volatile int *)&pe->do_progress)) {
 		pthread_mutex_lock(&pe->list_lock);
 		if (pe->domain->progress_mode == FI_PROGRESS_AUTO &&
 		    sock_pe_wait_ok(pe)) {
 			pthread_mutex_unlock(&pe->list_lock);
+			ofi_atomic_set32(&pe->idle, 1);
 			sock_pe_wait(pe);
+			ofi_atomic_set32(&pe->idle, 0);
 			pthread_mutex_lock(&pe->list_lock);
 		}
 
@@ -2651,6 +2949,9 @@ static void *sock_pe_progress_thread(void *data)
 				}
 			}
 		}
+
+		if (pe->domain->num_pe > 1)
+			sock_pe_share_work(pe);
 		pthread_mutex_unlock(&pe->list_lock);
 	}
 
@@ -2668,9 +2969,12 @@ static void sock_pe_init_table(struct sock_pe *pe)
 	dlist_init(&pe->free_list);
 	dlist_init(&pe->busy_list);
 	dlist_init(&pe->pool_list);
+	dlist_init(&pe->return_list);
 
 	for (i = 0; i < SOCK_PE_MAX_ENTRIES; i++) {
 		dlist_insert_head(&pe->pe_table[i].entry, &pe->free_list);
+		pe->pe_table[i].owner = pe;
+		pe->pe_table[i].id = pe->index * SOCK_PE_MAX_ENTRIES + i;
 		pe->pe_table[i].cache_sz = SOCK_PE_COMM_BUFF_SZ;
 		if (ofi_rbinit(&pe->pe_table[i].comm_buf, SOCK_PE_COMM_BUFF_SZ))
 			SOCK_LOG_ERROR("failed to init comm-cache\n");
@@ -2680,7 +2984,7 @@ static void sock_pe_init_table(struct sock_pe *pe)
 	SOCK_LOG_DBG("PE table init: OK\n");
 }
 
-struct sock_pe *sock_pe_init(struct sock_domain *domain)
+static struct sock_pe *sock_pe_create(struct sock_domain *domain, int index)
 {
 	struct sock_pe *pe;
 	int ret;
@@ -2689,12 +2993,15 @@ struct sock_pe *sock_pe_init(struct sock_domain *domain)
 	if (!pe)
 		return NULL;
 
+	pe->index = index;
 	sock_pe_init_table(pe);
 	dlist_init(&pe->tx_list);
 	dlist_init(&pe->rx_list);
 	fastlock_init(&pe->lock);
 	fastlock_init(&pe->signal_lock);
+	fastlock_init(&pe->return_lock);
 	pthread_mutex_init(&pe->list_lock, NULL);
+	ofi_atomic_initialize32(&pe->idle, 0);
 	pe->domain = domain;
 
 	
@@ -2752,11 +3059,13 @@ err1:
 	return NULL;
 }
 
+/* Pool entries may have been allocated by another PE of the domain */
 static void sock_pe_free_util_pool(struct sock_pe *pe)
 {
 	struct dlist_entry *entry;
 	struct sock_pe_entry *pe_entry;
 
+	sock_pe_reclaim_entries(pe);
 	while (!dlist_empty(&pe->pool_list)) {
 		entry = pe->pool_list.next;
 		pe_entry = container_of(entry, struct sock_pe_entry, entry);
@@ -2764,14 +3073,10 @@ static void sock_pe_free_util_pool(struct sock_pe *pe)
 		dlist_remove(&pe_entry->entry);
 		ofi_buf_free(pe_entry);
 	}
-
-	ofi_bufpool_destroy(pe->pe_rx_pool);
-	ofi_bufpool_destroy(pe->atomic_rx_pool);
 }
 
-void sock_pe_finalize(struct sock_pe *pe)
+static void sock_pe_stop(struct sock_pe *pe)
 {
-	int i;
 	if (pe->domain->progress_mode == FI_PROGRESS_AUTO) {
 		pe->do_progress = 0;
 		sock_pe_signal(pe);
@@ -2779,16 +3084,75 @@ void sock_pe_finalize(struct sock_pe *pe)
 		ofi_close_socket(pe->signal_fds[0]);
 		ofi_close_socket(pe->signal_fds[1]);
 	}
+}
+
+static void sock_pe_destroy(struct sock_pe *pe)
+{
+	int i;
 
 	for (i = 0; i < SOCK_PE_MAX_ENTRIES; i++) {
 		ofi_rbfree(&pe->pe_table[i].comm_buf);
 	}
 
-	sock_pe_free_util_pool(pe);
+	ofi_bufpool_destroy(pe->pe_rx_pool);
+	ofi_bufpool_destroy(pe->atomic_rx_pool);
 	fastlock_destroy(&pe->lock);
 	fastlock_destroy(&pe->signal_lock);
+	fastlock_destroy(&pe->return_lock);
 	pthread_mutex_destroy(&pe->list_lock);
 	fi_epoll_close(pe->epoll_set);
 	free(pe);
 	SOCK_LOG_DBG("Progress engine finalize: OK\n");
 }
+
+void sock_pe_finalize(struct sock_domain *domain)
+{
+	int i;
+
+	for (i = 0; i < domain->num_pe; i++)
+		sock_pe_stop(domain->pe_set[i]);
+	for (i = 0; i < domain->num_pe; i++)
+		sock_pe_free_util_pool(domain->pe_set[i]);
+	for (i = 0; i < domain->num_pe; i++)
+		sock_pe_destroy(domain->pe_set[i]);
+
+	fastlock_destroy(&domain->atomic_lock);
+	free(domain->pe_set);
+	domain->pe_set = NULL;
+	domain->pe = NULL;
+	domain->num_pe = 0;
+}
+
+int sock_pe_init(struct sock_domain *domain)
+{
+	int num_pe;
+
+	num_pe = MIN(MAX(sock_pe_count, 1), SOCK_PE_MAX_COUNT);
+	domain->pe_set = calloc(num_pe, sizeof(*domain->pe_set));
+	if (!domain->pe_set)
+		return -FI_ENOMEM;
+
+	fastlock_init(&domain->atomic_lock);
+	ofi_atomic_initialize32(&domain->pe_next, 0);
+	for (domain->num_pe = 0; domain->num_pe < num_pe; domain->num_pe++) {
+		domain->pe_set[domain->num_pe] =
+			sock_pe_create(domain, domain->num_pe);
+		if (!domain->pe_set[domain->num_pe]) {
+			sock_pe_finalize(domain);
+			return -FI_ENOMEM;
+		}
+	}
+
+	/* shared contexts are always progressed by the first PE */
+	domain->pe = domain->pe_set[0];
+	return 0;
+}
+
+struct sock_pe *sock_pe_select(struct sock_domain *domain)
+{
+	if (domain->num_pe == 1)
+		return domain->pe;
+
+	return domain->pe_set[(uint32_t) (ofi_atomic_inc32(&domain->pe_next) - 1) %
+			      domain->num_pe];
+}
@@ -233,10 +233,16 @@ struct tcpx_xfer_entry {
 	uint64_t		rem_len;
 	void			*mrecv_msg_start;
 	release_func_t		rx_msg_release_fn;
+	/* Posted buffer layout saved while only the header of a message
+	 * is received (dynamic receive buffers) */
+	size_t			peek_iov_cnt;
+	size_t			peek_iov_len;
 };
 
 struct tcpx_domain {
 	struct util_domain	util_domain;
+	/* Set by a utility provider through OFI_OPS_DYNAMIC_RBUF */
+	struct ofi_ops_dynamic_rbuf *dynamic_rbuf;
 };
 
 struct tcpx_buf_pool {
@@ -226,7 +226,8 @@ static void tcpx_buf_pool_init(struct ofi_bufpool_region *region, void *buf)
 	}
 }
 
-static int tcpx_buf_pools_create(struct tcpx_buf_pool *buf_pools)
+static int tcpx_buf_pools_create(struct tcpx_buf_pool *buf_pools,
+				 int numa_node)
 {
 	int i, ret;
 	struct ofi_bufpool_attr attr = {
@@ -237,6 +238,7 @@ static int tcpx_buf_pools_create(struct tcpx_buf_pool *buf_pools)
 		.flags = OFI_BUFPOOL_HUGEPAGES,
 	};
 
+	ofi_bufpool_attr_set_numa(&attr, numa_node);
 	for (i = 0; i < TCPX_OP_CODE_MAX; i++) {
 		buf_pools[i].op_type = i;
 
@@ -270,7 +272,8 @@ int tcpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	if (!attr->size)
 		attr->size = TCPX_DEF_CQ_SIZE;
 
-	ret = tcpx_buf_pools_create(tcpx_cq->buf_pools);
+	/* xfer entries are allocated per CQ, on the node of its opener */
+	ret = tcpx_buf_pools_create(tcpx_cq->buf_pools, ofi_numa_node_self());
 	if (ret)
 		goto free_cq;
 
@@ -133,12 +133,32 @@ static int tcpx_domain_close(fid_t fid)
 	return FI_SUCCESS;
 }
 
+static int tcpx_domain_ops_open(struct fid *fid, const char *name,
+				uint64_t flags, void **ops, void *context)
+{
+	struct tcpx_domain *tcpx_domain;
+	struct ofi_ops_dynamic_rbuf *rbuf_ops;
+
+	if (flags || strcmp(name, OFI_OPS_DYNAMIC_RBUF))
+		return -FI_ENOSYS;
+
+	rbuf_ops = *ops;
+	if (rbuf_ops && (rbuf_ops->size < sizeof(*rbuf_ops) ||
+			 !rbuf_ops->get_rbuf || !rbuf_ops->hdr_size))
+		return -FI_EINVAL;
+
+	tcpx_domain = container_of(fid, struct tcpx_domain,
+				   util_domain.domain_fid.fid);
+	tcpx_domain->dynamic_rbuf = rbuf_ops;
+	return FI_SUCCESS;
+}
+
 static struct fi_ops tcpx_domain_fi_ops = {
 	.size = sizeof(struct fi_ops),
 	.close = tcpx_domain_close,
 	.bind = fi_no_bind,
 	.control = fi_no_control,
-	.ops_open = fi_no_ops_open,
+	.ops_open = tcpx_domain_ops_open,
 };
 
 static struct fi_ops_mr tcpx_domain_fi_ops_mr = {
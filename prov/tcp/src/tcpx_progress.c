@@ -159,11 +159,51 @@ static int tcpx_prepare_rx_entry_resp(struct tcpx_xfer_entry *rx_entry)
 	return FI_SUCCESS;
 }
 
+/* Called once the header part of a message has been received. Lets the
+ * owner of the posted buffer place the rest of the message elsewhere. */
+static void tcpx_rx_get_rbuf(struct tcpx_xfer_entry *rx_entry)
+{
+	struct ofi_ops_dynamic_rbuf *rbuf_ops;
+	struct tcpx_domain *tcpx_domain;
+	struct iovec iov[TCPX_IOV_LIMIT];
+	size_t msg_len;
+	ssize_t cnt;
+
+	tcpx_domain = container_of(rx_entry->ep->util_ep.domain,
+				   struct tcpx_domain, util_domain);
+	rbuf_ops = tcpx_domain->dynamic_rbuf;
+	msg_len = rx_entry->hdr.base_hdr.size -
+		  rx_entry->hdr.base_hdr.payload_off;
+
+	cnt = rbuf_ops->get_rbuf(rx_entry->context, msg_len, iov,
+				 TCPX_IOV_LIMIT);
+	if (cnt > 0) {
+		memcpy(rx_entry->iov, iov, sizeof(*iov) * cnt);
+		rx_entry->iov_cnt = cnt;
+		if (!ofi_truncate_iov(rx_entry->iov, &rx_entry->iov_cnt,
+				      msg_len - rbuf_ops->hdr_size))
+			goto out;
+
+		FI_WARN(&tcpx_prov, FI_LOG_EP_DATA,
+			"dynamic rx buffer is not big enough\n");
+	}
+
+	/* Continue in the posted buffer, right after the header */
+	rx_entry->iov[0].iov_len = rx_entry->peek_iov_len;
+	rx_entry->iov_cnt = rx_entry->peek_iov_cnt;
+out:
+	rx_entry->peek_iov_cnt = 0;
+}
+
 static int process_rx_entry(struct tcpx_xfer_entry *rx_entry)
 {
 	int ret = FI_SUCCESS;
 
 	ret = tcpx_recv_msg_data(rx_entry);
+	if (!ret && rx_entry->peek_iov_cnt) {
+		tcpx_rx_get_rbuf(rx_entry);
+		ret = tcpx_recv_msg_data(rx_entry);
+	}
 	if (OFI_SOCK_TRY_SND_RCV_AGAIN(-ret))
 		return ret;
 
@@ -403,6 +443,41 @@ tcpx_rx_detect_init(struct tcpx_rx_detect *rx_detect)
 	rx_detect->done_len = 0;
 }
 
+/* Receive only the header of the message into the posted buffer first if
+ * the utility provider above wants to choose where the payload goes. This
+ * is only done while the rx CQ is empty so that the message is seen after
+ * all the messages that were received before it. */
+static void tcpx_rx_peek_setup(struct tcpx_ep *tcpx_ep,
+			       struct tcpx_xfer_entry *rx_entry, size_t msg_len)
+{
+	struct tcpx_domain *tcpx_domain;
+	struct util_cq *cq = tcpx_ep->util_ep.rx_cq;
+	size_t hdr_size;
+	int empty;
+
+	rx_entry->peek_iov_cnt = 0;
+
+	tcpx_domain = container_of(tcpx_ep->util_ep.domain,
+				   struct tcpx_domain, util_domain);
+	if (!tcpx_domain->dynamic_rbuf || (rx_entry->flags & FI_MULTI_RECV))
+		return;
+
+	hdr_size = tcpx_domain->dynamic_rbuf->hdr_size;
+	if (msg_len <= hdr_size || rx_entry->iov[0].iov_len <= hdr_size)
+		return;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	empty = ofi_cirque_isempty(cq->cirq);
+	cq->cq_fastlock_release(&cq->cq_lock);
+	if (!empty)
+		return;
+
+	rx_entry->peek_iov_cnt = rx_entry->iov_cnt;
+	rx_entry->peek_iov_len = rx_entry->iov[0].iov_len - hdr_size;
+	rx_entry->iov[0].iov_len = hdr_size;
+	rx_entry->iov_cnt = 1;
+}
+
 int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 {
 	struct tcpx_xfer_entry *rx_entry;
@@ -472,6 +547,7 @@ int tcpx_get_rx_entry_op_msg(struct tcpx_ep *tcpx_ep)
 		return ret;
 	}
 
+	tcpx_rx_peek_setup(tcpx_ep, rx_entry, msg_len);
 	tcpx_ep->cur_rx_proc_fn = process_rx_entry;
 	if (rx_detect->hdr.base_hdr.flags & OFI_REMOTE_CQ_DATA)
 		rx_entry->flags |= FI_REMOTE_CQ_DATA;
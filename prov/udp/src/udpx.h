@@ -41,6 +41,9 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#if HAVE_SENDMMSG || HAVE_RECVMMSG
+#include <netinet/udp.h>
+#endif
 
 #include <rdma/fabric.h>
 #include <rdma/fi_atomic.h>
@@ -56,6 +59,7 @@
 #include <ofi.h>
 #include <ofi_enosys.h>
 #include <ofi_rbuf.h>
+#include <ofi_iov.h>
 #include <ofi_list.h>
 #include <ofi_signal.h>
 #include <ofi_util.h>
@@ -72,6 +76,13 @@ extern struct fi_provider udpx_prov;
 extern struct util_prov udpx_util_prov;
 extern struct fi_info udpx_info;
 
+struct udpx_env {
+	int	gso;
+	int	gro;
+};
+
+extern struct udpx_env udpx_env;
+
 
 int udpx_fabric(struct fi_fabric_attr *attr, struct fid_fabric **fabric,
 		void *context);
@@ -83,6 +94,19 @@ int udpx_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 
 #define UDPX_FLAG_MULTI_RECV	1
 #define UDPX_IOV_LIMIT		4
+#define UDPX_DEF_MSG_SIZE	1472
+#define UDPX_MAX_MSG_SIZE	65507
+#define UDPX_MSG_BATCH		64
+#define UDPX_MAX_CTX		16
+
+/* UDP segmentation offload on send and receive (Linux 4.18 / 5.0) */
+#if HAVE_SENDMMSG && defined(UDP_SEGMENT)
+#define UDPX_HAVE_GSO		1
+#endif
+#if defined(UDP_GRO)
+#define UDPX_HAVE_GRO		1
+#define UDPX_GRO_BUF_SIZE	65536
+#endif
 
 struct udpx_ep_entry {
 	void			*context;
@@ -94,7 +118,18 @@ struct udpx_ep_entry {
 
 OFI_DECLARE_CIRQUE(struct udpx_ep_entry, udpx_rx_cirq);
 
+struct udpx_tx_entry {
+	void			*context;
+	struct iovec		iov[UDPX_IOV_LIMIT];
+	uint8_t			iov_count;
+	socklen_t		addrlen;
+	struct sockaddr_in6	addr;
+};
+
+OFI_DECLARE_CIRQUE(struct udpx_tx_entry, udpx_tx_cirq);
+
 struct udpx_ep;
+struct udpx_sep;
 typedef void (*udpx_rx_comp_func)(struct udpx_ep *ep, void *context,
 		uint64_t flags, size_t len, void *buf, void *addr);
 typedef void (*udpx_tx_comp_func)(struct udpx_ep *ep, void *context);
@@ -104,13 +139,46 @@ struct udpx_ep {
 	udpx_rx_comp_func	rx_comp;
 	udpx_tx_comp_func	tx_comp;
 	struct udpx_rx_cirq	*rxq;    /* protected by rx_cq lock */
+	struct udpx_tx_cirq	*txq;    /* protected by tx_cq lock */
 	SOCKET			sock;
 	int			is_bound;
+	int			gso;
+	void			*gro_buf;
+	struct udpx_sep		*sep;
 	ofi_atomic32_t		ref;
 };
 
 int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct fid_ep **ep, void *context);
+int udpx_ep_open(struct fid_domain *domain, struct fi_info *info,
+		 struct udpx_sep *sep, size_t fclass, SOCKET sock,
+		 struct fid_ep **ep_fid, void *context);
+int udpx_bind_addr(SOCKET sock, const void *addr, size_t addrlen);
+int udpx_bind_src_addr(SOCKET sock);
+
+/*
+ * Scalable endpoint.  Every RX context owns a socket bound to the same
+ * address with SO_REUSEPORT; the kernel spreads incoming flows across
+ * them.  RX context 0 and all TX contexts use the SEP's own socket.
+ */
+struct udpx_sep {
+	struct fid_ep		ep_fid;
+	struct util_domain	*domain;
+	struct util_av		*av;
+	struct fi_info		*info;
+	SOCKET			sock;
+	int			is_bound;
+	struct udpx_ep		*tx_ctx[UDPX_MAX_CTX];
+	struct udpx_ep		*rx_ctx[UDPX_MAX_CTX];
+	ofi_atomic32_t		ref;
+	fastlock_t		lock;
+};
+
+int udpx_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		     struct fid_ep **sep, void *context);
+int udpx_sep_enable(struct udpx_sep *sep);
+int udpx_sep_socket(struct udpx_sep *sep, SOCKET *sock);
+void udpx_sep_remove_ctx(struct udpx_sep *sep, struct udpx_ep *ep);
 
 
 int udpx_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
@@ -53,7 +53,7 @@ struct fi_ep_attr udpx_ep_attr = {
 	.type = FI_EP_DGRAM,
 	.protocol = FI_PROTO_UDP,
 	.protocol_version = 0,
-	.max_msg_size = 1472,
+	.max_msg_size = UDPX_MAX_MSG_SIZE,
 	.tx_ctx_cnt = 1,
 	.rx_ctx_cnt = 1
 };
@@ -70,8 +70,8 @@ struct fi_domain_attr udpx_domain_attr = {
 	.ep_cnt = 256,
 	.tx_ctx_cnt = 256,
 	.rx_ctx_cnt = 256,
-	.max_ep_tx_ctx = 1,
-	.max_ep_rx_ctx = 1
+	.max_ep_tx_ctx = UDPX_MAX_CTX,
+	.max_ep_rx_ctx = UDPX_MAX_CTX
 };
 
 struct fi_fabric_attr udpx_fabric_attr = {
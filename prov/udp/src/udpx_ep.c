@@ -36,23 +36,32 @@
 #include "udpx.h"
 
 
-static int udpx_setname(fid_t fid, void *addr, size_t addrlen)
+int udpx_bind_addr(SOCKET sock, const void *addr, size_t addrlen)
 {
-	struct udpx_ep *ep;
 	int ret;
 
-	ep = container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
 	ofi_straddr_dbg(&udpx_prov, FI_LOG_EP_CTRL, "bind addr: ", addr);
-	ret = bind(ep->sock, addr, (socklen_t)addrlen);
+	ret = bind(sock, addr, (socklen_t)addrlen);
 	if (ret) {
 		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL, "bind %d (%s)\n",
 			errno, strerror(errno));
 		return -errno;
 	}
-	ep->is_bound = 1;
 	return 0;
 }
 
+static int udpx_setname(fid_t fid, void *addr, size_t addrlen)
+{
+	struct udpx_ep *ep;
+	int ret;
+
+	ep = container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
+	ret = udpx_bind_addr(ep->sock, addr, addrlen);
+	if (!ret)
+		ep->is_bound = 1;
+	return ret;
+}
+
 static int udpx_getname(fid_t fid, void *addr, size_t *addrlen)
 {
 	struct udpx_ep *ep =
@@ -215,17 +224,12 @@ static struct fi_ops_ep udpx_ep_ops = {
 };
 
 
+/* Sends flushed from the queue may find the CQ full: those completions go
+ * to the overflow list */
 static void udpx_tx_comp(struct udpx_ep *ep, void *context)
 {
-	struct fi_cq_tagged_entry *comp;
-
-	comp = ofi_cirque_tail(ep->util_ep.tx_cq->cirq);
-	comp->op_context = context;
-	comp->flags = FI_SEND;
-	comp->len = 0;
-	comp->buf = NULL;
-	comp->data = 0;
-	ofi_cirque_commit(ep->util_ep.tx_cq->cirq);
+	ofi_cq_write_thread_unsafe(ep->util_ep.tx_cq, context, FI_SEND,
+				   0, NULL, 0, 0);
 }
 
 static void udpx_tx_comp_signal(struct udpx_ep *ep, void *context)
@@ -270,24 +274,339 @@ static void udpx_rx_src_comp_signal(struct udpx_ep *ep, void *context,
 	ep->util_ep.rx_cq->wait->signal(ep->util_ep.rx_cq->wait);
 }
 
-static void udpx_ep_progress(struct util_ep *util_ep)
+#define udpx_cirq_entry(cq, i) (&(cq)->buf[((cq)->rcnt + (i)) & (cq)->size_mask])
+
+static void udpx_init_tx_hdr(struct msghdr *hdr, struct udpx_tx_entry *entry)
+{
+	hdr->msg_name = &entry->addr;
+	hdr->msg_namelen = entry->addrlen;
+	hdr->msg_iov = entry->iov;
+	hdr->msg_iovlen = entry->iov_count;
+	hdr->msg_control = NULL;
+	hdr->msg_controllen = 0;
+	hdr->msg_flags = 0;
+}
+
+#if UDPX_HAVE_GSO
+union udpx_gso_ctrl {
+	char			buf[CMSG_SPACE(sizeof(uint16_t))];
+	struct cmsghdr		align;
+};
+
+/*
+ * Consecutive queued datagrams to the same peer that have the same size
+ * (the last one may be shorter) are handed to the kernel as one buffer
+ * with UDP_SEGMENT, which splits them back into the original datagrams.
+ * Returns the number of queued entries covered by the message.
+ */
+static size_t udpx_init_gso_hdr(struct udpx_ep *ep, struct msghdr *hdr,
+				size_t start, size_t cnt, struct iovec *iov,
+				union udpx_gso_ctrl *ctrl)
+{
+	struct udpx_tx_entry *first, *entry;
+	struct cmsghdr *cmsg;
+	size_t seg, len, total, n, i, iov_cnt;
+
+	first = udpx_cirq_entry(ep->txq, start);
+	udpx_init_tx_hdr(hdr, first);
+	seg = ofi_total_iov_len(first->iov, first->iov_count);
+	if (!seg)
+		return 1;
+
+	for (n = 1, total = seg; start + n < cnt; n++) {
+		entry = udpx_cirq_entry(ep->txq, start + n);
+		len = ofi_total_iov_len(entry->iov, entry->iov_count);
+		if (!len || len > seg || total + len > UDPX_MAX_MSG_SIZE ||
+		    entry->addrlen != first->addrlen ||
+		    memcmp(&entry->addr, &first->addr, first->addrlen))
+			break;
+		total += len;
+		if (len < seg) {
+			n++;
+			break;
+		}
+	}
+	if (n == 1)
+		return 1;
+
+	for (i = 0, iov_cnt = 0; i < n; i++) {
+		entry = udpx_cirq_entry(ep->txq, start + i);
+		memcpy(&iov[iov_cnt], entry->iov,
+		       entry->iov_count * sizeof(*iov));
+		iov_cnt += entry->iov_count;
+	}
+	hdr->msg_iov = iov;
+	hdr->msg_iovlen = iov_cnt;
+
+	hdr->msg_control = ctrl->buf;
+	hdr->msg_controllen = sizeof(ctrl->buf);
+	cmsg = CMSG_FIRSTHDR(hdr);
+	cmsg->cmsg_level = IPPROTO_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) seg;
+	return n;
+}
+#endif
+
+static void udpx_tx_err_comp(struct udpx_ep *ep, void *context, int err)
+{
+	struct fi_cq_err_entry err_entry = {
+		.op_context	= context,
+		.flags		= FI_SEND,
+		.err		= err,
+		.prov_errno	= err,
+	};
+
+	ofi_cq_write_error_thread_unsafe(ep->util_ep.tx_cq, &err_entry);
+	if (ep->util_ep.tx_cq->wait)
+		util_cq_signal(ep->util_ep.tx_cq);
+}
+
+/*
+ * Sends queued by FI_MORE are flushed with a single sendmmsg() where
+ * available.  A datagram that the socket refuses for reasons other than
+ * a full send buffer completes in error.  Called with the tx_cq lock
+ * held.
+ */
+static void udpx_flush_sends(struct udpx_ep *ep)
+{
+	struct udpx_tx_entry *entry;
+#if HAVE_SENDMMSG
+	struct mmsghdr msgs[UDPX_MSG_BATCH];
+	size_t segs[UDPX_MSG_BATCH];
+	size_t cnt, i, n;
+#if UDPX_HAVE_GSO
+	struct iovec iov[UDPX_MSG_BATCH * UDPX_IOV_LIMIT];
+	union udpx_gso_ctrl ctrl[UDPX_MSG_BATCH];
+	size_t iov_cnt;
+	int gso = ep->gso;
+#endif
+#else
+	struct msghdr hdr;
+#endif
+	int ret;
+
+	while (!ofi_cirque_isempty(ep->txq)) {
+#if HAVE_SENDMMSG
+		cnt = MIN(ofi_cirque_usedcnt(ep->txq), UDPX_MSG_BATCH);
+#if UDPX_HAVE_GSO
+		for (i = 0, n = 0, iov_cnt = 0; i < cnt; n++) {
+			if (gso) {
+				segs[n] = udpx_init_gso_hdr(ep, &msgs[n].msg_hdr,
+							    i, cnt,
+							    &iov[iov_cnt],
+							    &ctrl[n]);
+				if (segs[n] > 1)
+					iov_cnt += msgs[n].msg_hdr.msg_iovlen;
+			} else {
+				udpx_init_tx_hdr(&msgs[n].msg_hdr,
+						 udpx_cirq_entry(ep->txq, i));
+				segs[n] = 1;
+			}
+			i += segs[n];
+		}
+#else
+		for (n = 0; n < cnt; n++) {
+			udpx_init_tx_hdr(&msgs[n].msg_hdr,
+					 udpx_cirq_entry(ep->txq, n));
+			segs[n] = 1;
+		}
+#endif
+		ret = sendmmsg(ep->sock, msgs, (unsigned int) n, 0);
+#else
+		udpx_init_tx_hdr(&hdr, ofi_cirque_head(ep->txq));
+		ret = ofi_sendmsg_udp(ep->sock, &hdr, 0) < 0 ? -1 : 1;
+#endif
+		if (ret < 0) {
+			if (OFI_SOCK_TRY_SND_RCV_AGAIN(ofi_sockerr()))
+				break;
+#if UDPX_HAVE_GSO
+			/* e.g. segments larger than the path MTU */
+			if (gso && segs[0] > 1) {
+				FI_DBG(&udpx_prov, FI_LOG_EP_DATA,
+				       "segmented send failed: %s\n",
+				       strerror(ofi_sockerr()));
+				gso = 0;
+				continue;
+			}
+#endif
+			ret = ofi_sockerr();
+			FI_WARN(&udpx_prov, FI_LOG_EP_DATA,
+				"send failed: %s\n", strerror(ret));
+			entry = ofi_cirque_head(ep->txq);
+			udpx_tx_err_comp(ep, entry->context, ret);
+			ofi_cirque_discard(ep->txq);
+			continue;
+		}
+
+#if HAVE_SENDMMSG
+		for (cnt = 0, i = 0; i < (size_t) ret; i++)
+			cnt += segs[i];
+#else
+		cnt = ret;
+#endif
+		while (cnt--) {
+			entry = ofi_cirque_head(ep->txq);
+			ep->tx_comp(ep, entry->context);
+			ofi_cirque_discard(ep->txq);
+		}
+	}
+}
+
+static void udpx_ep_flush(struct udpx_ep *ep)
+{
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	udpx_flush_sends(ep);
+	fastlock_release(&ep->util_ep.tx_cq->cq_lock);
+}
+
+#if UDPX_HAVE_GRO
+/*
+ * Copy len bytes at offset off of the received data to a posted receive.
+ */
+static size_t udpx_copy_seg(struct udpx_ep_entry *entry,
+			    const struct iovec *src, size_t src_cnt,
+			    size_t off, size_t len)
+{
+	size_t i, done;
+
+	for (i = 0, done = 0; i < entry->iov_count && done < len; i++) {
+		done += ofi_copy_from_iov(entry->iov[i].iov_base,
+					  MIN(entry->iov[i].iov_len, len - done),
+					  src, src_cnt, off + done);
+	}
+	return done;
+}
+
+/*
+ * With UDP_GRO the kernel may deliver several datagrams of the same size
+ * from a peer as one.  The first datagram lands in the posted receive,
+ * the rest overflow into gro_buf and are copied out to the following
+ * receives.  Segments that find no posted receive or CQ space are dropped.
+ */
+static void udpx_recv_gro(struct udpx_ep *ep)
+{
+	struct udpx_ep_entry *entry;
+	struct iovec iov[UDPX_IOV_LIMIT + 1];
+	union {
+		char		buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr	align;
+	} ctrl;
+	struct cmsghdr *cmsg;
+	struct msghdr hdr;
+	struct sockaddr_in6 addr;
+	size_t cnt, iov_cnt, posted, seg, off, len;
+	ssize_t ret;
+
+	for (cnt = 0; cnt < UDPX_MSG_BATCH; cnt++) {
+		if (ofi_cirque_isempty(ep->rxq) ||
+		    ofi_cirque_isfull(ep->util_ep.rx_cq->cirq))
+			break;
+
+		entry = ofi_cirque_head(ep->rxq);
+		memcpy(iov, entry->iov, entry->iov_count * sizeof(*iov));
+		iov_cnt = entry->iov_count;
+		posted = ofi_total_iov_len(iov, iov_cnt);
+		iov[iov_cnt].iov_base = ep->gro_buf;
+		iov[iov_cnt].iov_len = UDPX_GRO_BUF_SIZE;
+
+		hdr.msg_name = &addr;
+		hdr.msg_namelen = sizeof(addr);
+		hdr.msg_iov = iov;
+		hdr.msg_iovlen = iov_cnt + 1;
+		hdr.msg_control = ctrl.buf;
+		hdr.msg_controllen = sizeof(ctrl.buf);
+		hdr.msg_flags = 0;
+
+		ret = ofi_recvmsg_udp(ep->sock, &hdr, 0);
+		if (ret < 0)
+			break;
+
+		seg = ret;
+		for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+		     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level == IPPROTO_UDP &&
+			    cmsg->cmsg_type == UDP_GRO)
+				seg = *(int *) CMSG_DATA(cmsg);
+		}
+
+		ep->rx_comp(ep, entry->context, 0, MIN(seg, posted), NULL,
+			    &addr);
+		ofi_cirque_discard(ep->rxq);
+
+		for (off = seg; off < (size_t) ret; off += seg) {
+			if (ofi_cirque_isempty(ep->rxq) ||
+			    ofi_cirque_isfull(ep->util_ep.rx_cq->cirq)) {
+				FI_DBG(&udpx_prov, FI_LOG_EP_DATA,
+				       "dropping %zu coalesced datagrams\n",
+				       (ret - off + seg - 1) / seg);
+				break;
+			}
+			entry = ofi_cirque_head(ep->rxq);
+			len = udpx_copy_seg(entry, iov, iov_cnt + 1, off,
+					    MIN(seg, ret - off));
+			ep->rx_comp(ep, entry->context, 0, len, NULL, &addr);
+			ofi_cirque_discard(ep->rxq);
+		}
+	}
+}
+#endif
+
+#if HAVE_RECVMMSG
+/*
+ * Drain up to one datagram per posted receive with a single recvmmsg(),
+ * limited by the space left in the CQ.
+ */
+static void udpx_recv_batch(struct udpx_ep *ep)
+{
+	struct udpx_ep_entry *entry;
+	struct mmsghdr msgs[UDPX_MSG_BATCH];
+	struct sockaddr_in6 addrs[UDPX_MSG_BATCH];
+	size_t cnt, i;
+	int ret;
+
+	cnt = MIN(ofi_cirque_usedcnt(ep->rxq),
+		  ofi_cirque_freecnt(ep->util_ep.rx_cq->cirq));
+	cnt = MIN(cnt, UDPX_MSG_BATCH);
+	if (!cnt)
+		return;
+
+	for (i = 0; i < cnt; i++) {
+		entry = udpx_cirq_entry(ep->rxq, i);
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		msgs[i].msg_hdr.msg_iov = entry->iov;
+		msgs[i].msg_hdr.msg_iovlen = entry->iov_count;
+		msgs[i].msg_hdr.msg_control = NULL;
+		msgs[i].msg_hdr.msg_controllen = 0;
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	ret = recvmmsg(ep->sock, msgs, (unsigned int) cnt, 0, NULL);
+	for (i = 0; ret > 0 && i < (size_t) ret; i++) {
+		entry = ofi_cirque_head(ep->rxq);
+		ep->rx_comp(ep, entry->context, 0, msgs[i].msg_len, NULL,
+			    &addrs[i]);
+		ofi_cirque_discard(ep->rxq);
+	}
+}
+#else
+static void udpx_recv_batch(struct udpx_ep *ep)
 {
-	struct udpx_ep *ep;
 	struct udpx_ep_entry *entry;
 	struct msghdr hdr;
 	struct sockaddr_in6 addr;
 	ssize_t ret;
 
-	ep = container_of(util_ep, struct udpx_ep, util_ep);
 	hdr.msg_name = &addr;
 	hdr.msg_namelen = sizeof(addr);
 	hdr.msg_control = NULL;
 	hdr.msg_controllen = 0;
 	hdr.msg_flags = 0;
 
-	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
 	if (ofi_cirque_isempty(ep->rxq))
-		goto out;
+		return;
 
 	entry = ofi_cirque_head(ep->rxq);
 	hdr.msg_iov = entry->iov;
@@ -298,7 +617,27 @@ static void udpx_ep_progress(struct util_ep *util_ep)
 		ep->rx_comp(ep, entry->context, 0, ret, NULL, &addr);
 		ofi_cirque_discard(ep->rxq);
 	}
-out:
+}
+#endif
+
+static void udpx_ep_progress(struct util_ep *util_ep)
+{
+	struct udpx_ep *ep;
+
+	ep = container_of(util_ep, struct udpx_ep, util_ep);
+	if (!ofi_cirque_isempty(ep->txq))
+		udpx_ep_flush(ep);
+
+	if (!ep->util_ep.rx_cq)
+		return;
+
+	fastlock_acquire(&ep->util_ep.rx_cq->cq_lock);
+#if UDPX_HAVE_GRO
+	if (ep->gro_buf)
+		udpx_recv_gro(ep);
+	else
+#endif
+		udpx_recv_batch(ep);
 	fastlock_release(&ep->util_ep.rx_cq->cq_lock);
 }
 
@@ -393,7 +732,9 @@ static ssize_t udpx_sendto(struct udpx_ep *ep, const void *buf, size_t len,
 	ssize_t ret;
 
 	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+	udpx_flush_sends(ep);
+	if (!ofi_cirque_isempty(ep->txq) ||
+	    ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
 		ret = -FI_EAGAIN;
 		goto out;
 	}
@@ -432,6 +773,39 @@ static ssize_t udpx_send_mc(struct fid_ep *ep_fid, const void *buf, size_t len,
 			   context);
 }
 
+static ssize_t udpx_queue_send(struct udpx_ep *ep, const struct fi_msg *msg,
+			       uint64_t flags)
+{
+	struct udpx_tx_entry *entry;
+	size_t addrlen;
+
+	if (msg->iov_count > UDPX_IOV_LIMIT)
+		return -FI_EINVAL;
+
+	if (ofi_cirque_isfull(ep->txq))
+		udpx_flush_sends(ep);
+
+	if (ofi_cirque_isfull(ep->txq))
+		return -FI_EAGAIN;
+
+	addrlen = udpx_dest_addrlen(ep, msg->addr, flags);
+	assert(addrlen <= sizeof(entry->addr));
+
+	entry = ofi_cirque_tail(ep->txq);
+	entry->context = msg->context;
+	for (entry->iov_count = 0; entry->iov_count < msg->iov_count;
+	     entry->iov_count++) {
+		entry->iov[entry->iov_count] = msg->msg_iov[entry->iov_count];
+	}
+	memcpy(&entry->addr, udpx_dest_addr(ep, msg->addr, flags), addrlen);
+	entry->addrlen = (socklen_t) addrlen;
+	ofi_cirque_commit(ep->txq);
+
+	if (!(flags & FI_MORE) || ofi_cirque_isfull(ep->txq))
+		udpx_flush_sends(ep);
+	return 0;
+}
+
 static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 			    uint64_t flags)
 {
@@ -440,6 +814,17 @@ static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
+	if ((flags & FI_MORE) || !ofi_cirque_isempty(ep->txq)) {
+		ret = udpx_queue_send(ep, msg, flags);
+		goto out;
+	}
+
+	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
+		ret = -FI_EAGAIN;
+		goto out;
+	}
+
 	hdr.msg_name = (void *)udpx_dest_addr(ep, msg->addr, flags);
 	hdr.msg_namelen = (int)udpx_dest_addrlen(ep, msg->addr, flags);
 	hdr.msg_iov = (struct iovec *)msg->msg_iov;
@@ -448,12 +833,6 @@ static ssize_t udpx_sendmsg(struct fid_ep *ep_fid, const struct fi_msg *msg,
 	hdr.msg_controllen = 0;
 	hdr.msg_flags = 0;
 
-	fastlock_acquire(&ep->util_ep.tx_cq->cq_lock);
-	if (ofi_cirque_isfull(ep->util_ep.tx_cq->cirq)) {
-		ret = -FI_EAGAIN;
-		goto out;
-	}
-
 	ret = ofi_sendmsg_udp(ep->sock, &hdr, 0);
 	if (ret >= 0) {
 		ep->tx_comp(ep, msg->context);
@@ -501,6 +880,12 @@ static ssize_t udpx_inject(struct fid_ep *ep_fid, const void *buf, size_t len,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if (!ofi_cirque_isempty(ep->txq)) {
+		udpx_ep_flush(ep);
+		if (!ofi_cirque_isempty(ep->txq))
+			return -FI_EAGAIN;
+	}
+
 	ret = ofi_sendto_socket(ep->sock, buf, len, 0,
 				ofi_ip_av_get_addr(ep->util_ep.av, (int)dest_addr),
 				(socklen_t)ep->util_ep.av->addrlen);
@@ -514,6 +899,12 @@ static ssize_t udpx_inject_mc(struct fid_ep *ep_fid, const void *buf,
 	ssize_t ret;
 
 	ep = container_of(ep_fid, struct udpx_ep, util_ep.ep_fid.fid);
+	if (!ofi_cirque_isempty(ep->txq)) {
+		udpx_ep_flush(ep);
+		if (!ofi_cirque_isempty(ep->txq))
+			return -FI_EAGAIN;
+	}
+
 	ret = ofi_sendto_socket(ep->sock, buf, len, 0,
 				(const void *)(uintptr_t)dest_addr,
 				(socklen_t)ofi_sizeofaddr((const void *)(uintptr_t)dest_addr));
@@ -546,6 +937,32 @@ static struct fi_ops_msg udpx_msg_mcast_ops = {
 	.injectdata = fi_no_msg_injectdata,
 };
 
+static struct fi_ops_msg udpx_msg_tx_ops = {
+	.size = sizeof(struct fi_ops_msg),
+	.recv = fi_no_msg_recv,
+	.recvv = fi_no_msg_recvv,
+	.recvmsg = fi_no_msg_recvmsg,
+	.send = udpx_send,
+	.sendv = udpx_sendv,
+	.sendmsg = udpx_sendmsg,
+	.inject = udpx_inject,
+	.senddata = fi_no_msg_senddata,
+	.injectdata = fi_no_msg_injectdata,
+};
+
+static struct fi_ops_msg udpx_msg_rx_ops = {
+	.size = sizeof(struct fi_ops_msg),
+	.recv = udpx_recv,
+	.recvv = udpx_recvv,
+	.recvmsg = udpx_recvmsg,
+	.send = fi_no_msg_send,
+	.sendv = fi_no_msg_sendv,
+	.sendmsg = fi_no_msg_sendmsg,
+	.inject = fi_no_msg_inject,
+	.senddata = fi_no_msg_senddata,
+	.injectdata = fi_no_msg_injectdata,
+};
+
 static int udpx_ep_close(struct fid *fid)
 {
 	struct udpx_ep *ep;
@@ -568,8 +985,19 @@ static int udpx_ep_close(struct fid *fid)
 				&ep->util_ep.ep_fid.fid);
 	}
 
+	if (ep->util_ep.tx_cq && !ofi_cirque_isempty(ep->txq))
+		udpx_ep_flush(ep);
+
+	udpx_tx_cirq_free(ep->txq);
 	udpx_rx_cirq_free(ep->rxq);
-	ofi_close_socket(ep->sock);
+	free(ep->gro_buf);
+	if (ep->sep) {
+		if (ep->sock != ep->sep->sock)
+			ofi_close_socket(ep->sock);
+		udpx_sep_remove_ctx(ep->sep, ep);
+	} else {
+		ofi_close_socket(ep->sock);
+	}
 	ofi_endpoint_close(&ep->util_ep);
 	free(ep);
 	return 0;
@@ -590,6 +1018,13 @@ static int udpx_ep_bind_cq(struct udpx_ep *ep, struct util_cq *cq,
 		ofi_atomic_inc32(&cq->ref);
 		ep->tx_comp = cq->wait ? udpx_tx_comp_signal :
 					 udpx_tx_comp;
+
+		/* progress flushes sends queued with FI_MORE */
+		ret = fid_list_insert(&cq->ep_list,
+				      &cq->ep_list_lock,
+				      &ep->util_ep.ep_fid.fid);
+		if (ret)
+			return ret;
 	}
 
 	if (flags & FI_RECV) {
@@ -658,7 +1093,7 @@ static int udpx_ep_bind(struct fid *ep_fid, struct fid *bfid, uint64_t flags)
 	return ret;
 }
 
-static void udpx_bind_src_addr(struct udpx_ep *ep)
+int udpx_bind_src_addr(SOCKET sock)
 {
 	int ret;
 	struct addrinfo ai, *rai = NULL, *cur_ai;
@@ -672,7 +1107,7 @@ static void udpx_bind_src_addr(struct udpx_ep *ep)
 	if (ret) {
 		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
 			"getaddrinfo failed\n");
-		return;
+		return -FI_EADDRNOTAVAIL;
 	}
 
 	for (cur_ai = rai; cur_ai && cur_ai->ai_family != AF_INET;
@@ -680,8 +1115,8 @@ static void udpx_bind_src_addr(struct udpx_ep *ep)
 		;
 
 	if (cur_ai) {
-		ret = udpx_setname(&ep->util_ep.ep_fid.fid, cur_ai->ai_addr,
-				   cur_ai->ai_addrlen);
+		ret = udpx_bind_addr(sock, cur_ai->ai_addr,
+				     cur_ai->ai_addrlen);
 	} else {
 		ret = -FI_EADDRNOTAVAIL;
 	}
@@ -689,6 +1124,36 @@ static void udpx_bind_src_addr(struct udpx_ep *ep)
 		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL, "failed to set addr\n");
 	}
 	freeaddrinfo(rai);
+	return ret;
+}
+
+/* Contexts of a scalable EP share the address of the SEP */
+static int udpx_ctx_enable(struct udpx_ep *ep)
+{
+	struct sockaddr_in6 addr;
+	size_t addrlen = sizeof(addr);
+	int ret;
+
+	if (!ep->util_ep.av) {
+		if (!ep->sep->av)
+			return -FI_ENOAV;
+		ret = ofi_ep_bind_av(&ep->util_ep, ep->sep->av);
+		if (ret)
+			return ret;
+	}
+
+	ret = udpx_sep_enable(ep->sep);
+	if (ret || ep->sock == ep->sep->sock || ep->is_bound)
+		return ret;
+
+	ret = fi_getname(&ep->sep->ep_fid.fid, &addr, &addrlen);
+	if (ret)
+		return ret;
+
+	ret = udpx_bind_addr(ep->sock, &addr, addrlen);
+	if (!ret)
+		ep->is_bound = 1;
+	return ret;
 }
 
 static int udpx_ep_ctrl(struct fid *fid, int command, void *arg)
@@ -698,13 +1163,16 @@ static int udpx_ep_ctrl(struct fid *fid, int command, void *arg)
 	ep = container_of(fid, struct udpx_ep, util_ep.ep_fid.fid);
 	switch (command) {
 	case FI_ENABLE:
-		if (!ep->util_ep.rx_cq || !ep->util_ep.tx_cq)
+		if ((ofi_recv_allowed(ep->util_ep.caps) && !ep->util_ep.rx_cq) ||
+		    (ofi_send_allowed(ep->util_ep.caps) && !ep->util_ep.tx_cq))
 			return -FI_ENOCQ;
+		if (ep->sep)
+			return udpx_ctx_enable(ep);
 		if (!ep->util_ep.av)
 			return -FI_ENOAV;
 
-		if (!ep->is_bound)
-			udpx_bind_src_addr(ep);
+		if (!ep->is_bound && !udpx_bind_src_addr(ep->sock))
+			ep->is_bound = 1;
 		break;
 	default:
 		return -FI_ENOSYS;
@@ -720,7 +1188,35 @@ static struct fi_ops udpx_ep_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
-static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
+static void udpx_ep_init_offload(struct udpx_ep *ep)
+{
+#if UDPX_HAVE_GSO || UDPX_HAVE_GRO
+	int val;
+#endif
+
+#if UDPX_HAVE_GSO
+	val = 0;
+	if (udpx_env.gso &&
+	    !setsockopt(ep->sock, IPPROTO_UDP, UDP_SEGMENT, &val, sizeof(val)))
+		ep->gso = 1;
+#endif
+#if UDPX_HAVE_GRO
+	val = 1;
+	if (udpx_env.gro) {
+		ep->gro_buf = malloc(UDPX_GRO_BUF_SIZE);
+		if (ep->gro_buf && setsockopt(ep->sock, IPPROTO_UDP, UDP_GRO,
+					      &val, sizeof(val))) {
+			free(ep->gro_buf);
+			ep->gro_buf = NULL;
+		}
+	}
+#endif
+	FI_INFO(&udpx_prov, FI_LOG_EP_CTRL, "gso: %s, gro: %s\n",
+		ep->gso ? "on" : "off", ep->gro_buf ? "on" : "off");
+}
+
+static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info,
+			SOCKET sock)
 {
 	int family;
 	int ret;
@@ -732,6 +1228,18 @@ static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
 		return ret;
 	}
 
+	ep->txq = udpx_tx_cirq_create(UDPX_MSG_BATCH);
+	if (!ep->txq) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	if (sock != INVALID_SOCKET) {
+		ep->sock = sock;
+		udpx_ep_init_offload(ep);
+		return 0;
+	}
+
 	family = info->src_addr ?
 		 ((struct sockaddr *) info->src_addr)->sa_family : AF_INET;
 	ep->sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
@@ -751,16 +1259,19 @@ static int udpx_ep_init(struct udpx_ep *ep, struct fi_info *info)
 	if (ret)
 		goto err2;
 
+	udpx_ep_init_offload(ep);
 	return 0;
 err2:
 	ofi_close_socket(ep->sock);
 err1:
+	udpx_tx_cirq_free(ep->txq);
 	udpx_rx_cirq_free(ep->rxq);
 	return ret;
 }
 
-int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
-		  struct fid_ep **ep_fid, void *context)
+int udpx_ep_open(struct fid_domain *domain, struct fi_info *info,
+		 struct udpx_sep *sep, size_t fclass, SOCKET sock,
+		 struct fid_ep **ep_fid, void *context)
 {
 	struct udpx_ep *ep;
 	int ret;
@@ -774,16 +1285,28 @@ int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		goto err1;
 
-	ret = udpx_ep_init(ep, info);
+	ret = udpx_ep_init(ep, info, sock);
 	if (ret)
 		goto err2;
 
+	ep->sep = sep;
 	*ep_fid = &ep->util_ep.ep_fid;
+	(*ep_fid)->fid.fclass = fclass;
 	(*ep_fid)->fid.ops = &udpx_ep_fi_ops;
 	(*ep_fid)->ops = &udpx_ep_ops;
 	(*ep_fid)->cm = &udpx_cm_ops;
-	(*ep_fid)->msg = (info->tx_attr->op_flags & FI_MULTICAST) ?
-			 &udpx_msg_mcast_ops : &udpx_msg_ops;
+	switch (fclass) {
+	case FI_CLASS_TX_CTX:
+		(*ep_fid)->msg = &udpx_msg_tx_ops;
+		break;
+	case FI_CLASS_RX_CTX:
+		(*ep_fid)->msg = &udpx_msg_rx_ops;
+		break;
+	default:
+		(*ep_fid)->msg = (info->tx_attr->op_flags & FI_MULTICAST) ?
+				 &udpx_msg_mcast_ops : &udpx_msg_ops;
+		break;
+	}
 
 	return 0;
 err2:
@@ -792,3 +1315,17 @@ err1:
 	free(ep);
 	return ret;
 }
+
+int udpx_endpoint(struct fid_domain *domain, struct fi_info *info,
+		  struct fid_ep **ep_fid, void *context)
+{
+	if (info && info->ep_attr && (info->ep_attr->tx_ctx_cnt > 1 ||
+				      info->ep_attr->rx_ctx_cnt > 1)) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"multiple contexts require a scalable endpoint\n");
+		return -FI_EINVAL;
+	}
+
+	return udpx_ep_open(domain, info, NULL, FI_CLASS_EP, INVALID_SOCKET,
+			    ep_fid, context);
+}
@@ -36,9 +36,15 @@
 #include "udpx.h"
 
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 
+struct udpx_env udpx_env = {
+	.gso	= 1,
+	.gro	= 0,
+};
+
 
 #if HAVE_GETIFADDRS
 static void udpx_getinfo_ifs(struct fi_info **info)
@@ -92,14 +98,66 @@ static void udpx_getinfo_ifs(struct fi_info **info)
 	fi_freeinfo(*info);
 	*info = head;
 }
+
+/*
+ * Report the largest datagram that isn't fragmented on the interface of
+ * the source address, e.g. ~64k over loopback or ~9k with jumbo frames.
+ */
+static void udpx_getinfo_if_mtu(struct fi_info *info)
+{
+	struct ifaddrs *ifaddrs, *ifa;
+	struct fi_info *cur;
+	struct ifreq ifr;
+	size_t hdr_size;
+	int sock;
+
+	if (ofi_getifaddrs(&ifaddrs))
+		return;
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		goto out;
+
+	for (cur = info; cur; cur = cur->next) {
+		if (!cur->src_addr)
+			continue;
+
+		for (ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+			if (ifa->ifa_addr &&
+			    ofi_equals_ipaddr(ifa->ifa_addr, cur->src_addr))
+				break;
+		}
+		if (!ifa)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		strncpy(ifr.ifr_name, ifa->ifa_name, sizeof(ifr.ifr_name) - 1);
+		if (ioctl(sock, SIOCGIFMTU, &ifr))
+			continue;
+
+		/* IP and UDP headers */
+		hdr_size = (ofi_sa_family(cur->src_addr) == AF_INET6 ? 40 : 20) + 8;
+		if ((size_t) ifr.ifr_mtu <= hdr_size)
+			continue;
+
+		cur->ep_attr->max_msg_size = MIN(ifr.ifr_mtu - hdr_size,
+						 UDPX_MAX_MSG_SIZE);
+	}
+
+	ofi_close_socket(sock);
+out:
+	freeifaddrs(ifaddrs);
+}
 #else
 #define udpx_getinfo_ifs(info) do{}while(0)
+#define udpx_getinfo_if_mtu(info) do{}while(0)
 #endif
 
 static int udpx_getinfo(uint32_t version, const char *node, const char *service,
 			uint64_t flags, const struct fi_info *hints,
 			struct fi_info **info)
 {
+	struct fi_info *cur;
 	int ret;
 
 	ret = util_getinfo(&udpx_util_prov, version, node, service, flags,
@@ -110,6 +168,12 @@ static int udpx_getinfo(uint32_t version, const char *node, const char *service,
 	if (!(*info)->src_addr && !(*info)->dest_addr)
 		udpx_getinfo_ifs(info);
 
+	/* Assume a standard Ethernet MTU unless the interface is known */
+	for (cur = *info; cur; cur = cur->next)
+		cur->ep_attr->max_msg_size = MIN(cur->ep_attr->max_msg_size,
+						 UDPX_DEF_MSG_SIZE);
+	udpx_getinfo_if_mtu(*info);
+
 	return 0;
 }
 
@@ -131,6 +195,16 @@ UDP_INI
 {
 	fi_param_define(&udpx_prov, "iface", FI_PARAM_STRING,
 			"Specify interface name");
+	fi_param_define(&udpx_prov, "gso", FI_PARAM_BOOL,
+			"Combine queued sends of equal size to the same peer "
+			"into a single UDP segmentation offload send "
+			"(default: yes)");
+	fi_param_define(&udpx_prov, "gro", FI_PARAM_BOOL,
+			"Let the kernel coalesce received datagrams with UDP "
+			"generic receive offload (default: no)");
+
+	fi_param_get_bool(&udpx_prov, "gso", &udpx_env.gso);
+	fi_param_get_bool(&udpx_prov, "gro", &udpx_env.gro);
 
 	return &udpx_prov;
 }
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "udpx.h"
+
+
+int udpx_sep_socket(struct udpx_sep *sep, SOCKET *sock)
+{
+#ifdef SO_REUSEPORT
+	int family, val = 1;
+	int ret;
+
+	family = sep->info->src_addr ?
+		 ((struct sockaddr *) sep->info->src_addr)->sa_family : AF_INET;
+	*sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if (*sock == INVALID_SOCKET)
+		return -ofi_sockerr();
+
+	ret = setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+	if (ret) {
+		ret = -ofi_sockerr();
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"SO_REUSEPORT failed: %s\n", strerror(-ret));
+		goto err;
+	}
+
+	ret = fi_fd_nonblock((int) *sock);
+	if (ret)
+		goto err;
+
+	return 0;
+err:
+	ofi_close_socket(*sock);
+	return ret;
+#else
+	return -FI_ENOSYS;
+#endif
+}
+
+int udpx_sep_enable(struct udpx_sep *sep)
+{
+	int ret = 0;
+
+	fastlock_acquire(&sep->lock);
+	if (!sep->is_bound) {
+		ret = udpx_bind_src_addr(sep->sock);
+		if (!ret)
+			sep->is_bound = 1;
+	}
+	fastlock_release(&sep->lock);
+	return ret;
+}
+
+void udpx_sep_remove_ctx(struct udpx_sep *sep, struct udpx_ep *ep)
+{
+	int i;
+
+	fastlock_acquire(&sep->lock);
+	for (i = 0; i < UDPX_MAX_CTX; i++) {
+		if (sep->tx_ctx[i] == ep)
+			sep->tx_ctx[i] = NULL;
+		if (sep->rx_ctx[i] == ep)
+			sep->rx_ctx[i] = NULL;
+	}
+	fastlock_release(&sep->lock);
+	ofi_atomic_dec32(&sep->ref);
+}
+
+static int udpx_sep_setname(fid_t fid, void *addr, size_t addrlen)
+{
+	struct udpx_sep *sep;
+	int ret;
+
+	sep = container_of(fid, struct udpx_sep, ep_fid.fid);
+	fastlock_acquire(&sep->lock);
+	if (sep->is_bound) {
+		ret = -FI_EOPBADSTATE;
+		goto out;
+	}
+
+	ret = udpx_bind_addr(sep->sock, addr, addrlen);
+	if (!ret)
+		sep->is_bound = 1;
+out:
+	fastlock_release(&sep->lock);
+	return ret;
+}
+
+static int udpx_sep_getname(fid_t fid, void *addr, size_t *addrlen)
+{
+	struct udpx_sep *sep;
+	size_t buflen = *addrlen;
+
+	sep = container_of(fid, struct udpx_sep, ep_fid.fid);
+	if (ofi_getsockname(sep->sock, addr, (socklen_t *)addrlen))
+		return -ofi_sockerr();
+
+	return buflen < *addrlen ? -FI_ETOOSMALL : 0;
+}
+
+static struct fi_ops_cm udpx_sep_cm_ops = {
+	.size = sizeof(struct fi_ops_cm),
+	.setname = udpx_sep_setname,
+	.getname = udpx_sep_getname,
+	.getpeer = fi_no_getpeer,
+	.connect = fi_no_connect,
+	.listen = fi_no_listen,
+	.accept = fi_no_accept,
+	.reject = fi_no_reject,
+	.shutdown = fi_no_shutdown,
+	.join = fi_no_join,
+};
+
+static int udpx_sep_ctx(struct fid_ep *sep_fid, int index, size_t fclass,
+			struct fi_tx_attr *tx_attr, struct fi_rx_attr *rx_attr,
+			struct fid_ep **ctx_fid, void *context)
+{
+	struct udpx_sep *sep;
+	struct udpx_ep **ctx;
+	struct fi_info *info;
+	SOCKET sock;
+	size_t cnt;
+	int ret;
+
+	sep = container_of(sep_fid, struct udpx_sep, ep_fid);
+	if (fclass == FI_CLASS_TX_CTX) {
+		cnt = sep->info->ep_attr->tx_ctx_cnt;
+		ctx = sep->tx_ctx;
+	} else {
+		cnt = sep->info->ep_attr->rx_ctx_cnt;
+		ctx = sep->rx_ctx;
+	}
+	if (index < 0 || (size_t) index >= cnt)
+		return -FI_EINVAL;
+
+	info = fi_dupinfo(sep->info);
+	if (!info)
+		return -FI_ENOMEM;
+
+	info->ep_attr->tx_ctx_cnt = 1;
+	info->ep_attr->rx_ctx_cnt = 1;
+	if (fclass == FI_CLASS_TX_CTX) {
+		if (tx_attr)
+			*info->tx_attr = *tx_attr;
+		info->caps = (info->caps & ~(FI_RECV | FI_SOURCE)) | FI_SEND;
+	} else {
+		if (rx_attr)
+			*info->rx_attr = *rx_attr;
+		info->caps = (info->caps & ~FI_SEND) | FI_RECV;
+	}
+
+	fastlock_acquire(&sep->lock);
+	if (ctx[index]) {
+		ret = -FI_EBUSY;
+		goto out;
+	}
+
+	if (fclass == FI_CLASS_RX_CTX && index) {
+		ret = udpx_sep_socket(sep, &sock);
+		if (ret)
+			goto out;
+	} else {
+		sock = sep->sock;
+	}
+
+	ret = udpx_ep_open(&sep->domain->domain_fid, info, sep, fclass, sock,
+			   ctx_fid, context);
+	if (ret) {
+		if (sock != sep->sock)
+			ofi_close_socket(sock);
+		goto out;
+	}
+
+	ctx[index] = container_of(*ctx_fid, struct udpx_ep, util_ep.ep_fid);
+	ofi_atomic_inc32(&sep->ref);
+	if (sep->av) {
+		ret = ofi_ep_bind_av(&ctx[index]->util_ep, sep->av);
+		if (ret) {
+			ctx[index] = NULL;
+			/* Closing the context takes the lock to remove it */
+			fastlock_release(&sep->lock);
+			fi_close(&(*ctx_fid)->fid);
+			*ctx_fid = NULL;
+			goto free;
+		}
+	}
+out:
+	fastlock_release(&sep->lock);
+free:
+	fi_freeinfo(info);
+	return ret;
+}
+
+static int udpx_sep_tx_ctx(struct fid_ep *sep, int index,
+			   struct fi_tx_attr *attr, struct fid_ep **tx_ep,
+			   void *context)
+{
+	return udpx_sep_ctx(sep, index, FI_CLASS_TX_CTX, attr, NULL,
+			    tx_ep, context);
+}
+
+static int udpx_sep_rx_ctx(struct fid_ep *sep, int index,
+			   struct fi_rx_attr *attr, struct fid_ep **rx_ep,
+			   void *context)
+{
+	return udpx_sep_ctx(sep, index, FI_CLASS_RX_CTX, NULL, attr,
+			    rx_ep, context);
+}
+
+static struct fi_ops_ep udpx_sep_ops = {
+	.size = sizeof(struct fi_ops_ep),
+	.cancel = fi_no_cancel,
+	.getopt = fi_no_getopt,
+	.setopt = fi_no_setopt,
+	.tx_ctx = udpx_sep_tx_ctx,
+	.rx_ctx = udpx_sep_rx_ctx,
+	.rx_size_left = fi_no_rx_size_left,
+	.tx_size_left = fi_no_tx_size_left,
+};
+
+static int udpx_sep_close(struct fid *fid)
+{
+	struct udpx_sep *sep;
+
+	sep = container_of(fid, struct udpx_sep, ep_fid.fid);
+	if (ofi_atomic_get32(&sep->ref)) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL, "SEP busy\n");
+		return -FI_EBUSY;
+	}
+
+	if (sep->av)
+		ofi_atomic_dec32(&sep->av->ref);
+	ofi_close_socket(sep->sock);
+	ofi_atomic_dec32(&sep->domain->ref);
+	fi_freeinfo(sep->info);
+	fastlock_destroy(&sep->lock);
+	free(sep);
+	return 0;
+}
+
+static int udpx_sep_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
+{
+	struct udpx_sep *sep;
+	int i, ret = 0;
+
+	sep = container_of(fid, struct udpx_sep, ep_fid.fid);
+	if (bfid->fclass != FI_CLASS_AV) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"invalid fid class\n");
+		return -FI_EINVAL;
+	}
+
+	fastlock_acquire(&sep->lock);
+	if (sep->av) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL, "duplicate AV binding\n");
+		ret = -FI_EINVAL;
+		goto out;
+	}
+
+	sep->av = container_of(bfid, struct util_av, av_fid.fid);
+	ofi_atomic_inc32(&sep->av->ref);
+
+	for (i = 0; i < UDPX_MAX_CTX && !ret; i++) {
+		if (sep->tx_ctx[i] && !sep->tx_ctx[i]->util_ep.av)
+			ret = ofi_ep_bind_av(&sep->tx_ctx[i]->util_ep, sep->av);
+		if (sep->rx_ctx[i] && !sep->rx_ctx[i]->util_ep.av && !ret)
+			ret = ofi_ep_bind_av(&sep->rx_ctx[i]->util_ep, sep->av);
+	}
+out:
+	fastlock_release(&sep->lock);
+	return ret;
+}
+
+static int udpx_sep_ctrl(struct fid *fid, int command, void *arg)
+{
+	struct udpx_sep *sep;
+
+	sep = container_of(fid, struct udpx_sep, ep_fid.fid);
+	switch (command) {
+	case FI_ENABLE:
+		if (!sep->av)
+			return -FI_ENOAV;
+		return udpx_sep_enable(sep);
+	default:
+		return -FI_ENOSYS;
+	}
+}
+
+static struct fi_ops_msg udpx_sep_msg_ops = {
+	.size = sizeof(struct fi_ops_msg),
+	.recv = fi_no_msg_recv,
+	.recvv = fi_no_msg_recvv,
+	.recvmsg = fi_no_msg_recvmsg,
+	.send = fi_no_msg_send,
+	.sendv = fi_no_msg_sendv,
+	.sendmsg = fi_no_msg_sendmsg,
+	.inject = fi_no_msg_inject,
+	.senddata = fi_no_msg_senddata,
+	.injectdata = fi_no_msg_injectdata,
+};
+
+static struct fi_ops udpx_sep_fi_ops = {
+	.size = sizeof(struct fi_ops),
+	.close = udpx_sep_close,
+	.bind = udpx_sep_bind,
+	.control = udpx_sep_ctrl,
+	.ops_open = fi_no_ops_open,
+};
+
+int udpx_scalable_ep(struct fid_domain *domain, struct fi_info *info,
+		     struct fid_ep **sep_fid, void *context)
+{
+	struct util_domain *util_domain;
+	struct udpx_sep *sep;
+	int ret;
+
+	util_domain = container_of(domain, struct util_domain, domain_fid);
+	if (!info || !info->ep_attr || !info->rx_attr || !info->tx_attr)
+		return -FI_EINVAL;
+
+	ret = ofi_prov_check_info(&udpx_util_prov,
+				  util_domain->fabric->fabric_fid.api_version,
+				  info);
+	if (ret)
+		return ret;
+
+	if (info->ep_attr->tx_ctx_cnt == FI_SHARED_CONTEXT ||
+	    info->ep_attr->rx_ctx_cnt == FI_SHARED_CONTEXT) {
+		FI_WARN(&udpx_prov, FI_LOG_EP_CTRL,
+			"shared contexts not supported\n");
+		return -FI_ENOSYS;
+	}
+
+	sep = calloc(1, sizeof(*sep));
+	if (!sep)
+		return -FI_ENOMEM;
+
+	sep->info = fi_dupinfo(info);
+	if (!sep->info) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+	if (!sep->info->ep_attr->tx_ctx_cnt)
+		sep->info->ep_attr->tx_ctx_cnt = 1;
+	if (!sep->info->ep_attr->rx_ctx_cnt)
+		sep->info->ep_attr->rx_ctx_cnt = 1;
+
+	ret = udpx_sep_socket(sep, &sep->sock);
+	if (ret)
+		goto err2;
+
+	if (info->src_addr) {
+		ret = udpx_bind_addr(sep->sock, info->src_addr,
+				     info->src_addrlen);
+		if (ret)
+			goto err3;
+		sep->is_bound = 1;
+	}
+
+	sep->domain = util_domain;
+	ofi_atomic_initialize32(&sep->ref, 0);
+	fastlock_init(&sep->lock);
+	ofi_atomic_inc32(&util_domain->ref);
+
+	sep->ep_fid.fid.fclass = FI_CLASS_SEP;
+	sep->ep_fid.fid.context = context;
+	sep->ep_fid.fid.ops = &udpx_sep_fi_ops;
+	sep->ep_fid.ops = &udpx_sep_ops;
+	sep->ep_fid.cm = &udpx_sep_cm_ops;
+	sep->ep_fid.msg = &udpx_sep_msg_ops;
+	*sep_fid = &sep->ep_fid;
+	return 0;
+err3:
+	ofi_close_socket(sep->sock);
+err2:
+	fi_freeinfo(sep->info);
+err1:
+	free(sep);
+	return ret;
+}
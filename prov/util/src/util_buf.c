@@ -44,6 +44,482 @@ enum {
 	OFI_BUFPOOL_REGION_CHUNK_CNT = 16
 };
 
+/*
+ * Thread-safe pools (OFI_BUFPOOL_THREAD_SAFE) follow the magazine design:
+ * each thread (hashed into one of OFI_BUFPOOL_CACHE_CNT caches) holds a
+ * loaded and a previous magazine of free buffers and only touches shared
+ * state when both are empty (alloc) or full (free).  Full and empty
+ * magazines are then exchanged with the depot, two lock-free stacks.
+ * Magazines are referenced by index so that the stack heads can carry an
+ * ABA tag.  The pool itself is only grown, under mt->lock, when the depot
+ * runs out of full magazines.
+ */
+enum {
+	OFI_BUFPOOL_MAG_SIZE = 32,
+	OFI_BUFPOOL_MAG_CHUNK_CNT = 64,
+	OFI_BUFPOOL_MAG_TABLE_SIZE = 1024,
+	OFI_BUFPOOL_CACHE_CNT = 16,
+};
+
+struct ofi_bufpool_mag {
+	uint32_t			id;
+	uint32_t			next;
+	size_t				cnt;
+	struct ofi_bufpool_hdr		*bufs[OFI_BUFPOOL_MAG_SIZE];
+};
+
+struct ofi_bufpool_cache {
+	fastlock_t			lock;
+	struct ofi_bufpool_mag		*loaded;
+	struct ofi_bufpool_mag		*prev;
+	/* keep caches of different threads on separate cache lines */
+	uint8_t				pad[64];
+};
+
+struct ofi_bufpool_table {
+	struct slist_entry		entry;
+	struct ofi_bufpool_region	**table;
+};
+
+struct ofi_bufpool_mt {
+	fastlock_t			lock;
+	struct ofi_bufpool_cache	cache[OFI_BUFPOOL_CACHE_CNT];
+
+	/* ABA tag << 32 | magazine id, 0 when empty */
+	ofi_atomic64_t			full;
+	ofi_atomic64_t			empty;
+
+	struct ofi_bufpool_mag		*mag_table[OFI_BUFPOOL_MAG_TABLE_SIZE];
+	size_t				mag_chunks;
+	struct slist			old_tables;
+	ofi_atomic32_t			table_cnt;
+
+	ofi_atomic64_t			depot_alloc;
+	ofi_atomic64_t			depot_free;
+	ofi_atomic64_t			depot_retry;
+	ofi_atomic64_t			cache_contention;
+#ifndef NDEBUG
+	ofi_atomic64_t			use_cnt;
+#endif
+};
+
+/* Indexed pools hand out the lowest free index first, which needs
+ * ordered free lists.  Thread-safe pools give that up for magazines. */
+static inline int ofi_bufpool_ordered(struct ofi_bufpool *pool)
+{
+	return (pool->attr.flags & OFI_BUFPOOL_INDEXED) &&
+	       !(pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE);
+}
+
+/*
+ * Other threads may look up indexed buffers while the pool grows, so the
+ * region table of a thread-safe pool is never reallocated in place.  Old
+ * tables are kept until the pool is destroyed.
+ */
+static struct ofi_bufpool_region **
+ofi_bufpool_mt_grow_table(struct ofi_bufpool *pool)
+{
+	struct ofi_bufpool_table *old;
+	struct ofi_bufpool_region **new_table;
+
+	new_table = malloc((pool->region_cnt + OFI_BUFPOOL_REGION_CHUNK_CNT) *
+			   sizeof(*pool->region_table));
+	if (!new_table)
+		return NULL;
+
+	if (pool->region_table) {
+		old = malloc(sizeof(*old));
+		if (!old) {
+			free(new_table);
+			return NULL;
+		}
+		memcpy(new_table, pool->region_table,
+		       pool->region_cnt * sizeof(*pool->region_table));
+		old->table = pool->region_table;
+		slist_insert_tail(&old->entry, &pool->mt->old_tables);
+	}
+	/* full barrier: the copy must be visible before the table is */
+	ofi_atomic_inc32(&pool->mt->table_cnt);
+	return new_table;
+}
+
+static inline struct ofi_bufpool_mag *
+ofi_bufpool_mag(struct ofi_bufpool_mt *mt, uint32_t id)
+{
+	id--;
+	return &mt->mag_table[id / OFI_BUFPOOL_MAG_CHUNK_CNT]
+			     [id % OFI_BUFPOOL_MAG_CHUNK_CNT];
+}
+
+static void ofi_bufpool_depot_push(struct ofi_bufpool_mt *mt,
+				   ofi_atomic64_t *depot,
+				   struct ofi_bufpool_mag *mag)
+{
+	uint64_t head, new_head;
+
+	for (;;) {
+		head = (uint64_t) ofi_atomic_get64(depot);
+		mag->next = (uint32_t) head;
+		new_head = (((head >> 32) + 1) << 32) | mag->id;
+		if (ofi_atomic_cas_bool64(depot, (int64_t) head,
+					  (int64_t) new_head))
+			break;
+		ofi_atomic_inc64(&mt->depot_retry);
+	}
+}
+
+static struct ofi_bufpool_mag *
+ofi_bufpool_depot_pop(struct ofi_bufpool_mt *mt, ofi_atomic64_t *depot)
+{
+	struct ofi_bufpool_mag *mag;
+	uint64_t head, new_head;
+
+	for (;;) {
+		head = (uint64_t) ofi_atomic_get64(depot);
+		if (!(uint32_t) head)
+			return NULL;
+
+		mag = ofi_bufpool_mag(mt, (uint32_t) head);
+		/* mag->next may be stale if another thread popped mag
+		 * meanwhile, but then the tag has changed as well */
+		new_head = (((head >> 32) + 1) << 32) | mag->next;
+		if (ofi_atomic_cas_bool64(depot, (int64_t) head,
+					  (int64_t) new_head))
+			return mag;
+		ofi_atomic_inc64(&mt->depot_retry);
+	}
+}
+
+/* Called with mt->lock held.  Returns the first of the new magazines,
+ * the others are pushed to the empty depot. */
+static struct ofi_bufpool_mag *ofi_bufpool_mag_grow(struct ofi_bufpool_mt *mt)
+{
+	struct ofi_bufpool_mag *mags;
+	size_t i;
+
+	if (mt->mag_chunks == OFI_BUFPOOL_MAG_TABLE_SIZE)
+		return NULL;
+
+	mags = calloc(OFI_BUFPOOL_MAG_CHUNK_CNT, sizeof(*mags));
+	if (!mags)
+		return NULL;
+
+	for (i = 0; i < OFI_BUFPOOL_MAG_CHUNK_CNT; i++)
+		mags[i].id = mt->mag_chunks * OFI_BUFPOOL_MAG_CHUNK_CNT + i + 1;
+	mt->mag_table[mt->mag_chunks++] = mags;
+
+	for (i = 1; i < OFI_BUFPOOL_MAG_CHUNK_CNT; i++)
+		ofi_bufpool_depot_push(mt, &mt->empty, &mags[i]);
+	return &mags[0];
+}
+
+static struct ofi_bufpool_cache *ofi_bufpool_cache(struct ofi_bufpool_mt *mt)
+{
+	struct ofi_bufpool_cache *cache;
+	uint64_t id;
+
+	id = (uint64_t) (uintptr_t) pthread_self();
+	id = (id ^ (id >> 17)) * 0x9e3779b97f4a7c15ULL;
+	cache = &mt->cache[(id >> 32) % OFI_BUFPOOL_CACHE_CNT];
+
+	if (fastlock_tryacquire(&cache->lock)) {
+		ofi_atomic_inc64(&mt->cache_contention);
+		fastlock_acquire(&cache->lock);
+	}
+	return cache;
+}
+
+/* Refill an empty magazine straight from the pool, growing it if needed */
+static int ofi_bufpool_mt_fill(struct ofi_bufpool *pool,
+			       struct ofi_bufpool_mag *mag)
+{
+	struct ofi_bufpool_hdr *buf_hdr;
+	int ret = 0;
+
+	fastlock_acquire(&pool->mt->lock);
+	if (slist_empty(&pool->free_list.entries)) {
+		ret = ofi_bufpool_grow(pool);
+		if (ret)
+			goto out;
+	}
+
+	while (mag->cnt < OFI_BUFPOOL_MAG_SIZE &&
+	       !slist_empty(&pool->free_list.entries)) {
+		slist_remove_head_container(&pool->free_list.entries,
+				struct ofi_bufpool_hdr, buf_hdr, entry.slist);
+		mag->bufs[mag->cnt++] = buf_hdr;
+	}
+out:
+	fastlock_release(&pool->mt->lock);
+	return ret;
+}
+
+void *ofi_bufpool_mt_alloc(struct ofi_bufpool *pool)
+{
+	struct ofi_bufpool_mt *mt = pool->mt;
+	struct ofi_bufpool_cache *cache;
+	struct ofi_bufpool_hdr *buf_hdr;
+	struct ofi_bufpool_mag *mag;
+
+	cache = ofi_bufpool_cache(mt);
+	if (OFI_UNLIKELY(!cache->loaded->cnt)) {
+		if (cache->prev->cnt) {
+			mag = cache->prev;
+			cache->prev = cache->loaded;
+			cache->loaded = mag;
+		} else if ((mag = ofi_bufpool_depot_pop(mt, &mt->full))) {
+			ofi_atomic_inc64(&mt->depot_alloc);
+			ofi_bufpool_depot_push(mt, &mt->empty, cache->prev);
+			cache->prev = cache->loaded;
+			cache->loaded = mag;
+		} else if (ofi_bufpool_mt_fill(pool, cache->loaded)) {
+			fastlock_release(&cache->lock);
+			return NULL;
+		}
+	}
+
+	buf_hdr = cache->loaded->bufs[--cache->loaded->cnt];
+	fastlock_release(&cache->lock);
+#ifndef NDEBUG
+	ofi_atomic_inc64(&mt->use_cnt);
+#endif
+	return ofi_buf_data(buf_hdr);
+}
+
+void ofi_bufpool_mt_free(struct ofi_bufpool *pool, void *buf)
+{
+	struct ofi_bufpool_mt *mt = pool->mt;
+	struct ofi_bufpool_cache *cache;
+	struct ofi_bufpool_mag *mag;
+
+#ifndef NDEBUG
+	assert(ofi_atomic_dec64(&mt->use_cnt) >= 0);
+#endif
+	cache = ofi_bufpool_cache(mt);
+	if (OFI_UNLIKELY(cache->loaded->cnt == OFI_BUFPOOL_MAG_SIZE)) {
+		if (!cache->prev->cnt) {
+			mag = cache->prev;
+			cache->prev = cache->loaded;
+			cache->loaded = mag;
+		} else {
+			mag = ofi_bufpool_depot_pop(mt, &mt->empty);
+			if (!mag) {
+				fastlock_acquire(&mt->lock);
+				mag = ofi_bufpool_mag_grow(mt);
+				if (!mag) {
+					/* out of magazines, return it to the pool */
+					slist_insert_head(&ofi_buf_hdr(buf)->entry.slist,
+							  &pool->free_list.entries);
+					fastlock_release(&mt->lock);
+					fastlock_release(&cache->lock);
+					return;
+				}
+				fastlock_release(&mt->lock);
+			}
+			ofi_atomic_inc64(&mt->depot_free);
+			ofi_bufpool_depot_push(mt, &mt->full, cache->prev);
+			cache->prev = cache->loaded;
+			cache->loaded = mag;
+		}
+	}
+
+	cache->loaded->bufs[cache->loaded->cnt++] = ofi_buf_hdr(buf);
+	fastlock_release(&cache->lock);
+}
+
+static int ofi_bufpool_mt_init(struct ofi_bufpool *pool)
+{
+	struct ofi_bufpool_mt *mt;
+	size_t i;
+
+	mt = calloc(1, sizeof(*mt));
+	if (!mt)
+		return -FI_ENOMEM;
+
+	fastlock_init(&mt->lock);
+	slist_init(&mt->old_tables);
+	ofi_atomic_initialize32(&mt->table_cnt, 0);
+	ofi_atomic_initialize64(&mt->full, 0);
+	ofi_atomic_initialize64(&mt->empty, 0);
+	ofi_atomic_initialize64(&mt->depot_alloc, 0);
+	ofi_atomic_initialize64(&mt->depot_free, 0);
+	ofi_atomic_initialize64(&mt->depot_retry, 0);
+	ofi_atomic_initialize64(&mt->cache_contention, 0);
+#ifndef NDEBUG
+	ofi_atomic_initialize64(&mt->use_cnt, 0);
+#endif
+
+	for (i = 0; i < OFI_BUFPOOL_CACHE_CNT; i++)
+		fastlock_init(&mt->cache[i].lock);
+
+	/* every cache starts with two empty magazines */
+	for (i = 0; i < OFI_BUFPOOL_CACHE_CNT; i++) {
+		mt->cache[i].loaded = ofi_bufpool_depot_pop(mt, &mt->empty);
+		if (!mt->cache[i].loaded)
+			mt->cache[i].loaded = ofi_bufpool_mag_grow(mt);
+		mt->cache[i].prev = ofi_bufpool_depot_pop(mt, &mt->empty);
+		if (!mt->cache[i].loaded || !mt->cache[i].prev)
+			goto err;
+	}
+
+	pool->mt = mt;
+	return 0;
+err:
+	for (i = 0; i < OFI_BUFPOOL_CACHE_CNT; i++)
+		fastlock_destroy(&mt->cache[i].lock);
+	for (i = 0; i < mt->mag_chunks; i++)
+		free(mt->mag_table[i]);
+	fastlock_destroy(&mt->lock);
+	free(mt);
+	return -FI_ENOMEM;
+}
+
+static void ofi_bufpool_mt_cleanup(struct ofi_bufpool *pool)
+{
+	struct ofi_bufpool_mt *mt = pool->mt;
+	struct ofi_bufpool_table *old;
+	struct ofi_bufpool_stats stats;
+	struct slist_entry *entry;
+	size_t i;
+
+	ofi_bufpool_get_stats(pool, &stats);
+	FI_INFO(&core_prov, FI_LOG_CORE, "thread-safe buffer pool %p: "
+		"%zu regions, %zu entries, depot alloc %zu free %zu "
+		"retries %zu, cache contention %zu\n", (void *) pool,
+		stats.grow_cnt, stats.entry_cnt, stats.depot_alloc,
+		stats.depot_free, stats.depot_retry, stats.cache_contention);
+
+	assert((pool->attr.flags & OFI_BUFPOOL_NO_TRACK) ||
+	       !ofi_atomic_get64(&mt->use_cnt));
+
+	for (i = 0; i < OFI_BUFPOOL_CACHE_CNT; i++)
+		fastlock_destroy(&mt->cache[i].lock);
+	for (i = 0; i < mt->mag_chunks; i++)
+		free(mt->mag_table[i]);
+
+	while (!slist_empty(&mt->old_tables)) {
+		entry = slist_remove_head(&mt->old_tables);
+		old = container_of(entry, struct ofi_bufpool_table, entry);
+		free(old->table);
+		free(old);
+	}
+	fastlock_destroy(&mt->lock);
+	free(mt);
+	pool->mt = NULL;
+}
+
+void ofi_bufpool_get_stats(struct ofi_bufpool *pool,
+			   struct ofi_bufpool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->grow_cnt = pool->region_cnt;
+	stats->entry_cnt = pool->entry_cnt;
+	stats->numa_bind_fail = pool->numa_bind_fail;
+	if (!pool->mt)
+		return;
+
+	stats->depot_alloc = ofi_atomic_get64(&pool->mt->depot_alloc);
+	stats->depot_free = ofi_atomic_get64(&pool->mt->depot_free);
+	stats->depot_retry = ofi_atomic_get64(&pool->mt->depot_retry);
+	stats->cache_contention = ofi_atomic_get64(&pool->mt->cache_contention);
+}
+
+/* mbind() works on whole pages */
+static void ofi_bufpool_set_alloc_size(struct ofi_bufpool *pool)
+{
+	pool->alloc_size = (pool->attr.chunk_cnt + 1) * pool->entry_size;
+	if (pool->attr.flags & OFI_BUFPOOL_NUMA)
+		pool->alloc_size = ofi_get_aligned_size(pool->alloc_size,
+						page_sizes[OFI_PAGE_SIZE]);
+	pool->region_size = pool->alloc_size - pool->entry_size;
+}
+
+/*
+ * Called before the region is cleared, so that if binding fails, at
+ * least the pages are first touched by the thread growing the pool.
+ */
+static void ofi_bufpool_numa_bind(struct ofi_bufpool *pool,
+				  struct ofi_bufpool_region *buf_region)
+{
+	int node, ret;
+
+	node = pool->attr.numa_node;
+	if (node == OFI_BUFPOOL_NUMA_LOCAL) {
+		node = ofi_numa_node_self();
+		if (node < 0) {
+			ret = node;
+			goto err;
+		}
+	}
+
+	ret = ofi_numa_bind(buf_region->alloc_region, pool->alloc_size, node);
+	if (!ret)
+		return;
+err:
+	pool->numa_bind_fail++;
+	FI_DBG(&core_prov, FI_LOG_CORE, "NUMA binding failed: %s\n",
+	       fi_strerror(-ret));
+}
+
+/*
+ * NUMA regions are mapped instead of taken from the heap.  The memory
+ * policy set by mbind() sticks to the pages, which malloc would hand out
+ * again to unrelated users once the pool is destroyed.
+ */
+static int ofi_bufpool_alloc_region(struct ofi_bufpool *pool,
+				    struct ofi_bufpool_region *buf_region)
+{
+	int ret;
+
+	if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES) {
+		ret = ofi_alloc_hugepage_buf((void **) &buf_region->alloc_region,
+					     pool->alloc_size);
+		/* If we can't allocate huge pages, fall back to normal
+		 * allocations if this is the first allocation attempt.
+		 */
+		if (!ret || pool->entry_cnt)
+			return ret;
+		pool->attr.flags &= ~OFI_BUFPOOL_HUGEPAGES;
+		ofi_bufpool_set_alloc_size(pool);
+	}
+
+	if (pool->attr.flags & OFI_BUFPOOL_NUMA) {
+		ret = ofi_alloc_numa_buf((void **) &buf_region->alloc_region,
+					 pool->alloc_size);
+		/* Same fallback, e.g. on platforms without NUMA support */
+		if (!ret || pool->entry_cnt)
+			return ret;
+		pool->numa_bind_fail++;
+		pool->attr.flags &= ~OFI_BUFPOOL_NUMA;
+		ofi_bufpool_set_alloc_size(pool);
+	}
+
+	return ofi_memalign((void **) &buf_region->alloc_region,
+			    pool->attr.alignment, pool->alloc_size);
+}
+
+static void ofi_bufpool_free_region(struct ofi_bufpool *pool,
+				    struct ofi_bufpool_region *buf_region)
+{
+	int ret;
+
+	if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES) {
+		ret = ofi_free_hugepage_buf(buf_region->alloc_region,
+					    pool->alloc_size);
+	} else if (pool->attr.flags & OFI_BUFPOOL_NUMA) {
+		ret = ofi_free_numa_buf(buf_region->alloc_region,
+					pool->alloc_size);
+	} else {
+		ofi_freealign(buf_region->alloc_region);
+		return;
+	}
+
+	if (ret) {
+		FI_DBG(&core_prov, FI_LOG_CORE, "Region free failed: %s\n",
+		       fi_strerror(errno));
+		assert(0);
+	}
+}
 
 int ofi_bufpool_grow(struct ofi_bufpool *pool)
 {
@@ -63,30 +539,16 @@ int ofi_bufpool_grow(struct ofi_bufpool *pool)
 	buf_region->pool = pool;
 	dlist_init(&buf_region->free_list);
 
-	if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES) {
-		ret = ofi_alloc_hugepage_buf((void **) &buf_region->alloc_region,
-					     pool->alloc_size);
-		/* If we can't allocate huge pages, fall back to normal
-		 * allocations if this is the first allocation attempt.
-		 */
-		if (ret && !pool->entry_cnt) {
-			pool->attr.flags &= ~OFI_BUFPOOL_HUGEPAGES;
-			pool->alloc_size = (pool->attr.chunk_cnt + 1) *
-					   pool->entry_size;
-			pool->region_size = pool->alloc_size - pool->entry_size;
-			goto retry;
-		}
-	} else {
-retry:
-		ret = ofi_memalign((void **) &buf_region->alloc_region,
-				   pool->attr.alignment, pool->alloc_size);
-	}
+	ret = ofi_bufpool_alloc_region(pool, buf_region);
 	if (ret) {
 		FI_DBG(&core_prov, FI_LOG_CORE, "Allocation failed: %s\n",
 		       fi_strerror(-ret));
 		goto err1;
 	}
 
+	if (pool->attr.flags & OFI_BUFPOOL_NUMA)
+		ofi_bufpool_numa_bind(pool, buf_region);
+
 	memset(buf_region->alloc_region, 0, pool->alloc_size);
 	buf_region->mem_region = buf_region->alloc_region + pool->entry_size;
 	if (pool->attr.alloc_fn) {
@@ -98,7 +560,10 @@ retry:
 	if (!(pool->region_cnt % OFI_BUFPOOL_REGION_CHUNK_CNT)) {
 		struct ofi_bufpool_region **new_table;
 
-		new_table = realloc(pool->region_table,
+		if (pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE)
+			new_table = ofi_bufpool_mt_grow_table(pool);
+		else
+			new_table = realloc(pool->region_table,
 				(pool->region_cnt + OFI_BUFPOOL_REGION_CHUNK_CNT) *
 				sizeof(*pool->region_table));
 		if (!new_table) {
@@ -136,7 +601,7 @@ retry:
 			pool->attr.init_fn(buf_region, buf);
 #endif
 		}
-		if (pool->attr.flags & OFI_BUFPOOL_INDEXED) {
+		if (ofi_bufpool_ordered(pool)) {
 			dlist_insert_tail(&buf_hdr->entry.dlist,
 					  &buf_region->free_list);
 		} else {
@@ -145,7 +610,7 @@ retry:
 		}
 	}
 
-	if (pool->attr.flags & OFI_BUFPOOL_INDEXED)
+	if (ofi_bufpool_ordered(pool))
 		dlist_insert_tail(&buf_region->entry, &pool->free_list.regions);
 
 	pool->entry_cnt += pool->attr.chunk_cnt;
@@ -155,10 +620,7 @@ err3:
 	if (pool->attr.free_fn)
 	    pool->attr.free_fn(buf_region);
 err2:
-	if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES)
-		ofi_free_hugepage_buf(buf_region->alloc_region, pool->alloc_size);
-	else
-		ofi_freealign(buf_region->alloc_region);
+	ofi_bufpool_free_region(pool, buf_region);
 err1:
 	free(buf_region);
 	return ret;
@@ -170,6 +632,7 @@ int ofi_bufpool_create_attr(struct ofi_bufpool_attr *attr,
 	struct ofi_bufpool *pool;
 	size_t entry_sz;
 	ssize_t hp_size;
+	int ret;
 
 	pool = calloc(1, sizeof(**buf_pool));
 	if (!pool)
@@ -185,12 +648,12 @@ int ofi_bufpool_create_attr(struct ofi_bufpool_attr *attr,
 			pool->entry_size < page_sizes[OFI_PAGE_SIZE] ? 64 : 16;
 	}
 
-	if (pool->attr.flags & OFI_BUFPOOL_INDEXED)
+	if (ofi_bufpool_ordered(pool))
 		dlist_init(&pool->free_list.regions);
 	else
 		slist_init(&pool->free_list.entries);
 
-	pool->alloc_size = (pool->attr.chunk_cnt + 1) * pool->entry_size;
+	ofi_bufpool_set_alloc_size(pool);
 	hp_size = ofi_get_hugepage_size();
 	if (hp_size <= 0 || pool->alloc_size < hp_size)
 		pool->attr.flags &= ~OFI_BUFPOOL_HUGEPAGES;
@@ -198,9 +661,16 @@ int ofi_bufpool_create_attr(struct ofi_bufpool_attr *attr,
 	if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES) {
 		pool->alloc_size = ofi_get_aligned_size(pool->alloc_size,
 							hp_size);
+		pool->region_size = pool->alloc_size - pool->entry_size;
 	}
 
-	pool->region_size = pool->alloc_size - pool->entry_size;
+	if (pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE) {
+		ret = ofi_bufpool_mt_init(pool);
+		if (ret) {
+			free(pool);
+			return ret;
+		}
+	}
 
 	*buf_pool = pool;
 	return FI_SUCCESS;
@@ -209,30 +679,21 @@ int ofi_bufpool_create_attr(struct ofi_bufpool_attr *attr,
 void ofi_bufpool_destroy(struct ofi_bufpool *pool)
 {
 	struct ofi_bufpool_region *buf_region;
-	int ret;
 	size_t i;
 
+	if (pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE)
+		ofi_bufpool_mt_cleanup(pool);
+
 	for (i = 0; i < pool->region_cnt; i++) {
 		buf_region = pool->region_table[i];
 
 		assert((pool->attr.flags & OFI_BUFPOOL_NO_TRACK) ||
+			(pool->attr.flags & OFI_BUFPOOL_THREAD_SAFE) ||
 			(buf_region->use_cnt == 0));
 		if (pool->attr.free_fn)
 			pool->attr.free_fn(buf_region);
 
-		if (pool->attr.flags & OFI_BUFPOOL_HUGEPAGES) {
-			ret = ofi_free_hugepage_buf(buf_region->alloc_region,
-						    pool->alloc_size);
-			if (ret) {
-				FI_DBG(&core_prov, FI_LOG_CORE,
-				       "Huge page free failed: %s\n",
-				       fi_strerror(-ret));
-				assert(0);
-			}
-		} else {
-			ofi_freealign(buf_region->alloc_region);
-		}
-
+		ofi_bufpool_free_region(pool, buf_region);
 		free(buf_region);
 	}
 	free(pool->region_table);
@@ -65,19 +65,113 @@ int ofi_cq_write_overflow(struct util_cq *cq, void *context, uint64_t flags, siz
 	return 0;
 }
 
-int ofi_cq_write_error(struct util_cq *cq,
-		       const struct fi_cq_err_entry *err_entry)
+/*
+ * Ring overflow and error entries are queued in order on oflow_err_list.
+ * While the list is not empty, oflow_pending makes all producers queue
+ * their completions on it as well, so that nothing overtakes them.
+ */
+static void util_cq_ring_queue(struct util_cq *cq,
+			       struct util_cq_oflow_err_entry *entry)
 {
-	struct util_cq_oflow_err_entry *entry;
-	struct fi_cq_tagged_entry *comp;
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	slist_insert_tail(&entry->list_entry, &cq->oflow_err_list);
+	ofi_atomic_set32(&cq->oflow_pending, 1);
+	cq->cq_fastlock_release(&cq->cq_lock);
+}
 
-	assert(err_entry->err);
+int ofi_cq_ring_write_overflow(struct util_cq *cq, void *context,
+			       uint64_t flags, size_t len, void *buf,
+			       uint64_t data, uint64_t tag, fi_addr_t src)
+{
+	struct util_cq_oflow_err_entry *entry;
 
 	if (!(entry = calloc(1, sizeof(*entry))))
 		return -FI_ENOMEM;
 
-	entry->comp = *err_entry;
+	entry->comp.op_context = context;
+	entry->comp.flags = flags;
+	entry->comp.len = len;
+	entry->comp.buf = buf;
+	entry->comp.data = data;
+	entry->comp.tag = tag;
+	entry->src = src;
+
+	util_cq_ring_queue(cq, entry);
+	return 0;
+}
+
+static int util_cq_ring_write_batch(struct util_cq *cq,
+				    const struct fi_cq_tagged_entry *comps,
+				    const fi_addr_t *src, size_t count)
+{
+	struct util_comp_ring *ring = cq->ring;
+	uint64_t pos;
+	size_t i, n, idx;
+	int ret;
+
+	while (count) {
+		if (OFI_UNLIKELY(ofi_atomic_get32(&cq->oflow_pending)))
+			break;
+
+		n = util_comp_ring_reserve(ring, count, &pos);
+		if (OFI_UNLIKELY(!n))
+			break;
+
+		for (i = 0; i < n; i++) {
+			idx = util_comp_ring_idx(ring, pos + i);
+			ring->comp[idx] = comps[i];
+			ring->src[idx] = src ? src[i] : 0;
+			util_comp_ring_commit(ring, pos + i);
+		}
+		comps += n;
+		if (src)
+			src += n;
+		count -= n;
+	}
+
+	for (; count; count--, comps++) {
+		ret = ofi_cq_ring_write_overflow(cq, comps->op_context,
+				comps->flags, comps->len, comps->buf,
+				comps->data, comps->tag, src ? *src++ : 0);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+int ofi_cq_write_batch(struct util_cq *cq,
+		       const struct fi_cq_tagged_entry *comps,
+		       const fi_addr_t *src, size_t count)
+{
+	size_t i;
+	int ret = 0;
+
+	if (cq->ring)
+		return util_cq_ring_write_batch(cq, comps, src, count);
+
 	cq->cq_fastlock_acquire(&cq->cq_lock);
+	for (i = 0; i < count && !ret; i++) {
+		if (src && cq->src) {
+			ret = ofi_cq_write_src_thread_unsafe(cq,
+				comps[i].op_context, comps[i].flags,
+				comps[i].len, comps[i].buf, comps[i].data,
+				comps[i].tag, src[i]);
+		} else {
+			ret = ofi_cq_write_thread_unsafe(cq,
+				comps[i].op_context, comps[i].flags,
+				comps[i].len, comps[i].buf, comps[i].data,
+				comps[i].tag);
+		}
+	}
+	cq->cq_fastlock_release(&cq->cq_lock);
+	return ret;
+}
+
+static void util_cq_queue_error(struct util_cq *cq,
+				struct util_cq_oflow_err_entry *entry)
+{
+	struct fi_cq_tagged_entry *comp;
+
 	slist_insert_tail(&entry->list_entry, &cq->oflow_err_list);
 
 	if (OFI_UNLIKELY(ofi_cirque_isfull(cq->cirq))) {
@@ -89,7 +183,45 @@ int ofi_cq_write_error(struct util_cq *cq,
 		comp->flags = UTIL_FLAG_ERROR;
 		ofi_cirque_commit(cq->cirq);
 	}
+}
+
+/* Caller must hold `cq_lock` */
+int ofi_cq_write_error_thread_unsafe(struct util_cq *cq,
+				     const struct fi_cq_err_entry *err_entry)
+{
+	struct util_cq_oflow_err_entry *entry;
+
+	assert(!cq->ring);
+	assert(err_entry->err);
+
+	if (!(entry = calloc(1, sizeof(*entry))))
+		return -FI_ENOMEM;
+
+	entry->comp = *err_entry;
+	util_cq_queue_error(cq, entry);
+	return 0;
+}
+
+int ofi_cq_write_error(struct util_cq *cq,
+		       const struct fi_cq_err_entry *err_entry)
+{
+	struct util_cq_oflow_err_entry *entry;
+
+	assert(err_entry->err);
+
+	if (!(entry = calloc(1, sizeof(*entry))))
+		return -FI_ENOMEM;
+
+	entry->comp = *err_entry;
+	if (cq->ring) {
+		util_cq_ring_queue(cq, entry);
+		goto signal;
+	}
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	util_cq_queue_error(cq, entry);
 	cq->cq_fastlock_release(&cq->cq_lock);
+signal:
 	if (cq->wait)
 		cq->wait->signal(cq->wait);
 	return 0;
@@ -201,6 +333,50 @@ static void util_cq_read_tagged(void **dst, void *src)
 	*(char **)dst += sizeof(struct fi_cq_tagged_entry);
 }
 
+/*
+ * Bulk versions of the above for runs of entries.  Completions are stored
+ * as fi_cq_tagged_entry, so tagged CQs copy them out in one go.
+ */
+static void util_cq_read_ctx_n(void **dst, struct fi_cq_tagged_entry *src,
+			       size_t count)
+{
+	struct fi_cq_entry *entry = *dst;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		entry[i].op_context = src[i].op_context;
+	*dst = entry + count;
+}
+
+static void util_cq_read_msg_n(void **dst, struct fi_cq_tagged_entry *src,
+			       size_t count)
+{
+	struct fi_cq_msg_entry *entry = *dst;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		entry[i] = *(struct fi_cq_msg_entry *) &src[i];
+	*dst = entry + count;
+}
+
+static void util_cq_read_data_n(void **dst, struct fi_cq_tagged_entry *src,
+				size_t count)
+{
+	struct fi_cq_data_entry *entry = *dst;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		entry[i] = *(struct fi_cq_data_entry *) &src[i];
+	*dst = entry + count;
+}
+
+static void util_cq_read_tagged_n(void **dst, struct fi_cq_tagged_entry *src,
+				  size_t count)
+{
+	memcpy(*dst, src, count * sizeof(*src));
+	*(char **) dst += count * sizeof(*src);
+}
+
 static inline
 void util_cq_read_oflow_entry(struct util_cq *cq,
 			      struct util_cq_oflow_err_entry *oflow_entry,
@@ -230,14 +406,120 @@ void util_cq_read_entry(struct util_cq *cq, struct fi_cq_tagged_entry *entry,
 	ofi_cirque_discard(cq->cirq);
 }
 
+/* Number of plain entries at the head of the cirq, without wrapping */
+static inline size_t util_cq_cirq_run(struct util_cq *cq, size_t count)
+{
+	struct fi_cq_tagged_entry *entry;
+	size_t idx, n;
+
+	idx = ofi_cirque_rindex(cq->cirq);
+	count = MIN(count, cq->cirq->size - idx);
+	entry = &cq->cirq->buf[idx];
+	for (n = 0; n < count; n++) {
+		if (entry[n].flags & (UTIL_FLAG_ERROR | UTIL_FLAG_OVERFLOW))
+			break;
+	}
+	return n;
+}
+
+static inline void util_cq_read_run(struct util_cq *cq, void **buf,
+				    fi_addr_t *src_addr, ssize_t i, size_t run)
+{
+	size_t idx = ofi_cirque_rindex(cq->cirq);
+
+	if (src_addr && cq->src)
+		memcpy(&src_addr[i], &cq->src[idx], run * sizeof(*src_addr));
+	cq->read_entries(buf, &cq->cirq->buf[idx], run);
+	cq->cirq->rcnt += run;
+}
+
+/* Caller must hold `cq_lock` */
+static ssize_t util_cq_ring_read(struct util_cq *cq, void *buf, size_t count,
+				 fi_addr_t *src_addr)
+{
+	struct util_cq_oflow_err_entry *oflow_entry;
+	struct fi_cq_tagged_entry comp;
+	size_t idx, run;
+	ssize_t i;
+
+	for (i = 0; i < (ssize_t) count; ) {
+		run = util_comp_ring_peek(cq->ring, count - i);
+		if (OFI_LIKELY(run)) {
+			idx = util_comp_ring_idx(cq->ring, cq->ring->tail);
+			if (src_addr && (cq->domain->info_domain_caps & FI_SOURCE))
+				memcpy(&src_addr[i], &cq->ring->src[idx],
+				       run * sizeof(*src_addr));
+			cq->read_entries(&buf, &cq->ring->comp[idx], run);
+			util_comp_ring_discard(cq->ring, run);
+			i += run;
+			continue;
+		}
+
+		if (!ofi_atomic_get32(&cq->oflow_pending))
+			break;
+
+		oflow_entry = container_of(cq->oflow_err_list.head,
+					   struct util_cq_oflow_err_entry,
+					   list_entry);
+		if (oflow_entry->comp.err) {
+			if (!i)
+				i = -FI_EAVAIL;
+			break;
+		}
+
+		slist_remove_head(&cq->oflow_err_list);
+		if (slist_empty(&cq->oflow_err_list))
+			ofi_atomic_set32(&cq->oflow_pending, 0);
+
+		if (src_addr && (cq->domain->info_domain_caps & FI_SOURCE))
+			src_addr[i] = oflow_entry->src;
+		comp.op_context = oflow_entry->comp.op_context;
+		comp.flags = oflow_entry->comp.flags;
+		comp.len = oflow_entry->comp.len;
+		comp.buf = oflow_entry->comp.buf;
+		comp.data = oflow_entry->comp.data;
+		comp.tag = oflow_entry->comp.tag;
+		cq->read_entry(&buf, &comp);
+		free(oflow_entry);
+		i++;
+	}
+
+	if (!i && !util_comp_ring_peek(cq->ring, 1) &&
+	    !ofi_atomic_get32(&cq->oflow_pending))
+		return -FI_EAGAIN;
+	return i;
+}
+
+static ssize_t util_cq_ring_readfrom(struct util_cq *cq, void *buf,
+				     size_t count, fi_addr_t *src_addr)
+{
+	ssize_t ret;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	ret = util_cq_ring_read(cq, buf, count, src_addr);
+	cq->cq_fastlock_release(&cq->cq_lock);
+	if (ret != -FI_EAGAIN && count)
+		return ret;
+
+	cq->progress(cq);
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	ret = util_cq_ring_read(cq, buf, count, src_addr);
+	cq->cq_fastlock_release(&cq->cq_lock);
+	return ret;
+}
+
 ssize_t ofi_cq_readfrom(struct fid_cq *cq_fid, void *buf, size_t count,
 			fi_addr_t *src_addr)
 {
 	struct util_cq *cq;
 	struct fi_cq_tagged_entry *entry;
+	size_t run;
 	ssize_t i;
 
 	cq = container_of(cq_fid, struct util_cq, cq_fid);
+	if (cq->ring)
+		return util_cq_ring_readfrom(cq, buf, count, src_addr);
 
 	cq->cq_fastlock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isempty(cq->cirq) || !count) {
@@ -255,6 +537,12 @@ ssize_t ofi_cq_readfrom(struct fid_cq *cq_fid, void *buf, size_t count,
 
 	for (i = 0; i < (ssize_t)count; i++) {
 		entry = ofi_cirque_head(cq->cirq);
+		run = util_cq_cirq_run(cq, count - i);
+		if (run > 1) {
+			util_cq_read_run(cq, &buf, src_addr, i, run);
+			i += run - 1;
+			continue;
+		}
 		if (OFI_UNLIKELY(entry->flags & (UTIL_FLAG_ERROR |
 						 UTIL_FLAG_OVERFLOW))) {
 			if (entry->flags & UTIL_FLAG_ERROR) {
@@ -312,6 +600,55 @@ ssize_t ofi_cq_read(struct fid_cq *cq_fid, void *buf, size_t count)
 	return ofi_cq_readfrom(cq_fid, buf, count, NULL);
 }
 
+static void util_cq_copy_err(struct util_cq *cq, struct fi_cq_err_entry *buf,
+			     struct util_cq_oflow_err_entry *err)
+{
+	char *err_buf_save;
+	size_t err_data_size;
+	uint32_t api_version;
+
+	api_version = cq->domain->fabric->fabric_fid.api_version;
+	if ((FI_VERSION_GE(api_version, FI_VERSION(1, 5))) && buf->err_data_size) {
+		err_data_size = MIN(buf->err_data_size, err->comp.err_data_size);
+		memcpy(buf->err_data, err->comp.err_data, err_data_size);
+		err_buf_save = buf->err_data;
+		*buf = err->comp;
+		buf->err_data = err_buf_save;
+		buf->err_data_size = err_data_size;
+	} else {
+		memcpy(buf, &err->comp, sizeof(struct fi_cq_err_entry_1_0));
+	}
+}
+
+/* An error is only reported once all completions queued before it are */
+static ssize_t util_cq_ring_readerr(struct util_cq *cq,
+				    struct fi_cq_err_entry *buf)
+{
+	struct util_cq_oflow_err_entry *err;
+	ssize_t ret = -FI_EAGAIN;
+
+	cq->cq_fastlock_acquire(&cq->cq_lock);
+	if (util_comp_ring_peek(cq->ring, 1) ||
+	    !ofi_atomic_get32(&cq->oflow_pending))
+		goto unlock;
+
+	err = container_of(cq->oflow_err_list.head,
+			   struct util_cq_oflow_err_entry, list_entry);
+	if (!err->comp.err)
+		goto unlock;
+
+	slist_remove_head(&cq->oflow_err_list);
+	if (slist_empty(&cq->oflow_err_list))
+		ofi_atomic_set32(&cq->oflow_pending, 0);
+
+	util_cq_copy_err(cq, buf, err);
+	free(err);
+	ret = 1;
+unlock:
+	cq->cq_fastlock_release(&cq->cq_lock);
+	return ret;
+}
+
 ssize_t ofi_cq_readerr(struct fid_cq *cq_fid, struct fi_cq_err_entry *buf,
 		       uint64_t flags)
 {
@@ -319,13 +656,11 @@ ssize_t ofi_cq_readerr(struct fid_cq *cq_fid, struct fi_cq_err_entry *buf,
 	struct util_cq_oflow_err_entry *err;
 	struct slist_entry *entry;
 	struct fi_cq_tagged_entry *cirq_entry;
-	char *err_buf_save;
-	size_t err_data_size;
-	uint32_t api_version;
 	ssize_t ret;
 
 	cq = container_of(cq_fid, struct util_cq, cq_fid);
-	api_version = cq->domain->fabric->fabric_fid.api_version;
+	if (cq->ring)
+		return util_cq_ring_readerr(cq, buf);
 
 	cq->cq_fastlock_acquire(&cq->cq_lock);
 	if (ofi_cirque_isempty(cq->cirq) ||
@@ -336,16 +671,7 @@ ssize_t ofi_cq_readerr(struct fid_cq *cq_fid, struct fi_cq_err_entry *buf,
 
 	entry = slist_remove_head(&cq->oflow_err_list);
 	err = container_of(entry, struct util_cq_oflow_err_entry, list_entry);
-	if ((FI_VERSION_GE(api_version, FI_VERSION(1, 5))) && buf->err_data_size) {
-		err_data_size = MIN(buf->err_data_size, err->comp.err_data_size);
-		memcpy(buf->err_data, err->comp.err_data, err_data_size);
-		err_buf_save = buf->err_data;
-		*buf = err->comp;
-		buf->err_data = err_buf_save;
-		buf->err_data_size = err_data_size;
-	} else {
-		memcpy(buf, &err->comp, sizeof(struct fi_cq_err_entry_1_0));
-	}
+	util_cq_copy_err(cq, buf, err);
 
 	cirq_entry = ofi_cirque_head(cq->cirq);
 	if (!(cirq_entry->flags & UTIL_FLAG_OVERFLOW)) {
@@ -458,7 +784,10 @@ int ofi_cq_cleanup(struct util_cq *cq)
 	}
 
 	ofi_atomic_dec32(&cq->domain->ref);
-	util_comp_cirq_free(cq->cirq);
+	if (cq->ring)
+		free(cq->ring);
+	else
+		util_comp_cirq_free(cq->cirq);
 	fastlock_destroy(&cq->cq_lock);
 	fastlock_destroy(&cq->ep_list_lock);
 	free(cq->src);
@@ -513,6 +842,7 @@ static int fi_cq_init(struct fid_domain *domain, struct fi_cq_attr *attr,
 	cq->domain = container_of(domain, struct util_domain, domain_fid);
 	ofi_atomic_initialize32(&cq->ref, 0);
 	ofi_atomic_initialize32(&cq->signaled, 0);
+	ofi_atomic_initialize32(&cq->oflow_pending, 0);
 	dlist_init(&cq->ep_list);
 	fastlock_init(&cq->ep_list_lock);
 	fastlock_init(&cq->cq_lock);
@@ -597,11 +927,53 @@ void ofi_cq_progress(struct util_cq *cq)
 	cq->cq_fastlock_release(&cq->ep_list_lock);
 }
 
+static struct util_comp_ring *util_comp_ring_create(size_t size)
+{
+	struct util_comp_ring *ring;
+	uint64_t i;
+
+	size = roundup_power_of_two(size);
+	ring = calloc(1, sizeof(*ring) + size * (sizeof(*ring->comp) +
+			 sizeof(*ring->seq) + sizeof(*ring->src)));
+	if (!ring)
+		return NULL;
+
+	ring->size = size;
+	ring->comp = (struct fi_cq_tagged_entry *) (ring + 1);
+	ring->seq = (ofi_atomic64_t *) (ring->comp + size);
+	ring->src = (fi_addr_t *) (ring->seq + size);
+	ofi_atomic_initialize64(&ring->head, 0);
+	for (i = 0; i < size; i++)
+		ofi_atomic_initialize64(&ring->seq[i], i);
+	return ring;
+}
+
+/*
+ * The ring only pays off if cq_lock is a real lock: producers then no
+ * longer take it, and consumers only contend among themselves.
+ */
+static int util_cq_use_ring(struct util_cq *cq, int flags)
+{
+	return (flags & OFI_CQ_LOCKFREE) &&
+	       cq->domain->threading != FI_THREAD_COMPLETION &&
+	       cq->domain->threading != FI_THREAD_DOMAIN;
+}
+
 int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 		 struct fi_cq_attr *attr, struct util_cq *cq,
 		 ofi_cq_progress_func progress, void *context)
+{
+	return ofi_cq_init_flags(prov, domain, attr, cq, progress, 0, context);
+}
+
+int ofi_cq_init_flags(const struct fi_provider *prov,
+		      struct fid_domain *domain, struct fi_cq_attr *attr,
+		      struct util_cq *cq, ofi_cq_progress_func progress,
+		      int flags, void *context)
 {
 	fi_cq_read_func read_func;
+	fi_cq_read_n_func read_n_func;
+	size_t size;
 	int ret;
 
 	assert(progress);
@@ -617,15 +989,19 @@ int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 	case FI_CQ_FORMAT_UNSPEC:
 	case FI_CQ_FORMAT_CONTEXT:
 		read_func = util_cq_read_ctx;
+		read_n_func = util_cq_read_ctx_n;
 		break;
 	case FI_CQ_FORMAT_MSG:
 		read_func = util_cq_read_msg;
+		read_n_func = util_cq_read_msg_n;
 		break;
 	case FI_CQ_FORMAT_DATA:
 		read_func = util_cq_read_data;
+		read_n_func = util_cq_read_data_n;
 		break;
 	case FI_CQ_FORMAT_TAGGED:
 		read_func = util_cq_read_tagged;
+		read_n_func = util_cq_read_tagged_n;
 		break;
 	default:
 		assert(0);
@@ -635,6 +1011,7 @@ int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 	ret = fi_cq_init(domain, attr, read_func, cq, context);
 	if (ret)
 		return ret;
+	cq->read_entries = read_n_func;
 
 	/* CQ must be fully operational before adding to wait set */
 	if (cq->wait) {
@@ -646,7 +1023,17 @@ int ofi_cq_init(const struct fi_provider *prov, struct fid_domain *domain,
 		}
 	}
 
-	cq->cirq = util_comp_cirq_create(attr->size == 0 ? UTIL_DEF_CQ_SIZE : attr->size);
+	size = attr->size == 0 ? UTIL_DEF_CQ_SIZE : attr->size;
+	if (util_cq_use_ring(cq, flags)) {
+		cq->ring = util_comp_ring_create(size);
+		if (!cq->ring) {
+			ret = -FI_ENOMEM;
+			goto err1;
+		}
+		return 0;
+	}
+
+	cq->cirq = util_comp_cirq_create(size);
 	if (!cq->cirq) {
 		ret = -FI_ENOMEM;
 		goto err1;
@@ -103,12 +103,44 @@ void ofi_monitor_init(void)
 			" and free calls.  Userfaultfd is the default if"
 			" available on the system. 'disabled' option disables"
 			" memory caching.");
+	fi_param_define(NULL, "mr_cache_shards", FI_PARAM_SIZE_T,
+			"Number of independently locked shards the MR cache"
+			" is split into, rounded up to a power of two.  Regions"
+			" are assigned to shards by address, so lookups from"
+			" threads using different buffers do not contend."
+			" The cache limits are divided evenly between shards."
+			" (default: 1)");
+	fi_param_define(NULL, "mr_cache_reclaim", FI_PARAM_BOOL,
+			"If set to true, a background thread deregisters"
+			" regions that are evicted from the cache or"
+			" invalidated by the memory monitor, and keeps the"
+			" cache below mr_cache_low_watermark.  This moves"
+			" deregistration off the registration path."
+			" (default: false)");
+	fi_param_define(NULL, "mr_cache_low_watermark", FI_PARAM_SIZE_T,
+			"Percentage of mr_cache_max_count and"
+			" mr_cache_max_size that the reclaim thread trims"
+			" unused regions down to.  Only used with"
+			" mr_cache_reclaim.  (default: 80)");
+	fi_param_define(NULL, "mr_cache_notify_queue", FI_PARAM_SIZE_T,
+			"Number of invalidated address ranges each MR cache"
+			" can queue.  If set, the memory monitor queues"
+			" invalidations, combining overlapping and adjacent"
+			" ranges, and the next cache search applies them"
+			" in a batch.  Setting this to zero invalidates"
+			" regions immediately.  (default: 0)");
 
 	fi_param_get_size_t(NULL, "mr_cache_max_size", &cache_params.max_size);
 	fi_param_get_size_t(NULL, "mr_cache_max_count", &cache_params.max_cnt);
 	fi_param_get_bool(NULL, "mr_cache_merge_regions",
 			  &cache_params.merge_regions);
 	fi_param_get_str(NULL, "mr_cache_monitor", &cache_params.monitor);
+	fi_param_get_size_t(NULL, "mr_cache_shards", &cache_params.shard_cnt);
+	fi_param_get_bool(NULL, "mr_cache_reclaim", &cache_params.reclaim);
+	fi_param_get_size_t(NULL, "mr_cache_low_watermark",
+			    &cache_params.low_watermark);
+	fi_param_get_size_t(NULL, "mr_cache_notify_queue",
+			    &cache_params.notify_queue);
 
 	if (!cache_params.max_size)
 		cache_params.max_size = ofi_default_cache_size();
@@ -223,11 +255,42 @@ void ofi_monitor_unsubscribe(struct ofi_mem_monitor *monitor,
 #include <linux/userfaultfd.h>
 
 
+#define OFI_UFFD_MSG_CNT	32
+
+static void ofi_uffd_handle_msg(struct uffd_msg *msg)
+{
+	switch (msg->event) {
+	case UFFD_EVENT_REMOVE:
+		ofi_monitor_unsubscribe(&uffd.monitor,
+			(void *) (uintptr_t) msg->arg.remove.start,
+			(size_t) (msg->arg.remove.end -
+				  msg->arg.remove.start));
+		/* fall through */
+	case UFFD_EVENT_UNMAP:
+		ofi_monitor_notify(&uffd.monitor,
+			(void *) (uintptr_t) msg->arg.remove.start,
+			(size_t) (msg->arg.remove.end -
+				  msg->arg.remove.start));
+		break;
+	case UFFD_EVENT_REMAP:
+		ofi_monitor_notify(&uffd.monitor,
+			(void *) (uintptr_t) msg->arg.remap.from,
+			(size_t) msg->arg.remap.len);
+		break;
+	default:
+		FI_WARN(&core_prov, FI_LOG_MR,
+			"Unhandled uffd event %d\n", msg->event);
+		break;
+	}
+}
+
+/* Reads all pending events at once and reports them under one lock hold */
 static void *ofi_uffd_handler(void *arg)
 {
-	struct uffd_msg msg;
+	struct uffd_msg msg[OFI_UFFD_MSG_CNT];
 	struct pollfd fds;
-	int ret;
+	ssize_t ret;
+	size_t i;
 
 	fds.fd = uffd.fd;
 	fds.events = POLLIN;
@@ -237,37 +300,16 @@ static void *ofi_uffd_handler(void *arg)
 			break;
 
 		pthread_mutex_lock(&uffd.monitor.lock);
-		ret = read(uffd.fd, &msg, sizeof(msg));
-		if (ret != sizeof(msg)) {
+		ret = read(uffd.fd, msg, sizeof(msg));
+		if (ret < (ssize_t) sizeof(*msg)) {
 			pthread_mutex_unlock(&uffd.monitor.lock);
 			if (errno != EAGAIN)
 				break;
 			continue;
 		}
 
-		switch (msg.event) {
-		case UFFD_EVENT_REMOVE:
-			ofi_monitor_unsubscribe(&uffd.monitor,
-				(void *) (uintptr_t) msg.arg.remove.start,
-				(size_t) (msg.arg.remove.end -
-					  msg.arg.remove.start));
-			/* fall through */
-		case UFFD_EVENT_UNMAP:
-			ofi_monitor_notify(&uffd.monitor,
-				(void *) (uintptr_t) msg.arg.remove.start,
-				(size_t) (msg.arg.remove.end -
-					  msg.arg.remove.start));
-			break;
-		case UFFD_EVENT_REMAP:
-			ofi_monitor_notify(&uffd.monitor,
-				(void *) (uintptr_t) msg.arg.remap.from,
-				(size_t) msg.arg.remap.len);
-			break;
-		default:
-			FI_WARN(&core_prov, FI_LOG_MR,
-				"Unhandled uffd event %d\n", msg.event);
-			break;
-		}
+		for (i = 0; i < ret / sizeof(*msg); i++)
+			ofi_uffd_handle_msg(&msg[i]);
 		pthread_mutex_unlock(&uffd.monitor.lock);
 	}
 	return NULL;
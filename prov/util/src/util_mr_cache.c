@@ -34,15 +34,19 @@
 
 #include <config.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <ofi_util.h>
 #include <ofi_iov.h>
 #include <ofi_mr.h>
 #include <ofi_list.h>
 #include <ofi_tree.h>
 
+#define OFI_MR_NOTIFY_BATCH	64
 
 struct ofi_mr_cache_params cache_params = {
 	.max_cnt = 1024,
+	.shard_cnt = 1,
+	.low_watermark = 80,
 };
 
 static int util_mr_find_within(struct ofi_rbmap *map, void *key, void *data)
@@ -71,18 +75,136 @@ static int util_mr_find_overlap(struct ofi_rbmap *map, void *key, void *data)
 	return 0;
 }
 
-static void util_mr_free_entry(struct ofi_mr_cache *cache,
-			       struct ofi_mr_entry *entry)
+static struct ofi_mr_cache_shard *
+util_mr_span_shard(struct ofi_mr_cache *cache)
+{
+	return &cache->shards[cache->shard_cnt - 1];
+}
+
+static struct ofi_mr_cache_shard *
+util_mr_cache_shard(struct ofi_mr_cache *cache, const struct iovec *iov)
+{
+	uint64_t block;
+
+	if (cache->shard_cnt == 1)
+		return cache->shards;
+
+	block = ((uintptr_t) iov->iov_base) >> OFI_MR_CACHE_SHARD_SHIFT;
+	if (block != (((uintptr_t) ofi_iov_end(iov)) >>
+		      OFI_MR_CACHE_SHARD_SHIFT))
+		return util_mr_span_shard(cache);
+
+	return &cache->shards[((block * 0x9E3779B97F4A7C15ULL) >> 32) &
+			      (cache->shard_cnt - 2)];
+}
+
+/*
+ * A region within one block may be covered by a cached region that
+ * crosses into the block, which only the span shard holds.  Called with
+ * the lock of the block's shard held: span shard locks are taken last.
+ */
+static struct ofi_mr_entry *
+util_mr_cache_find_span(struct ofi_mr_cache *cache, struct ofi_mr_info *info)
+{
+	struct ofi_mr_cache_shard *span;
+	struct ofi_mr_entry *entry;
+
+	if (cache->shard_cnt == 1)
+		return NULL;
+
+	span = util_mr_span_shard(cache);
+	pthread_mutex_lock(&span->lock);
+	entry = span->storage.find(&span->storage, info);
+	if (entry && ofi_iov_within(&info->iov, &entry->info.iov)) {
+		span->hit_cnt++;
+		if (entry->use_cnt++ == 0)
+			dlist_remove_init(&entry->lru_entry);
+	} else {
+		entry = NULL;
+	}
+	pthread_mutex_unlock(&span->lock);
+	return entry;
+}
+
+static void util_mr_release_entry(struct ofi_mr_cache *cache,
+				  struct ofi_mr_entry *entry)
 {
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "free %p (len: %" PRIu64 ")\n",
 	       entry->info.iov.iov_base, entry->info.iov.iov_len);
 
-	assert(!entry->storage_context);
 	cache->delete_region(cache, entry);
 	ofi_buf_free(entry);
 }
 
-static void util_mr_uncache_entry_storage(struct ofi_mr_cache *cache,
+/* Returns true if the queue has grown past the size of the cache */
+static bool util_mr_reclaim_queue(struct ofi_mr_cache *cache,
+				  struct ofi_mr_entry *entry)
+{
+	bool full;
+
+	pthread_mutex_lock(&cache->reclaim_lock);
+	if (dlist_empty(&cache->reclaim_list))
+		pthread_cond_signal(&cache->reclaim_cond);
+	dlist_insert_tail(&entry->lru_entry, &cache->reclaim_list);
+	if (++cache->reclaim_pending > cache->reclaim_pending_max)
+		cache->reclaim_pending_max = cache->reclaim_pending;
+	full = cache->reclaim_pending >
+	       cache_params.max_cnt / MAX(cache->share_cnt, 1);
+	pthread_mutex_unlock(&cache->reclaim_lock);
+	return full;
+}
+
+static void util_mr_reclaim_wake(struct ofi_mr_cache *cache)
+{
+	pthread_mutex_lock(&cache->reclaim_lock);
+	if (!cache->reclaim_evict) {
+		cache->reclaim_evict = 1;
+		pthread_cond_signal(&cache->reclaim_cond);
+	}
+	pthread_mutex_unlock(&cache->reclaim_lock);
+}
+
+/* Deregisters all queued regions, returns the number released */
+static size_t util_mr_reclaim_drain(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_entry *entry;
+	struct dlist_entry list;
+	size_t cnt = 0;
+
+	dlist_init(&list);
+	pthread_mutex_lock(&cache->reclaim_lock);
+	dlist_splice_tail(&list, &cache->reclaim_list);
+	pthread_mutex_unlock(&cache->reclaim_lock);
+
+	while (!dlist_empty(&list)) {
+		dlist_pop_front(&list, struct ofi_mr_entry, entry, lru_entry);
+		util_mr_release_entry(cache, entry);
+		cnt++;
+	}
+
+	if (cnt) {
+		pthread_mutex_lock(&cache->reclaim_lock);
+		cache->reclaim_pending -= cnt;
+		cache->reclaim_released += cnt;
+		pthread_mutex_unlock(&cache->reclaim_lock);
+	}
+	return cnt;
+}
+
+/* If the reclaim thread falls behind, the caller helps drain the queue
+ * to bound the number of registrations held by queued regions.
+ */
+static void util_mr_free_entry(struct ofi_mr_cache_shard *shard,
+			       struct ofi_mr_entry *entry)
+{
+	assert(!entry->storage_context);
+	if (!shard->cache->reclaim)
+		util_mr_release_entry(shard->cache, entry);
+	else if (util_mr_reclaim_queue(shard->cache, entry))
+		util_mr_reclaim_drain(shard->cache);
+}
+
+static void util_mr_uncache_entry_storage(struct ofi_mr_cache_shard *shard,
 					  struct ofi_mr_entry *entry)
 {
 	/* Without subscription context, we might unsubscribe from
@@ -91,92 +213,435 @@ static void util_mr_uncache_entry_storage(struct ofi_mr_cache *cache,
 	 * notification events, but is harmless to correct operation.
 	 */
 
-	cache->storage.erase(&cache->storage, entry);
-	cache->cached_cnt--;
-	cache->cached_size -= entry->info.iov.iov_len;
+	shard->storage.erase(&shard->storage, entry);
+	shard->cached_cnt--;
+	shard->cached_size -= entry->info.iov.iov_len;
 }
 
-static void util_mr_uncache_entry(struct ofi_mr_cache *cache,
+static void util_mr_uncache_entry(struct ofi_mr_cache_shard *shard,
 				  struct ofi_mr_entry *entry)
 {
-	util_mr_uncache_entry_storage(cache, entry);
+	util_mr_uncache_entry_storage(shard, entry);
 
 	if (entry->use_cnt == 0) {
 		dlist_remove_init(&entry->lru_entry);
-		util_mr_free_entry(cache, entry);
+		util_mr_free_entry(shard, entry);
 	} else {
-		cache->uncached_cnt++;
-		cache->uncached_size += entry->info.iov.iov_len;
+		shard->uncached_cnt++;
+		shard->uncached_size += entry->info.iov.iov_len;
 	}
 }
 
-/* Caller must hold ofi_mem_monitor lock as well as unsubscribe from the region */
-void ofi_mr_cache_notify(struct ofi_mr_cache *cache, const void *addr, size_t len)
+/* A region may overlap a range without starting in one of its blocks, so
+ * every shard is checked.  Caller must not hold a shard lock.
+ */
+static void util_mr_cache_invalidate(struct ofi_mr_cache *cache,
+				     const struct iovec *iov, size_t cnt)
 {
+	struct ofi_mr_cache_shard *shard;
 	struct ofi_mr_entry *entry;
+	size_t i, j;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		for (j = 0; j < cnt; j++) {
+			for (entry = shard->storage.overlap(&shard->storage,
+							    &iov[j]); entry;
+			     entry = shard->storage.overlap(&shard->storage,
+							    &iov[j]))
+				util_mr_uncache_entry(shard, entry);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/* Caller must hold ofi_mem_monitor lock.  Returns false if the queue is full. */
+static bool util_mr_notify_push(struct ofi_mr_notify_queue *queue,
+				uintptr_t start, uintptr_t end)
+{
+	struct ofi_mr_notify_range *range;
+	int64_t head, tail;
+
+	head = ofi_atomic_get64(&queue->head);
+	tail = ofi_atomic_get64(&queue->tail);
+	if (tail != head) {
+		range = &queue->ranges[(tail - 1) & (queue->size - 1)];
+		if (ofi_atomic_cas_bool32(&range->state, OFI_MR_NOTIFY_READY,
+					  OFI_MR_NOTIFY_BUSY)) {
+			if (start <= range->end && end >= range->start) {
+				range->start = MIN(range->start, start);
+				range->end = MAX(range->end, end);
+				ofi_atomic_set32(&range->state,
+						 OFI_MR_NOTIFY_READY);
+				queue->coalesce_cnt++;
+				return true;
+			}
+			ofi_atomic_set32(&range->state, OFI_MR_NOTIFY_READY);
+		}
+	}
+
+	if ((size_t) (tail - head) == queue->size)
+		return false;
+
+	range = &queue->ranges[tail & (queue->size - 1)];
+	range->start = start;
+	range->end = end;
+	ofi_atomic_set32(&range->state, OFI_MR_NOTIFY_READY);
+	ofi_atomic_set64(&queue->tail, tail + 1);
+	return true;
+}
+
+static int util_mr_range_cmp(const void *a, const void *b)
+{
+	const struct iovec *x = a, *y = b;
+
+	return (x->iov_base > y->iov_base) - (x->iov_base < y->iov_base);
+}
+
+/* Sorts the ranges and combines overlapping and adjacent ones */
+static size_t util_mr_merge_ranges(struct iovec *iov, size_t cnt)
+{
+	uintptr_t end;
+	size_t i, n;
+
+	if (!cnt)
+		return 0;
+
+	qsort(iov, cnt, sizeof(*iov), util_mr_range_cmp);
+	for (i = 1, n = 0; i < cnt; i++) {
+		end = (uintptr_t) iov[n].iov_base + iov[n].iov_len;
+		if ((uintptr_t) iov[i].iov_base <= end) {
+			iov[n].iov_len = MAX(end, (uintptr_t) iov[i].iov_base +
+					     iov[i].iov_len) -
+					 (uintptr_t) iov[n].iov_base;
+		} else {
+			iov[++n] = iov[i];
+		}
+	}
+	return n + 1;
+}
+
+/* Applies all queued invalidations.  Caller must not hold a shard lock. */
+static void util_mr_notify_drain(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_notify_queue *queue = &cache->notify_queue;
+	struct ofi_mr_notify_range *range;
+	struct iovec iov[OFI_MR_NOTIFY_BATCH];
+	int64_t head;
+	size_t cnt;
+
+	if (!queue->size || ofi_atomic_get64(&queue->head) ==
+			    ofi_atomic_get64(&queue->tail))
+		return;
+
+	pthread_mutex_lock(&queue->drain_lock);
+	head = ofi_atomic_get64(&queue->head);
+	while (head != ofi_atomic_get64(&queue->tail)) {
+		for (cnt = 0; cnt < OFI_MR_NOTIFY_BATCH &&
+			      head != ofi_atomic_get64(&queue->tail); cnt++) {
+			range = &queue->ranges[head & (queue->size - 1)];
+			/* wait for the producer to finish extending the range */
+			while (!ofi_atomic_cas_bool32(&range->state,
+						      OFI_MR_NOTIFY_READY,
+						      OFI_MR_NOTIFY_TAKEN))
+				;
+			iov[cnt].iov_base = (void *) range->start;
+			iov[cnt].iov_len = range->end - range->start;
+			ofi_atomic_set64(&queue->head, ++head);
+		}
+
+		cnt = util_mr_merge_ranges(iov, cnt);
+		util_mr_cache_invalidate(cache, iov, cnt);
+		queue->drain_cnt++;
+		queue->range_cnt += cnt;
+	}
+	pthread_mutex_unlock(&queue->drain_lock);
+}
+
+static int util_mr_notify_init(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_notify_queue *queue = &cache->notify_queue;
+	size_t i, size;
+
+	memset(queue, 0, sizeof(*queue));
+	if (!cache_params.notify_queue)
+		return 0;
+
+	size = roundup_power_of_two(cache_params.notify_queue);
+	queue->ranges = calloc(size, sizeof(*queue->ranges));
+	if (!queue->ranges)
+		return -FI_ENOMEM;
+
+	queue->size = size;
+	for (i = 0; i < queue->size; i++)
+		ofi_atomic_initialize32(&queue->ranges[i].state,
+					OFI_MR_NOTIFY_TAKEN);
+	ofi_atomic_initialize64(&queue->head, 0);
+	ofi_atomic_initialize64(&queue->tail, 0);
+	pthread_mutex_init(&queue->drain_lock, NULL);
+	return 0;
+}
+
+static void util_mr_notify_cleanup(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_notify_queue *queue = &cache->notify_queue;
+
+	if (!queue->size)
+		return;
+
+	pthread_mutex_destroy(&queue->drain_lock);
+	free(queue->ranges);
+	queue->ranges = NULL;
+	queue->size = 0;
+}
+
+/* Caller must hold ofi_mem_monitor lock as well as unsubscribe from the region.
+ * If the cache has a notify queue, the range is invalidated by the next search.
+ */
+void ofi_mr_cache_notify(struct ofi_mr_cache *cache, const void *addr, size_t len)
+{
 	struct iovec iov;
 
 	cache->notify_cnt++;
+	if (cache->notify_queue.size) {
+		if (util_mr_notify_push(&cache->notify_queue, (uintptr_t) addr,
+					(uintptr_t) addr + len))
+			return;
+		cache->notify_queue.overflow_cnt++;
+	}
+
 	iov.iov_base = (void *) addr;
 	iov.iov_len = len;
-
-	for (entry = cache->storage.overlap(&cache->storage, &iov); entry;
-	     entry = cache->storage.overlap(&cache->storage, &iov))
-		util_mr_uncache_entry(cache, entry);
+	util_mr_cache_invalidate(cache, &iov, 1);
 }
 
-static bool mr_cache_flush(struct ofi_mr_cache *cache)
+static bool mr_cache_flush(struct ofi_mr_cache_shard *shard)
 {
 	struct ofi_mr_entry *entry;
 
-	if (dlist_empty(&cache->lru_list))
+	if (dlist_empty(&shard->lru_list))
 		return false;
 
-	dlist_pop_front(&cache->lru_list, struct ofi_mr_entry,
+	dlist_pop_front(&shard->lru_list, struct ofi_mr_entry,
 			entry, lru_entry);
 	dlist_init(&entry->lru_entry);
-	FI_DBG(cache->domain->prov, FI_LOG_MR, "flush %p (len: %" PRIu64 ")\n",
+	FI_DBG(shard->cache->domain->prov, FI_LOG_MR,
+	       "flush %p (len: %" PRIu64 ")\n",
 	       entry->info.iov.iov_base, entry->info.iov.iov_len);
 
-	util_mr_uncache_entry_storage(cache, entry);
-	util_mr_free_entry(cache, entry);
+	util_mr_uncache_entry_storage(shard, entry);
+	util_mr_free_entry(shard, entry);
+	shard->evict_cnt++;
 	return true;
 }
 
-bool ofi_mr_cache_flush(struct ofi_mr_cache *cache)
+/* Caller must hold the shard lock.  Other shards are only try-locked, since
+ * ofi_mr_cache_notify acquires shard locks in a fixed order.
+ */
+static bool mr_cache_flush_any(struct ofi_mr_cache_shard *shard)
+{
+	struct ofi_mr_cache *cache = shard->cache;
+	struct ofi_mr_cache_shard *other;
+	bool flushed;
+	size_t i;
+
+	if (mr_cache_flush(shard))
+		return true;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		other = &cache->shards[i];
+		if (other == shard || pthread_mutex_trylock(&other->lock))
+			continue;
+
+		flushed = mr_cache_flush(other);
+		pthread_mutex_unlock(&other->lock);
+		if (flushed)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Waits until as many regions as are queued now have been deregistered.
+ * Another thread, e.g. the reclaim thread, may already have taken them
+ * off the list, so draining the list alone is not enough.  Returns false
+ * if nothing was queued.
+ */
+static bool util_mr_reclaim_wait(struct ofi_mr_cache *cache)
+{
+	size_t target;
+	bool done;
+
+	pthread_mutex_lock(&cache->reclaim_lock);
+	if (!cache->reclaim_pending) {
+		pthread_mutex_unlock(&cache->reclaim_lock);
+		return false;
+	}
+	target = cache->reclaim_released + cache->reclaim_pending;
+	pthread_mutex_unlock(&cache->reclaim_lock);
+
+	do {
+		if (!util_mr_reclaim_drain(cache))
+			sched_yield();
+
+		pthread_mutex_lock(&cache->reclaim_lock);
+		done = cache->reclaim_released >= target;
+		pthread_mutex_unlock(&cache->reclaim_lock);
+	} while (!done);
+	return true;
+}
+
+/* Frees provider resources so that a failed add_region can be retried */
+static bool mr_cache_release(struct ofi_mr_cache_shard *shard)
 {
-	bool empty;
+	struct ofi_mr_cache *cache = shard->cache;
+
+	if (!cache->reclaim)
+		return mr_cache_flush_any(shard);
+
+	if (util_mr_reclaim_wait(cache))
+		return true;
 
-	pthread_mutex_lock(&cache->monitor->lock);
-	empty = mr_cache_flush(cache);
-	pthread_mutex_unlock(&cache->monitor->lock);
-	return empty;
+	return mr_cache_flush_any(shard) && util_mr_reclaim_wait(cache);
+}
+
+static bool mr_cache_above_low(struct ofi_mr_cache_shard *shard)
+{
+	return (shard->cached_cnt > shard->low_cnt) ||
+	       (shard->cached_size > shard->low_size);
+}
+
+static void util_mr_cache_trim(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		while (mr_cache_above_low(shard) && mr_cache_flush(shard))
+			;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+static void *util_mr_reclaim_handler(void *arg)
+{
+	struct ofi_mr_cache *cache = arg;
+
+	pthread_mutex_lock(&cache->reclaim_lock);
+	while (!cache->reclaim_stop) {
+		if (dlist_empty(&cache->reclaim_list) && !cache->reclaim_evict) {
+			fi_wait_cond(&cache->reclaim_cond,
+				     &cache->reclaim_lock, -1);
+			continue;
+		}
+
+		cache->reclaim_evict = 0;
+		pthread_mutex_unlock(&cache->reclaim_lock);
+
+		util_mr_notify_drain(cache);
+		util_mr_cache_trim(cache);
+		util_mr_reclaim_drain(cache);
+
+		pthread_mutex_lock(&cache->reclaim_lock);
+	}
+	pthread_mutex_unlock(&cache->reclaim_lock);
+
+	util_mr_reclaim_drain(cache);
+	return NULL;
+}
+
+static int util_mr_reclaim_start(struct ofi_mr_cache *cache)
+{
+	int ret;
+
+	cache->reclaim_stop = 0;
+	cache->reclaim_evict = 0;
+	cache->reclaim_released = 0;
+	cache->reclaim_pending = 0;
+	cache->reclaim_pending_max = 0;
+	dlist_init(&cache->reclaim_list);
+	pthread_mutex_init(&cache->reclaim_lock, NULL);
+	pthread_cond_init(&cache->reclaim_cond, NULL);
+
+	cache->reclaim = 1;
+	ret = pthread_create(&cache->reclaim_thread, NULL,
+			     util_mr_reclaim_handler, cache);
+	if (ret) {
+		FI_WARN(cache->domain->prov, FI_LOG_MR,
+			"failed to create reclaim thread %s\n", strerror(ret));
+		cache->reclaim = 0;
+		pthread_cond_destroy(&cache->reclaim_cond);
+		pthread_mutex_destroy(&cache->reclaim_lock);
+		return -ret;
+	}
+	return 0;
+}
+
+/* The reclaim thread releases all queued regions before it exits */
+static void util_mr_reclaim_stop(struct ofi_mr_cache *cache)
+{
+	pthread_mutex_lock(&cache->reclaim_lock);
+	cache->reclaim_stop = 1;
+	pthread_cond_signal(&cache->reclaim_cond);
+	pthread_mutex_unlock(&cache->reclaim_lock);
+
+	pthread_join(cache->reclaim_thread, NULL);
+	assert(dlist_empty(&cache->reclaim_list));
+	assert(!cache->reclaim_pending);
+}
+
+static void util_mr_reclaim_cleanup(struct ofi_mr_cache *cache)
+{
+	pthread_cond_destroy(&cache->reclaim_cond);
+	pthread_mutex_destroy(&cache->reclaim_lock);
+	cache->reclaim = 0;
+}
+
+bool ofi_mr_cache_flush(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_cache_shard *shard;
+	bool flushed = false;
+	size_t i;
+
+	for (i = 0; i < cache->shard_cnt && !flushed; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		flushed = mr_cache_flush(shard);
+		pthread_mutex_unlock(&shard->lock);
+	}
+	return flushed;
 }
 
 void ofi_mr_cache_delete(struct ofi_mr_cache *cache, struct ofi_mr_entry *entry)
 {
+	struct ofi_mr_cache_shard *shard = entry->shard;
+
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "delete %p (len: %" PRIu64 ")\n",
 	       entry->info.iov.iov_base, entry->info.iov.iov_len);
 
-	pthread_mutex_lock(&cache->monitor->lock);
-	cache->delete_cnt++;
+	pthread_mutex_lock(&shard->lock);
+	shard->delete_cnt++;
 
 	if (--entry->use_cnt == 0) {
 		if (entry->storage_context) {
-			dlist_insert_tail(&entry->lru_entry, &cache->lru_list);
+			dlist_insert_tail(&entry->lru_entry, &shard->lru_list);
 		} else {
-			cache->uncached_cnt--;
-			cache->uncached_size -= entry->info.iov.iov_len;
-			util_mr_free_entry(cache, entry);
+			shard->uncached_cnt--;
+			shard->uncached_size -= entry->info.iov.iov_len;
+			util_mr_free_entry(shard, entry);
 		}
 	}
-	pthread_mutex_unlock(&cache->monitor->lock);
+	pthread_mutex_unlock(&shard->lock);
 }
 
 static int
-util_mr_cache_create(struct ofi_mr_cache *cache, const struct iovec *iov,
+util_mr_cache_create(struct ofi_mr_cache_shard *shard, const struct iovec *iov,
 		     uint64_t access, struct ofi_mr_entry **entry)
 {
+	struct ofi_mr_cache *cache = shard->cache;
 	int ret;
 
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "create %p (len: %" PRIu64 ")\n",
@@ -186,39 +651,40 @@ util_mr_cache_create(struct ofi_mr_cache *cache, const struct iovec *iov,
 	if (OFI_UNLIKELY(!*entry))
 		return -FI_ENOMEM;
 
+	(*entry)->shard = shard;
 	(*entry)->storage_context = NULL;
 	(*entry)->info.iov = *iov;
 	(*entry)->use_cnt = 1;
 
 	ret = cache->add_region(cache, *entry);
 	if (ret) {
-		while (ret && mr_cache_flush(cache)) {
+		while (ret && mr_cache_release(shard)) {
 			ret = cache->add_region(cache, *entry);
 		}
 		if (ret) {
-			assert(!mr_cache_flush(cache));
+			assert(!mr_cache_flush(shard));
 			ofi_buf_free(*entry);
 			return ret;
 		}
 	}
 
-	if ((cache->cached_cnt >= cache_params.max_cnt) ||
-	    (cache->cached_size >= cache_params.max_size)) {
-		cache->uncached_cnt++;
-		cache->uncached_size += iov->iov_len;
+	if ((shard->cached_cnt >= shard->max_cnt) ||
+	    (shard->cached_size >= shard->max_size)) {
+		shard->uncached_cnt++;
+		shard->uncached_size += iov->iov_len;
 	} else {
-		if (cache->storage.insert(&cache->storage,
+		if (shard->storage.insert(&shard->storage,
 					  &(*entry)->info, *entry)) {
 			ret = -FI_ENOMEM;
 			goto err;
 		}
-		cache->cached_cnt++;
-		cache->cached_size += iov->iov_len;
+		shard->cached_cnt++;
+		shard->cached_size += iov->iov_len;
 
 		ret = ofi_monitor_subscribe(cache->monitor, iov->iov_base,
 					    iov->iov_len);
 		if (ret)
-			util_mr_uncache_entry(cache, *entry);
+			util_mr_uncache_entry(shard, *entry);
 		else
 			(*entry)->subscribed = 1;
 	}
@@ -226,19 +692,20 @@ util_mr_cache_create(struct ofi_mr_cache *cache, const struct iovec *iov,
 	return 0;
 
 err:
-	util_mr_free_entry(cache, *entry);
+	util_mr_free_entry(shard, *entry);
 	return ret;
 }
 
 static int
-util_mr_cache_merge(struct ofi_mr_cache *cache, const struct fi_mr_attr *attr,
+util_mr_cache_merge(struct ofi_mr_cache_shard *shard,
+		    const struct fi_mr_attr *attr,
 		    struct ofi_mr_entry *old_entry, struct ofi_mr_entry **entry)
 {
 	struct ofi_mr_info info, *old_info;
 
 	info.iov = *attr->mr_iov;
 	do {
-		FI_DBG(cache->domain->prov, FI_LOG_MR,
+		FI_DBG(shard->cache->domain->prov, FI_LOG_MR,
 		       "merging %p (len: %" PRIu64 ") with %p (len: %" PRIu64 ")\n",
 		       info.iov.iov_base, info.iov.iov_len,
 		       old_entry->info.iov.iov_base, old_entry->info.iov.iov_len);
@@ -248,22 +715,24 @@ util_mr_cache_merge(struct ofi_mr_cache *cache, const struct fi_mr_attr *attr,
 			MAX(ofi_iov_end(&info.iov), ofi_iov_end(&old_info->iov))) + 1 -
 			((uintptr_t) MIN(info.iov.iov_base, old_info->iov.iov_base));
 		info.iov.iov_base = MIN(info.iov.iov_base, old_info->iov.iov_base);
-		FI_DBG(cache->domain->prov, FI_LOG_MR, "merged %p (len: %" PRIu64 ")\n",
+		FI_DBG(shard->cache->domain->prov, FI_LOG_MR,
+		       "merged %p (len: %" PRIu64 ")\n",
 		       info.iov.iov_base, info.iov.iov_len);
 
 		/* New entry will expand range of subscription */
 		old_entry->subscribed = 0;
 
-		util_mr_uncache_entry(cache, old_entry);
+		util_mr_uncache_entry(shard, old_entry);
 
-	} while ((old_entry = cache->storage.find(&cache->storage, &info)));
+	} while ((old_entry = shard->storage.find(&shard->storage, &info)));
 
-	return util_mr_cache_create(cache, &info.iov, attr->access, entry);
+	return util_mr_cache_create(shard, &info.iov, attr->access, entry);
 }
 
 int ofi_mr_cache_search(struct ofi_mr_cache *cache, const struct fi_mr_attr *attr,
 			struct ofi_mr_entry **entry)
 {
+	struct ofi_mr_cache_shard *shard;
 	struct ofi_mr_info info;
 	int ret = 0;
 
@@ -271,19 +740,29 @@ int ofi_mr_cache_search(struct ofi_mr_cache *cache, const struct fi_mr_attr *att
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "search %p (len: %" PRIu64 ")\n",
 	       attr->mr_iov->iov_base, attr->mr_iov->iov_len);
 
-	pthread_mutex_lock(&cache->monitor->lock);
-	cache->search_cnt++;
+	util_mr_notify_drain(cache);
+	shard = util_mr_cache_shard(cache, attr->mr_iov);
+	pthread_mutex_lock(&shard->lock);
+	shard->search_cnt++;
 
-	while (((cache->cached_cnt >= cache_params.max_cnt) ||
-		(cache->cached_size >= cache_params.max_size)) &&
-	       mr_cache_flush(cache))
-		;
+	if (cache->reclaim) {
+		if (mr_cache_above_low(shard) && !dlist_empty(&shard->lru_list))
+			util_mr_reclaim_wake(cache);
+	} else {
+		while (((shard->cached_cnt >= shard->max_cnt) ||
+			(shard->cached_size >= shard->max_size)) &&
+		       mr_cache_flush(shard))
+			;
+	}
 
 	info.iov = *attr->mr_iov;
-	*entry = cache->storage.find(&cache->storage, &info);
+	*entry = shard->storage.find(&shard->storage, &info);
 	if (!*entry) {
-		ret = util_mr_cache_create(cache, attr->mr_iov,
-					   attr->access, entry);
+		if (shard != util_mr_span_shard(cache))
+			*entry = util_mr_cache_find_span(cache, &info);
+		if (!*entry)
+			ret = util_mr_cache_create(shard, attr->mr_iov,
+						   attr->access, entry);
 		goto unlock;
 	}
 
@@ -292,22 +771,23 @@ int ofi_mr_cache_search(struct ofi_mr_cache *cache, const struct fi_mr_attr *att
 	 * find function (util_mr_find_within) would match the enclosed region.
 	 */
 	if (!ofi_iov_within(attr->mr_iov, &(*entry)->info.iov)) {
-		ret = util_mr_cache_merge(cache, attr, *entry, entry);
+		ret = util_mr_cache_merge(shard, attr, *entry, entry);
 		goto unlock;
 	}
 
-	cache->hit_cnt++;
+	shard->hit_cnt++;
 	if ((*entry)->use_cnt++ == 0)
 		dlist_remove_init(&(*entry)->lru_entry);
 
 unlock:
-	pthread_mutex_unlock(&cache->monitor->lock);
+	pthread_mutex_unlock(&shard->lock);
 	return ret;
 }
 
 struct ofi_mr_entry *ofi_mr_cache_find(struct ofi_mr_cache *cache,
 				       const struct fi_mr_attr *attr)
 {
+	struct ofi_mr_cache_shard *shard;
 	struct ofi_mr_info info;
 	struct ofi_mr_entry *entry;
 
@@ -315,12 +795,16 @@ struct ofi_mr_entry *ofi_mr_cache_find(struct ofi_mr_cache *cache,
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "find %p (len: %" PRIu64 ")\n",
 	       attr->mr_iov->iov_base, attr->mr_iov->iov_len);
 
-	pthread_mutex_lock(&cache->monitor->lock);
-	cache->search_cnt++;
+	util_mr_notify_drain(cache);
+	shard = util_mr_cache_shard(cache, attr->mr_iov);
+	pthread_mutex_lock(&shard->lock);
+	shard->search_cnt++;
 
 	info.iov = *attr->mr_iov;
-	entry = cache->storage.find(&cache->storage, &info);
+	entry = shard->storage.find(&shard->storage, &info);
 	if (!entry) {
+		if (shard != util_mr_span_shard(cache))
+			entry = util_mr_cache_find_span(cache, &info);
 		goto unlock;
 	}
 
@@ -329,37 +813,40 @@ struct ofi_mr_entry *ofi_mr_cache_find(struct ofi_mr_cache *cache,
 		goto unlock;
 	}
 
-	cache->hit_cnt++;
+	shard->hit_cnt++;
 	if ((entry)->use_cnt++ == 0)
 		dlist_remove_init(&(entry)->lru_entry);
 
 unlock:
-	pthread_mutex_unlock(&cache->monitor->lock);
+	pthread_mutex_unlock(&shard->lock);
 	return entry;
 }
 
 int ofi_mr_cache_reg(struct ofi_mr_cache *cache, const struct fi_mr_attr *attr,
 		     struct ofi_mr_entry **entry)
 {
+	struct ofi_mr_cache_shard *shard;
 	int ret;
 
 	assert(attr->iov_count == 1);
 	FI_DBG(cache->domain->prov, FI_LOG_MR, "reg %p (len: %" PRIu64 ")\n",
 	       attr->mr_iov->iov_base, attr->mr_iov->iov_len);
 
-	pthread_mutex_lock(&cache->monitor->lock);
+	shard = util_mr_cache_shard(cache, attr->mr_iov);
+	pthread_mutex_lock(&shard->lock);
 	*entry = ofi_buf_alloc(cache->entry_pool);
 	if (*entry) {
-		cache->uncached_cnt++;
-		cache->uncached_size += attr->mr_iov->iov_len;
+		shard->uncached_cnt++;
+		shard->uncached_size += attr->mr_iov->iov_len;
 	} else {
 		ret = -FI_ENOMEM;
 		goto unlock;
 	}
-	pthread_mutex_unlock(&cache->monitor->lock);
+	pthread_mutex_unlock(&shard->lock);
 
 	(*entry)->info.iov = *attr->mr_iov;
 	(*entry)->use_cnt = 1;
+	(*entry)->shard = shard;
 	(*entry)->storage_context = NULL;
 
 	ret = cache->add_region(cache, *entry);
@@ -369,39 +856,121 @@ int ofi_mr_cache_reg(struct ofi_mr_cache *cache, const struct fi_mr_attr *attr,
 	return 0;
 
 buf_free:
-	pthread_mutex_lock(&cache->monitor->lock);
+	pthread_mutex_lock(&shard->lock);
 	ofi_buf_free(*entry);
-	cache->uncached_cnt--;
-	cache->uncached_size -= attr->mr_iov->iov_len;
+	shard->uncached_cnt--;
+	shard->uncached_size -= attr->mr_iov->iov_len;
 unlock:
-	pthread_mutex_unlock(&cache->monitor->lock);
+	pthread_mutex_unlock(&shard->lock);
 	return ret;
 }
 
+void ofi_mr_cache_stats(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_cache_shard *shard;
+	size_t i;
+
+	cache->cached_cnt = 0;
+	cache->cached_size = 0;
+	cache->uncached_cnt = 0;
+	cache->uncached_size = 0;
+	cache->search_cnt = 0;
+	cache->delete_cnt = 0;
+	cache->hit_cnt = 0;
+	cache->evict_cnt = 0;
+	cache->reclaim_cnt = 0;
+	cache->reclaim_queue_cnt = 0;
+	cache->reclaim_queue_max = 0;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		cache->cached_cnt += shard->cached_cnt;
+		cache->cached_size += shard->cached_size;
+		cache->uncached_cnt += shard->uncached_cnt;
+		cache->uncached_size += shard->uncached_size;
+		cache->search_cnt += shard->search_cnt;
+		cache->delete_cnt += shard->delete_cnt;
+		cache->hit_cnt += shard->hit_cnt;
+		cache->evict_cnt += shard->evict_cnt;
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	if (cache->reclaim) {
+		pthread_mutex_lock(&cache->reclaim_lock);
+		cache->reclaim_cnt = cache->reclaim_released;
+		cache->reclaim_queue_cnt = cache->reclaim_pending;
+		cache->reclaim_queue_max = cache->reclaim_pending_max;
+		pthread_mutex_unlock(&cache->reclaim_lock);
+	}
+}
+
+static void ofi_mr_cache_cleanup_shards(struct ofi_mr_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		cache->shards[i].storage.destroy(&cache->shards[i].storage);
+		pthread_mutex_destroy(&cache->shards[i].lock);
+	}
+	free(cache->shards);
+	cache->shards = NULL;
+}
+
 void ofi_mr_cache_cleanup(struct ofi_mr_cache *cache)
 {
+	struct ofi_mr_cache_shard *shard;
 	struct ofi_mr_entry *entry;
 	struct dlist_entry *tmp;
+	size_t i;
 
 	/* If we don't have a domain, initialization failed */
 	if (!cache->domain)
 		return;
 
+	/* Stop invalidations before the reclaim thread goes away */
+	ofi_monitor_del_cache(cache);
+
+	ofi_mr_cache_stats(cache);
 	FI_INFO(cache->domain->prov, FI_LOG_MR, "MR cache stats: "
-		"searches %zu, deletes %zu, hits %zu notify %zu\n",
+		"searches %zu, deletes %zu, hits %zu, misses %zu, notify %zu, "
+		"evictions %zu, shards %zu\n",
 		cache->search_cnt, cache->delete_cnt, cache->hit_cnt,
-		cache->notify_cnt);
+		cache->search_cnt - cache->hit_cnt, cache->notify_cnt,
+		cache->evict_cnt, cache->shard_cnt);
+	if (cache->notify_queue.size) {
+		FI_INFO(cache->domain->prov, FI_LOG_MR, "MR cache notify queue "
+			"stats: coalesced %zu, overflows %zu, batches %zu, "
+			"ranges %zu\n", cache->notify_queue.coalesce_cnt,
+			cache->notify_queue.overflow_cnt,
+			cache->notify_queue.drain_cnt,
+			cache->notify_queue.range_cnt);
+	}
 
-	pthread_mutex_lock(&cache->monitor->lock);
-	dlist_foreach_container_safe(&cache->lru_list, struct ofi_mr_entry,
-				     entry, lru_entry, tmp) {
-		assert(entry->use_cnt == 0);
-		util_mr_uncache_entry(cache, entry);
+	for (i = 0; i < cache->shard_cnt; i++) {
+		shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->lock);
+		dlist_foreach_container_safe(&shard->lru_list,
+					     struct ofi_mr_entry,
+					     entry, lru_entry, tmp) {
+			assert(entry->use_cnt == 0);
+			util_mr_uncache_entry(shard, entry);
+		}
+		pthread_mutex_unlock(&shard->lock);
 	}
-	pthread_mutex_unlock(&cache->monitor->lock);
 
-	ofi_monitor_del_cache(cache);
-	cache->storage.destroy(&cache->storage);
+	if (cache->reclaim) {
+		util_mr_reclaim_stop(cache);
+		ofi_mr_cache_stats(cache);
+		FI_INFO(cache->domain->prov, FI_LOG_MR, "MR cache reclaim "
+			"stats: deregistered %zu, max queue depth %zu\n",
+			cache->reclaim_cnt, cache->reclaim_queue_max);
+		util_mr_reclaim_cleanup(cache);
+	}
+
+	util_mr_notify_cleanup(cache);
+	ofi_mr_cache_stats(cache);
+	ofi_mr_cache_cleanup_shards(cache);
 	ofi_atomic_dec32(&cache->domain->ref);
 	ofi_bufpool_destroy(cache->entry_pool);
 	assert(cache->cached_cnt == 0);
@@ -459,36 +1028,40 @@ static int ofi_mr_rbt_erase(struct ofi_mr_storage *storage,
 	return 0;
 }
 
-static int ofi_mr_cache_init_rbt(struct ofi_mr_cache *cache)
+static int ofi_mr_cache_init_rbt(struct ofi_mr_storage *storage)
 {
-	cache->storage.storage = ofi_rbmap_create(cache_params.merge_regions ?
-						  util_mr_find_overlap :
-						  util_mr_find_within);
-	if (!cache->storage.storage)
+	storage->storage = ofi_rbmap_create(cache_params.merge_regions ?
+					    util_mr_find_overlap :
+					    util_mr_find_within);
+	if (!storage->storage)
 		return -FI_ENOMEM;
 
-	cache->storage.overlap = ofi_mr_rbt_overlap;
-	cache->storage.destroy = ofi_mr_rbt_destroy;
-	cache->storage.find = ofi_mr_rbt_find;
-	cache->storage.insert = ofi_mr_rbt_insert;
-	cache->storage.erase = ofi_mr_rbt_erase;
+	storage->overlap = ofi_mr_rbt_overlap;
+	storage->destroy = ofi_mr_rbt_destroy;
+	storage->find = ofi_mr_rbt_find;
+	storage->insert = ofi_mr_rbt_insert;
+	storage->erase = ofi_mr_rbt_erase;
 	return 0;
 }
 
-static int ofi_mr_cache_init_storage(struct ofi_mr_cache *cache)
+static int ofi_mr_cache_init_storage(struct ofi_mr_cache *cache,
+				     struct ofi_mr_storage *storage)
 {
 	int ret;
 
 	switch (cache->storage.type) {
 	case OFI_MR_STORAGE_DEFAULT:
 	case OFI_MR_STORAGE_RBT:
-		ret = ofi_mr_cache_init_rbt(cache);
+		storage->type = cache->storage.type;
+		ret = ofi_mr_cache_init_rbt(storage);
 		break;
 	case OFI_MR_STORAGE_USER:
 		ret = (cache->storage.storage && cache->storage.overlap &&
 		      cache->storage.destroy && cache->storage.find &&
 		      cache->storage.insert && cache->storage.erase) ?
 			0 : -FI_EINVAL;
+		if (!ret)
+			*storage = cache->storage;
 		break;
 	default:
 		ret = -FI_EINVAL;
@@ -498,6 +1071,51 @@ static int ofi_mr_cache_init_storage(struct ofi_mr_cache *cache)
 	return ret;
 }
 
+/* User provided storage cannot be replicated, so it always has one shard */
+static int ofi_mr_cache_init_shards(struct ofi_mr_cache *cache)
+{
+	struct ofi_mr_cache_shard *shard;
+	size_t i, div;
+	int ret;
+
+	cache->shard_cnt = (cache->storage.type == OFI_MR_STORAGE_USER) ? 1 :
+			   roundup_power_of_two(MAX(cache_params.shard_cnt, 1));
+	if (cache->shard_cnt > 1)
+		cache->shard_cnt++;
+	div = cache->shard_cnt * MAX(cache->share_cnt, 1);
+	cache->shards = calloc(cache->shard_cnt, sizeof(*cache->shards));
+	if (!cache->shards)
+		return -FI_ENOMEM;
+
+	for (i = 0; i < cache->shard_cnt; i++) {
+		shard = &cache->shards[i];
+		ret = ofi_mr_cache_init_storage(cache, &shard->storage);
+		if (ret)
+			goto err;
+
+		pthread_mutex_init(&shard->lock, NULL);
+		dlist_init(&shard->lru_list);
+		shard->cache = cache;
+		shard->max_cnt = MAX(cache_params.max_cnt / div, 1);
+		shard->max_size = MAX(cache_params.max_size / div, 1);
+		shard->low_cnt = shard->max_cnt *
+				 MIN(cache_params.low_watermark, 100) / 100;
+		shard->low_size = shard->max_size / 100 *
+				  MIN(cache_params.low_watermark, 100);
+	}
+	return 0;
+
+err:
+	while (i--) {
+		shard = &cache->shards[i];
+		shard->storage.destroy(&shard->storage);
+		pthread_mutex_destroy(&shard->lock);
+	}
+	free(cache->shards);
+	cache->shards = NULL;
+	return ret;
+}
+
 int ofi_mr_cache_init(struct util_domain *domain,
 		      struct ofi_mem_monitor *monitor,
 		      struct ofi_mr_cache *cache)
@@ -508,7 +1126,6 @@ int ofi_mr_cache_init(struct util_domain *domain,
 	if (!cache_params.max_cnt || !cache_params.max_size)
 		return -FI_ENOSPC;
 
-	dlist_init(&cache->lru_list);
 	cache->cached_cnt = 0;
 	cache->cached_size = 0;
 	cache->uncached_cnt = 0;
@@ -517,29 +1134,54 @@ int ofi_mr_cache_init(struct util_domain *domain,
 	cache->delete_cnt = 0;
 	cache->hit_cnt = 0;
 	cache->notify_cnt = 0;
+	cache->evict_cnt = 0;
+	cache->reclaim = 0;
 	cache->domain = domain;
 	ofi_atomic_inc32(&domain->ref);
 
-	ret = ofi_mr_cache_init_storage(cache);
+	ret = ofi_mr_cache_init_shards(cache);
 	if (ret)
 		goto dec;
 
-	ret = ofi_monitor_add_cache(monitor, cache);
+	ret = util_mr_notify_init(cache);
 	if (ret)
 		goto destroy;
 
+	/* Entries of different shards are allocated under different locks,
+	 * and the reclaim thread frees them without a shard lock.
+	 */
 	ret = ofi_bufpool_create(&cache->entry_pool,
 				 sizeof(struct ofi_mr_entry) +
 				 cache->entry_data_size,
-				 16, 0, 0, 0);
+				 16, 0, 0, (cache->shard_cnt > 1 ||
+					    cache_params.reclaim) ?
+				 OFI_BUFPOOL_THREAD_SAFE : 0);
 	if (ret)
-		goto del;
+		goto notify;
+
+	/* Monitor notifications may arrive as soon as the cache is added */
+	if (cache_params.reclaim) {
+		ret = util_mr_reclaim_start(cache);
+		if (ret)
+			goto pool;
+	}
+
+	ret = ofi_monitor_add_cache(monitor, cache);
+	if (ret)
+		goto reclaim;
 
 	return 0;
-del:
-	ofi_monitor_del_cache(cache);
+reclaim:
+	if (cache->reclaim) {
+		util_mr_reclaim_stop(cache);
+		util_mr_reclaim_cleanup(cache);
+	}
+pool:
+	ofi_bufpool_destroy(cache->entry_pool);
+notify:
+	util_mr_notify_cleanup(cache);
 destroy:
-	cache->storage.destroy(&cache->storage);
+	ofi_mr_cache_cleanup_shards(cache);
 dec:
 	ofi_atomic_dec32(&cache->domain->ref);
 	cache->domain = NULL;
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Multi-threaded test of OFI_BUFPOOL_THREAD_SAFE pools.  Threads allocate
+ * bursts of buffers, free some of them and hand the rest to a neighbour,
+ * which frees them from its own magazines.  Every buffer carries a state
+ * word that is flipped on alloc and free, so that a buffer handed out
+ * twice, or freed twice, is caught.  The indexed pass also looks buffers
+ * up by index while other threads grow the region table.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <ofi.h>
+#include <ofi_mem.h>
+
+
+enum {
+	TEST_THREAD_CNT = 4,
+	TEST_ITER_CNT = 20000,
+	TEST_BURST = 48,
+	TEST_HANDOFF = 256,
+};
+
+enum {
+	TEST_BUF_FREE = 1,
+	TEST_BUF_USED,
+};
+
+struct test_buf {
+	ofi_atomic32_t		state;
+	uint32_t		owner;
+};
+
+struct test_handoff {
+	pthread_mutex_t		lock;
+	void			*bufs[TEST_HANDOFF];
+	size_t			cnt;
+};
+
+static struct ofi_bufpool *pool;
+static struct test_handoff handoff[TEST_THREAD_CNT];
+static ofi_atomic32_t errors;
+
+
+static void test_buf_init(struct ofi_bufpool_region *region, void *buf)
+{
+	ofi_atomic_initialize32(&((struct test_buf *) buf)->state,
+				TEST_BUF_FREE);
+}
+
+static void *test_alloc(uint32_t owner)
+{
+	struct test_buf *buf;
+
+	if (pool->attr.flags & OFI_BUFPOOL_INDEXED)
+		buf = ofi_ibuf_alloc(pool);
+	else
+		buf = ofi_buf_alloc(pool);
+	if (!buf) {
+		fprintf(stderr, "alloc failed\n");
+		ofi_atomic_inc32(&errors);
+		return NULL;
+	}
+
+	if (!ofi_atomic_cas_bool32(&buf->state, TEST_BUF_FREE,
+				   TEST_BUF_USED)) {
+		fprintf(stderr, "buffer %p allocated twice\n", (void *) buf);
+		ofi_atomic_inc32(&errors);
+	}
+	if ((pool->attr.flags & OFI_BUFPOOL_INDEXED) &&
+	    ofi_bufpool_get_ibuf(pool, ofi_buf_index(buf)) != buf) {
+		fprintf(stderr, "index %zu does not map to %p\n",
+			ofi_buf_index(buf), (void *) buf);
+		ofi_atomic_inc32(&errors);
+	}
+	buf->owner = owner;
+	return buf;
+}
+
+static void test_free(void *ptr)
+{
+	struct test_buf *buf = ptr;
+
+	if (!ofi_atomic_cas_bool32(&buf->state, TEST_BUF_USED,
+				   TEST_BUF_FREE)) {
+		fprintf(stderr, "buffer %p freed twice\n", ptr);
+		ofi_atomic_inc32(&errors);
+	}
+	if (pool->attr.flags & OFI_BUFPOOL_INDEXED)
+		ofi_ibuf_free(buf);
+	else
+		ofi_buf_free(buf);
+}
+
+static void test_drain(struct test_handoff *h)
+{
+	pthread_mutex_lock(&h->lock);
+	while (h->cnt)
+		test_free(h->bufs[--h->cnt]);
+	pthread_mutex_unlock(&h->lock);
+}
+
+static void *test_thread(void *arg)
+{
+	uint32_t id = (uint32_t) (uintptr_t) arg;
+	struct test_handoff *next = &handoff[(id + 1) % TEST_THREAD_CNT];
+	void *bufs[TEST_BURST];
+	size_t i, j, cnt;
+
+	for (i = 0; i < TEST_ITER_CNT; i++) {
+		cnt = 1 + (i * 7 + id) % TEST_BURST;
+		for (j = 0; j < cnt; j++) {
+			bufs[j] = test_alloc(id);
+			if (!bufs[j])
+				return NULL;
+		}
+
+		/* hand odd buffers to the next thread, free the rest here */
+		pthread_mutex_lock(&next->lock);
+		for (j = 1; j < cnt && next->cnt < TEST_HANDOFF; j += 2) {
+			next->bufs[next->cnt++] = bufs[j];
+			bufs[j] = NULL;
+		}
+		pthread_mutex_unlock(&next->lock);
+
+		for (j = 0; j < cnt; j++) {
+			if (bufs[j]) {
+				if (((struct test_buf *) bufs[j])->owner != id) {
+					fprintf(stderr, "buffer %p owner changed\n",
+						bufs[j]);
+					ofi_atomic_inc32(&errors);
+				}
+				test_free(bufs[j]);
+			}
+		}
+
+		test_drain(&handoff[id]);
+	}
+	return NULL;
+}
+
+static int test_pool(int flags)
+{
+	struct ofi_bufpool_attr attr = {
+		.size		= sizeof(struct test_buf),
+		.alignment	= 16,
+		.chunk_cnt	= 64,
+		.init_fn	= test_buf_init,
+		.flags		= OFI_BUFPOOL_THREAD_SAFE | flags,
+	};
+	struct ofi_bufpool_stats stats;
+	pthread_t thread[TEST_THREAD_CNT];
+	void *buf;
+	int i, ret;
+
+	ret = ofi_bufpool_create_attr(&attr, &pool);
+	if (ret) {
+		fprintf(stderr, "ofi_bufpool_create_attr: %d\n", ret);
+		return ret;
+	}
+
+	for (i = 0; i < TEST_THREAD_CNT; i++) {
+		ret = pthread_create(&thread[i], NULL, test_thread,
+				     (void *) (uintptr_t) i);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %d\n", ret);
+			exit(1);
+		}
+	}
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		pthread_join(thread[i], NULL);
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		test_drain(&handoff[i]);
+
+	/* the pool must keep working once every buffer was returned */
+	ofi_bufpool_get_stats(pool, &stats);
+	buf = test_alloc(0);
+	if (buf)
+		test_free(buf);
+
+	printf("%s: grow %zu entries %zu depot alloc %zu free %zu "
+	       "retry %zu contention %zu\n",
+	       flags & OFI_BUFPOOL_INDEXED ? "indexed" : "plain",
+	       stats.grow_cnt, stats.entry_cnt, stats.depot_alloc,
+	       stats.depot_free, stats.depot_retry, stats.cache_contention);
+	ofi_bufpool_destroy(pool);
+	return 0;
+}
+
+int main(void)
+{
+	int i, ret;
+
+	ofi_mem_init();
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		pthread_mutex_init(&handoff[i].lock, NULL);
+	ofi_atomic_initialize32(&errors, 0);
+
+	ret = test_pool(0);
+	if (!ret)
+		ret = test_pool(OFI_BUFPOOL_INDEXED);
+
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		pthread_mutex_destroy(&handoff[i].lock);
+	ofi_mem_fini();
+
+	if (ret || ofi_atomic_get32(&errors)) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Multi-threaded test of the lock-free completion ring of OFI_CQ_LOCKFREE
+ * CQs.  Several producers write single completions, batches and error
+ * entries while one thread reads them back in bulk.  The context of each
+ * entry encodes its producer and sequence number, so lost, duplicated or
+ * reordered completions are caught.  A small ring forces the overflow
+ * path, a large one keeps every write on the ring.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <ofi_util.h>
+
+
+enum {
+	TEST_THREAD_CNT = 4,
+	TEST_COMP_CNT = 100000,
+	TEST_BATCH = 8,
+	TEST_READ_CNT = 32,
+	TEST_ERR_INTERVAL = 9973,
+};
+
+static struct fi_provider test_prov = {
+	.name = "cq_ring_mt",
+};
+
+static struct util_fabric fabric;
+static struct util_domain domain;
+static struct util_cq *cq;
+
+
+static void *test_context(uint64_t thread, uint64_t seq)
+{
+	return (void *) (uintptr_t) ((thread << 32) | seq);
+}
+
+static int test_write_batch(uint64_t thread, uint64_t seq)
+{
+	struct fi_cq_tagged_entry comp[TEST_BATCH];
+	int i;
+
+	memset(comp, 0, sizeof comp);
+	for (i = 0; i < TEST_BATCH; i++) {
+		comp[i].op_context = test_context(thread, seq + i);
+		comp[i].flags = FI_SEND;
+		comp[i].tag = seq + i;
+	}
+	return ofi_cq_write_batch(cq, comp, NULL, TEST_BATCH);
+}
+
+static int test_is_err(uint64_t seq)
+{
+	return seq % TEST_ERR_INTERVAL == TEST_ERR_INTERVAL - 1;
+}
+
+/* Every other run of TEST_BATCH entries is written as a batch, unless the
+ * run holds an error entry or passes the end. */
+static int test_is_batch(uint64_t seq)
+{
+	return seq % (2 * TEST_BATCH) == TEST_BATCH &&
+	       seq + TEST_BATCH <= TEST_COMP_CNT &&
+	       seq / TEST_ERR_INTERVAL ==
+	       (seq + TEST_BATCH) / TEST_ERR_INTERVAL;
+}
+
+static void *test_producer(void *arg)
+{
+	uint64_t thread = (uintptr_t) arg;
+	struct fi_cq_err_entry err_entry;
+	uint64_t seq;
+	int ret;
+
+	for (seq = 0; seq < TEST_COMP_CNT; seq++) {
+		if (test_is_err(seq)) {
+			memset(&err_entry, 0, sizeof err_entry);
+			err_entry.op_context = test_context(thread, seq);
+			err_entry.tag = seq;
+			err_entry.err = FI_ETRUNC;
+			err_entry.prov_errno = -FI_ETRUNC;
+			ret = ofi_cq_write_error(cq, &err_entry);
+		} else if (test_is_batch(seq)) {
+			ret = test_write_batch(thread, seq);
+			seq += TEST_BATCH - 1;
+		} else {
+			ret = ofi_cq_write(cq, test_context(thread, seq),
+					   FI_SEND, 0, NULL, 0, seq);
+		}
+		if (ret) {
+			fprintf(stderr, "write failed: %d\n", ret);
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+static void test_check(uint64_t *next, void *context, uint64_t tag, int err)
+{
+	uint64_t thread = (uintptr_t) context >> 32;
+	uint64_t seq = (uintptr_t) context & 0xffffffff;
+
+	if (thread >= TEST_THREAD_CNT || seq != next[thread] || tag != seq) {
+		fprintf(stderr, "thread %" PRIu64 ": got %" PRIu64
+			" tag %" PRIu64 ", expected %" PRIu64 "\n",
+			thread, seq, tag, thread < TEST_THREAD_CNT ?
+			next[thread] : 0);
+		exit(1);
+	}
+	if (err != test_is_err(seq)) {
+		fprintf(stderr, "thread %" PRIu64 ": entry %" PRIu64
+			" has the wrong error state\n", thread, seq);
+		exit(1);
+	}
+	next[thread]++;
+}
+
+static int test_ring(size_t size)
+{
+	struct fi_cq_attr attr = {
+		.size		= size,
+		.format		= FI_CQ_FORMAT_TAGGED,
+		.wait_obj	= FI_WAIT_NONE,
+	};
+	struct fi_cq_tagged_entry comp[TEST_READ_CNT];
+	struct fi_cq_err_entry err_entry;
+	uint64_t next[TEST_THREAD_CNT] = { 0 };
+	pthread_t thread[TEST_THREAD_CNT];
+	size_t total = 0;
+	ssize_t i, ret;
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return -FI_ENOMEM;
+
+	ret = ofi_cq_init_flags(&test_prov, &domain.domain_fid, &attr, cq,
+				&ofi_cq_progress, OFI_CQ_LOCKFREE, NULL);
+	if (ret) {
+		fprintf(stderr, "ofi_cq_init_flags: %zd\n", ret);
+		free(cq);
+		return (int) ret;
+	}
+	if (!cq->ring) {
+		fprintf(stderr, "CQ was not created with a ring\n");
+		ret = -FI_EINVAL;
+		goto close;
+	}
+
+	for (i = 0; i < TEST_THREAD_CNT; i++) {
+		ret = pthread_create(&thread[i], NULL, test_producer,
+				     (void *) (uintptr_t) i);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %zd\n", ret);
+			exit(1);
+		}
+	}
+
+	while (total < (size_t) TEST_THREAD_CNT * TEST_COMP_CNT) {
+		ret = fi_cq_read(&cq->cq_fid, comp, TEST_READ_CNT);
+		if (ret == -FI_EAGAIN)
+			continue;
+
+		if (ret == -FI_EAVAIL) {
+			memset(&err_entry, 0, sizeof err_entry);
+			ret = fi_cq_readerr(&cq->cq_fid, &err_entry, 0);
+			if (ret != 1 || err_entry.err != FI_ETRUNC) {
+				fprintf(stderr, "fi_cq_readerr: %zd\n", ret);
+				exit(1);
+			}
+			test_check(next, err_entry.op_context,
+				   err_entry.tag, 1);
+			total++;
+			continue;
+		}
+
+		if (ret < 0) {
+			fprintf(stderr, "fi_cq_read: %zd\n", ret);
+			exit(1);
+		}
+
+		for (i = 0; i < ret; i++)
+			test_check(next, comp[i].op_context, comp[i].tag, 0);
+		total += ret;
+	}
+
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		pthread_join(thread[i], NULL);
+
+	ret = 0;
+	if (fi_cq_read(&cq->cq_fid, comp, TEST_READ_CNT) != -FI_EAGAIN) {
+		fprintf(stderr, "CQ not empty after all entries were read\n");
+		ret = -FI_EOTHER;
+	}
+	printf("ring size %" PRIu64 ": %zu completions\n",
+	       cq->ring->size, total);
+close:
+	fi_close(&cq->cq_fid.fid);
+	return (int) ret;
+}
+
+int main(void)
+{
+	int ret;
+
+	fabric.prov = &test_prov;
+	domain.fabric = &fabric;
+	domain.threading = FI_THREAD_SAFE;
+	ofi_atomic_initialize32(&domain.ref, 0);
+
+	ret = test_ring(64);
+	if (!ret)
+		ret = test_ring(1 << 20);
+
+	if (ret) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
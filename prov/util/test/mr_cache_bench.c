@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * MR cache registration benchmark.  Threads look up and release regions
+ * in their own buffers through one cache, for an increasing number of
+ * threads, and report the aggregate lookup rate.  With a cache smaller
+ * than the working set, lookups miss and evict.  The registration cost
+ * of a real provider can be modelled by spinning in add_region.
+ *
+ * Run with -h for options, e.g. compare -s 1 with -s 8.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <ofi_mr.h>
+#include <ofi_util.h>
+
+
+enum {
+	BENCH_PAGE_SIZE = 4096,
+	BENCH_MAX_THREADS = 256,
+};
+
+static struct fi_provider bench_prov = {
+	.name = "mr_cache_bench",
+};
+
+static struct util_fabric fabric;
+static struct util_domain domain;
+static struct ofi_mr_cache cache;
+static ofi_atomic64_t add_cnt;
+
+static size_t iter_cnt = 1000000;
+static size_t buf_cnt = 64;
+static uint64_t reg_us;
+
+
+static int bench_add_region(struct ofi_mr_cache *cache,
+			    struct ofi_mr_entry *entry)
+{
+	uint64_t end;
+
+	ofi_atomic_inc64(&add_cnt);
+	if (reg_us) {
+		end = fi_gettime_us() + reg_us;
+		while (fi_gettime_us() < end)
+			;
+	}
+	return 0;
+}
+
+static void bench_delete_region(struct ofi_mr_cache *cache,
+				struct ofi_mr_entry *entry)
+{
+}
+
+static void *bench_thread(void *arg)
+{
+	size_t len = buf_cnt * BENCH_PAGE_SIZE;
+	struct iovec iov = {
+		.iov_len	= BENCH_PAGE_SIZE,
+	};
+	struct fi_mr_attr attr = {
+		.mr_iov		= &iov,
+		.iov_count	= 1,
+	};
+	struct ofi_mr_entry *entry;
+	char *base;
+	size_t i;
+	int ret;
+
+	base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "mmap failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < iter_cnt; i++) {
+		iov.iov_base = base + (i % buf_cnt) * BENCH_PAGE_SIZE;
+		ret = ofi_mr_cache_search(&cache, &attr, &entry);
+		if (ret) {
+			fprintf(stderr, "ofi_mr_cache_search: %d\n", ret);
+			exit(1);
+		}
+		ofi_mr_cache_delete(&cache, entry);
+	}
+
+	munmap(base, len);
+	return NULL;
+}
+
+static int bench_run(int thread_cnt)
+{
+	pthread_t thread[BENCH_MAX_THREADS];
+	uint64_t start, end;
+	size_t search_cnt, hit_cnt;
+	int i, ret;
+
+	ofi_atomic_initialize64(&add_cnt, 0);
+	memset(&cache, 0, sizeof cache);
+	cache.add_region = bench_add_region;
+	cache.delete_region = bench_delete_region;
+	ret = ofi_mr_cache_init(&domain, default_monitor, &cache);
+	if (ret) {
+		fprintf(stderr, "ofi_mr_cache_init: %d\n", ret);
+		return ret;
+	}
+
+	start = fi_gettime_us();
+	for (i = 0; i < thread_cnt; i++) {
+		ret = pthread_create(&thread[i], NULL, bench_thread, NULL);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %d\n", ret);
+			exit(1);
+		}
+	}
+	for (i = 0; i < thread_cnt; i++)
+		pthread_join(thread[i], NULL);
+	end = fi_gettime_us();
+
+	ofi_mr_cache_stats(&cache);
+	search_cnt = cache.search_cnt;
+	hit_cnt = cache.hit_cnt;
+	ofi_mr_cache_cleanup(&cache);
+
+	printf("%7d %7zu %14.2f %9.1f%% %12" PRId64 "\n", thread_cnt,
+	       cache_params.shard_cnt, (double) thread_cnt * iter_cnt /
+	       MAX(end - start, 1), search_cnt ? 100.0 * hit_cnt / search_cnt : 0,
+	       ofi_atomic_get64(&add_cnt));
+	return 0;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "usage: %s [options]\n", name);
+	fprintf(stderr, "  -t <threads>   run 1, 2, 4 .. up to <threads> threads "
+		"(default: online CPUs)\n");
+	fprintf(stderr, "  -s <shards>    cache shards "
+		"(default: FI_MR_CACHE_SHARDS)\n");
+	fprintf(stderr, "  -c <count>     cache max count "
+		"(default: FI_MR_CACHE_MAX_COUNT)\n");
+	fprintf(stderr, "  -b <buffers>   pages per thread (default: %zu)\n",
+		buf_cnt);
+	fprintf(stderr, "  -n <iters>     lookups per thread (default: %zu)\n",
+		iter_cnt);
+	fprintf(stderr, "  -r <usec>      registration cost (default: 0)\n");
+}
+
+int main(int argc, char **argv)
+{
+	long max_threads;
+	int op, i, ret = 0;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	ofi_mem_init();
+	ofi_monitor_init();
+
+	while ((op = getopt(argc, argv, "t:s:c:b:n:r:h")) != -1) {
+		switch (op) {
+		case 't':
+			max_threads = atol(optarg);
+			break;
+		case 's':
+			cache_params.shard_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cache_params.max_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buf_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iter_cnt = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			reg_us = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+	if (max_threads < 1 || max_threads > BENCH_MAX_THREADS || !buf_cnt) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fabric.prov = &bench_prov;
+	domain.fabric = &fabric;
+	domain.prov = &bench_prov;
+	ofi_atomic_initialize32(&domain.ref, 0);
+
+	printf("online CPUs %ld, %zu pages per thread, %zu lookups per "
+	       "thread, registration cost %" PRIu64 " us\n",
+	       sysconf(_SC_NPROCESSORS_ONLN), buf_cnt, iter_cnt, reg_us);
+	printf("%7s %7s %14s %10s %12s\n", "threads", "shards",
+	       "Mlookups/sec", "hits", "registered");
+	for (i = 1; !ret; i = MIN(i * 2, max_threads)) {
+		ret = bench_run(i);
+		if (i == max_threads)
+			break;
+	}
+
+	ofi_monitor_cleanup();
+	ofi_mem_fini();
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * MR cache notification stress test.  The main thread reports
+ * invalidations of registered pages through the memory monitor, as the
+ * monitor thread would, while other threads keep looking pages up.  It
+ * prints the notification rate, with or without the notification queue,
+ * and then the rate of real monitor events caused by madvise().
+ *
+ * Run with -h for options, e.g. compare -q 0 with -q 1024.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <ofi_mr.h>
+#include <ofi_util.h>
+
+
+enum {
+	BENCH_PAGE_SIZE = 4096,
+	BENCH_PAGE_CNT = 4096,
+	BENCH_MAX_THREADS = 256,
+};
+
+static struct fi_provider bench_prov = {
+	.name = "mr_notify_bench",
+};
+
+static struct util_fabric fabric;
+static struct util_domain domain;
+static struct ofi_mr_cache cache;
+static char *pages;
+static ofi_atomic64_t add_cnt;
+static ofi_atomic32_t stop;
+
+
+static int bench_add_region(struct ofi_mr_cache *cache,
+			    struct ofi_mr_entry *entry)
+{
+	ofi_atomic_inc64(&add_cnt);
+	return 0;
+}
+
+static void bench_delete_region(struct ofi_mr_cache *cache,
+				struct ofi_mr_entry *entry)
+{
+}
+
+static void bench_search(void *addr)
+{
+	struct iovec iov = {
+		.iov_base	= addr,
+		.iov_len	= BENCH_PAGE_SIZE,
+	};
+	struct fi_mr_attr attr = {
+		.mr_iov		= &iov,
+		.iov_count	= 1,
+	};
+	struct ofi_mr_entry *entry;
+	int ret;
+
+	ret = ofi_mr_cache_search(&cache, &attr, &entry);
+	if (ret) {
+		fprintf(stderr, "ofi_mr_cache_search: %d\n", ret);
+		exit(1);
+	}
+	ofi_mr_cache_delete(&cache, entry);
+}
+
+static void *bench_searcher(void *arg)
+{
+	size_t i;
+
+	for (i = 0; !ofi_atomic_get32(&stop); i++)
+		bench_search(pages + (i % BENCH_PAGE_CNT) * BENCH_PAGE_SIZE);
+	return (void *) (uintptr_t) i;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "usage: %s [options]\n", name);
+	fprintf(stderr, "  -t <threads>   searching threads (default: 1)\n");
+	fprintf(stderr, "  -q <size>      notification queue size, 0 to "
+		"disable (default: FI_MR_CACHE_NOTIFY_QUEUE)\n");
+	fprintf(stderr, "  -n <count>     notifications (default: 2000000)\n");
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t thread[BENCH_MAX_THREADS];
+	size_t i, notify_cnt = 2000000, search_cnt = 0;
+	uint64_t start, end;
+	int op, thread_cnt = 1, ret;
+	void *cnt;
+
+	ofi_mem_init();
+	ofi_monitor_init();
+
+	while ((op = getopt(argc, argv, "t:q:n:h")) != -1) {
+		switch (op) {
+		case 't':
+			thread_cnt = atoi(optarg);
+			break;
+		case 'q':
+			cache_params.notify_queue = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			notify_cnt = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return op == 'h' ? 0 : 1;
+		}
+	}
+	if (thread_cnt < 0 || thread_cnt > BENCH_MAX_THREADS) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fabric.prov = &bench_prov;
+	domain.fabric = &fabric;
+	domain.prov = &bench_prov;
+	ofi_atomic_initialize32(&domain.ref, 0);
+	ofi_atomic_initialize64(&add_cnt, 0);
+	ofi_atomic_initialize32(&stop, 0);
+
+	cache_params.max_cnt = BENCH_PAGE_CNT * 2;
+	cache.add_region = bench_add_region;
+	cache.delete_region = bench_delete_region;
+	ret = ofi_mr_cache_init(&domain, default_monitor, &cache);
+	if (ret) {
+		fprintf(stderr, "ofi_mr_cache_init: %d\n", ret);
+		return 1;
+	}
+
+	pages = mmap(NULL, BENCH_PAGE_CNT * BENCH_PAGE_SIZE,
+		     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED) {
+		fprintf(stderr, "mmap failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < (size_t) thread_cnt; i++) {
+		ret = pthread_create(&thread[i], NULL, bench_searcher, NULL);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %d\n", ret);
+			return 1;
+		}
+	}
+
+	start = fi_gettime_us();
+	for (i = 0; i < notify_cnt; i++) {
+		pthread_mutex_lock(&cache.monitor->lock);
+		ofi_monitor_notify(cache.monitor, pages + (i % BENCH_PAGE_CNT) *
+				   BENCH_PAGE_SIZE, BENCH_PAGE_SIZE);
+		pthread_mutex_unlock(&cache.monitor->lock);
+	}
+	end = fi_gettime_us();
+
+	ofi_atomic_set32(&stop, 1);
+	for (i = 0; i < (size_t) thread_cnt; i++) {
+		pthread_join(thread[i], &cnt);
+		search_cnt += (uintptr_t) cnt;
+	}
+
+	printf("online CPUs %ld, queue %zu, searchers %d: %.2f M notify/sec, "
+	       "%zu searches\n", sysconf(_SC_NPROCESSORS_ONLN),
+	       cache.notify_queue.size, thread_cnt,
+	       (double) notify_cnt / MAX(end - start, 1), search_cnt);
+
+	/* real monitor events: discard registered pages */
+	for (i = 0; i < BENCH_PAGE_CNT; i++)
+		bench_search(pages + i * BENCH_PAGE_SIZE);
+	start = fi_gettime_us();
+	for (i = 0; i < BENCH_PAGE_CNT; i++)
+		madvise(pages + i * BENCH_PAGE_SIZE, BENCH_PAGE_SIZE,
+			MADV_DONTNEED);
+	end = fi_gettime_us();
+	for (i = 0; i < BENCH_PAGE_CNT; i++)
+		bench_search(pages + i * BENCH_PAGE_SIZE);
+	printf("madvise: %.0f events/sec\n",
+	       (double) BENCH_PAGE_CNT * 1000000 / MAX(end - start, 1));
+
+	ofi_mr_cache_cleanup(&cache);
+	printf("notify %zu coalesced %zu overflows %zu batches %zu ranges %zu "
+	       "registered %" PRId64 "\n", cache.notify_cnt,
+	       cache.notify_queue.coalesce_cnt,
+	       cache.notify_queue.overflow_cnt, cache.notify_queue.drain_cnt,
+	       cache.notify_queue.range_cnt, ofi_atomic_get64(&add_cnt));
+
+	munmap(pages, BENCH_PAGE_CNT * BENCH_PAGE_SIZE);
+	ofi_monitor_cleanup();
+	ofi_mem_fini();
+	return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Multi-threaded test of the MR cache notification queue.  Each thread
+ * owns a set of pages: it looks a page up, invalidates it through the
+ * monitor and looks it up again, which must register the page anew.
+ * Another thread floods the queue with invalidations of memory that is
+ * never registered, so that ranges are coalesced, drained by the lookups
+ * of other threads and, with a small queue, overflow.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <ofi_mr.h>
+#include <ofi_util.h>
+
+
+enum {
+	TEST_THREAD_CNT = 4,
+	TEST_PAGE_CNT = 64,
+	TEST_ITER_CNT = 20000,
+	TEST_PAGE_SIZE = 4096,
+};
+
+static struct fi_provider test_prov = {
+	.name = "mr_notify_mt",
+};
+
+static struct util_fabric fabric;
+static struct util_domain domain;
+static struct ofi_mr_cache cache;
+static char *pages;
+static char *flood_pages;
+static ofi_atomic64_t add_cnt;
+static ofi_atomic64_t del_cnt;
+static ofi_atomic32_t stop;
+static __thread size_t thread_add_cnt;
+
+
+static int test_add_region(struct ofi_mr_cache *cache,
+			   struct ofi_mr_entry *entry)
+{
+	ofi_atomic_inc64(&add_cnt);
+	thread_add_cnt++;
+	return 0;
+}
+
+static void test_delete_region(struct ofi_mr_cache *cache,
+			       struct ofi_mr_entry *entry)
+{
+	ofi_atomic_inc64(&del_cnt);
+}
+
+static void test_search(void *addr)
+{
+	struct iovec iov = {
+		.iov_base	= addr,
+		.iov_len	= TEST_PAGE_SIZE,
+	};
+	struct fi_mr_attr attr = {
+		.mr_iov		= &iov,
+		.iov_count	= 1,
+	};
+	struct ofi_mr_entry *entry;
+	int ret;
+
+	ret = ofi_mr_cache_search(&cache, &attr, &entry);
+	if (ret) {
+		fprintf(stderr, "ofi_mr_cache_search: %d\n", ret);
+		exit(1);
+	}
+	ofi_mr_cache_delete(&cache, entry);
+}
+
+static void test_notify(void *addr, size_t len)
+{
+	pthread_mutex_lock(&cache.monitor->lock);
+	ofi_monitor_notify(cache.monitor, addr, len);
+	pthread_mutex_unlock(&cache.monitor->lock);
+}
+
+static void *test_owner(void *arg)
+{
+	char *base = pages + (uintptr_t) arg * TEST_PAGE_CNT * TEST_PAGE_SIZE;
+	size_t i, cnt;
+	char *page;
+
+	for (i = 0; i < TEST_ITER_CNT; i++) {
+		page = base + (i % TEST_PAGE_CNT) * TEST_PAGE_SIZE;
+		test_search(page);
+
+		test_notify(page, TEST_PAGE_SIZE);
+		cnt = thread_add_cnt;
+		test_search(page);
+		if (thread_add_cnt != cnt + 1) {
+			fprintf(stderr, "stale entry for %p returned\n",
+				(void *) page);
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+/* Pairs of invalidations of the same page coalesce, while the pages of
+ * consecutive pairs are not adjacent and take a queue slot each. */
+static void *test_flood(void *arg)
+{
+	size_t i;
+
+	for (i = 0; !ofi_atomic_get32(&stop); i++) {
+		test_notify(flood_pages + ((i & ~1) * 2 % TEST_PAGE_CNT) *
+			    TEST_PAGE_SIZE, TEST_PAGE_SIZE);
+	}
+	return NULL;
+}
+
+static int test_queue(size_t size)
+{
+	pthread_t thread[TEST_THREAD_CNT], flood;
+	int i, ret;
+
+	cache_params.notify_queue = size;
+	ofi_atomic_initialize64(&add_cnt, 0);
+	ofi_atomic_initialize64(&del_cnt, 0);
+	ofi_atomic_initialize32(&stop, 0);
+
+	memset(&cache, 0, sizeof cache);
+	cache.add_region = test_add_region;
+	cache.delete_region = test_delete_region;
+	ret = ofi_mr_cache_init(&domain, default_monitor, &cache);
+	if (ret) {
+		fprintf(stderr, "ofi_mr_cache_init: %d, skipping\n", ret);
+		return ret;
+	}
+
+	ret = pthread_create(&flood, NULL, test_flood, NULL);
+	for (i = 0; i < TEST_THREAD_CNT && !ret; i++) {
+		ret = pthread_create(&thread[i], NULL, test_owner,
+				     (void *) (uintptr_t) i);
+	}
+	if (ret) {
+		fprintf(stderr, "pthread_create: %d\n", ret);
+		exit(1);
+	}
+
+	for (i = 0; i < TEST_THREAD_CNT; i++)
+		pthread_join(thread[i], NULL);
+	ofi_atomic_set32(&stop, 1);
+	pthread_join(flood, NULL);
+
+	ofi_mr_cache_cleanup(&cache);
+	printf("queue %zu: adds %" PRId64 " coalesced %zu overflows %zu "
+	       "batches %zu ranges %zu\n", size, ofi_atomic_get64(&add_cnt),
+	       cache.notify_queue.coalesce_cnt,
+	       cache.notify_queue.overflow_cnt, cache.notify_queue.drain_cnt,
+	       cache.notify_queue.range_cnt);
+
+	if (ofi_atomic_get64(&add_cnt) != ofi_atomic_get64(&del_cnt)) {
+		fprintf(stderr, "%" PRId64 " regions registered, %" PRId64
+			" deregistered\n", ofi_atomic_get64(&add_cnt),
+			ofi_atomic_get64(&del_cnt));
+		return -FI_EOTHER;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	size_t len = TEST_THREAD_CNT * TEST_PAGE_CNT * TEST_PAGE_SIZE;
+	int ret;
+
+	ofi_mem_init();
+	ofi_monitor_init();
+	cache_params.max_cnt = 1 << 16;
+
+	fabric.prov = &test_prov;
+	domain.fabric = &fabric;
+	domain.prov = &test_prov;
+	ofi_atomic_initialize32(&domain.ref, 0);
+
+	pages = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	flood_pages = mmap(NULL, TEST_PAGE_CNT * TEST_PAGE_SIZE,
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pages == MAP_FAILED || flood_pages == MAP_FAILED) {
+		fprintf(stderr, "mmap failed\n");
+		return 1;
+	}
+
+	ret = test_queue(16);
+	if (ret == -FI_ENOSYS || ret == -FI_EPERM || ret == -FI_ENODEV) {
+		/* no usable memory monitor */
+		ret = 77;
+		goto out;
+	}
+	if (!ret)
+		ret = test_queue(1024);
+	ret = ret ? 1 : 0;
+out:
+	munmap(flood_pages, TEST_PAGE_CNT * TEST_PAGE_SIZE);
+	munmap(pages, len);
+	ofi_monitor_cleanup();
+	ofi_mem_fini();
+	printf("%s\n", ret == 77 ? "SKIP" : ret ? "FAIL" : "PASS");
+	return ret;
+}
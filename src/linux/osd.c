@@ -46,6 +46,7 @@
 #include <linux/ethtool.h>
 #include <linux/sockios.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 
 ssize_t ofi_get_hugepage_size(void)
 {
@@ -71,6 +72,49 @@ ssize_t ofi_get_hugepage_size(void)
 	return val * 1024;
 }
 
+/* Use the raw system calls rather than adding a libnuma dependency */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED	1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE	(1 << 1)
+#endif
+
+#define OFI_NUMA_MAX_NODES 1024
+
+int ofi_numa_node_self(void)
+{
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return -errno;
+
+	return (int) node;
+}
+
+/*
+ * Prefer, rather than require, the given node so that allocations still
+ * succeed when it runs out of memory.  Pages that were already touched
+ * are moved to the node.
+ */
+int ofi_numa_bind(void *addr, size_t len, int node)
+{
+	unsigned long mask[OFI_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	size_t bits = 8 * sizeof(unsigned long);
+
+	if (node < 0 || node >= OFI_NUMA_MAX_NODES)
+		return -FI_EINVAL;
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] |= 1UL << (node % bits);
+
+	if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask,
+		    OFI_NUMA_MAX_NODES + 1, MPOL_MF_MOVE))
+		return -errno;
+
+	return 0;
+}
+
 #ifdef HAVE_ETHTOOL
 
 #if HAVE_DECL_ETHTOOL_CMD_SPEED
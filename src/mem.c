@@ -49,6 +49,7 @@ static const int OFI_CACHE_SIZE = 64;
 
 size_t *page_sizes = NULL;
 size_t num_page_sizes = 0;
+int ofi_bufpool_numa = 0;
 
 
 void ofi_mem_init(void)
@@ -59,6 +60,12 @@ void ofi_mem_init(void)
 	long psize;
 	int n;
 
+	fi_param_define(NULL, "bufpool_numa", FI_PARAM_BOOL,
+			"Place the buffer pools of providers that support it "
+			"on the NUMA node of the thread that opens the owning "
+			"endpoint or CQ (default: no)");
+	fi_param_get_bool(NULL, "bufpool_numa", &ofi_bufpool_numa);
+
 	psize = ofi_get_page_size();
 	if (psize < 0)
 		return;